@@ -0,0 +1,112 @@
+/*
+ * Cost of one ThinTESLA hook, as a call into libcthintesla and with the fast
+ * path inlined into the caller, which is what -thin-tesla-runtime-bitcode
+ * gives instrumented code. Built twice by run-fastpath: the second time with
+ * INLINE_FAST_PATH, which puts the fast path in this translation unit.
+ *
+ * The automaton is "previously(foo())" within a bound: start, foo, assertion
+ * site, end. Hooks are timed while it is enabled, calling foo over and over,
+ * and once it has completed and every hook returns straight away.
+ */
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <stdio.h>
+
+#include "TeslaLogic.h"
+
+#ifdef INLINE_FAST_PATH
+#include "TeslaFastPath.c"
+#include "TeslaLogicShiftAnd.c"
+#endif
+
+#ifndef RUNS
+#error Must define RUNS=integer
+#endif
+
+#define NUM_EVENTS 4
+
+static TeslaEvent	 events[NUM_EVENTS];
+static TeslaEvent	*eventPtrs[NUM_EVENTS];
+static TeslaEvent	*successors[NUM_EVENTS];
+static uint64_t		 successorMasks[NUM_EVENTS];
+static TeslaAutomaton	 automaton;
+
+static void
+build(void)
+{
+	for (size_t i = 0; i < NUM_EVENTS; i++) {
+		TeslaEvent *event = &events[i];
+
+		event->id = i;
+		event->flags.isDeterministic = true;
+		event->successorMask = &successorMasks[i];
+		eventPtrs[i] = event;
+
+		if (i + 1 < NUM_EVENTS) {
+			successors[i] = &events[i + 1];
+			event->successors = &successors[i];
+			event->numSuccessors = 1;
+			successorMasks[i] = (uint64_t)1 << (i + 1);
+			events[i + 1].predecessorMask = (uint64_t)1 << i;
+		}
+	}
+
+	events[1].flags.isInitial = true;
+	events[2].flags.isAssertion = true;
+	events[2].flags.isFinal = true;
+	events[3].flags.isEnd = true;
+
+	automaton.events = eventPtrs;
+	automaton.numEvents = NUM_EVENTS;
+	automaton.name = "instrcost";
+	automaton.flags.isDeterministic = true;
+	automaton.flags.isThreadLocal = true;
+	automaton.flags.isShiftAnd = true;
+	automaton.threadKey = INVALID_THREAD_KEY;
+	automaton.numTotalAutomata = 1;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	if (gettimeofday(&end, NULL) != 0)
+		err(-1, "gettimeofday() failed");
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_usec - start->tv_usec) * 1e3;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timeval start;
+
+	build();
+
+	if (gettimeofday(&start, NULL) != 0)
+		err(-1, "gettimeofday() failed");
+
+	for (size_t i = 0; i < RUNS; i++)
+		UpdateAutomatonDeterministic(&automaton, &events[1]);
+
+	double enabled = elapsed(&start) / RUNS;
+
+	UpdateAutomatonDeterministic(&automaton, &events[2]);
+
+	if (gettimeofday(&start, NULL) != 0)
+		err(-1, "gettimeofday() failed");
+
+	for (size_t i = 0; i < RUNS; i++)
+		UpdateAutomatonDeterministic(&automaton, &events[1]);
+
+	double disabled = elapsed(&start) / RUNS;
+
+	EndAutomaton(&automaton, &events[3]);
+
+	printf("%.3g\t%.3g", enabled, disabled);
+
+	return 0;
+}
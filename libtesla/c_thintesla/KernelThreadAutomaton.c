@@ -1,6 +1,7 @@
 #include "KernelThreadAutomaton.h"
 #include "TeslaLogic.h"
 #include "TeslaMalloc.h"
+#include "TeslaSlab.h"
 
 #ifdef _KERNEL
 #include <sys/eventhandler.h>
@@ -61,7 +62,8 @@ bool InitializeKernelThreadAutomata(KernelThreadAutomata* automata, size_t numAu
         automata->numCurrent = 0;
         automata->numAutomata = numAutomata;
 
-        automata->automata = TeslaMallocZero(sizeof(TeslaAutomaton) * numAutomata);
+        // The static storage does not align, and each automaton must start a cache line.
+        automata->automata = TeslaSlab_Allocate(sizeof(TeslaAutomaton) * numAutomata);
 
         return automata->automata != NULL;
     }
@@ -1,4 +1,12 @@
 #include "TeslaAssert.h"
+#include "TeslaFailure.h"
+
+static TeslaFailHandler failHandler = NULL;
+
+void TeslaSetFailHandler(TeslaFailHandler handler)
+{
+    failHandler = handler;
+}
 
 void TeslaWarning(const char* warning)
 {
@@ -16,6 +24,20 @@ void TeslaAssertionFail(TeslaAutomaton* automaton)
 
 void TeslaAssertionFailMessage(TeslaAutomaton* automaton, const char* message)
 {
+    if (failHandler != NULL)
+    {
+        failHandler(automaton, message);
+        return;
+    }
+
+#ifndef _KERNEL
+    if (TeslaGetFailPolicy() != TESLA_FAIL_PANIC)
+    {
+        TeslaFailure_Report(automaton, message);
+        return;
+    }
+#endif
+
 #ifndef _KERNEL
     if (message != NULL && strcmp(message, "") != 0)
     {
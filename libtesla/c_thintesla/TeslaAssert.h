@@ -1,9 +1,22 @@
 #pragma once
 #include "TeslaState.h"
 
+EXTERN_C
+
 void TeslaAssertionFail(TeslaAutomaton* automaton);
 void TeslaAssertionFailMessage(TeslaAutomaton* automaton, const char* message);
 
+/*
+ * Called instead of reporting a failed assertion and panicking, with the
+ * automaton that failed and the reason, which may be NULL. For tools that
+ * run automata and count their failures, like tesla-replay. NULL restores
+ * the default.
+ */
+typedef void (*TeslaFailHandler)(TeslaAutomaton* automaton, const char* message);
+void TeslaSetFailHandler(TeslaFailHandler handler);
+
 void TeslaPanic(void);
 
-void TeslaWarning(const char* warning);
\ No newline at end of file
+void TeslaWarning(const char* warning);
+
+EXTERN_C_END
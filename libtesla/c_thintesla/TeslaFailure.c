@@ -0,0 +1,337 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime and nanosleep under -std=c99.
+
+#include "TeslaFailure.h"
+#include "TeslaMalloc.h"
+#include "TeslaLogic.h"
+
+#ifndef _KERNEL
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Under the log policy, a failing thread only claims a slot of a bounded
+ * queue with a compare-and-swap and fills it in. Every slot has a sequence
+ * number, which tells the reporter that the slot is full and producers that
+ * it has been emptied, so producers never wait for each other or for the
+ * reporter. The reporter thread formats what it finds, folds repeats of the
+ * same failure of the same automaton together and reports those at most once
+ * per TESLA_FAIL_REPORT_INTERVAL_NS.
+ */
+
+typedef struct TeslaFailure
+{
+    size_t sequence;
+    size_t automatonId;
+    const char* reason;
+    TeslaThreadKey threadKey;
+    uint64_t timestamp; // CLOCK_REALTIME, in ns.
+} TeslaFailure;
+
+// A failure seen by the reporter, and how many of its repeats it has not reported yet.
+typedef struct TeslaFailureRecord
+{
+    size_t automatonId;
+    const char* reason;
+    size_t suppressed;
+    uint64_t lastReport;
+} TeslaFailureRecord;
+
+#define TESLA_FAIL_RECORDS 1024
+#define TESLA_FAIL_IDLE_NS 10000000
+
+static TeslaFailure failQueue[TESLA_FAIL_QUEUE_SIZE];
+static size_t failEnqueue = 0;
+static size_t failDequeue = 0; // Only moved by the reporter, under reportLock.
+static size_t failLost = 0;
+
+static TeslaFailureRecord failRecords[TESLA_FAIL_RECORDS];
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int failPolicy = TESLA_FAIL_PANIC;
+static size_t failCounts[TESLA_MAX_AUTOMATA];
+static char* failNames[TESLA_MAX_AUTOMATA];
+
+static pthread_t reporter;
+static int reporterStop = 0;
+
+static pthread_once_t failOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t reporterOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t TeslaFailure_Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static bool TeslaFailure_Enqueue(size_t automatonId, const char* reason)
+{
+    size_t position = __atomic_load_n(&failEnqueue, __ATOMIC_RELAXED);
+    TeslaFailure* slot;
+
+    for (;;)
+    {
+        slot = &failQueue[position % TESLA_FAIL_QUEUE_SIZE];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&failEnqueue, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (difference < 0) // The reporter has not emptied this slot since the last time round.
+        {
+            return false;
+        }
+        else
+        {
+            position = __atomic_load_n(&failEnqueue, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->automatonId = automatonId;
+    slot->reason = reason;
+    slot->threadKey = GetThreadKey();
+    slot->timestamp = TeslaFailure_Now();
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static const char* TeslaFailure_Name(size_t automatonId)
+{
+    if (automatonId >= TESLA_MAX_AUTOMATA)
+        return "(unknown)";
+
+    char* name = __atomic_load_n(&failNames[automatonId], __ATOMIC_ACQUIRE);
+    return name != NULL ? name : "(unknown)";
+}
+
+static const char* TeslaFailure_Reason(const char* reason)
+{
+    return reason != NULL && reason[0] != '\0' ? reason : "failed";
+}
+
+static TeslaFailureRecord* TeslaFailure_Find(size_t automatonId, const char* reason)
+{
+    size_t hash = automatonId * 31 + ((uintptr_t)reason >> 4);
+    for (size_t i = 0; i < TESLA_FAIL_RECORDS; ++i)
+    {
+        TeslaFailureRecord* record = &failRecords[(hash + i) % TESLA_FAIL_RECORDS];
+        if (record->lastReport == 0)
+        {
+            record->automatonId = automatonId;
+            record->reason = reason;
+            return record;
+        }
+
+        if (record->automatonId == automatonId && record->reason == reason)
+            return record;
+    }
+
+    return NULL; // Too many different failures to tell apart, report them all.
+}
+
+/* Called with the report lock held. */
+static void TeslaFailure_Print(TeslaFailure* failure)
+{
+    TeslaFailureRecord* record = TeslaFailure_Find(failure->automatonId, failure->reason);
+
+    if (record != NULL && record->lastReport != 0 && failure->timestamp - record->lastReport < TESLA_FAIL_REPORT_INTERVAL_NS)
+    {
+        record->suppressed++;
+        return;
+    }
+
+    fprintf(stderr, "[TESLA] %llu.%06llu thread %zx: assertion failed - automaton %s: %s",
+            (unsigned long long)(failure->timestamp / 1000000000ull), (unsigned long long)(failure->timestamp % 1000000000ull / 1000),
+            (size_t)failure->threadKey, TeslaFailure_Name(failure->automatonId), TeslaFailure_Reason(failure->reason));
+
+    if (record != NULL && record->suppressed > 0)
+        fprintf(stderr, " (%zu more since the last report)", record->suppressed);
+    fprintf(stderr, "\n");
+
+    if (record != NULL)
+    {
+        record->suppressed = 0;
+        record->lastReport = failure->timestamp;
+    }
+}
+
+/* Called with the report lock held. Returns false if the queue was empty. */
+static bool TeslaFailure_Drain(void)
+{
+    bool drained = false;
+
+    for (;;)
+    {
+        TeslaFailure* slot = &failQueue[failDequeue % TESLA_FAIL_QUEUE_SIZE];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != failDequeue + 1)
+            break;
+
+        TeslaFailure failure = *slot;
+        __atomic_store_n(&slot->sequence, failDequeue + TESLA_FAIL_QUEUE_SIZE, __ATOMIC_RELEASE);
+        failDequeue++;
+
+        TeslaFailure_Print(&failure);
+        drained = true;
+    }
+
+    if (drained)
+        fflush(stderr);
+
+    return drained;
+}
+
+static void* TeslaFailure_Reporter(void* unused)
+{
+    (void)unused;
+    struct timespec idle = {0, TESLA_FAIL_IDLE_NS};
+
+    while (!__atomic_load_n(&reporterStop, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&reportLock);
+        bool drained = TeslaFailure_Drain();
+        pthread_mutex_unlock(&reportLock);
+
+        if (!drained)
+            nanosleep(&idle, NULL);
+    }
+
+    return NULL;
+}
+
+/* Reports what is left, and the repeats that were held back, when the process exits. */
+static void TeslaFailure_Exit(void)
+{
+    __atomic_store_n(&reporterStop, 1, __ATOMIC_RELEASE);
+    pthread_join(reporter, NULL);
+
+    pthread_mutex_lock(&reportLock);
+    TeslaFailure_Drain();
+
+    for (size_t i = 0; i < TESLA_FAIL_RECORDS; ++i)
+    {
+        TeslaFailureRecord* record = &failRecords[i];
+        if (record->suppressed > 0)
+        {
+            fprintf(stderr, "[TESLA] automaton %s: %s - %zu more failures not reported\n", TeslaFailure_Name(record->automatonId),
+                    TeslaFailure_Reason(record->reason), record->suppressed);
+            record->suppressed = 0;
+        }
+    }
+
+    size_t lost = __atomic_load_n(&failLost, __ATOMIC_RELAXED);
+    if (lost > 0)
+        fprintf(stderr, "[TESLA] %zu failures were not reported, the queue was full\n", lost);
+
+    fflush(stderr);
+    pthread_mutex_unlock(&reportLock);
+}
+
+static void TeslaFailure_StartReporter(void)
+{
+    if (pthread_create(&reporter, NULL, TeslaFailure_Reporter, NULL) == 0)
+        atexit(TeslaFailure_Exit);
+}
+
+static void TeslaFailure_Init(void)
+{
+    for (size_t i = 0; i < TESLA_FAIL_QUEUE_SIZE; ++i)
+        failQueue[i].sequence = i;
+
+    const char* policy = getenv("TESLA_FAIL_POLICY");
+    if (policy == NULL)
+        return;
+
+    if (strcmp(policy, "log") == 0)
+        failPolicy = TESLA_FAIL_LOG;
+    else if (strcmp(policy, "count") == 0)
+        failPolicy = TESLA_FAIL_COUNT;
+    else if (strcmp(policy, "panic") != 0)
+        fprintf(stderr, "[TESLA] Unknown TESLA_FAIL_POLICY '%s', expected panic, log or count\n", policy);
+}
+
+/* The name is copied, since the reporter may run after the automaton is gone. */
+static void TeslaFailure_SetName(TeslaAutomaton* automaton)
+{
+    size_t length = strlen(automaton->name) + 1;
+    char* name = (char*)TeslaMalloc(length);
+    if (name == NULL)
+        return;
+
+    memcpy(name, automaton->name, length);
+
+    char* expected = NULL;
+    if (!__atomic_compare_exchange_n(&failNames[automaton->id], &expected, name, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        TeslaFree(name);
+}
+#endif
+
+void TeslaSetFailPolicy(TeslaFailPolicy policy)
+{
+#ifndef _KERNEL
+    pthread_once(&failOnce, TeslaFailure_Init);
+    __atomic_store_n(&failPolicy, policy, __ATOMIC_RELAXED);
+#else
+    (void)policy;
+#endif
+}
+
+TeslaFailPolicy TeslaGetFailPolicy(void)
+{
+#ifndef _KERNEL
+    pthread_once(&failOnce, TeslaFailure_Init);
+    return (TeslaFailPolicy)__atomic_load_n(&failPolicy, __ATOMIC_RELAXED);
+#else
+    return TESLA_FAIL_PANIC;
+#endif
+}
+
+void TeslaFailure_Report(TeslaAutomaton* automaton, const char* reason)
+{
+#ifndef _KERNEL
+    size_t id = automaton != NULL ? automaton->id : SIZE_MAX;
+
+    if (id < TESLA_MAX_AUTOMATA)
+    {
+        __atomic_fetch_add(&failCounts[id], 1, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&failNames[id], __ATOMIC_RELAXED) == NULL)
+            TeslaFailure_SetName(automaton);
+    }
+
+    if (TeslaGetFailPolicy() != TESLA_FAIL_LOG)
+        return;
+
+    pthread_once(&reporterOnce, TeslaFailure_StartReporter);
+    if (!TeslaFailure_Enqueue(id, reason))
+        __atomic_fetch_add(&failLost, 1, __ATOMIC_RELAXED);
+#else
+    (void)automaton;
+    (void)reason;
+#endif
+}
+
+size_t TeslaGetFailureCount(TeslaAutomaton* base)
+{
+#ifndef _KERNEL
+    if (base->id >= TESLA_MAX_AUTOMATA)
+        return 0;
+
+    return __atomic_load_n(&failCounts[base->id], __ATOMIC_RELAXED);
+#else
+    (void)base;
+    return 0;
+#endif
+}
+
+void TeslaFlushFailures(void)
+{
+#ifndef _KERNEL
+    pthread_mutex_lock(&reportLock);
+    TeslaFailure_Drain();
+    pthread_mutex_unlock(&reportLock);
+#endif
+}
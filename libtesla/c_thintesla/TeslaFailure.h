@@ -0,0 +1,42 @@
+#pragma once
+
+#include "TeslaState.h"
+#include "ThinTesla.h"
+
+/*
+ * What happens when an assertion fails. Set TESLA_FAIL_POLICY to panic, log
+ * or count in the environment, or call TeslaSetFailPolicy.
+ */
+typedef enum TeslaFailPolicy
+{
+    TESLA_FAIL_PANIC, // Report the failure on the failing thread and stop. The default.
+    TESLA_FAIL_LOG,   // Queue the failure for the reporter thread, and continue.
+    TESLA_FAIL_COUNT, // Only count the failure, and continue.
+} TeslaFailPolicy;
+
+// Failures waiting for the reporter thread. Failures beyond that are counted as lost.
+#define TESLA_FAIL_QUEUE_SIZE 4096
+
+// The same failure of the same automaton is reported at most once per interval, with the number of repeats.
+#define TESLA_FAIL_REPORT_INTERVAL_NS 1000000000ull
+
+EXTERN_C
+
+void TeslaSetFailPolicy(TeslaFailPolicy policy);
+TeslaFailPolicy TeslaGetFailPolicy(void);
+
+/*
+ * Handles a failure of automaton, or of every automaton if NULL, under the
+ * log and count policies. The reason must be a string literal or otherwise
+ * live until the process exits: under the log policy only the pointer is
+ * queued, and failures are told apart by it.
+ */
+void TeslaFailure_Report(TeslaAutomaton* automaton, const char* reason);
+
+/* Failures of base under the log and count policies, including those lost from a full queue. */
+size_t TeslaGetFailureCount(TeslaAutomaton* base);
+
+/* Waits until the reporter has written every failure queued so far. Also runs at exit. */
+void TeslaFlushFailures(void);
+
+EXTERN_C_END
@@ -0,0 +1,88 @@
+#include "TeslaLogic.h"
+
+#ifndef _KERNEL
+#include <string.h>
+#endif
+
+/*
+ * What runs on every instrumented event while an automaton is enabled: finding
+ * the clone of the thread and taking a deterministic transition. Besides being
+ * part of cthintesla, this file and TeslaLogicShiftAnd.c are compiled to the
+ * cthintesla-fastpath bitcode, which ThinTeslaInstrumenter links into modules
+ * given -thin-tesla-runtime-bitcode and inlines into every hook. Late
+ * initialization, the slow clone lookup, the generic engine, verification and
+ * failures stay out of line, in the shared library.
+ */
+
+bool AreThreadKeysEqual(TeslaThreadKey first, TeslaThreadKey second)
+{
+    return first == second;
+}
+
+TeslaAutomaton* GetThreadAutomaton(TeslaAutomaton* automaton)
+{
+    DEBUG_ASSERT(automaton->flags.isThreadLocal);
+
+#ifndef _KERNEL
+    return GetThreadAutomatonUser(automaton);
+#else
+    return GetThreadAutomatonKernel(automaton);
+#endif
+}
+
+TeslaAutomaton* GetThreadAutomatonUser(TeslaAutomaton* base)
+{
+#ifndef _KERNEL
+    UserThreadAutomata* automata = &userThreadAutomata;
+
+    if (base->id < automata->numAutomata)
+    {
+        TeslaAutomaton* automaton = automata->automata[base->id];
+
+        if (automaton != NULL)
+        {
+            if (AreThreadKeysEqual(automaton->threadKey, automata->threadKey))
+                return automaton;
+
+            // Our clone was released at the end of a temporal bound. Take it back, unless somebody was faster.
+            if (AreThreadKeysEqual(automaton->threadKey, INVALID_THREAD_KEY) &&
+                __sync_bool_compare_and_swap(&(automaton->threadKey), INVALID_THREAD_KEY, automata->threadKey))
+            {
+                DEBUG_ASSERT(!automaton->state.isInit);
+                return automaton;
+            }
+
+            automata->automata[base->id] = NULL;
+        }
+    }
+#endif
+
+    return GetThreadAutomatonUserSlow(base);
+}
+
+void UpdateAutomatonDeterministic(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    TESLA_PROFILE_HOOK(automaton, event->id);
+    if (TESLA_TRACE_HOOK(automaton, event->id, TESLA_TRACE_EVENT, NULL, 0))
+        return;
+    GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
+    TESLA_STAT(automaton, events);
+
+    if (__builtin_expect(automaton->flags.isConcurrent, 0))
+        UpdateAutomatonConcurrent(automaton, event);
+    else if (automaton->flags.isShiftAnd)
+        UpdateAutomatonShiftAnd(automaton, event);
+    else
+        UpdateAutomatonDeterministicGeneric(automaton, event, true);
+}
+
+void UpdateEventWithData(TeslaAutomaton* automaton, size_t eventId, void* data)
+{
+    TESLA_PROFILE_HOOK(automaton, eventId);
+    TeslaEvent* event = automaton->events[eventId];
+    if (TESLA_TRACE_HOOK(automaton, eventId, TESLA_TRACE_MATCH_DATA, data, event->matchDataSize))
+        return;
+    GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
+
+    memcpy(automaton->eventStates[eventId].matchData, data, GetEventMatchSize(automaton->events[eventId]));
+}
@@ -1,5 +1,98 @@
 #include "TeslaHash.h"
 
+#define K0 0x9E3779B97F4A7C15ULL
+#define K1 0xC2B2AE3D27D4EB4FULL
+#define K2 0x165667B19E3779F9ULL
+#define K3 0xD6E8FEB86659FD93ULL
+#define K4 0xFF51AFD7ED558CCDULL
+
+static inline uint64_t Rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Pointers only differ in their middle bits: fold the high half of the product back down. */
+static inline HashSize TeslaHash_Finalize(uint64_t hash)
+{
+    hash ^= hash >> 32;
+    hash *= K4;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+/* The multiplies of the different words are independent, so they can issue back to back. */
+static HashSize TeslaHash_1Word(void* data, size_t len)
+{
+    (void)len;
+    size_t* words = data;
+    return TeslaHash_Finalize(words[0] * K0);
+}
+
+static HashSize TeslaHash_2Words(void* data, size_t len)
+{
+    (void)len;
+    size_t* words = data;
+    return TeslaHash_Finalize(words[0] * K0 + Rotl64(words[1] * K1, 31));
+}
+
+static HashSize TeslaHash_3Words(void* data, size_t len)
+{
+    (void)len;
+    size_t* words = data;
+    return TeslaHash_Finalize(words[0] * K0 + Rotl64(words[1] * K1, 31) + Rotl64(words[2] * K2, 17));
+}
+
+static HashSize TeslaHash_4Words(void* data, size_t len)
+{
+    (void)len;
+    size_t* words = data;
+    return TeslaHash_Finalize(words[0] * K0 + Rotl64(words[1] * K1, 31) + Rotl64(words[2] * K2, 17) +
+                              Rotl64(words[3] * K3, 47));
+}
+
+/* The multiply only depends on the word, so it stays off the dependency chain of the lane. */
+static inline uint64_t TeslaHash_Lane(uint64_t lane, uint64_t word)
+{
+    return Rotl64(lane + word * K4, 27);
+}
+
+/* Four independent lanes, mixed like the words of the four word kernel at the end. */
+static HashSize TeslaHash_NWords(void* data, size_t len)
+{
+    DEBUG_ASSERT(len % sizeof(size_t) == 0);
+
+    size_t* words = data;
+    size_t numWords = len / sizeof(size_t);
+
+    uint64_t a = K0, b = K1, c = K2, d = K3;
+
+    size_t i = 0;
+    for (; i + 4 <= numWords; i += 4)
+    {
+        a = TeslaHash_Lane(a, words[i]);
+        b = TeslaHash_Lane(b, words[i + 1]);
+        c = TeslaHash_Lane(c, words[i + 2]);
+        d = TeslaHash_Lane(d, words[i + 3]);
+    }
+
+    if (i < numWords)
+        a = TeslaHash_Lane(a, words[i++]);
+    if (i < numWords)
+        b = TeslaHash_Lane(b, words[i++]);
+    if (i < numWords)
+        c = TeslaHash_Lane(c, words[i++]);
+
+    return TeslaHash_Finalize(a * K0 + Rotl64(b * K1, 31) + Rotl64(c * K2, 17) + Rotl64(d * K3, 47) + numWords);
+}
+
+const TeslaHashFunction TeslaHashKernels[TESLA_HASH_NUM_KERNELS] = {
+    TeslaHash_1Word,
+    TeslaHash_2Words,
+    TeslaHash_3Words,
+    TeslaHash_4Words,
+    TeslaHash_NWords,
+};
+
 HashSize FakeHash64(void* data, size_t len)
 {
     return ((size_t*)data)[0];
@@ -19,13 +112,8 @@ HashSize BadHash64(void* data, size_t len)
     return hash;
 }
 
+/* Prefer keeping the kernel index around: this selects it again on every call. */
 HashSize Hash64(void* data, size_t len)
 {
-    /* uint64_t out[2] = {0};
-
-    MurmurHash3_x64_128(data, len, 19, out);
-
-    return out[0]; */
-
-    return FakeHash64(data, len);
+    return TeslaHash_Run(TeslaHash_SelectKernel(len / sizeof(size_t)), data, len);
 }
\ No newline at end of file
@@ -5,9 +5,44 @@
 
 typedef uint64_t HashSize;
 
+typedef HashSize (*TeslaHashFunction)(void* data, size_t len);
+
+/*
+ * Match data is almost always one to four pointers, so each common arity gets
+ * its own kernel. The kernel is chosen once from the size of the match data
+ * and stored as an index into TeslaHashKernels.
+ */
+typedef enum TeslaHashKernel
+{
+    TESLA_HASH_1_WORD,
+    TESLA_HASH_2_WORDS,
+    TESLA_HASH_3_WORDS,
+    TESLA_HASH_4_WORDS,
+    TESLA_HASH_N_WORDS,
+    TESLA_HASH_NUM_KERNELS
+} TeslaHashKernel;
+
+static inline uint8_t TeslaHash_SelectKernel(size_t numWords)
+{
+    if (numWords >= 1 && numWords <= 4)
+        return (uint8_t)(TESLA_HASH_1_WORD + numWords - 1);
+
+    return TESLA_HASH_N_WORDS;
+}
+
+EXTERN_C
+
+extern const TeslaHashFunction TeslaHashKernels[TESLA_HASH_NUM_KERNELS];
+
 HashSize Hash64(void* data, size_t len);
 
 HashSize FakeHash64(void* data, size_t len);
 
 HashSize BadHash64(void* data, size_t len);
 
+EXTERN_C_END
+
+static inline HashSize TeslaHash_Run(uint8_t kernel, void* data, size_t len)
+{
+    return TeslaHashKernels[kernel](data, len);
+}
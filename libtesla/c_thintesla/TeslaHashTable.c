@@ -1,13 +1,101 @@
 #include "TeslaHashTable.h"
 #include "TeslaMalloc.h"
+#include "TeslaTag.h"
 #include "ThinTesla.h"
 
+/*
+ * Looks for data in one of the tables of hashtable. Returns the bucket that
+ * holds it, or the empty bucket where it would go.
+ */
+static BucketHeader* TeslaHT_Probe(TeslaHT* hashtable, uint8_t* table, size_t capacity, void* data, uint64_t hash)
+{
+    size_t bucketIndex = hash % capacity;
+
+    uint8_t* bucket = table + hashtable->bucketSize * bucketIndex;
+
+    BucketHeader* header = (BucketHeader*)bucket;
+
+    while (TeslaHT_IsBucketFull(hashtable, header) && memcmp(data, bucket + TeslaHT_GetHeaderSize(), hashtable->dataSize) != 0)
+    {
+        bucketIndex = (bucketIndex + 1) % capacity;
+        bucket = table + hashtable->bucketSize * bucketIndex;
+        header = (BucketHeader*)bucket;
+    }
+
+    return header;
+}
+
+/*
+ * The first write to every page of a new table faults, which costs a few
+ * microseconds per page. With incremental resizing, the table for the next
+ * resize is zeroed a page per insert, starting just early enough to be done
+ * by the resize, so each of the inserts that lead up to it takes at most one
+ * fault instead of the resize taking them all.
+ */
+static void TeslaHT_PrepareNextTable(TeslaHT* hashtable)
+{
+    size_t nextSize = hashtable->bucketSize * hashtable->capacity * 2;
+
+    if (hashtable->nextTable == NULL)
+    {
+        size_t insertsLeft = hashtable->size < hashtable->capacity / 2 ? hashtable->capacity / 2 - hashtable->size : 0;
+        size_t pagesLeft = (nextSize + TESLA_HT_ZERO_CHUNK - 1) / TESLA_HT_ZERO_CHUNK;
+
+        if (nextSize <= TESLA_HT_ZERO_CHUNK || insertsLeft > pagesLeft)
+            return;
+
+        hashtable->nextTable = TeslaMalloc(nextSize);
+        hashtable->nextCapacity = hashtable->capacity * 2;
+        hashtable->nextZeroed = 0;
+
+        if (hashtable->nextTable == NULL)
+            return;
+    }
+
+    if (hashtable->nextZeroed < nextSize)
+    {
+        size_t length = nextSize - hashtable->nextZeroed;
+        if (length > TESLA_HT_ZERO_CHUNK)
+            length = TESLA_HT_ZERO_CHUNK;
+
+        memset(hashtable->nextTable + hashtable->nextZeroed, 0, length);
+        hashtable->nextZeroed += length;
+    }
+}
+
+/* Returns a zeroed table for newCapacity buckets, preferably the one prepared ahead of time. */
+static uint8_t* TeslaHT_AllocateTable(TeslaHT* hashtable, size_t newCapacity)
+{
+    size_t size = hashtable->bucketSize * newCapacity;
+    uint8_t* table = hashtable->nextTable;
+    hashtable->nextTable = NULL;
+
+    if (table != NULL && hashtable->nextCapacity == newCapacity)
+    {
+        memset(table + hashtable->nextZeroed, 0, size - hashtable->nextZeroed);
+        return table;
+    }
+
+    TeslaFree(table);
+
+    table = TeslaMalloc(size);
+    if (table != NULL)
+        memset(table, 0, size);
+
+    return table;
+}
+
 bool TeslaHT_Create(size_t initialCapacity, size_t dataSize, TeslaHT* hashtable)
 {
     memset(hashtable, 0, sizeof(TeslaHT));
 
     hashtable->dataSize = dataSize;
     hashtable->bucketSize = TeslaHT_GetHeaderSize() + dataSize;
+    hashtable->hashKernel = TeslaHash_SelectKernel(dataSize / sizeof(size_t));
+    hashtable->generation = 1;
+#ifdef TESLA_HT_INCREMENTAL_RESIZE
+    hashtable->incrementalResize = true;
+#endif
 
     return TeslaHT_ResizeTable(hashtable, initialCapacity);
 }
@@ -15,20 +103,37 @@ bool TeslaHT_Create(size_t initialCapacity, size_t dataSize, TeslaHT* hashtable)
 void TeslaHT_Destroy(TeslaHT* hashtable)
 {
     TeslaFree(hashtable->table);
+    TeslaFree(hashtable->oldTable);
+    TeslaFree(hashtable->nextTable);
 }
 
 void TeslaHT_Clear(TeslaHT* hashtable)
 {
-    memset(hashtable->table, 0, TeslaHT_GetTableSize(hashtable));
     hashtable->size = 0;
+    hashtable->generation++;
+
+    // Nothing is left to move out of the old table.
+    TeslaFree(hashtable->oldTable);
+    hashtable->oldTable = NULL;
+    hashtable->oldSize = 0;
+
+    // Buckets from the previous use of this generation could look full again.
+    if (hashtable->generation == 0)
+    {
+        memset(hashtable->table, 0, TeslaHT_GetTableSize(hashtable));
+        hashtable->generation = 1;
+    }
 }
 
 bool TeslaHT_ResizeTable(TeslaHT* hashtable, size_t newCapacity)
 {
-
     DEBUG_ASSERT(newCapacity > hashtable->capacity);
 
-    uint8_t* newTable = TeslaMalloc(hashtable->bucketSize * newCapacity);
+    // There is only room for one old table.
+    if (hashtable->oldTable != NULL)
+        TeslaHT_Migrate(hashtable, hashtable->oldCapacity);
+
+    uint8_t* newTable = TeslaHT_AllocateTable(hashtable, newCapacity);
 
     if (newTable == NULL)
         return false;
@@ -39,7 +144,15 @@ bool TeslaHT_ResizeTable(TeslaHT* hashtable, size_t newCapacity)
     hashtable->table = newTable;
     hashtable->capacity = newCapacity;
 
-    memset(newTable, 0, TeslaHT_GetTableSize(hashtable));
+    // Small tables are moved at once; they could also be too full to probe for a missing entry.
+    if (hashtable->size > 0 && hashtable->incrementalResize && oldCapacity > TESLA_HT_MIGRATE_BUCKETS)
+    {
+        hashtable->oldTable = oldTable;
+        hashtable->oldCapacity = oldCapacity;
+        hashtable->oldSize = hashtable->size;
+        hashtable->migrated = 0;
+        return true;
+    }
 
     if (hashtable->size > 0)
         TeslaHT_HashToNewTable(hashtable, oldCapacity, oldTable);
@@ -59,13 +172,50 @@ void TeslaHT_HashToNewTable(TeslaHT* hashtable, size_t oldCapacity, uint8_t* old
         uint8_t* bucket = oldTable + hashtable->bucketSize * i;
         BucketHeader* header = (BucketHeader*)bucket;
 
-        if (header->full)
+        if (TeslaHT_IsBucketFull(hashtable, header))
         {
             assert(TeslaHT_InsertInternal(hashtable, header->tag, bucket + TeslaHT_GetHeaderSize(), false));
         }
     }
 }
 
+/*
+ * Moves the entries of the next numBuckets buckets of the old table to the
+ * table. Moved entries are left behind in the old table: the table is always
+ * looked at first, so they are never found there, and probes in the old table
+ * still run through them.
+ */
+void TeslaHT_Migrate(TeslaHT* hashtable, size_t numBuckets)
+{
+    size_t end = hashtable->migrated + numBuckets;
+    if (end > hashtable->oldCapacity)
+        end = hashtable->oldCapacity;
+
+    for (; hashtable->migrated < end && hashtable->oldSize > 0; ++hashtable->migrated)
+    {
+        uint8_t* bucket = hashtable->oldTable + hashtable->bucketSize * hashtable->migrated;
+        BucketHeader* header = (BucketHeader*)bucket;
+
+        if (!TeslaHT_IsBucketFull(hashtable, header))
+            continue;
+
+        uint8_t* data = bucket + TeslaHT_GetHeaderSize();
+        uint64_t hash = TeslaHash_Run(hashtable->hashKernel, data, hashtable->dataSize);
+        BucketHeader* target = TeslaHT_Probe(hashtable, hashtable->table, hashtable->capacity, data, hash);
+
+        DEBUG_ASSERT(!TeslaHT_IsBucketFull(hashtable, target));
+        memcpy(target, bucket, hashtable->bucketSize);
+        hashtable->oldSize--;
+    }
+
+    if (hashtable->oldSize == 0)
+    {
+        TeslaFree(hashtable->oldTable);
+        hashtable->oldTable = NULL;
+        hashtable->oldCapacity = 0;
+    }
+}
+
 bool TeslaHT_Insert(TeslaHT* hashtable, uint64_t tag, void* data)
 {
     return TeslaHT_InsertInternal(hashtable, tag, data, true);
@@ -79,34 +229,36 @@ bool TeslaHT_InsertInternal(TeslaHT* hashtable, uint64_t tag, void* data, bool a
             return false;
     }
 
-    uint64_t hash = Hash64(data, hashtable->dataSize);
+    if (hashtable->oldTable != NULL)
+        TeslaHT_Migrate(hashtable, TESLA_HT_MIGRATE_BUCKETS);
 
-    size_t bucketIndex = hash % hashtable->capacity;
+    uint64_t hash = TeslaHash_Run(hashtable->hashKernel, data, hashtable->dataSize);
 
-    uint8_t* bucket = TeslaHT_GetBucket(hashtable, bucketIndex);
+    BucketHeader* header = TeslaHT_Probe(hashtable, hashtable->table, hashtable->capacity, data, hash);
 
-    BucketHeader* header = (BucketHeader*)bucket;
+    // An entry that has not been moved yet is updated where it is, and moved with its new tag.
+    if (!TeslaHT_IsBucketFull(hashtable, header) && hashtable->oldTable != NULL)
+    {
+        BucketHeader* oldHeader = TeslaHT_Probe(hashtable, hashtable->oldTable, hashtable->oldCapacity, data, hash);
+        if (TeslaHT_IsBucketFull(hashtable, oldHeader))
+            header = oldHeader;
+    }
 
-    while (header->full)
+    if (TeslaHT_IsBucketFull(hashtable, header))
     {
-        if (memcmp(data, bucket + TeslaHT_GetHeaderSize(), hashtable->dataSize) == 0)
-        {
-            header->tag |= tag;
-            return true;
-        }
-        else
-        {
-            bucketIndex = (bucketIndex + 1) % hashtable->capacity;
-            bucket = TeslaHT_GetBucket(hashtable, bucketIndex);
-            header = (BucketHeader*)bucket;
-        }
+        header->tag = TeslaTag_Merge(header->tag, tag);
+        return true;
     }
 
     header->full = 1;
+    header->generation = hashtable->generation;
     header->tag = tag;
-    memcpy(bucket + TeslaHT_GetHeaderSize(), data, hashtable->dataSize);
+    memcpy((uint8_t*)header + TeslaHT_GetHeaderSize(), data, hashtable->dataSize);
     hashtable->size++;
 
+    if (hashtable->incrementalResize)
+        TeslaHT_PrepareNextTable(hashtable);
+
     if (allowResizing && (hashtable->size > hashtable->capacity / 2))
     {
         return TeslaHT_ResizeTable(hashtable, hashtable->capacity * 2);
@@ -128,27 +280,21 @@ BucketHeader* TeslaHT_LookupTagPtr(TeslaHT* hashtable, void* data)
 {
     if (hashtable->size == 0)
         return NULL;
-        
-    uint64_t hash = Hash64(data, hashtable->dataSize);
 
-    size_t bucketIndex = hash % hashtable->capacity;
+    if (hashtable->oldTable != NULL)
+        TeslaHT_Migrate(hashtable, TESLA_HT_MIGRATE_BUCKETS);
 
-    uint8_t* bucket = TeslaHT_GetBucket(hashtable, bucketIndex);
+    uint64_t hash = TeslaHash_Run(hashtable->hashKernel, data, hashtable->dataSize);
 
-    BucketHeader* header = (BucketHeader*)bucket;
+    BucketHeader* header = TeslaHT_Probe(hashtable, hashtable->table, hashtable->capacity, data, hash);
+    if (TeslaHT_IsBucketFull(hashtable, header))
+        return header;
 
-    while (header->full)
+    if (hashtable->oldTable != NULL)
     {
-        if (memcmp(data, bucket + TeslaHT_GetHeaderSize(), hashtable->dataSize) == 0)
-        {
+        header = TeslaHT_Probe(hashtable, hashtable->oldTable, hashtable->oldCapacity, data, hash);
+        if (TeslaHT_IsBucketFull(hashtable, header))
             return header;
-        }
-        else
-        {
-            bucketIndex = (bucketIndex + 1) % hashtable->capacity;
-            bucket = TeslaHT_GetBucket(hashtable, bucketIndex);
-            header = (BucketHeader*)bucket;
-        }
     }
 
     return NULL;
@@ -159,6 +305,11 @@ uint8_t* TeslaHT_GetBucket(TeslaHT* hashtable, size_t index)
     return hashtable->table + hashtable->bucketSize * index;
 }
 
+bool TeslaHT_IsBucketFull(TeslaHT* hashtable, BucketHeader* header)
+{
+    return header->full && header->generation == hashtable->generation;
+}
+
 size_t TeslaHT_GetHeaderSize()
 {
     return sizeof(BucketHeader);
@@ -7,20 +7,46 @@ struct BucketHeader
 {
     uint64_t tag : 63;
     uint64_t full : 1;
+    uint32_t generation; // The bucket is only full if this matches the generation of the table.
 } __attribute__ ((packed));
 
 typedef struct BucketHeader BucketHeader;
 
-typedef struct TeslaHashTable
+typedef struct TeslaHT
 {
     size_t dataSize;
     size_t bucketSize;
+    uint8_t hashKernel;
 
     size_t capacity;
     size_t size;
     uint8_t* table;
+
+    // Clearing the table only bumps this, buckets from older generations are empty.
+    uint32_t generation;
+
+    // With incremental resizing, the table before the last resize is kept until every
+    // entry has moved out of it, TESLA_HT_MIGRATE_BUCKETS buckets per insert or lookup.
+    // It trades slower inserts around a resize for a shorter slowest one, and is only
+    // on by default with TESLA_HT_INCREMENTAL_RESIZE.
+    bool incrementalResize;
+    uint8_t* oldTable;
+    size_t oldCapacity;
+    size_t oldSize;   // Entries not moved yet.
+    size_t migrated;  // Buckets of the old table moved so far.
+
+    // The table for the next resize, zeroed ahead of time.
+    uint8_t* nextTable;
+    size_t nextCapacity;
+    size_t nextZeroed; // In bytes.
 } TeslaHT;
 
+// Moving this many buckets per operation empties the old table well before the next resize.
+#define TESLA_HT_MIGRATE_BUCKETS 8
+
+// Bytes of the next table zeroed per insert: one page, so that an insert takes at most one fault.
+#define TESLA_HT_ZERO_CHUNK 4096
+
 bool TeslaHT_Create(size_t initialCapacity, size_t dataSize, TeslaHT* hashtable);
 void TeslaHT_Destroy(TeslaHT* hashtable);
 void TeslaHT_Clear(TeslaHT* hashtable);
@@ -33,6 +59,8 @@ BucketHeader* TeslaHT_LookupTagPtr(TeslaHT* hashtable, void* data);
 size_t TeslaHT_GetHeaderSize(void);
 size_t TeslaHT_GetTableSize(TeslaHT* hashtable);
 uint8_t* TeslaHT_GetBucket(TeslaHT* hashtable, size_t index);
+bool TeslaHT_IsBucketFull(TeslaHT* hashtable, BucketHeader* header);
 
 bool TeslaHT_ResizeTable(TeslaHT* hashtable, size_t newCapacity);
 void TeslaHT_HashToNewTable(TeslaHT* hashtable, size_t oldCapacity, uint8_t* oldTable);
+void TeslaHT_Migrate(TeslaHT* hashtable, size_t numBuckets);
@@ -1,48 +1,160 @@
 #include "TeslaHistory.h"
 #include "TeslaMalloc.h"
 
-#define OBSERVATION_SIZE (sizeof(Observation))
+_Static_assert((TESLA_HISTORY_CAPACITY & (TESLA_HISTORY_CAPACITY - 1)) == 0, "History capacity must be a power of two");
 
-bool TeslaHistory_Create(TeslaHistory* history)
+#define RING_SIZE (sizeof(Observation) * TESLA_HISTORY_CAPACITY)
+#define PER_EVENT_SIZE (sizeof(ObservationSummary) + sizeof(Observation) + sizeof(size_t))
+
+size_t TeslaHistory_GetBlockSize(size_t numEvents)
+{
+    return RING_SIZE + numEvents * PER_EVENT_SIZE;
+}
+bool TeslaHistory_Create(TeslaHistory* history, size_t numEvents)
+{
+    // Everything lives in a single allocation, sized once for the automaton.
+    uint8_t* block = TeslaMalloc(TeslaHistory_GetBlockSize(numEvents));
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    TeslaHistory_CreateInPlace(history, numEvents, block);
+    history->ownsBlock = true;
+
+    return true;
+}
+void TeslaHistory_CreateInPlace(TeslaHistory* history, size_t numEvents, void* block)
 {
     memset(history, 0, sizeof(TeslaHistory));
 
-    history->data = TeslaMalloc(sizeof(TeslaVector));
-    if (history->data == NULL)
+    history->ring = (Observation*)block;
+    history->summaries = (ObservationSummary*)(history->ring + TESLA_HISTORY_CAPACITY);
+    history->sorted = (Observation*)(history->summaries + numEvents);
+    history->sortedIndices = (size_t*)(history->sorted + numEvents);
+    history->numEvents = numEvents;
+
+    memset(history->summaries, 0, numEvents * sizeof(ObservationSummary));
+    history->generation = 1;
+}
+void TeslaHistory_Destroy(TeslaHistory* history)
+{
+    if (history->ownsBlock)
+        TeslaFree(history->ring);
+    history->ring = NULL;
+}
+void TeslaHistory_Clear(TeslaHistory* history)
+{
+    history->numObservations = 0;
+    history->generation++;
+
+    // Summaries from the previous use of this generation could look current again.
+    if (history->generation == 0)
     {
-        return false;
+        memset(history->summaries, 0, history->numEvents * sizeof(ObservationSummary));
+        history->generation = 1;
     }
+}
 
-    if (!TeslaVector_Create(OBSERVATION_SIZE, history->data))
+static ObservationSummary* TeslaHistory_GetCurrentSummary(TeslaHistory* history, size_t numEvent)
+{
+    ObservationSummary* summary = &history->summaries[numEvent];
+    return summary->generation == history->generation ? summary : NULL;
+}
+
+static void TeslaHistory_UpdateSummary(ObservationSummary* summary, size_t index, HashSize hash)
+{
+    SummarySlot* victim = &summary->slots[0];
+
+    for (size_t i = 0; i < TESLA_HISTORY_SUMMARY_SLOTS; ++i)
     {
-        TeslaFree(history->data);
-        return false;
+        SummarySlot* slot = &summary->slots[i];
+
+        if (slot->count != 0 && slot->hash == hash)
+        {
+            slot->lastIndex = index;
+            slot->count++;
+            return;
+        }
+
+        if (slot->count == 0 || (victim->count != 0 && slot->lastIndex < victim->lastIndex))
+            victim = slot;
+    }
+
+    if (victim->count != 0)
+        summary->hasEvicted = true;
+
+    victim->hash = hash;
+    victim->lastIndex = index;
+    victim->count = 1;
+}
+
+bool TeslaHistory_Add(TeslaHistory* history, size_t numEvent, HashSize hash)
+{
+    DEBUG_ASSERT(numEvent < history->numEvents);
+
+    size_t index = history->numObservations++;
+
+    Observation* newElem = &history->ring[index & (TESLA_HISTORY_CAPACITY - 1)];
+    newElem->header.numEvent = numEvent;
+    newElem->hash = hash;
+
+    ObservationSummary* summary = &history->summaries[numEvent];
+    if (summary->generation != history->generation)
+    {
+        memset(summary, 0, sizeof(ObservationSummary));
+        summary->generation = history->generation;
     }
 
+    TeslaHistory_UpdateSummary(summary, index, hash);
+
     return true;
 }
-void TeslaHistory_Destroy(TeslaHistory* history)
+
+size_t TeslaHistory_GetFirstIndex(TeslaHistory* history)
 {
-    TeslaVector_Destroy(history->data);
+    return TeslaHistory_HasOverflowed(history) ? history->numObservations - TESLA_HISTORY_CAPACITY : 0;
 }
-void TeslaHistory_Clear(TeslaHistory* history)
+
+bool TeslaHistory_HasOverflowed(TeslaHistory* history)
 {
-    TeslaVector_Clear(history->data);
+    return history->numObservations > TESLA_HISTORY_CAPACITY;
 }
 
-bool TeslaHistory_Add(TeslaHistory* history, size_t numEvent, size_t dataSize, void* data)
+Observation* TeslaHistory_GetObservation(TeslaHistory* history, size_t index)
 {
-    Observation newElem;
-    newElem.header.numEvent = numEvent;
-    newElem.hash = data != NULL ? Hash64(data, dataSize) : 0;
+    DEBUG_ASSERT(index >= TeslaHistory_GetFirstIndex(history) && index < history->numObservations);
 
-    return TeslaVector_Add(history->data, &newElem);
+    return &history->ring[index & (TESLA_HISTORY_CAPACITY - 1)];
 }
 
-Observation* TeslaHistory_GetObservations(TeslaHistory* history, size_t* numObservations)
+SummarySlot* TeslaHistory_FindSummarySlot(TeslaHistory* history, size_t numEvent, HashSize hash)
 {
-    if (numObservations != NULL)
-        *numObservations = history->data->size;
+    ObservationSummary* summary = TeslaHistory_GetCurrentSummary(history, numEvent);
+    if (summary == NULL)
+        return NULL;
+
+    for (size_t i = 0; i < TESLA_HISTORY_SUMMARY_SLOTS; ++i)
+    {
+        if (summary->slots[i].count != 0 && summary->slots[i].hash == hash)
+            return &summary->slots[i];
+    }
+
+    return NULL;
+}
+
+bool TeslaHistory_HasEvicted(TeslaHistory* history, size_t numEvent)
+{
+    ObservationSummary* summary = TeslaHistory_GetCurrentSummary(history, numEvent);
+    return summary != NULL && summary->hasEvicted;
+}
+
+Observation* ObservationWindow_Get(ObservationWindow* window, size_t index)
+{
+    DEBUG_ASSERT(index >= window->first && index < window->end);
+
+    if (window->sorted != NULL)
+        return &window->sorted[index];
 
-    return (Observation*)history->data->data;
+    return TeslaHistory_GetObservation(window->history, index);
 }
\ No newline at end of file
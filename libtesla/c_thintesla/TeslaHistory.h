@@ -1,8 +1,12 @@
 #pragma once
 #include "ThinTesla.h"
-#include "TeslaVector.h"
 #include "TeslaHash.h"
 
+// Number of observations kept per automaton. Must be a power of two.
+#define TESLA_HISTORY_CAPACITY 256
+
+// Number of distinct values remembered per event by its summary.
+#define TESLA_HISTORY_SUMMARY_SLOTS 4
 
 typedef struct ObservationHeader{
     uint32_t numEvent;
@@ -13,13 +17,60 @@ typedef struct Observation{
     HashSize hash;
 } Observation;
 
+typedef struct SummarySlot{
+    HashSize hash;
+    size_t lastIndex;
+    size_t count; // 0 if the slot is unused.
+} SummarySlot;
+
+// Latest observations of an event, one slot per distinct hash. Least recently seen hashes are evicted first.
+typedef struct ObservationSummary{
+    SummarySlot slots[TESLA_HISTORY_SUMMARY_SLOTS];
+    bool hasEvicted;
+    uint32_t generation; // The summary is empty unless this matches the generation of the history.
+} ObservationSummary;
+
+/*
+ * Observations are numbered from 0 since the last clear, and only the last
+ * TESLA_HISTORY_CAPACITY of them are kept in the ring. The summaries are
+ * updated on every observation, so they can usually answer a verification
+ * without walking the ring at all.
+ */
 typedef struct TeslaHistory{
-    TeslaVector* data;
+    Observation* ring;
+    ObservationSummary* summaries;
+
+    // Space for numEvents observations, used to order the summaries during verification.
+    Observation* sorted;
+    size_t* sortedIndices;
+
+    size_t numEvents;
+    size_t numObservations;
+    uint32_t generation;
     bool valid;
+    bool ownsBlock; // False if the block was handed to TeslaHistory_CreateInPlace.
 } TeslaHistory;
 
-bool TeslaHistory_Create(TeslaHistory* history);
+size_t TeslaHistory_GetBlockSize(size_t numEvents);
+bool TeslaHistory_Create(TeslaHistory* history, size_t numEvents);
+void TeslaHistory_CreateInPlace(TeslaHistory* history, size_t numEvents, void* block);
 void TeslaHistory_Destroy(TeslaHistory* history);
 void TeslaHistory_Clear(TeslaHistory* history);
-bool TeslaHistory_Add(TeslaHistory* history, size_t numEvent, size_t dataSize, void* data);
-Observation* TeslaHistory_GetObservations(TeslaHistory* history, size_t* numObservations);
\ No newline at end of file
+bool TeslaHistory_Add(TeslaHistory* history, size_t numEvent, HashSize hash);
+
+size_t TeslaHistory_GetFirstIndex(TeslaHistory* history);
+bool TeslaHistory_HasOverflowed(TeslaHistory* history);
+Observation* TeslaHistory_GetObservation(TeslaHistory* history, size_t index);
+SummarySlot* TeslaHistory_FindSummarySlot(TeslaHistory* history, size_t numEvent, HashSize hash);
+bool TeslaHistory_HasEvicted(TeslaHistory* history, size_t numEvent);
+
+// The observations a verification walks over, from first (oldest) to end.
+typedef struct ObservationWindow{
+    TeslaHistory* history;
+    Observation* sorted; // If not NULL, the observations were rebuilt from the summaries instead of the ring.
+    size_t first;
+    size_t end;
+    bool isTruncated; // Older observations have been dropped from the ring.
+} ObservationWindow;
+
+Observation* ObservationWindow_Get(ObservationWindow* window, size_t index);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "TeslaLogic.h"
 #include "TeslaAssert.h"
 #include "TeslaMalloc.h"
+#include "TeslaTag.h"
 #include "TeslaUtils.h"
 
 volatile size_t useless_var = 0;
@@ -46,20 +47,20 @@ const size_t NO_SUCC = SIZE_MAX;
 
 size_t GetSuccessor(TeslaEvent* event, TeslaEvent* successor)
 {
-    if (successor->id <= event->id)
+    DEBUG_ASSERT(event->successorMask != NULL);
+
+    if (!IsSuccessor(event, successor))
         return NO_SUCC;
 
-    for (size_t i = 0; i < event->numSuccessors; ++i)
-    {
-        if (event->successors[i] == successor)
-            return i;
-    }
+    // Successors are sorted by id, so the index is the number of them with a lower id.
+    size_t word = successor->id / 64;
+    size_t index = __builtin_popcountll(event->successorMask[word] & ((1ULL << (successor->id % 64)) - 1));
 
-    return NO_SUCC;
-}
+    for (size_t i = event->id / 64; i < word; ++i)
+        index += __builtin_popcountll(event->successorMask[i]);
 
-const TeslaTemporalTag INVALID_TAG = 0;
-const TeslaTemporalTag ONE = 1;
+    return index;
+}
 
 //#define PRINT_TRANSITIONS
 //#define PRINT_VERIFICATION
@@ -123,25 +124,83 @@ TeslaAutomaton* GenerateAutomaton(TeslaAutomaton* base)
     return automaton;
 }
 
+static TeslaAutomaton* StartBound(TeslaAutomaton* base, TeslaAutomaton* automaton)
+{
+    if (automaton == NULL)
+        automaton = GenerateAutomaton(base);
+    else if (automaton->state.isInit)
+        return automaton;
+
+#ifdef TESLA_STATS
+    TeslaStats_StartBound(base);
+#endif
+
+    if (automaton != NULL && !SampleBound(base))
+    {
+        TA_InitUntracked(automaton);
+        return automaton;
+    }
+
+    return InitAutomaton(automaton);
+}
+
 TeslaAutomaton* LateInitAutomaton(TeslaAutomaton* base, TeslaAutomaton* automaton, TeslaEvent* event)
 {
 #ifdef LATE_INIT
     if (!event->flags.isInitial && !event->flags.isAssertion)
         return NULL;
 
-    if (automaton == NULL)
-        automaton = GenerateAndInitAutomaton(base);
-    else if (!automaton->state.isInit)
-        automaton = InitAutomaton(automaton);
+    if (base->flags.isConcurrent) // Other threads may be starting the same bound.
+    {
+        TeslaAutomaton_Lock(base);
+        automaton = StartBound(base, automaton);
+        TeslaAutomaton_Unlock(base);
+        return automaton;
+    }
 
-    return automaton;
+    return StartBound(base, automaton);
 #endif
 }
 
+static void UpdateAutomatonWithData(TeslaAutomaton* automaton, TeslaEvent* event, void* data);
+
 void UpdateAutomaton(TeslaAutomaton* automaton, TeslaEvent* event, void* data)
 {
+    TESLA_PROFILE_HOOK(automaton, event->id);
+    if (TESLA_TRACE_HOOK(automaton, event->id, TESLA_TRACE_EVENT_DATA, data, event->matchDataSize))
+        return;
     GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
+    TESLA_STAT(automaton, events);
+
+    if (automaton->flags.isConcurrent)
+    {
+        TeslaAutomaton_Lock(automaton);
+        if (automaton->state.isActive && !automaton->state.hasFailed) // It may have completed while we waited.
+            UpdateAutomatonWithData(automaton, event, data);
+        TeslaAutomaton_Unlock(automaton);
+    }
+    else
+    {
+        UpdateAutomatonWithData(automaton, event, data);
+    }
+}
 
+#ifndef LINEAR_HISTORY
+/* Starts a new epoch when the automaton backtracks, see TeslaTag.h. */
+static void NextTemporalTag(TeslaAutomaton* automaton)
+{
+    TeslaTemporalTag next = TeslaTag_Next(automaton->state.currentTemporalTag);
+
+    // Past TESLA_TAG_MAX_EPOCH, later epochs can no longer be told apart.
+    if (next == automaton->state.currentTemporalTag)
+        automaton->state.isCorrect = false;
+
+    automaton->state.currentTemporalTag = next;
+}
+#endif
+
+static void UpdateAutomatonWithData(TeslaAutomaton* automaton, TeslaEvent* event, void* data)
+{
 #ifdef PRINT_TRANSITIONS
     DebugAutomaton(automaton);
     printf("Transitioning - from:\t");
@@ -160,35 +219,39 @@ void UpdateAutomaton(TeslaAutomaton* automaton, TeslaEvent* event, void* data)
         return;
     }
 
-    size_t succ = GetSuccessor(automaton->state.currentEvent, event);
+    bool isSuccessor = IsSuccessor(automaton->state.currentEvent, event);
 
 #ifndef LINEAR_HISTORY
 
     TeslaEvent* current = automaton->state.currentEvent;
     TeslaEvent* last = automaton->state.lastEvent;
 
-    if (succ != NO_SUCC)
+    if (isSuccessor)
     {
         automaton->state.currentEvent = event;
     }
     else if (event->id <= last->id)
     {
-        automaton->state.currentTemporalTag <<= 1;
+        NextTemporalTag(automaton);
     }
 
     automaton->state.lastEvent = event;
 
-    if (state->store != NULL && state->store->type != TESLA_STORE_INVALID)
+    TeslaStore* store = TA_GetStore(automaton, event);
+    if (store != NULL)
     {
-        /* bool insert = */ TeslaStore_Insert(state->store, automaton->state.currentTemporalTag, data);
+        size_t capacity = TeslaStore_GetCapacity(store);
+        /* bool insert = */ TeslaStore_Insert(store, automaton->state.currentTemporalTag, data);
+        TESLA_STAT(automaton, storeInserts);
+        TESLA_STAT_ADD(automaton, storeResizes, TeslaStore_GetCapacity(store) != capacity);
     }
 
-    if (event->id > current->id && succ == NO_SUCC)
+    if (event->id > current->id && !isSuccessor)
     {
-        automaton->state.currentTemporalTag <<= 1;
+        NextTemporalTag(automaton);
     }
 #else
-    if (succ != NO_SUCC)
+    if (isSuccessor)
     {
         automaton->state.currentEvent = event;
     }
@@ -202,12 +265,6 @@ void UpdateAutomaton(TeslaAutomaton* automaton, TeslaEvent* event, void* data)
 #endif
 }
 
-void UpdateAutomatonDeterministic(TeslaAutomaton* automaton, TeslaEvent* event)
-{
-    GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
-    UpdateAutomatonDeterministicGeneric(automaton, event, true);
-}
-
 void UpdateAutomatonDeterministicGeneric(TeslaAutomaton* automaton, TeslaEvent* event, bool updateTag)
 {
     bool triedAgain = false;
@@ -243,6 +300,7 @@ tryagain:
         if (!triedAgain)
         {
             triedAgain = true;
+            TESLA_STAT(automaton, retries);
             goto tryagain;
         }
     }
@@ -252,17 +310,16 @@ tryagain:
 
         DEBUG_ASSERT(current != NULL);
 
-        size_t succIndex = GetSuccessor(current, event);
-        if (succIndex != NO_SUCC)
+        if (IsSuccessor(current, event))
         {
-            automaton->state.currentEvent = current->successors[succIndex];
+            automaton->state.currentEvent = event;
             foundSuccessor = true;
         }
 
         if (!foundSuccessor)
         {
             // If both events are in the same OR block (regardless of their relative order), this is fine.
-            if (current->flags.isOR && event->flags.isOR && GetSuccessor(event, current) != NO_SUCC)
+            if (current->flags.isOR && event->flags.isOR && IsSuccessor(event, current))
                 foundSuccessor = true;
         }
 
@@ -278,6 +335,7 @@ tryagain:
             if (!triedAgain)
             {
                 triedAgain = true;
+                TESLA_STAT(automaton, retries);
                 goto tryagain;
             }
         }
@@ -288,21 +346,25 @@ tryagain:
     DebugEvent(automaton->state.currentEvent);
 #endif
 
+    TESLA_STAT_ADD(automaton, transitions, foundSuccessor);
+
     if (!automaton->flags.isDeterministic)
     {
 #ifndef LINEAR_HISTORY
         if ((!foundSuccessor || triedAgain) && event->id <= originalCurrent->id) // We're backtracking.
-            automaton->state.currentTemporalTag <<= 1;
+            NextTemporalTag(automaton);
 
         if (updateTag)
         {
             TeslaEventState* state = &automaton->eventStates[event->id];
 
-            *((uintptr_t*)&(state->store)) |= automaton->state.currentTemporalTag;
+            // Deterministic events keep their tag in place of a store.
+            TeslaTemporalTag tag = (TeslaTemporalTag)((uintptr_t)state->store);
+            state->store = (TeslaStore*)(uintptr_t)TeslaTag_Merge(tag, automaton->state.currentTemporalTag);
         }
 
         if ((!foundSuccessor || triedAgain) && event->id > originalCurrent->id) // We briefly went to the future, now we're going back to the past.
-            automaton->state.currentTemporalTag <<= 1;
+            NextTemporalTag(automaton);
 
         automaton->state.lastEvent = automaton->state.currentEvent;
 #else
@@ -343,6 +405,7 @@ tryagain:
     if (foundSuccessor && event->flags.isFinal) // In guideline mode, this automaton has just succesfully completed. Disable it.
     {
         automaton->state.isActive = false;
+        TA_SetLive(automaton, false);
 #ifdef _KERNEL
         if (!automaton->flags.isLinked)
         {
@@ -353,17 +416,18 @@ tryagain:
 #endif
 }
 
-bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, TeslaTemporalTag* lowerBound, TeslaTemporalTag* upperBound)
+/*
+ * Bounds are epochs, see TeslaTag.h: lowerBound is the latest epoch of the
+ * first event that happened, upperBound that of the last event checked.
+ */
+bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, int64_t* lowerBound, int64_t* upperBound)
 {
     size_t localIndex = *i;
 
-    TeslaTemporalTag max = *upperBound;
-    TeslaTemporalTag min = (size_t)-1;
+    int64_t max = *upperBound;
 
-    TeslaTemporalTag validMask = (*lowerBound - ONE) ^ min;
 #ifdef PRINT_VERIFICATION
-    printf("[OR] Valid mask:\t");
-    printBits(sizeof(validMask), &validMask);
+    printf("[OR] Lower bound:\t%lld\n", (long long)*lowerBound);
 #endif
 
     bool atLeastOnceinOR = false;
@@ -372,15 +436,12 @@ bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, TeslaTemporalTag* lower
         TeslaEvent* event = automaton->events[localIndex];
         TeslaEventState* state = &automaton->eventStates[localIndex];
 
-        if (!event->flags.isDeterministic && (state->store == NULL || state->store->type == TESLA_STORE_INVALID))
-            continue;
-
         if (!event->flags.isOR)
         {
             if (!atLeastOnceinOR)
                 AUTOMATON_FAIL_MESSAGE_FALSE(automaton, "No event in OR block has occurred");
 
-            if (*lowerBound == INVALID_TAG)
+            if (*lowerBound == TESLA_NO_EPOCH)
                 *lowerBound = max;
 
             *upperBound = max;
@@ -390,31 +451,27 @@ bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, TeslaTemporalTag* lower
 
         TeslaTemporalTag tag = event->flags.isDeterministic ? (TeslaTemporalTag)((uintptr_t)state->store)
                                                             : TeslaStore_Get(state->store, state->matchData);
+        int64_t latest = TeslaTag_Latest(tag);
 
 #ifdef PRINT_VERIFICATION
-        printf("[OR] Current tag:\t");
-        printBits(sizeof(*upperBound), upperBound);
+        printf("[OR] Current epoch:\t%lld\n", (long long)*upperBound);
         printf("[OR] Tag for event %llu:\t", event->id);
         printBits(sizeof(tag), &tag);
 #endif
 
-        if (tag != INVALID_TAG && tag >= *upperBound) // Real event.
+        if (latest != TESLA_NO_EPOCH && latest >= *upperBound) // Real event.
         {
             atLeastOnceinOR = true;
         }
-        else if (tag == INVALID_TAG || tag < *lowerBound) // Didn't happen or happened too far in the past.
+        else if (latest == TESLA_NO_EPOCH || latest < *lowerBound) // Didn't happen or happened too far in the past.
             continue;
 
-        if (validMask && (!IsPowerOfTwo(validMask & tag) || (validMask & tag) < *upperBound))
+        // At most one epoch of the event since the lower bound, and not before the upper bound.
+        if (*lowerBound != TESLA_NO_EPOCH && (TeslaTag_Previous(tag) >= *lowerBound || latest < *upperBound))
             AUTOMATON_FAIL_MESSAGE_FALSE(automaton, "OR event occurred multiple times");
 
-        TeslaTemporalTag bound = ONE << LeftmostOne(tag);
-
-        if (bound > max)
-            max = bound;
-
-        if (bound < min)
-            min = bound;
+        if (latest > max)
+            max = latest;
     }
 
     assert(false);
@@ -423,8 +480,8 @@ bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, TeslaTemporalTag* lower
 
 void VerifyAutomaton(TeslaAutomaton* automaton)
 {
-    TeslaTemporalTag upperBound = INVALID_TAG;
-    TeslaTemporalTag lowerBound = INVALID_TAG;
+    int64_t upperBound = TESLA_NO_EPOCH;
+    int64_t lowerBound = TESLA_NO_EPOCH;
 
     for (size_t i = 1; i < automaton->numEvents - 1; ++i)
     {
@@ -437,11 +494,6 @@ void VerifyAutomaton(TeslaAutomaton* automaton)
             return;
         }
 
-        if (!event->flags.isDeterministic && (state->store == NULL || state->store->type == TESLA_STORE_INVALID))
-        {
-            assert(false);
-        }
-
         if (event->flags.isOR)
         {
             if (!VerifyORBlock(automaton, &i, &lowerBound, &upperBound))
@@ -452,64 +504,59 @@ void VerifyAutomaton(TeslaAutomaton* automaton)
 
         TeslaTemporalTag tag = event->flags.isDeterministic ? (TeslaTemporalTag)((uintptr_t)state->store)
                                                             : TeslaStore_Get(state->store, state->matchData);
+        int64_t latest = TeslaTag_Latest(tag);
 
 #ifdef PRINT_VERIFICATION
-        printf("Current tag:\t\t");
-        printBits(sizeof(upperBound), &upperBound);
+        printf("Current epoch:\t\t%lld\n", (long long)upperBound);
         printf("Tag for event %llu:\t", event->id);
         printBits(sizeof(tag), &tag);
 #endif
 
-        if (event->flags.isOptional && (tag == INVALID_TAG || tag < upperBound))
+        if (event->flags.isOptional && (latest == TESLA_NO_EPOCH || latest < upperBound))
             continue;
 
-        if (tag == INVALID_TAG)
+        if (latest == TESLA_NO_EPOCH)
         {
             AUTOMATON_FAIL_MESSAGE(automaton, "Required event didn't occur");
         }
 
-        if (tag < upperBound)
+        if (latest < upperBound)
         {
             AUTOMATON_FAIL_MESSAGE(automaton, "Event occurred in the past");
         }
 
-        upperBound = ONE << LeftmostOne(tag);
+        upperBound = latest;
 
-        if (lowerBound == INVALID_TAG)
+        if (lowerBound == TESLA_NO_EPOCH)
             lowerBound = upperBound;
 
-        if ((MaskBetweenExclUpper(upperBound, lowerBound) & tag) != 0)
+        if (TeslaTag_Previous(tag) >= lowerBound)
         {
             AUTOMATON_FAIL_MESSAGE(automaton, "Multiple events of the same type occurred");
         }
     }
 }
 
-void VerifyAfterAssertion(TeslaAutomaton* automaton, size_t i, TeslaTemporalTag lowerBound, TeslaTemporalTag upperBound)
+void VerifyAfterAssertion(TeslaAutomaton* automaton, size_t i, int64_t lowerBound, int64_t upperBound)
 {
     for (; i < automaton->numEvents - 1; ++i)
     {
         TeslaEvent* event = automaton->events[i];
         TeslaEventState* state = &automaton->eventStates[i];
 
-        if (!event->flags.isDeterministic && (state->store == NULL || state->store->type == TESLA_STORE_INVALID))
-        {
-            assert(false);
-        }
-
         //  printf("Store for event %d: %p\n", event->id, state->store);
 
         TeslaTemporalTag tag = event->flags.isDeterministic ? (TeslaTemporalTag)((uintptr_t)state->store)
                                                             : TeslaStore_Get(state->store, state->matchData);
+        int64_t latest = TeslaTag_Latest(tag);
 
 #ifdef PRINT_VERIFICATION
-        printf("[AFT] Lower bound:\t");
-        printBits(sizeof(lowerBound), &lowerBound);
+        printf("[AFT] Lower bound:\t%lld\n", (long long)lowerBound);
         printf("[AFT] Tag for event %llu:\t", event->id);
         printBits(sizeof(tag), &tag);
 #endif
 
-        if (tag != INVALID_TAG && tag >= lowerBound)
+        if (latest != TESLA_NO_EPOCH && latest >= lowerBound)
         {
             AUTOMATON_FAIL_MESSAGE(automaton, "Event after assertion happened before assertion");
         }
@@ -518,6 +565,9 @@ void VerifyAfterAssertion(TeslaAutomaton* automaton, size_t i, TeslaTemporalTag
 
 void EndAutomaton(TeslaAutomaton* automaton, TeslaEvent* event)
 {
+    TESLA_PROFILE_HOOK(automaton, event->id);
+    if (TESLA_TRACE_HOOK(automaton, event->id, TESLA_TRACE_END, NULL, 0))
+        return;
     GET_THREAD_AUTOMATON(automaton, event);
 
     if (automaton == NULL) // No automaton, this is fine.
@@ -542,6 +592,7 @@ void EndAutomaton(TeslaAutomaton* automaton, TeslaEvent* event)
 #endif
                 if (!automaton->state.currentEvent->flags.isFinal)
                 {
+                    TESLA_STAT(automaton, failures);
                     TeslaAssertionFailMessage(automaton, "Automaton has reached the final temporal bound but is not in a final state");
                 }
                 else
@@ -554,7 +605,18 @@ void EndAutomaton(TeslaAutomaton* automaton, TeslaEvent* event)
     }
 
     if (!automaton->flags.isLinked) // Linked automata will be reset later, not now.
-        TA_Reset(automaton);
+    {
+        if (automaton->flags.isConcurrent)
+        {
+            TeslaAutomaton_Lock(automaton);
+            TA_Reset(automaton);
+            TeslaAutomaton_Unlock(automaton);
+        }
+        else
+        {
+            TA_Reset(automaton);
+        }
+    }
 
 #ifdef _KERNEL
     if (GetKernelActiveCount() > 0)
@@ -579,6 +641,24 @@ const bool xorMode = false;
 
 void EndLinkedAutomata(TeslaAutomaton** automata, size_t numAutomata)
 {
+    // Profiled as the end event of the first automaton.
+    TESLA_PROFILE_HOOK(automata[0], automata[0]->numEvents - 1);
+
+#ifdef TESLA_TRACE
+    if (__builtin_expect(teslaTraceState != TESLA_TRACE_OFF, 0))
+    {
+        bool recordOnly = false;
+        for (size_t i = 0; i < numAutomata; ++i)
+        {
+            size_t position[2] = {i, numAutomata};
+            recordOnly = TeslaTrace_Record(automata[i], automata[i]->numEvents - 1, TESLA_TRACE_END_LINKED, position, 2);
+        }
+
+        if (recordOnly)
+            return;
+    }
+#endif
+
     // Only one automaton should succeed in XOR mode.
     bool oneSucceeded = false;
     bool oneActive = false;
@@ -629,14 +709,6 @@ void EndLinkedAutomata(TeslaAutomaton** automata, size_t numAutomata)
         TeslaAssertionFailMessage(automata[0], "No linked automata succeeded");
 }
 
-void UpdateEventWithData(TeslaAutomaton* automaton, size_t eventId, void* data)
-{
-    TeslaEvent* event = automaton->events[eventId];
-    GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
-
-    memcpy(automaton->eventStates[eventId].matchData, data, GetEventMatchSize(automaton->events[eventId]));
-}
-
 void DebugEvent(TeslaEvent* event)
 {
 #ifndef _KERNEL
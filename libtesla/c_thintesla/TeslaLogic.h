@@ -1,6 +1,9 @@
 #pragma once
 
 #include "TeslaState.h"
+#include "TeslaStats.h"
+#include "TeslaProfile.h"
+#include "TeslaTrace.h"
 #include "ThinTesla.h"
 #include "KernelThreadAutomaton.h"
 
@@ -17,6 +20,8 @@
 #define LINEAR_HISTORY
 #endif
 
+EXTERN_C
+
 /* Generic and per-event tagging */
 void StartAutomaton(TeslaAutomaton* automaton);
 TeslaAutomaton* GenerateAutomaton(TeslaAutomaton* base);
@@ -27,8 +32,8 @@ void UpdateAutomaton(TeslaAutomaton* automaton, TeslaEvent* event, void* data);
 void UpdateAutomatonDeterministic(TeslaAutomaton* automaton, TeslaEvent* event);
 void UpdateAutomatonDeterministicGeneric(TeslaAutomaton* automaton, TeslaEvent* event, bool updateTag);
 void VerifyAutomaton(TeslaAutomaton* automaton);
-bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, TeslaTemporalTag* lowerBound, TeslaTemporalTag* upperBound);
-void VerifyAfterAssertion(TeslaAutomaton* automaton, size_t i, TeslaTemporalTag lowerBound, TeslaTemporalTag upperBound);
+bool VerifyORBlock(TeslaAutomaton* automaton, size_t* i, int64_t* lowerBound, int64_t* upperBound);
+void VerifyAfterAssertion(TeslaAutomaton* automaton, size_t i, int64_t lowerBound, int64_t upperBound);
 void EndAutomaton(TeslaAutomaton* automaton, TeslaEvent* event);
 void EndLinkedAutomata(TeslaAutomaton** automata, size_t numAutomata);
 void EndAllAutomataKernel(void);
@@ -36,16 +41,45 @@ void EndAllAutomataKernel(void);
 /* Linear history */
 size_t GetFirstOREventFromLastInBlock(TeslaAutomaton* automaton, size_t lastOREvent);
 bool MatchEvent(TeslaAutomaton* automaton, Observation* observation);
-bool VerifyORBlockLinearHistory(TeslaAutomaton* automaton, Observation* invalid, Observation** currentObservation, size_t lastOREvent, size_t* out_i);
+bool GetSummaryWindow(TeslaAutomaton* automaton, ObservationWindow* window);
+void GetRingWindow(TeslaAutomaton* automaton, ObservationWindow* window);
+bool DegradeIfTruncated(TeslaAutomaton* automaton, ObservationWindow* window);
+bool VerifyORBlockLinearHistory(TeslaAutomaton* automaton, ObservationWindow* window, size_t* currentObservation, size_t lastOREvent, size_t* out_i);
 bool UpdateAutomatonLinearHistory(TeslaAutomaton* automaton, TeslaEvent* event, void* data);
 void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEventId);
 
+/* Shift-and */
+void UpdateAutomatonShiftAnd(TeslaAutomaton* automaton, TeslaEvent* event);
+
+/* Concurrent global automata */
+#define TESLA_MAX_STAGED_EVENTS 64
+
+void TeslaAutomaton_Lock(TeslaAutomaton* automaton);
+void TeslaAutomaton_Unlock(TeslaAutomaton* automaton);
+void UpdateAutomatonConcurrent(TeslaAutomaton* automaton, TeslaEvent* event);
+void StageEventWithData(TeslaAutomaton* automaton, size_t eventId, void* data);
+
+/* Sampling */
+bool SampleBound(TeslaAutomaton* base);
+bool TeslaGetSampleCounts(TeslaAutomaton* base, size_t* tracked, size_t* untracked);
+
+/* Specialized transition functions */
+TeslaAutomaton* GetSpecializedAutomaton(TeslaAutomaton* automaton, TeslaEvent* event);
+void RestartSpecializedAutomaton(TeslaAutomaton* automaton);
+void FinishSpecializedTransition(TeslaAutomaton* automaton, TeslaEvent* event, bool foundSuccessor);
+
 /* Per-thread specific */
+#ifndef _KERNEL
+extern __thread UserThreadAutomata userThreadAutomata __attribute__((tls_model("initial-exec")));
+#endif
 bool AreThreadKeysEqual(TeslaThreadKey first, TeslaThreadKey second);
 TeslaThreadKey GetThreadKey(void);
 TeslaAutomaton* GetThreadAutomaton(TeslaAutomaton* automaton);
 TeslaAutomaton* GetThreadAutomatonKey(TeslaThreadKey key, TeslaAutomaton* automaton);
 TeslaAutomaton* GetThreadAutomatonAndLast(TeslaThreadKey key, TeslaAutomaton* automaton, TeslaAutomaton** lastInChain);
+TeslaAutomaton* GetThreadAutomatonUser(TeslaAutomaton* base);
+TeslaAutomaton* GetThreadAutomatonUserSlow(TeslaAutomaton* base);
+void RegisterThreadAutomaton(TeslaAutomaton* base, TeslaAutomaton* automaton);
 TeslaAutomaton* GetUnusedAutomaton(TeslaAutomaton* automaton);
 TeslaAutomaton* CreateAndCloneAutomaton(TeslaAutomaton* base);
 TeslaAutomaton* CloneAutomaton(TeslaAutomaton* automaton, TeslaAutomaton* base);
@@ -62,6 +96,8 @@ void DebugEvent(TeslaEvent* event);
 void DebugAutomaton(TeslaAutomaton* automaton);
 void DebugMatchArray(TeslaAutomaton* automaton, TeslaEvent* event);
 
+EXTERN_C_END
+
 
 #define INCLUDING_TESLA_MACROS
 #include "TeslaMacros.h"
@@ -0,0 +1,216 @@
+#include "TeslaLogic.h"
+
+#ifndef _KERNEL
+#include <sched.h>
+#include <string.h>
+#endif
+
+/*
+ * Global automata that several threads update at once, flagged isConcurrent
+ * by the instrumenter. Deterministic automata move with a compare-and-swap of
+ * the current event, following the same rules as
+ * UpdateAutomatonDeterministicGeneric, except at assertion sites, which move
+ * and check them under the lock. Everything else, the history and the
+ * match arrays of parametric automata, is only touched under the lock of the
+ * automaton. The match data of an assertion site is staged in the thread
+ * that reaches it and copied to the automaton under the lock, so threads
+ * asserting at once cannot mix their parameters.
+ */
+
+#ifndef _KERNEL
+typedef struct TeslaStagedEvents
+{
+    TeslaAutomaton* automaton;
+    void* data[TESLA_MAX_STAGED_EVENTS];
+} TeslaStagedEvents;
+
+static __thread TeslaStagedEvents stagedEvents __attribute__((tls_model("initial-exec")));
+#endif
+
+void TeslaAutomaton_Lock(TeslaAutomaton* automaton)
+{
+    size_t spins = 0;
+    while (__atomic_exchange_n(&automaton->lock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        while (__atomic_load_n(&automaton->lock, __ATOMIC_RELAXED) != 0)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+#ifndef _KERNEL
+            if (++spins % 64 == 0) // The holder may not be running.
+                sched_yield();
+#endif
+        }
+    }
+}
+
+void TeslaAutomaton_Unlock(TeslaAutomaton* automaton)
+{
+    __atomic_store_n(&automaton->lock, 0, __ATOMIC_RELEASE);
+}
+
+void StageEventWithData(TeslaAutomaton* automaton, size_t eventId, void* data)
+{
+    DEBUG_ASSERT(automaton->flags.isConcurrent && eventId < TESLA_MAX_STAGED_EVENTS);
+    TESLA_PROFILE_HOOK(automaton, eventId);
+
+    TeslaEvent* event = automaton->events[eventId];
+    if (TESLA_TRACE_HOOK(automaton, eventId, TESLA_TRACE_MATCH_DATA, data, event->matchDataSize))
+        return;
+    GET_THREAD_AUTOMATON_IF_ENABLED(automaton, event);
+
+#ifndef _KERNEL
+    // The data lives on the stack of the assertion site, until it calls UpdateAutomatonConcurrent.
+    if (stagedEvents.automaton != automaton)
+    {
+        memset(stagedEvents.data, 0, sizeof(stagedEvents.data));
+        stagedEvents.automaton = automaton;
+    }
+
+    stagedEvents.data[eventId] = data;
+#else
+    memcpy(automaton->eventStates[eventId].matchData, data, GetEventMatchSize(event));
+#endif
+}
+
+/* Called with the lock held. */
+static void ApplyStagedEvents(TeslaAutomaton* automaton)
+{
+#ifndef _KERNEL
+    if (stagedEvents.automaton != automaton)
+        return;
+
+    for (size_t i = 0; i < automaton->numEvents && i < TESLA_MAX_STAGED_EVENTS; ++i)
+    {
+        if (stagedEvents.data[i] != NULL)
+            memcpy(automaton->eventStates[i].matchData, stagedEvents.data[i], GetEventMatchSize(automaton->events[i]));
+    }
+
+    stagedEvents.automaton = NULL;
+#endif
+}
+
+/* The event UpdateAutomatonDeterministicGeneric moves to from current, without moving it. */
+static TeslaEvent* GetNextEvent(TeslaAutomaton* automaton, TeslaEvent* current, TeslaEvent* event, bool* foundSuccessor, bool* triedAgain)
+{
+    for (*triedAgain = false;; *triedAgain = true)
+    {
+        if (current != event)
+        {
+            if (IsSuccessor(current, event))
+            {
+                *foundSuccessor = true;
+                return event;
+            }
+
+            // Both events are in the same OR block.
+            if (current->flags.isOR && event->flags.isOR && IsSuccessor(event, current))
+            {
+                *foundSuccessor = true;
+                return current;
+            }
+        }
+
+        current = automaton->events[0];
+        if (*triedAgain)
+        {
+            *foundSuccessor = false;
+            return current;
+        }
+    }
+}
+
+static void UpdateAutomatonLocked(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    TeslaAutomaton_Lock(automaton);
+
+    if (automaton->state.isActive && !automaton->state.hasFailed) // It may have completed while we waited.
+    {
+        if (event->flags.isAssertion)
+            ApplyStagedEvents(automaton);
+
+        UpdateAutomatonDeterministicGeneric(automaton, event, true);
+    }
+
+    TeslaAutomaton_Unlock(automaton);
+}
+
+/* Moves the current event with a compare-and-swap. Returns false if the bound has been reset. */
+static bool MoveConcurrent(TeslaAutomaton* automaton, TeslaEvent* event, bool* foundSuccessor)
+{
+    TeslaEvent* current = __atomic_load_n(&automaton->state.currentEvent, __ATOMIC_ACQUIRE);
+    TeslaEvent* next;
+    bool triedAgain;
+
+    do
+    {
+        if (current == NULL) // Reset by the end of the bound.
+            return false;
+
+        next = GetNextEvent(automaton, current, event, foundSuccessor, &triedAgain);
+    } while (!__atomic_compare_exchange_n(&automaton->state.currentEvent, &current, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    TESLA_STAT_ADD(automaton, transitions, *foundSuccessor);
+    TESLA_STAT_ADD(automaton, retries, triedAgain);
+    return true;
+}
+
+/*
+ * Called with the lock held. EndAutomaton resets the bound under the same
+ * lock, so an assertion site that moved the automaton of one bound cannot
+ * mark the next one as reached, and the fail state is never written by two
+ * threads at once. AUTOMATON_FAIL_MESSAGE may return, so the caller unlocks.
+ */
+static void UpdateAssertionSite(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    if (!automaton->state.isActive || automaton->state.hasFailed)
+        return;
+
+    ApplyStagedEvents(automaton);
+
+    bool foundSuccessor;
+    if (!MoveConcurrent(automaton, event, &foundSuccessor))
+        return;
+
+    if (automaton->state.reachedAssertion)
+        AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site reached multiple times");
+
+    if (!foundSuccessor)
+        AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site didn't cause a transition");
+
+    automaton->state.reachedAssertion = true;
+
+#ifdef GUIDELINE_MODE
+    if (foundSuccessor && event->flags.isFinal)
+        automaton->state.isActive = false;
+#endif
+}
+
+void UpdateAutomatonConcurrent(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    DEBUG_ASSERT(automaton->flags.isConcurrent && !automaton->flags.isThreadLocal);
+
+    if (!automaton->flags.isDeterministic)
+    {
+        UpdateAutomatonLocked(automaton, event);
+        return;
+    }
+
+    if (event->flags.isAssertion)
+    {
+        TeslaAutomaton_Lock(automaton);
+        UpdateAssertionSite(automaton, event);
+        TeslaAutomaton_Unlock(automaton);
+        return;
+    }
+
+    bool foundSuccessor;
+    if (!MoveConcurrent(automaton, event, &foundSuccessor))
+        return;
+
+#ifdef GUIDELINE_MODE
+    if (foundSuccessor && event->flags.isFinal)
+        __atomic_store_n(&automaton->state.isActive, false, __ATOMIC_RELEASE);
+#endif
+}
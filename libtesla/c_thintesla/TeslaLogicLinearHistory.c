@@ -5,7 +5,11 @@ bool UpdateAutomatonLinearHistory(TeslaAutomaton* automaton, TeslaEvent* event,
     if (automaton->history == NULL || !automaton->history->valid)
         return false;
 
-    return TeslaHistory_Add(automaton->history, event->id, event->matchDataSize, data);
+    bool added = TeslaHistory_Add(automaton->history, event->id, data != NULL ? GetEventHash(event, data) : 0);
+
+    TESLA_STAT(automaton, storeInserts);
+    TESLA_STAT_MAX(automaton, historyHighWater, automaton->history->numObservations);
+    return added;
 }
 
 bool MatchEvent(TeslaAutomaton* automaton, Observation* observation)
@@ -19,7 +23,73 @@ bool MatchEvent(TeslaAutomaton* automaton, Observation* observation)
     if (event->flags.isDeterministic)
         return true;
     else
-        return Hash64(state->matchData, GetEventMatchSize(event)) == observation->hash;
+        return GetEventHash(event, state->matchData) == observation->hash;
+}
+
+bool GetSummaryWindow(TeslaAutomaton* automaton, ObservationWindow* window)
+{
+    TeslaHistory* history = automaton->history;
+    size_t numMatching = 0;
+
+    for (size_t i = 0; i < automaton->numEvents; ++i)
+    {
+        TeslaEvent* event = automaton->events[i];
+
+        // Deterministic events are always recorded without data.
+        HashSize hash = event->flags.isDeterministic ? 0 : GetEventHash(event, automaton->eventStates[i].matchData);
+
+        SummarySlot* slot = TeslaHistory_FindSummarySlot(history, i, hash);
+        if (slot == NULL)
+        {
+            if (TeslaHistory_HasEvicted(history, i)) // The matching value may have been evicted.
+                return false;
+
+            continue;
+        }
+
+        if (slot->count > 1) // Only the ring knows where the earlier occurrences are.
+            return false;
+
+        // Insertion sort on the observation index, there are at most numEvents of them.
+        size_t k = numMatching++;
+        while (k > 0 && history->sortedIndices[k - 1] > slot->lastIndex)
+        {
+            history->sortedIndices[k] = history->sortedIndices[k - 1];
+            history->sorted[k] = history->sorted[k - 1];
+            k--;
+        }
+
+        history->sortedIndices[k] = slot->lastIndex;
+        history->sorted[k].header.numEvent = i;
+        history->sorted[k].hash = hash;
+    }
+
+    window->history = history;
+    window->sorted = history->sorted;
+    window->first = 0;
+    window->end = numMatching;
+    window->isTruncated = false;
+
+    return true;
+}
+
+void GetRingWindow(TeslaAutomaton* automaton, ObservationWindow* window)
+{
+    window->history = automaton->history;
+    window->sorted = NULL;
+    window->first = TeslaHistory_GetFirstIndex(automaton->history);
+    window->end = automaton->history->numObservations;
+    window->isTruncated = TeslaHistory_HasOverflowed(automaton->history);
+}
+
+/* We ran out of observations. If the ring dropped older ones, we can't tell whether the assertion holds. */
+bool DegradeIfTruncated(TeslaAutomaton* automaton, ObservationWindow* window)
+{
+    if (!window->isTruncated)
+        return false;
+
+    automaton->state.isCorrect = false;
+    return true;
 }
 
 size_t GetFirstOREventFromLastInBlock(TeslaAutomaton* automaton, size_t lastOREvent)
@@ -34,23 +104,25 @@ size_t GetFirstOREventFromLastInBlock(TeslaAutomaton* automaton, size_t lastOREv
     return current + 1;
 }
 
-bool VerifyORBlockLinearHistory(TeslaAutomaton* automaton, Observation* invalid, Observation** currentObservation, size_t lastOREvent, size_t* out_i)
+bool VerifyORBlockLinearHistory(TeslaAutomaton* automaton, ObservationWindow* window, size_t* currentObservation, size_t lastOREvent, size_t* out_i)
 {
     size_t firstOREvent = GetFirstOREventFromLastInBlock(automaton, lastOREvent);
 
     bool atLeastOne = false;
 
-    Observation* current = *currentObservation;
+    size_t current = *currentObservation;
 
-    while (current != invalid)
+    while (current != window->first)
     {
-        if (!MatchEvent(automaton, current))
+        Observation* observation = ObservationWindow_Get(window, current - 1);
+
+        if (!MatchEvent(automaton, observation))
         {
             current--;
             continue;
         }
 
-        if (current->header.numEvent >= firstOREvent && current->header.numEvent <= lastOREvent)
+        if (observation->header.numEvent >= firstOREvent && observation->header.numEvent <= lastOREvent)
         {
             atLeastOne = true;
         }
@@ -64,6 +136,9 @@ bool VerifyORBlockLinearHistory(TeslaAutomaton* automaton, Observation* invalid,
 
     if (!atLeastOne)
     {
+        if (current == window->first && DegradeIfTruncated(automaton, window))
+            return false;
+
         AUTOMATON_FAIL_MESSAGE_FALSE(automaton, "No event in OR block has occurred");
     }
 
@@ -78,11 +153,13 @@ void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEve
     assert(automaton->history != NULL);
     assert(automaton->history->valid);
 
-    size_t numObservations = 0;
-    Observation* observations = TeslaHistory_GetObservations(automaton->history, &numObservations);
-    Observation* invalid = (observations == NULL) ? NULL : (observations - 1);
+    // The summaries are enough unless an event was seen several times with the asserted values.
+    ObservationWindow window;
+    if (!GetSummaryWindow(automaton, &window))
+        GetRingWindow(automaton, &window);
 
-    Observation* current = (observations == NULL) ? NULL : (observations + (numObservations - 1));
+    // Observations are consumed from the most recent one; current is one past the next observation to look at.
+    size_t current = window.end;
 
     size_t i = assertionEventId - 1;
 
@@ -92,7 +169,7 @@ void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEve
 
         if (event->flags.isOR)
         {
-            if (!VerifyORBlockLinearHistory(automaton, invalid, &current, i, &i))
+            if (!VerifyORBlockLinearHistory(automaton, &window, &current, i, &i))
                 return;
 
             continue;
@@ -104,10 +181,19 @@ void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEve
             continue;
         }
 
-        if (current == invalid) // We have no more observations.
+        // Skip the events we don't care about.
+        while (current != window.first && !MatchEvent(automaton, ObservationWindow_Get(&window, current - 1)))
+        {
+            current--;
+        }
+
+        if (current == window.first) // We have no more observations.
         {
             if (!event->flags.isOptional)
             {
+                if (DegradeIfTruncated(automaton, &window))
+                    return;
+
                 AUTOMATON_FAIL_MESSAGE(automaton, "Required event didn't occur");
             }
             else
@@ -117,12 +203,7 @@ void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEve
             }
         }
 
-        if (!MatchEvent(automaton, current)) // This is an event we don't care about.
-        {
-            current--;
-        }
-
-        if (current->header.numEvent != event->id) // This is another named event.
+        if (ObservationWindow_Get(&window, current - 1)->header.numEvent != event->id) // This is another named event.
         {
             if (event->flags.isOptional) // We may have skipped this event if it's optional, just continue.
             {
@@ -144,15 +225,19 @@ void VerifyAutomatonLinearHistory(TeslaAutomaton* automaton, size_t assertionEve
     }
 
     // Check that all other events are not named events that should only happen after the assertion.
-    while (current != invalid)
+    while (current != window.first)
     {
-        if (current->header.numEvent > assertionEventId)
+        Observation* observation = ObservationWindow_Get(&window, current - 1);
+        if (observation->header.numEvent > assertionEventId)
         {
-            if (MatchEvent(automaton, current))
+            if (MatchEvent(automaton, observation))
             {
                 AUTOMATON_FAIL_MESSAGE(automaton, "Event after assertion happened before assertion");
             }
         }
         current--;
     }
+
+    // One of the dropped observations may still have been an event from after the assertion.
+    DegradeIfTruncated(automaton, &window);
 }
\ No newline at end of file
@@ -3,9 +3,12 @@
 #include "TeslaAssert.h"
 #include "TeslaLogic.h"
 #include "TeslaMalloc.h"
+#include "TeslaSlab.h"
 #include "TeslaUtils.h"
 #ifdef _KERNEL
 #include <sys/proc.h>
+#else
+#include <string.h>
 #endif
 
 //#define ENABLE_THREAD_DEBUG
@@ -19,10 +22,48 @@ void DebugThread(const char* message)
 
 void* BAD_VALUE = (void*)0xFFFFFFFFFFFFFFFF;
 
-bool AreThreadKeysEqual(TeslaThreadKey first, TeslaThreadKey second)
+#ifndef _KERNEL
+// Per-thread table of automaton clones indexed by TeslaAutomaton::id, the userspace
+// counterpart of curthread->automata. The chain of clones hanging off each base
+// automaton is only walked when a slot is empty or stale. It is looked up by the
+// fast path in TeslaFastPath.c, which may be inlined outside of this library.
+__thread UserThreadAutomata userThreadAutomata __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t threadExitOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t threadExitKey;
+
+/*
+ * Runs when a thread that has taken clones exits. The table of the thread
+ * lists every clone it has held. One it still holds is in a bound that will
+ * never end, so it is reset for another thread to take, and its stores go
+ * back to the pool.
+ */
+static void ReleaseThreadAutomata(void* data)
+{
+    UserThreadAutomata* automata = (UserThreadAutomata*)data;
+
+    for (size_t i = 0; i < automata->numAutomata; ++i)
+    {
+        TeslaAutomaton* automaton = automata->automata[i];
+        if (automaton == NULL || !AreThreadKeysEqual(automaton->threadKey, automata->threadKey))
+            continue;
+
+        if (!automaton->flags.isDeterministic)
+            TA_ClearEventStates(automaton);
+
+        TA_Reset(automaton);
+    }
+
+    TeslaFree(automata->automata);
+    automata->automata = NULL;
+    automata->numAutomata = 0;
+}
+
+static void CreateThreadExitKey(void)
 {
-    return first == second;
+    pthread_key_create(&threadExitKey, ReleaseThreadAutomata);
 }
+#endif
 
 TeslaThreadKey GetThreadKey()
 {
@@ -73,33 +114,61 @@ TeslaAutomaton* GetThreadAutomatonKey(TeslaThreadKey key, TeslaAutomaton* automa
     return GetThreadAutomatonAndLast(key, automaton, &last);
 }
 
-TeslaAutomaton* GetThreadAutomaton(TeslaAutomaton* automaton)
+TeslaAutomaton* GetThreadAutomatonUserSlow(TeslaAutomaton* base)
 {
-    assert(automaton->flags.isThreadLocal);
+    TeslaAutomaton* automaton = GetThreadAutomatonKey(GetThreadKey(), base);
+
+    if (automaton != NULL)
+        RegisterThreadAutomaton(base, automaton);
 
+    return automaton;
+}
+
+void RegisterThreadAutomaton(TeslaAutomaton* base, TeslaAutomaton* automaton)
+{
 #ifndef _KERNEL
-    return GetThreadAutomatonKey(GetThreadKey(), automaton);
-#else
-    return GetThreadAutomatonKernel(automaton);
+    UserThreadAutomata* automata = &userThreadAutomata;
+
+    if (automata->automata == NULL)
+    {
+        automata->automata = TeslaMallocZero(sizeof(TeslaAutomaton*) * base->numTotalAutomata);
+        if (automata->automata == NULL)
+            return;
+
+        automata->numAutomata = base->numTotalAutomata;
+        automata->threadKey = GetThreadKey();
+
+        pthread_once(&threadExitOnce, CreateThreadExitKey);
+        pthread_setspecific(threadExitKey, automata);
+    }
+
+    if (base->id < automata->numAutomata)
+        automata->automata[base->id] = automaton;
 #endif
 }
 
 void FreeAutomaton(TeslaAutomaton* automaton)
 {
-    if (automaton != NULL)
+    // Clones live in a slab and are never freed themselves, see CloneAutomaton. Only the stores are allocated outside of it.
+    if (automaton == NULL || automaton->eventStates == NULL)
+        return;
+
+    for (size_t i = 0; i < automaton->numEvents; ++i)
     {
-        if (automaton->eventStates != NULL)
-        {
-            for (size_t i = 0; i < automaton->numEvents; ++i)
-            {
-                if (!automaton->events[i]->flags.isDeterministic)
-                    TeslaFree(automaton->eventStates[i].matchData);
-            }
+        TeslaEventState* state = &automaton->eventStates[i];
 
-            TeslaFree(automaton->eventStates);
+        if (!automaton->events[i]->flags.isDeterministic && state->store != NULL)
+        {
+            TeslaStore_Destroy(state->store);
+            TeslaFree(state->store);
+            state->store = NULL;
         }
+    }
 
-        TeslaFree(automaton);
+    if (automaton->history != NULL && automaton->history->valid)
+    {
+        TeslaHistory_Destroy(automaton->history);
+        automaton->history->valid = false;
     }
 }
 
@@ -116,6 +185,7 @@ retrysearch:
     if (existing != NULL)
     {
         *leftover = true;
+        RegisterThreadAutomaton(base, existing);
         return existing;
     }
     else
@@ -127,6 +197,7 @@ retrysearch:
                 goto retrysearch; // Somebody was faster, try again.
 
             DEBUG_ASSERT(!existing->state.isActive);
+            RegisterThreadAutomaton(base, existing);
             return existing;
         }
 
@@ -150,52 +221,122 @@ tryappendagain:
         goto tryappendagain;
     }
 
+    RegisterThreadAutomaton(base, automaton);
     return automaton;
 }
 
-TeslaAutomaton* CreateAndCloneAutomaton(TeslaAutomaton* base)
+/*
+ * A clone is a single block: the automaton, its event states, the match data
+ * of every parametric event, then the history in userspace. The stores of the
+ * kernel are taken on the first insert of their event, see TA_GetStore. Each
+ * part starts on a cache line, so an update touches the header and the lines
+ * right after it rather than several unrelated heap chunks.
+ */
+typedef struct CloneLayout
 {
-    TeslaAutomaton* automaton = TeslaMallocZero(sizeof(TeslaAutomaton));
+    size_t eventStates;
+    size_t matchData;
+    size_t history;
+    size_t historyBlock;
+    size_t size;
+} CloneLayout;
+
+/* Offsets are relative to the start of the block, which holds headerSize bytes of automaton first. */
+static void GetCloneLayout(TeslaAutomaton* base, size_t headerSize, CloneLayout* layout)
+{
+    memset(layout, 0, sizeof(CloneLayout));
+
+    size_t offset = TeslaSlab_Align(headerSize);
 
-    return CloneAutomaton(automaton, base);
+    if (!base->flags.isDeterministic)
+    {
+        layout->eventStates = offset;
+        offset += sizeof(TeslaEventState) * base->numEvents;
+
+        layout->matchData = offset;
+        for (size_t i = 0; i < base->numEvents; ++i)
+        {
+            if (!base->events[i]->flags.isDeterministic)
+                offset += base->events[i]->matchDataSize * sizeof(size_t);
+        }
+        offset = TeslaSlab_Align(offset);
+
+#ifdef LINEAR_HISTORY
+        layout->history = offset;
+        offset += TeslaSlab_Align(sizeof(TeslaHistory));
+
+        layout->historyBlock = offset;
+        offset += TeslaHistory_GetBlockSize(base->numEvents);
+#endif
+    }
+
+    layout->size = offset;
 }
 
-TeslaAutomaton* CloneAutomaton(TeslaAutomaton* automaton, TeslaAutomaton* base)
+static TeslaAutomaton* CloneAutomatonInBlock(TeslaAutomaton* automaton, TeslaAutomaton* base, uint8_t* block, CloneLayout* layout)
 {
-    if (automaton == NULL)
-        return NULL;
-
     // Copy static information.
     automaton->numEvents = base->numEvents;
     automaton->flags = base->flags;
     automaton->events = base->events;
     automaton->name = base->name;
     automaton->threadKey = GetThreadKey();
+    automaton->numTotalAutomata = base->numTotalAutomata;
+    automaton->id = base->id;
+    automaton->sampleRate = base->sampleRate;
 
     if (!base->flags.isDeterministic)
     {
-        automaton->eventStates = TeslaMallocZero(sizeof(TeslaEventState) * base->numEvents);
-
-        if (automaton->eventStates == NULL)
-        {
-            FreeAutomaton(automaton);
-            return NULL;
-        }
+        automaton->eventStates = (TeslaEventState*)(block + layout->eventStates);
 
+        uint8_t* matchData = block + layout->matchData;
         for (size_t i = 0; i < automaton->numEvents; ++i)
         {
             if (!automaton->events[i]->flags.isDeterministic)
             {
-                automaton->eventStates[i].matchData = TeslaMalloc(automaton->events[i]->matchDataSize * sizeof(size_t));
-
-                if (automaton->eventStates[i].matchData == NULL)
-                {
-                    FreeAutomaton(automaton);
-                    return NULL;
-                }
+                automaton->eventStates[i].matchData = matchData;
+                matchData += automaton->events[i]->matchDataSize * sizeof(size_t);
             }
         }
+
+#ifdef LINEAR_HISTORY
+        automaton->history = (TeslaHistory*)(block + layout->history);
+        TeslaHistory_CreateInPlace(automaton->history, automaton->numEvents, block + layout->historyBlock);
+        automaton->history->valid = true;
+#endif
     }
 
     return automaton;
+}
+
+TeslaAutomaton* CreateAndCloneAutomaton(TeslaAutomaton* base)
+{
+    CloneLayout layout;
+    GetCloneLayout(base, sizeof(TeslaAutomaton), &layout);
+
+    uint8_t* block = TeslaSlab_Allocate(layout.size);
+    if (block == NULL)
+        return NULL;
+
+    return CloneAutomatonInBlock((TeslaAutomaton*)block, base, block, &layout);
+}
+
+TeslaAutomaton* CloneAutomaton(TeslaAutomaton* automaton, TeslaAutomaton* base)
+{
+    if (automaton == NULL)
+        return NULL;
+
+    // The automaton itself is already allocated, as in the per-thread array of the kernel.
+    CloneLayout layout;
+    GetCloneLayout(base, 0, &layout);
+
+    uint8_t* block = NULL;
+    if (layout.size > 0)
+    {
+        block = TeslaSlab_Allocate(layout.size);
+        if (block == NULL)
+            return NULL;
+    }
+
+    return CloneAutomatonInBlock(automaton, base, block, &layout);
 }
\ No newline at end of file
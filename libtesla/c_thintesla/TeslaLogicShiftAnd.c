@@ -0,0 +1,65 @@
+#include "TeslaLogic.h"
+
+/*
+ * Shift-and execution of deterministic automata, equivalent to
+ * UpdateAutomatonDeterministicGeneric. The state is the bit of the current
+ * event. An event is taken from the current one if the state intersects its
+ * predecessors, and ignored if the state is a later event of its OR block.
+ * Otherwise the generic engine starts over from the first event, which takes
+ * the event if the first event is one of its predecessors and stays at the
+ * first event if not. The four cases are turned into masks instead of
+ * branches: only assertion sites and the kernel take a branch.
+ */
+void UpdateAutomatonShiftAnd(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    DEBUG_ASSERT(automaton->flags.isShiftAnd && automaton->flags.isDeterministic);
+    DEBUG_ASSERT(automaton->state.isActive && automaton->state.currentEvent != NULL);
+
+    uint64_t self = (uint64_t)1 << event->id;
+    uint64_t current = (uint64_t)1 << automaton->state.currentEvent->id;
+
+    // At most one of these is all ones.
+    uint64_t advance = -(uint64_t)((current & event->predecessorMask) != 0);
+    uint64_t stay = -(uint64_t)((current & event->orBlockMask) != 0) & ~advance;
+    uint64_t restart = -(uint64_t)(event->predecessorMask & 1) & ~(advance | stay);
+    uint64_t found = advance | stay | restart;
+
+    uint64_t next = ((advance | restart) & self) | (stay & current) | (~found & 1);
+    automaton->state.currentEvent = automaton->events[__builtin_ctzll(next)];
+
+    bool foundSuccessor = (bool)(found & 1);
+
+    TESLA_STAT_ADD(automaton, transitions, found & 1);
+    TESLA_STAT_ADD(automaton, retries, ~(advance | stay) & 1);
+
+    if (event->flags.isAssertion)
+    {
+        if (automaton->state.reachedAssertion)
+            AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site reached multiple times");
+
+        if (!foundSuccessor)
+            AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site didn't cause a transition");
+
+        automaton->state.reachedAssertion = true;
+
+#ifdef _KERNEL
+        if (!automaton->flags.isLinked)
+            IncreaseKernelActiveCount();
+#endif
+    }
+
+#ifdef GUIDELINE_MODE
+    // In guideline mode, an automaton that reaches a final event has completed.
+    bool completed = foundSuccessor & event->flags.isFinal;
+    automaton->state.isActive &= !completed;
+
+    if (completed)
+    {
+        TA_SetLive(automaton, false);
+#ifdef _KERNEL
+        if (!automaton->flags.isLinked)
+            DecreaseKernelActiveCount();
+#endif
+    }
+#endif
+}
@@ -0,0 +1,66 @@
+#include "TeslaLogic.h"
+
+/*
+ * Runtime half of the transition functions that the instrumenter emits with
+ * -thin-tesla-codegen=specialized. The emitted code switches on the current
+ * event and moves the automaton itself, following the same rules as
+ * UpdateAutomatonDeterministicGeneric. It only calls in here to find the
+ * automaton of the thread, to start over from the first event, and when an
+ * assertion site or a final event has been reached.
+ */
+
+TeslaAutomaton* GetSpecializedAutomaton(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    if (TESLA_TRACE_HOOK(automaton, event->id, TESLA_TRACE_EVENT, NULL, 0))
+        return NULL;
+    GET_THREAD_AUTOMATON(automaton, event);
+
+    if (automaton == NULL || !automaton->state.isActive || automaton->state.hasFailed)
+        return NULL;
+
+    TESLA_STAT(automaton, events);
+
+    DEBUG_ASSERT(automaton->flags.isDeterministic && automaton->state.currentEvent != NULL);
+    return automaton;
+}
+
+void RestartSpecializedAutomaton(TeslaAutomaton* automaton)
+{
+    TESLA_STAT(automaton, retries);
+#ifdef LINEAR_HISTORY
+    if (automaton->history != NULL)
+        TeslaHistory_Clear(automaton->history);
+#endif
+    automaton->state.currentEvent = automaton->events[0];
+}
+
+void FinishSpecializedTransition(TeslaAutomaton* automaton, TeslaEvent* event, bool foundSuccessor)
+{
+    if (event->flags.isAssertion)
+    {
+        if (automaton->state.reachedAssertion)
+            AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site reached multiple times");
+
+        if (!foundSuccessor)
+            AUTOMATON_FAIL_MESSAGE(automaton, "Assertion site didn't cause a transition");
+
+        automaton->state.reachedAssertion = true;
+
+#ifdef _KERNEL
+        if (!automaton->flags.isLinked)
+            IncreaseKernelActiveCount();
+#endif
+    }
+
+#ifdef GUIDELINE_MODE
+    if (foundSuccessor && event->flags.isFinal)
+    {
+        automaton->state.isActive = false;
+        TA_SetLive(automaton, false);
+#ifdef _KERNEL
+        if (!automaton->flags.isLinked)
+            DecreaseKernelActiveCount();
+#endif
+    }
+#endif
+}
@@ -80,6 +80,7 @@
 #define AUTOMATON_FAIL_MESSAGE_RETURN(automaton, message, retval) \
     do                                                            \
     {                                                             \
+        TESLA_STAT(automaton, failures);                          \
         automaton->state.hasFailed = true;                        \
         automaton->state.isActive = false;                        \
         automaton->state.failReason = message;                    \
@@ -95,6 +96,7 @@
 #define AUTOMATON_FAIL_MESSAGE_RETURN(automaton, message, retval) \
     do                                                            \
     {                                                             \
+        TESLA_STAT(automaton, failures);                          \
         automaton->state.hasFailed = true;                        \
         automaton->state.isActive = false;                        \
         if (automaton->flags.isLinked)                            \
@@ -0,0 +1,339 @@
+#include "TeslaProfile.h"
+#include "TeslaMalloc.h"
+
+#ifdef TESLA_PROFILE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct TeslaProfileEvent
+{
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t histogram[TESLA_PROFILE_BUCKETS];
+} TeslaProfileEvent;
+
+typedef struct TeslaProfileAutomaton
+{
+    size_t numEvents;
+    TeslaProfileEvent events[];
+} TeslaProfileAutomaton;
+
+/*
+ * The profile of a thread, with a block per automaton allocated the first time
+ * one of its hooks runs. Only the thread itself writes to it, and the array of
+ * blocks is only replaced under the lock, so other threads read it under the
+ * lock. What they read may be a few hooks behind.
+ */
+typedef struct TeslaThreadProfile
+{
+    struct TeslaThreadProfile* next;
+    size_t numAutomata;
+    TeslaProfileAutomaton** automata;
+} TeslaThreadProfile;
+
+static __thread TeslaThreadProfile threadProfile __attribute__((tls_model("initial-exec")));
+
+static TeslaThreadProfile* threadProfileList = NULL;
+static TeslaThreadProfile retiredProfile; // Profiles of the threads that have exited.
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* profileNames[TESLA_MAX_AUTOMATA];
+static uint64_t profileStart;
+
+static pthread_once_t profileOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t profileKey;
+
+static size_t TeslaProfile_Bucket(uint64_t cycles)
+{
+    if (cycles < TESLA_PROFILE_LINEAR_BUCKETS)
+        return cycles;
+
+    size_t exponent = 63 - __builtin_clzll(cycles);
+    if (exponent > TESLA_PROFILE_MAX_EXPONENT)
+        return TESLA_PROFILE_BUCKETS - 1;
+
+    return TESLA_PROFILE_LINEAR_BUCKETS + (exponent - 4) * 8 + ((cycles >> (exponent - 3)) & 7);
+}
+
+/* The middle of the cycles that fall into a bucket. */
+static uint64_t TeslaProfile_BucketValue(size_t bucket)
+{
+    if (bucket < TESLA_PROFILE_LINEAR_BUCKETS)
+        return bucket;
+
+    size_t exponent = 4 + (bucket - TESLA_PROFILE_LINEAR_BUCKETS) / 8;
+    uint64_t sub = (bucket - TESLA_PROFILE_LINEAR_BUCKETS) % 8;
+    return ((8 + sub) << (exponent - 3)) + ((uint64_t)1 << (exponent - 3)) / 2;
+}
+
+/* Makes room for automaton id in profile. Called with the lock held once profile is linked. */
+static TeslaProfileAutomaton** TeslaProfile_Reserve(TeslaThreadProfile* profile, size_t id, size_t numAutomata)
+{
+    if (id >= profile->numAutomata)
+    {
+        if (numAutomata <= id)
+            numAutomata = id + 1;
+
+        TeslaProfileAutomaton** automata = (TeslaProfileAutomaton**)TeslaMallocZero(numAutomata * sizeof(TeslaProfileAutomaton*));
+        if (profile->automata != NULL)
+        {
+            memcpy(automata, profile->automata, profile->numAutomata * sizeof(TeslaProfileAutomaton*));
+            TeslaFree(profile->automata);
+        }
+
+        profile->automata = automata;
+        profile->numAutomata = numAutomata;
+    }
+
+    return &profile->automata[id];
+}
+
+static TeslaProfileAutomaton* TeslaProfile_CreateAutomaton(size_t numEvents)
+{
+    TeslaProfileAutomaton* automaton = (TeslaProfileAutomaton*)TeslaMallocZero(sizeof(TeslaProfileAutomaton) + numEvents * sizeof(TeslaProfileEvent));
+    automaton->numEvents = numEvents;
+    return automaton;
+}
+
+static void TeslaProfile_AddEvent(TeslaProfileEvent* total, const TeslaProfileEvent* event)
+{
+    total->count += event->count;
+    total->cycles += event->cycles;
+    for (size_t i = 0; i < TESLA_PROFILE_BUCKETS; ++i)
+        total->histogram[i] += event->histogram[i];
+}
+
+static void TeslaProfile_ThreadExit(void* data)
+{
+    TeslaThreadProfile* profile = (TeslaThreadProfile*)data;
+
+    pthread_mutex_lock(&profileLock);
+    for (TeslaThreadProfile** it = &threadProfileList; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == profile)
+        {
+            *it = profile->next;
+            break;
+        }
+    }
+
+    for (size_t id = 0; id < profile->numAutomata; ++id)
+    {
+        TeslaProfileAutomaton* automaton = profile->automata[id];
+        if (automaton == NULL)
+            continue;
+
+        TeslaProfileAutomaton** retired = TeslaProfile_Reserve(&retiredProfile, id, profile->numAutomata);
+        if (*retired == NULL)
+        {
+            *retired = automaton; // Handed over as it is.
+            continue;
+        }
+
+        for (size_t i = 0; i < automaton->numEvents && i < (*retired)->numEvents; ++i)
+            TeslaProfile_AddEvent(&(*retired)->events[i], &automaton->events[i]);
+        TeslaFree(automaton);
+    }
+    pthread_mutex_unlock(&profileLock);
+
+    TeslaFree(profile->automata);
+    memset(profile, 0, sizeof(TeslaThreadProfile));
+}
+
+static void TeslaProfile_DumpAtExit(void)
+{
+    TeslaDumpProfile(STDERR_FILENO);
+}
+
+static void TeslaProfile_Init(void)
+{
+    profileStart = TeslaProfile_Now();
+    pthread_key_create(&profileKey, TeslaProfile_ThreadExit);
+
+    if (getenv("TESLA_PROFILE") != NULL)
+        atexit(TeslaProfile_DumpAtExit);
+}
+
+/* The first hook of automaton in this thread. */
+static TeslaProfileAutomaton* TeslaProfile_GetSlow(TeslaAutomaton* base)
+{
+    pthread_once(&profileOnce, TeslaProfile_Init);
+
+    if (base->id < TESLA_MAX_AUTOMATA && __atomic_load_n(&profileNames[base->id], __ATOMIC_RELAXED) == NULL)
+    {
+        size_t length = strlen(base->name) + 1;
+        char* name = (char*)TeslaMalloc(length);
+        memcpy(name, base->name, length);
+
+        char* expected = NULL;
+        if (!__atomic_compare_exchange_n(&profileNames[base->id], &expected, name, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            TeslaFree(name);
+    }
+
+    TeslaProfileAutomaton* automaton = TeslaProfile_CreateAutomaton(base->numEvents);
+
+    pthread_mutex_lock(&profileLock);
+    if (threadProfile.numAutomata == 0)
+    {
+        threadProfile.next = threadProfileList;
+        threadProfileList = &threadProfile;
+        pthread_setspecific(profileKey, &threadProfile);
+    }
+    *TeslaProfile_Reserve(&threadProfile, base->id, base->numTotalAutomata) = automaton;
+    pthread_mutex_unlock(&profileLock);
+
+    return automaton;
+}
+
+void TeslaProfile_End(TeslaProfileScope* scope)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int processor;
+    uint64_t end = __builtin_ia32_rdtscp(&processor);
+#else
+    uint64_t end = TeslaProfile_Now();
+#endif
+    uint64_t cycles = end - scope->start;
+
+    TeslaAutomaton* base = scope->automaton;
+    TeslaProfileAutomaton* automaton = base->id < threadProfile.numAutomata ? threadProfile.automata[base->id] : NULL;
+    if (__builtin_expect(automaton == NULL, 0))
+        automaton = TeslaProfile_GetSlow(base);
+
+    if (scope->eventId >= automaton->numEvents)
+        return;
+
+    TeslaProfileEvent* event = &automaton->events[scope->eventId];
+    event->count++;
+    event->cycles += cycles;
+    event->histogram[TeslaProfile_Bucket(cycles)]++;
+}
+
+/* Called with the lock held. */
+static bool TeslaProfile_Sum(size_t id, size_t eventId, TeslaProfileEvent* total)
+{
+    memset(total, 0, sizeof(TeslaProfileEvent));
+
+    if (id < retiredProfile.numAutomata && retiredProfile.automata[id] != NULL && eventId < retiredProfile.automata[id]->numEvents)
+        TeslaProfile_AddEvent(total, &retiredProfile.automata[id]->events[eventId]);
+
+    for (TeslaThreadProfile* it = threadProfileList; it != NULL; it = it->next)
+    {
+        if (id < it->numAutomata && it->automata[id] != NULL && eventId < it->automata[id]->numEvents)
+            TeslaProfile_AddEvent(total, &it->automata[id]->events[eventId]);
+    }
+
+    return total->count > 0;
+}
+
+static uint64_t TeslaProfile_Percentile(const TeslaProfileEvent* event, uint64_t percent)
+{
+    uint64_t rank = (event->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < TESLA_PROFILE_BUCKETS; ++i)
+    {
+        seen += event->histogram[i];
+        if (seen >= rank)
+            return TeslaProfile_BucketValue(i);
+    }
+
+    return TeslaProfile_BucketValue(TESLA_PROFILE_BUCKETS - 1);
+}
+
+static void TeslaProfile_Summarize(const TeslaProfileEvent* event, TeslaProfileSummary* summary)
+{
+    summary->count = event->count;
+    summary->cycles = event->cycles;
+    summary->mean = event->cycles / event->count;
+    summary->p50 = TeslaProfile_Percentile(event, 50);
+    summary->p99 = TeslaProfile_Percentile(event, 99);
+}
+
+/* The most events of an automaton over every profile. Called with the lock held. */
+static size_t TeslaProfile_GetNumEvents(size_t id)
+{
+    size_t numEvents = 0;
+
+    if (id < retiredProfile.numAutomata && retiredProfile.automata[id] != NULL)
+        numEvents = retiredProfile.automata[id]->numEvents;
+
+    for (TeslaThreadProfile* it = threadProfileList; it != NULL; it = it->next)
+    {
+        if (id < it->numAutomata && it->automata[id] != NULL && it->automata[id]->numEvents > numEvents)
+            numEvents = it->automata[id]->numEvents;
+    }
+
+    return numEvents;
+}
+#endif
+
+bool TeslaGetProfile(TeslaAutomaton* base, size_t eventId, TeslaProfileSummary* summary)
+{
+#ifdef TESLA_PROFILE
+    TeslaProfileEvent total;
+
+    pthread_mutex_lock(&profileLock);
+    bool found = TeslaProfile_Sum(base->id, eventId, &total);
+    pthread_mutex_unlock(&profileLock);
+
+    if (found)
+        TeslaProfile_Summarize(&total, summary);
+    return found;
+#else
+    (void)base;
+    (void)eventId;
+    (void)summary;
+    return false;
+#endif
+}
+
+void TeslaDumpProfile(int fd)
+{
+#ifdef TESLA_PROFILE
+    char line[512];
+    int length;
+    uint64_t elapsed = TeslaProfile_Now() - profileStart;
+    uint64_t profiled = 0;
+
+    pthread_mutex_lock(&profileLock);
+
+    length = snprintf(line, sizeof(line), "[TESLA] automaton\tevent\tcount\tmean\tp50\tp99\tshare (%%)\n");
+    write(fd, line, length);
+
+    for (size_t id = 0; id < TESLA_MAX_AUTOMATA; ++id)
+    {
+        char* name = __atomic_load_n(&profileNames[id], __ATOMIC_ACQUIRE);
+        if (name == NULL)
+            continue;
+
+        size_t numEvents = TeslaProfile_GetNumEvents(id);
+        for (size_t eventId = 0; eventId < numEvents; ++eventId)
+        {
+            TeslaProfileEvent total;
+            if (!TeslaProfile_Sum(id, eventId, &total))
+                continue;
+
+            TeslaProfileSummary summary;
+            TeslaProfile_Summarize(&total, &summary);
+            profiled += summary.cycles;
+
+            length = snprintf(line, sizeof(line), "[TESLA] %s\t%zu\t%llu\t%llu\t%llu\t%llu\t%.4f\n", name, eventId,
+                              (unsigned long long)summary.count, (unsigned long long)summary.mean, (unsigned long long)summary.p50,
+                              (unsigned long long)summary.p99, elapsed > 0 ? 100.0 * summary.cycles / elapsed : 0.0);
+            if (length > 0)
+                write(fd, line, length < (int)sizeof(line) ? length : (int)sizeof(line) - 1);
+        }
+    }
+
+    pthread_mutex_unlock(&profileLock);
+
+    length = snprintf(line, sizeof(line), "[TESLA] total\t%llu of %llu cycles (%.4f%%)\n", (unsigned long long)profiled,
+                      (unsigned long long)elapsed, elapsed > 0 ? 100.0 * profiled / elapsed : 0.0);
+    write(fd, line, length);
+#else
+    (void)fd;
+#endif
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "TeslaState.h"
+#include "ThinTesla.h"
+
+// Cycle profiling of every hook. Off unless built with TESLA_PROFILE (cmake -DTHIN_TESLA_PROFILE=ON).
+#if defined(_KERNEL)
+#undef TESLA_PROFILE
+#endif
+
+#if defined(TESLA_PROFILE) && !defined(__x86_64__) && !defined(__i386__)
+#include <time.h>
+#endif
+
+/*
+ * Cycles per hook are kept in a log-linear histogram: exact below 16 cycles,
+ * then eight buckets per power of two, so percentiles are within 12.5%.
+ * Anything above 2^36 cycles goes into the last bucket.
+ */
+#define TESLA_PROFILE_LINEAR_BUCKETS 16
+#define TESLA_PROFILE_MAX_EXPONENT 35
+#define TESLA_PROFILE_BUCKETS (TESLA_PROFILE_LINEAR_BUCKETS + (TESLA_PROFILE_MAX_EXPONENT - 3) * 8)
+
+typedef struct TeslaProfileSummary
+{
+    uint64_t count;  // Hooks run for the event.
+    uint64_t cycles; // Total, from entering the hook to leaving it.
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p99;
+} TeslaProfileSummary;
+
+#ifdef TESLA_PROFILE
+typedef struct TeslaProfileScope
+{
+    uint64_t start;
+    TeslaAutomaton* automaton;
+    size_t eventId;
+} TeslaProfileScope;
+
+EXTERN_C
+
+void TeslaProfile_End(TeslaProfileScope* scope);
+
+EXTERN_C_END
+
+static inline uint64_t TeslaProfile_Now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+/*
+ * Starts timing a hook for an event of automaton, the base automaton it was
+ * called with. The time is recorded when the hook returns, whichever return
+ * it takes, by the cleanup of a local variable.
+ */
+#define TESLA_PROFILE_HOOK(automaton, eventId)                                                \
+    TeslaProfileScope teslaProfileScope __attribute__((cleanup(TeslaProfile_End))) = {        \
+        TeslaProfile_Now(), (automaton), (eventId)}
+#else
+#define TESLA_PROFILE_HOOK(automaton, eventId) \
+    do                                         \
+    {                                          \
+    } while (0)
+#endif
+
+EXTERN_C
+
+/*
+ * Adds up the cycles of one event of base over every thread, including
+ * threads that have exited. Returns false if profiling is compiled out, or
+ * the event has never been seen.
+ */
+bool TeslaGetProfile(TeslaAutomaton* base, size_t eventId, TeslaProfileSummary* summary);
+
+/*
+ * Writes the mean, median and 99th percentile cycles of every profiled event
+ * to fd, with its share of the cycles since profiling started, summed over
+ * threads. Set TESLA_PROFILE in the environment to have it written to stderr
+ * at exit.
+ */
+void TeslaDumpProfile(int fd);
+
+EXTERN_C_END
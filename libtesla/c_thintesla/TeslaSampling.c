@@ -0,0 +1,121 @@
+#include "TeslaLogic.h"
+
+#ifndef _KERNEL
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Sampled checking: when an automaton with a sample rate of N is initialized
+ * at the start of a temporal bound, the bound is checked with probability 1/N
+ * and otherwise left untracked, see TA_InitUntracked. The rate comes from the
+ * instrumenter (-thin-tesla-sample-rate and -thin-tesla-sample) and can be
+ * overridden with TESLA_SAMPLE_RATE, either a rate for every automaton or a
+ * list like "name=N,name=N,N" where the bare rate applies to the others.
+ */
+
+typedef struct TeslaSampleCounts
+{
+    size_t tracked;
+    size_t untracked;
+} __attribute__((aligned(64))) TeslaSampleCounts;
+
+// Only kept for sampled automata, so that the bounds of the others cost nothing more.
+static TeslaSampleCounts sampleCounts[TESLA_MAX_AUTOMATA];
+
+static __thread uint64_t sampleState __attribute__((tls_model("initial-exec")));
+
+/* xorshift64*, seeded from the address of the state, which differs in every thread. */
+static uint64_t TeslaSampling_Next(void)
+{
+    uint64_t x = sampleState;
+    if (x == 0)
+        x = ((uint64_t)(uintptr_t)&sampleState * 0x9E3779B97F4A7C15ull) | 1;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sampleState = x;
+
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/* The rate for name in TESLA_SAMPLE_RATE, or 0 if it has none. */
+static size_t TeslaSampling_ParseRate(const char* rates, const char* name)
+{
+    size_t defaultRate = 0;
+    size_t length = strlen(name);
+
+    for (const char* entry = rates; entry != NULL; entry = strchr(entry, ','))
+    {
+        if (*entry == ',')
+            entry++;
+
+        const char* equals = strchr(entry, '=');
+        const char* comma = strchr(entry, ',');
+
+        if (equals == NULL || (comma != NULL && comma < equals))
+            defaultRate = strtoull(entry, NULL, 10);
+        else if ((size_t)(equals - entry) == length && strncmp(entry, name, length) == 0)
+            return strtoull(equals + 1, NULL, 10);
+    }
+
+    return defaultRate;
+}
+
+/*
+ * Applied once per automaton, when it is first initialized. Threads racing on
+ * it write the same values.
+ */
+static void TeslaSampling_ResolveRate(TeslaAutomaton* base)
+{
+    const char* rates = getenv("TESLA_SAMPLE_RATE");
+    if (rates != NULL)
+    {
+        size_t rate = TeslaSampling_ParseRate(rates, base->name);
+        if (rate != 0)
+            base->sampleRate = rate;
+    }
+
+    base->flags.isSampleRateResolved = true;
+}
+#endif
+
+bool SampleBound(TeslaAutomaton* base)
+{
+#ifndef _KERNEL
+    if (__builtin_expect(!base->flags.isSampleRateResolved, 0))
+        TeslaSampling_ResolveRate(base);
+
+    // Linked automata are checked together, so they are never sampled.
+    size_t rate = base->sampleRate;
+    if (rate <= 1 || base->flags.isLinked)
+        return true;
+
+    // Lemire's multiply-shift: the high word of x * rate is uniform in [0, rate).
+    bool tracked = ((unsigned __int128)TeslaSampling_Next() * rate) >> 64 == 0;
+
+    if (base->id < TESLA_MAX_AUTOMATA)
+    {
+        TeslaSampleCounts* counts = &sampleCounts[base->id];
+        __atomic_fetch_add(tracked ? &counts->tracked : &counts->untracked, 1, __ATOMIC_RELAXED);
+    }
+
+    return tracked;
+#else
+    return true;
+#endif
+}
+
+bool TeslaGetSampleCounts(TeslaAutomaton* base, size_t* tracked, size_t* untracked)
+{
+#ifndef _KERNEL
+    if (base->id >= TESLA_MAX_AUTOMATA)
+        return false;
+
+    *tracked = __atomic_load_n(&sampleCounts[base->id].tracked, __ATOMIC_RELAXED);
+    *untracked = __atomic_load_n(&sampleCounts[base->id].untracked, __ATOMIC_RELAXED);
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,139 @@
+#include "TeslaSites.h"
+
+#ifndef _KERNEL
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct TeslaSiteTable
+{
+    TeslaSite* begin;
+    TeslaSite* end;
+} TeslaSiteTable;
+
+static TeslaSiteTable siteTables[TESLA_MAX_SITE_TABLES];
+static size_t numSiteTables = 0;
+static pthread_mutex_t sitesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The byte is rewritten while other threads may be running the code around
+ * it. A single byte store is atomic, and x86 picks up the new immediate the
+ * next time the instruction is fetched. The page stays executable throughout,
+ * since other functions may share it.
+ */
+static bool TeslaSites_Patch(TeslaSite* site, uint8_t value)
+{
+    if (*site->immediate == value)
+        return true;
+
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t page = (uintptr_t)site->immediate & ~(pageSize - 1);
+
+    if (mprotect((void*)page, pageSize, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    {
+        fprintf(stderr, "[TESLA] Cannot patch the site at %p of %s\n", site->immediate, site->automaton);
+        return false;
+    }
+
+    __atomic_store_n(site->immediate, value, __ATOMIC_SEQ_CST);
+    mprotect((void*)page, pageSize, PROT_READ | PROT_EXEC);
+    return true;
+}
+
+static size_t TeslaSites_PatchAutomaton(const char* name, uint8_t value)
+{
+    size_t numPatched = 0;
+
+    pthread_mutex_lock(&sitesLock);
+    for (size_t i = 0; i < numSiteTables; ++i)
+    {
+        for (TeslaSite* site = siteTables[i].begin; site < siteTables[i].end; ++site)
+        {
+            if (strcmp(site->automaton, name) == 0 && TeslaSites_Patch(site, value))
+                numPatched++;
+        }
+    }
+    pthread_mutex_unlock(&sitesLock);
+
+    return numPatched;
+}
+
+/* Whether the automaton is listed in TESLA_ENABLE. */
+static bool TeslaSites_EnabledByEnvironment(const char* enable, const char* name)
+{
+    if (strcmp(enable, "all") == 0)
+        return true;
+
+    size_t length = strlen(name);
+    for (const char* entry = enable; entry != NULL; entry = strchr(entry, ','))
+    {
+        if (*entry == ',')
+            entry++;
+
+        if (strncmp(entry, name, length) == 0 && (entry[length] == ',' || entry[length] == '\0'))
+            return true;
+    }
+
+    return false;
+}
+#endif
+
+void TeslaRegisterSites(TeslaSite* begin, TeslaSite* end)
+{
+#ifndef _KERNEL
+    pthread_mutex_lock(&sitesLock);
+
+    // Every instrumented object file of a module registers the same table.
+    for (size_t i = 0; i < numSiteTables; ++i)
+    {
+        if (siteTables[i].begin == begin)
+        {
+            pthread_mutex_unlock(&sitesLock);
+            return;
+        }
+    }
+
+    assert(numSiteTables < TESLA_MAX_SITE_TABLES && "Too many modules with patchable sites");
+    siteTables[numSiteTables].begin = begin;
+    siteTables[numSiteTables].end = end;
+    numSiteTables++;
+
+    const char* enable = getenv("TESLA_ENABLE");
+    if (enable != NULL)
+    {
+        for (TeslaSite* site = begin; site < end; ++site)
+        {
+            if (TeslaSites_EnabledByEnvironment(enable, site->automaton))
+                TeslaSites_Patch(site, 1);
+        }
+    }
+
+    pthread_mutex_unlock(&sitesLock);
+#endif
+}
+
+size_t TeslaEnableAutomaton(const char* name)
+{
+#ifndef _KERNEL
+    return TeslaSites_PatchAutomaton(name, 1);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * The end of the bound is disabled with the rest of the sites, so a thread
+ * that is inside the bound keeps its automaton as it is. Disable automata
+ * when no thread is inside their bound, or expect spurious failures of that
+ * bound once they are enabled again.
+ */
+size_t TeslaDisableAutomaton(const char* name)
+{
+#ifndef _KERNEL
+    return TeslaSites_PatchAutomaton(name, 0);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ThinTesla.h"
+
+// Number of modules (executables and shared libraries) whose sites can be registered.
+#define TESLA_MAX_SITE_TABLES 64
+
+/*
+ * Instrumentation sites emitted with -thin-tesla-patchable. Each hook is run
+ * only if a movb of an immediate 0 or 1, just before it, loads 1. Every site
+ * leaves an entry in the tesla_sites section of its module, which a
+ * constructor registers with TeslaRegisterSites. Enabling an automaton
+ * rewrites the immediate of its sites in the text segment, so a disabled
+ * site costs a register move and a branch that is never taken.
+ */
+typedef struct TeslaSite
+{
+    uint8_t* immediate;   // Last byte of the movb.
+    const char* automaton; // Name of the automaton, like TeslaAutomaton::name.
+} TeslaSite;
+
+EXTERN_C
+
+/*
+ * Registers the sites of a module. Sites start disabled, unless their automaton
+ * is listed in the TESLA_ENABLE environment variable, separated by commas, or
+ * TESLA_ENABLE is "all". Registering the same table twice does nothing.
+ */
+void TeslaRegisterSites(TeslaSite* begin, TeslaSite* end);
+
+/* Return the number of sites that were patched, zero if no site belongs to the automaton. */
+size_t TeslaEnableAutomaton(const char* name);
+size_t TeslaDisableAutomaton(const char* name);
+
+EXTERN_C_END
@@ -0,0 +1,50 @@
+#include "TeslaSlab.h"
+#include "TeslaMalloc.h"
+
+#ifndef _KERNEL
+static __thread TeslaSlab threadSlab __attribute__((tls_model("initial-exec")));
+#endif
+
+/* Allocates size bytes aligned to a cache line. The unaligned pointer is lost, which is fine as they are never freed. */
+static uint8_t* TeslaSlab_AllocateChunk(size_t size)
+{
+    uint8_t* chunk = TeslaMallocZero(size + TESLA_CACHE_LINE_SIZE - 1);
+    if (chunk == NULL)
+        return NULL;
+
+    return (uint8_t*)TeslaSlab_Align((uintptr_t)chunk);
+}
+
+void* TeslaSlab_Allocate(size_t size)
+{
+#ifndef _KERNEL
+    return TeslaSlab_AllocateFrom(&threadSlab, size);
+#else
+    // Kernel threads have no TLS of their own, and the static storage is a bump allocator already.
+    return TeslaSlab_AllocateChunk(TeslaSlab_Align(size));
+#endif
+}
+
+void* TeslaSlab_AllocateFrom(TeslaSlab* slab, size_t size)
+{
+    size = TeslaSlab_Align(size);
+
+    // Big allocations get a chunk of their own rather than wasting most of a slab.
+    if (size > TESLA_SLAB_SIZE / 4)
+        return TeslaSlab_AllocateChunk(size);
+
+    if (slab->current == NULL || (size_t)(slab->end - slab->current) < size)
+    {
+        uint8_t* chunk = TeslaSlab_AllocateChunk(TESLA_SLAB_SIZE);
+        if (chunk == NULL)
+            return NULL;
+
+        slab->current = chunk;
+        slab->end = chunk + TESLA_SLAB_SIZE;
+    }
+
+    uint8_t* data = slab->current;
+    slab->current += size;
+
+    return data;
+}
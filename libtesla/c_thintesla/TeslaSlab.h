@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ThinTesla.h"
+
+#define TESLA_CACHE_LINE_SIZE 64
+
+// Size of the chunks a thread carves its allocations from.
+#define TESLA_SLAB_SIZE (64 * 1024)
+
+#define TeslaSlab_Align(SIZE) (((SIZE) + TESLA_CACHE_LINE_SIZE - 1) & ~(size_t)(TESLA_CACHE_LINE_SIZE - 1))
+
+/*
+ * Bump allocator for memory that lives as long as the program, such as
+ * automaton clones. Each thread owns its current slab, so allocations made by
+ * the same thread end up next to each other and never share a cache line with
+ * another thread's. Nothing is ever given back.
+ */
+typedef struct TeslaSlab
+{
+    uint8_t* current;
+    uint8_t* end;
+} TeslaSlab;
+
+EXTERN_C
+
+/* Returns size zeroed bytes aligned to a cache line, or NULL. */
+void* TeslaSlab_Allocate(size_t size);
+
+/* Same, from the given slab instead of the one of the calling thread. */
+void* TeslaSlab_AllocateFrom(TeslaSlab* slab, size_t size);
+
+EXTERN_C_END
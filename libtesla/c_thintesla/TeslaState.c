@@ -1,39 +1,39 @@
 #include "TeslaState.h"
 #include "TeslaAssert.h"
+#include "TeslaStats.h"
 
 #ifdef _KERNEL
 #include <sys/proc.h>
 #endif
 
-void TA_Reset(TeslaAutomaton* automaton)
+#ifndef _KERNEL
+__thread uint8_t teslaLiveAutomata[TESLA_MAX_AUTOMATA] __attribute__((tls_model("initial-exec")));
+#endif
+
+/*
+ * Instrumented code reads the live byte of a thread-local automaton before an
+ * event that cannot start it, and only calls into the runtime if it is set.
+ * It is set when the clone of the thread is initialized and cleared when it
+ * completes or is reset. A failed automaton stays live until its bound ends,
+ * which only costs calls that return early. Clones are only moved by their
+ * own thread, so the byte is always the one of the calling thread.
+ */
+void TA_SetLive(TeslaAutomaton* automaton, bool live)
 {
-    memset(&automaton->state, 0, sizeof(automaton->state));
+#ifndef _KERNEL
+    if (automaton->flags.isThreadLocal && automaton->id < TESLA_MAX_AUTOMATA)
+        teslaLiveAutomata[automaton->id] = live;
+#endif
+}
 
-    if (!automaton->flags.isDeterministic)
-    {
-        for (size_t i = 0; i < automaton->numEvents; ++i)
-        {
-            TeslaEvent* event = automaton->events[i];
-            TeslaEventState* state = &automaton->eventStates[i];
+void TA_Reset(TeslaAutomaton* automaton)
+{
+    // Event stores and the history are cleared lazily, by TA_ClearEventStates when the automaton is next initialized.
+    TESLA_STAT(automaton, resets);
 
-            if (event->flags.isDeterministic)
-            {
-                state->store = NULL;
-                continue;
-            }
+    memset(&automaton->state, 0, sizeof(automaton->state));
 
-            if (state->store != NULL)
-            {
-                //   printf("[Clear] Store for event %d: %p\n", event->id, event->state.store);
-                TeslaStore_Clear(state->store);
-                //   TeslaFree(event->state.store);
-                //   event->state.store = NULL;
-            }
-        }
-
-        if (automaton->history != NULL && automaton->history->valid)
-            TeslaHistory_Clear(automaton->history);
-    }
+    TA_SetLive(automaton, false);
 
     //printf("[%lu] Resetting automaton %p\n",  automaton->threadKey, automaton);
 
@@ -42,6 +42,35 @@ void TA_Reset(TeslaAutomaton* automaton)
     automaton->threadKey = INVALID_THREAD_KEY;
 }
 
+void TA_ClearEventStates(TeslaAutomaton* automaton)
+{
+    for (size_t i = 0; i < automaton->numEvents; ++i)
+    {
+        TeslaEvent* event = automaton->events[i];
+        TeslaEventState* state = &automaton->eventStates[i];
+
+        if (event->flags.isDeterministic)
+        {
+            state->store = NULL;
+            continue;
+        }
+
+        if (state->store != NULL)
+        {
+            //   printf("[Clear] Store for event %d: %p\n", event->id, event->state.store);
+#ifndef _KERNEL
+            TeslaStore_Release(state->store);
+            state->store = NULL;
+#else
+            TeslaStore_Clear(state->store); // Kernel memory is not given back, so the store stays with the automaton.
+#endif
+        }
+    }
+
+    if (automaton->history != NULL && automaton->history->valid)
+        TeslaHistory_Clear(automaton->history);
+}
+
 void TA_InitCommon(TeslaAutomaton* automaton)
 {
     assert(automaton != NULL);
@@ -52,6 +81,8 @@ void TA_InitCommon(TeslaAutomaton* automaton)
     automaton->state.isActive = true;
     automaton->state.isInit = true;
 
+    TA_SetLive(automaton, true);
+
     // Beginning of time.
     automaton->state.currentTemporalTag = 1;
 
@@ -65,49 +96,33 @@ void TA_InitCommon(TeslaAutomaton* automaton)
 #endif
 }
 
-void TA_Init(TeslaAutomaton* automaton)
+/*
+ * A bound that was not sampled: the automaton is initialized but inactive,
+ * like one that has already completed, so every other event of the bound
+ * returns at RETURN_IF_DISABLED and the end of the bound only resets it.
+ */
+void TA_InitUntracked(TeslaAutomaton* automaton)
 {
-    TA_InitCommon(automaton);
-
-    if (!automaton->flags.isDeterministic)
-    {
-        bool allCorrect = true;
-
-        for (size_t i = 0; i < automaton->numEvents; ++i)
-        {
-            TeslaEvent* event = automaton->events[i];
-            TeslaEventState* state = &automaton->eventStates[i];
-
-            if (event->flags.isDeterministic)
-                continue;
+    assert(automaton != NULL);
 
-            size_t dataSize = event->matchDataSize * sizeof(size_t);
+    automaton->state.currentEvent = automaton->events[0];
+    automaton->state.lastEvent = automaton->state.currentEvent;
+    automaton->state.isActive = false;
+    automaton->state.isInit = true;
+    automaton->state.isCorrect = true;
 
-            // Try to allocate space for the store data structure.
-            if (state->store == NULL)
-            {
-                state->store = TeslaMalloc(sizeof(TeslaStore));
-                if (state->store == NULL)
-                {
-                    allCorrect = false;
-                }
-                else
-                    state->store->type = TESLA_STORE_INVALID;
-            }
+#ifdef _KERNEL
+    automaton->state.initTag = curthread->automata->initTag;
+#endif
+}
 
-            // Try to construct the store.
-            if (state->store != NULL && state->store->type == TESLA_STORE_INVALID)
-            {
-                if (!TeslaStore_Create(TESLA_STORE_HT, 10, dataSize, state->store))
-                {
-                    state->store->type = TESLA_STORE_INVALID;
-                    allCorrect = false;
-                }
-            }
-        }
+void TA_Init(TeslaAutomaton* automaton)
+{
+    TA_InitCommon(automaton);
 
-        automaton->state.isCorrect = allCorrect;
-    }
+    // Stores are only taken when their event first happens in the bound, see TA_GetStore.
+    if (!automaton->flags.isDeterministic)
+        TA_ClearEventStates(automaton);
 
     /*  if (!automaton->state.isCorrect)
     {
@@ -115,6 +130,25 @@ void TA_Init(TeslaAutomaton* automaton)
     } */
 }
 
+/*
+ * Gives the store of a parametric event, taking one of the kind the
+ * instrumenter picked for the event on its first insert. If none can be
+ * allocated, the automaton may give a wrong answer at the end of the bound.
+ */
+TeslaStore* TA_GetStore(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    TeslaEventState* state = &automaton->eventStates[event->id];
+    if (state->store != NULL)
+        return state->store;
+
+    StoreType type = event->storeKind != TESLA_STORE_INVALID ? (StoreType)event->storeKind : TESLA_DEFAULT_STORE;
+    state->store = TeslaStore_Acquire(type, type == TESLA_STORE_SINGLE ? 1 : 16, GetEventMatchSize(event));
+    if (state->store == NULL)
+        automaton->state.isCorrect = false;
+
+    return state->store;
+}
+
 void TA_InitLinearHistory(TeslaAutomaton* automaton)
 {
     TA_InitCommon(automaton);
@@ -122,6 +156,9 @@ void TA_InitLinearHistory(TeslaAutomaton* automaton)
     if (!automaton->flags.isDeterministic)
     {
         bool allCorrect = true;
+
+        TA_ClearEventStates(automaton);
+
         if (automaton->history == NULL)
         {
             automaton->history = TeslaMalloc(sizeof(TeslaHistory));
@@ -135,7 +172,7 @@ void TA_InitLinearHistory(TeslaAutomaton* automaton)
 
         if (automaton->history != NULL && !automaton->history->valid)
         {
-            if (!TeslaHistory_Create(automaton->history))
+            if (!TeslaHistory_Create(automaton->history, automaton->numEvents))
             {
                 allCorrect = false;
                 automaton->history->valid = false;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "TeslaHistory.h"
+#include "TeslaSlab.h"
 #include "TeslaStore.h"
 #include "TeslaTypes.h"
 #include "ThinTesla.h"
@@ -42,15 +43,38 @@ typedef struct TeslaEvent
     size_t numSuccessors;
     size_t id;
     uint8_t matchDataSize;
+    uint8_t hashKernel; // TeslaHashKernel for matchDataSize, see TeslaHash_SelectKernel.
+    uint8_t storeKind;  // StoreType of the store for the match data, TESLA_STORE_INVALID for TESLA_DEFAULT_STORE.
+
+    // Bit i is set if the event with id i is a successor. Successors are sorted by id.
+    const uint64_t* successorMask;
+
+    // Only set for automata run by the shift-and engine, see UpdateAutomatonShiftAnd.
+    uint64_t predecessorMask; // Bit i is set if this event is a successor of the event with id i.
+    uint64_t orBlockMask;     // Later events of the same OR block.
 } TeslaEvent;
 
 #define GetEventMatchSize(eventToGetSizeFrom) (eventToGetSizeFrom->matchDataSize * sizeof(size_t))
+#define GetEventHash(eventToHash, data) TeslaHash_Run(eventToHash->hashKernel, data, GetEventMatchSize(eventToHash))
+
+// The shift-and engine keeps the state of an automaton in a single word.
+#define TESLA_SHIFT_AND_MAX_EVENTS 64
+
+// Number of words in the successor mask of an event, for an automaton of numEvents events.
+#define TESLA_SUCCESSOR_MASK_WORDS(numEvents) (((numEvents) + 63) / 64)
+
+// Successors always come later in the automaton, so the mask is only read for higher ids.
+#define IsSuccessor(event, successor) \
+    ((successor)->id > (event)->id && (((event)->successorMask[(successor)->id / 64] >> ((successor)->id % 64)) & 1))
 
 typedef struct TeslaAutomatonFlags
 {
     uint8_t isDeterministic : 1;
     uint8_t isThreadLocal : 1;
     uint8_t isLinked : 1;
+    uint8_t isShiftAnd : 1; // Deterministic, at most TESLA_SHIFT_AND_MAX_EVENTS events, see UpdateAutomatonShiftAnd.
+    uint8_t isSampleRateResolved : 1; // TESLA_SAMPLE_RATE has been applied to sampleRate, see SampleBound.
+    uint8_t isConcurrent : 1;         // Global, updated from several threads, see UpdateAutomatonConcurrent.
 } TeslaAutomatonFlags;
 
 typedef struct TeslaAutomatonState
@@ -67,32 +91,60 @@ typedef struct TeslaAutomatonState
     size_t initTag;
 } TeslaAutomatonState;
 
+/*
+ * The description of an automaton comes first and is shared by every clone,
+ * then the chain that other threads walk and append to in ForkAutomaton. Both
+ * are only read on the path of an update. The state starts on a cache line of
+ * its own, and the automaton is a whole number of lines, so updates to one
+ * automaton never invalidate the description of another one next to it in an
+ * array of globals or of kernel thread automata.
+ */
 typedef struct TeslaAutomaton
 {
     TeslaEvent** events;
     TeslaAutomatonFlags flags;
     size_t numEvents;
     char* name;
-
-    TeslaAutomatonState state;
     TeslaEventState* eventStates;
     TeslaHistory* history;
+    size_t numTotalAutomata;
+    size_t id;
 
     TeslaThreadKey threadKey;
     struct TeslaAutomaton* next;
+    size_t sampleRate; // One temporal bound in sampleRate is checked. 0 and 1 check every bound.
 
-    size_t numTotalAutomata;
-    size_t id;
+    TeslaAutomatonState state __attribute__((aligned(TESLA_CACHE_LINE_SIZE)));
+    size_t lock; // Only used by concurrent automata, see TeslaAutomaton_Lock.
 } TeslaAutomaton;
 
-_Static_assert(sizeof(TeslaAutomaton) == 144, "Invalid size");
-_Static_assert(offsetof(TeslaAutomaton, numEvents) == 16, "Invalid size");
-_Static_assert(offsetof(TeslaAutomaton, next) == 120, "Invalid size");
+#ifndef TESLA_PACK_STRUCTS
+_Static_assert(offsetof(TeslaAutomaton, state) % TESLA_CACHE_LINE_SIZE == 0, "State must start a cache line");
+_Static_assert(offsetof(TeslaAutomatonState, failReason) < TESLA_CACHE_LINE_SIZE, "State fields of an update span cache lines");
+_Static_assert(sizeof(TeslaAutomaton) % TESLA_CACHE_LINE_SIZE == 0, "Automata in an array share cache lines");
+#endif
+
+// Automata with an id below this have a live byte (see TA_SetLive), sampling counters,
+// statistics and profiles that outlive their threads, failure counts, and a name in
+// traces. Automata above it still work, without these.
+#define TESLA_MAX_AUTOMATA 1024
+
+EXTERN_C
+
+#ifndef _KERNEL
+extern __thread uint8_t teslaLiveAutomata[TESLA_MAX_AUTOMATA] __attribute__((tls_model("initial-exec")));
+#endif
 
 void TA_Reset(TeslaAutomaton* automaton);
+void TA_ClearEventStates(TeslaAutomaton* automaton);
 void TA_InitCommon(TeslaAutomaton* automaton);
 void TA_Init(TeslaAutomaton* automaton);
 void TA_InitLinearHistory(TeslaAutomaton* automaton);
+void TA_InitUntracked(TeslaAutomaton* automaton);
+TeslaStore* TA_GetStore(TeslaAutomaton* automaton, TeslaEvent* event);
+void TA_SetLive(TeslaAutomaton* automaton, bool live);
+
+EXTERN_C_END
 
 #ifdef TESLA_PACK_STRUCTS
 #pragma options align = reset
@@ -0,0 +1,251 @@
+#include "TeslaStats.h"
+#include "TeslaMalloc.h"
+
+#ifdef TESLA_STATS
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+__thread TeslaThreadStats* teslaThreadStats __attribute__((tls_model("initial-exec")));
+
+// Blocks of the running threads. Blocks are only written by their thread, and only linked, unlinked and read under the lock.
+static TeslaThreadStats* threadStatsList = NULL;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Counters of the threads that have exited, and the names of the automata for TeslaDumpStats.
+static TeslaStats retiredStats[TESLA_MAX_AUTOMATA];
+static char* statsNames[TESLA_MAX_AUTOMATA];
+
+// Counted into when no block can be allocated.
+static __thread TeslaStats discardedStats;
+
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t statsKey;
+
+// The SIGUSR2 handler writes a byte here, and a thread of its own does the dump.
+static int dumpPipe[2] = {-1, -1};
+
+static void TeslaStats_Add(TeslaStats* total, const TeslaStats* stats)
+{
+    total->events += stats->events;
+    total->transitions += stats->transitions;
+    total->retries += stats->retries;
+    total->lateInits += stats->lateInits;
+    total->resets += stats->resets;
+    total->storeInserts += stats->storeInserts;
+    total->storeResizes += stats->storeResizes;
+    total->failures += stats->failures;
+
+    if (total->historyHighWater < stats->historyHighWater)
+        total->historyHighWater = stats->historyHighWater;
+}
+
+/* Called with the lock held. */
+static void TeslaStats_Unlink(TeslaThreadStats* stats)
+{
+    for (TeslaThreadStats** it = &threadStatsList; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == stats)
+        {
+            *it = stats->next;
+            return;
+        }
+    }
+}
+
+static void TeslaStats_ThreadExit(void* data)
+{
+    TeslaThreadStats* stats = (TeslaThreadStats*)data;
+
+    pthread_mutex_lock(&statsLock);
+    TeslaStats_Unlink(stats);
+    for (size_t i = 0; i < stats->numAutomata && i < TESLA_MAX_AUTOMATA; ++i)
+        TeslaStats_Add(&retiredStats[i], &stats->counters[i]);
+    pthread_mutex_unlock(&statsLock);
+
+    teslaThreadStats = NULL;
+    TeslaFree(stats);
+}
+
+static void TeslaStats_DumpAtExit(void)
+{
+    TeslaDumpStats(STDERR_FILENO);
+}
+
+/* Only write is async-signal-safe here, the pipe being full means a dump is already on its way. */
+static void TeslaStats_DumpOnSignal(int signal)
+{
+    (void)signal;
+
+    int savedErrno = errno;
+    char request = 0;
+    ssize_t written = write(dumpPipe[1], &request, 1);
+    (void)written;
+    errno = savedErrno;
+}
+
+static void* TeslaStats_DumpThread(void* data)
+{
+    (void)data;
+
+    for (;;)
+    {
+        char request;
+        ssize_t length = read(dumpPipe[0], &request, 1);
+
+        if (length > 0)
+            TeslaDumpStats(STDERR_FILENO);
+        else if (length == 0 || errno != EINTR)
+            return NULL;
+    }
+}
+
+static bool TeslaStats_StartDumpThread(void)
+{
+    if (pipe(dumpPipe) != 0)
+        return false;
+
+    fcntl(dumpPipe[1], F_SETFL, O_NONBLOCK);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, TeslaStats_DumpThread, NULL) != 0)
+    {
+        close(dumpPipe[0]);
+        close(dumpPipe[1]);
+        return false;
+    }
+
+    pthread_detach(thread);
+    return true;
+}
+
+static void TeslaStats_Init(void)
+{
+    pthread_key_create(&statsKey, TeslaStats_ThreadExit);
+
+    if (getenv("TESLA_STATS") != NULL)
+    {
+        atexit(TeslaStats_DumpAtExit);
+
+        if (TeslaStats_StartDumpThread())
+            signal(SIGUSR2, TeslaStats_DumpOnSignal);
+    }
+}
+
+/*
+ * Allocates the block of the thread, or grows it if the automaton comes from a
+ * module that has more automata than the ones seen so far.
+ */
+TeslaStats* TeslaStats_GetSlow(TeslaAutomaton* automaton)
+{
+    pthread_once(&statsOnce, TeslaStats_Init);
+
+    TeslaThreadStats* old = teslaThreadStats;
+    size_t numAutomata = automaton->numTotalAutomata > automaton->id ? automaton->numTotalAutomata : automaton->id + 1;
+
+    TeslaThreadStats* stats = (TeslaThreadStats*)TeslaMallocZero(sizeof(TeslaThreadStats) + numAutomata * sizeof(TeslaStats));
+    if (stats == NULL)
+        return &discardedStats;
+
+    stats->numAutomata = numAutomata;
+
+    pthread_mutex_lock(&statsLock);
+    if (old != NULL)
+    {
+        memcpy(stats->counters, old->counters, old->numAutomata * sizeof(TeslaStats));
+        TeslaStats_Unlink(old);
+    }
+    stats->next = threadStatsList;
+    threadStatsList = stats;
+    pthread_mutex_unlock(&statsLock);
+
+    TeslaFree(old);
+    teslaThreadStats = stats;
+    pthread_setspecific(statsKey, stats);
+
+    return &stats->counters[automaton->id];
+}
+
+/* The name is copied, since the dump may run at exit, after the automaton is gone. */
+void TeslaStats_StartBound(TeslaAutomaton* base)
+{
+    if (base->id < TESLA_MAX_AUTOMATA && __atomic_load_n(&statsNames[base->id], __ATOMIC_RELAXED) == NULL)
+    {
+        size_t length = strlen(base->name) + 1;
+        char* name = (char*)TeslaMalloc(length);
+        memcpy(name, base->name, length);
+
+        char* expected = NULL;
+        if (!__atomic_compare_exchange_n(&statsNames[base->id], &expected, name, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            TeslaFree(name);
+    }
+
+    TESLA_STAT(base, lateInits);
+}
+
+/* Called with the lock held. */
+static void TeslaStats_Sum(size_t id, TeslaStats* stats)
+{
+    memcpy(stats, &retiredStats[id], sizeof(TeslaStats));
+    for (TeslaThreadStats* it = threadStatsList; it != NULL; it = it->next)
+    {
+        if (id < it->numAutomata)
+            TeslaStats_Add(stats, &it->counters[id]);
+    }
+}
+#endif
+
+bool TeslaGetStats(TeslaAutomaton* base, TeslaStats* stats)
+{
+#ifdef TESLA_STATS
+    if (base->id >= TESLA_MAX_AUTOMATA)
+        return false;
+
+    pthread_mutex_lock(&statsLock);
+    TeslaStats_Sum(base->id, stats);
+    pthread_mutex_unlock(&statsLock);
+    return true;
+#else
+    (void)base;
+    (void)stats;
+    return false;
+#endif
+}
+
+/* Runs at exit, or in the dump thread after a SIGUSR2, never in the handler itself. */
+void TeslaDumpStats(int fd)
+{
+#ifdef TESLA_STATS
+    char line[512];
+    int length;
+
+    pthread_mutex_lock(&statsLock);
+
+    length = snprintf(line, sizeof(line), "[TESLA] automaton\tevents\ttransitions\tretries\tlate inits\tresets\tstore inserts\tstore resizes\thistory max\tfailures\n");
+    write(fd, line, length);
+
+    for (size_t id = 0; id < TESLA_MAX_AUTOMATA; ++id)
+    {
+        char* name = __atomic_load_n(&statsNames[id], __ATOMIC_ACQUIRE);
+        if (name == NULL)
+            continue;
+
+        TeslaStats stats;
+        TeslaStats_Sum(id, &stats);
+
+        length = snprintf(line, sizeof(line), "[TESLA] %s\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\n", name, stats.events,
+                          stats.transitions, stats.retries, stats.lateInits, stats.resets, stats.storeInserts, stats.storeResizes,
+                          stats.historyHighWater, stats.failures);
+        if (length > 0)
+            write(fd, line, length < (int)sizeof(line) ? length : (int)sizeof(line) - 1);
+    }
+
+    pthread_mutex_unlock(&statsLock);
+#else
+    (void)fd;
+#endif
+}
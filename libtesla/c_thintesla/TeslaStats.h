@@ -0,0 +1,86 @@
+#pragma once
+
+#include "TeslaState.h"
+#include "ThinTesla.h"
+
+// Per-automaton counters. Build with TESLA_NO_STATS (cmake -DTHIN_TESLA_STATS=OFF) to compile them away.
+#if !defined(_KERNEL) && !defined(TESLA_NO_STATS)
+#define TESLA_STATS
+#endif
+
+/*
+ * Counters of one automaton. Every thread counts into its own block, so that
+ * counting is a plain increment, and the blocks are only added up when they
+ * are read. Clones count into the block of their base automaton.
+ */
+typedef struct TeslaStats
+{
+    size_t events;           // Events that reached an active automaton.
+    size_t transitions;      // Events that moved it, or kept it in an OR block. Not counted with specialized codegen.
+    size_t retries;          // Events that sent it back to the first event to try again.
+    size_t lateInits;        // Temporal bounds started, checked or not.
+    size_t resets;           // Calls to TA_Reset.
+    size_t storeInserts;     // Match data recorded, in the event stores or the history.
+    size_t storeResizes;     // Event stores that grew while recording match data.
+    size_t historyHighWater; // Most observations recorded in a history between two clears.
+    size_t failures;         // Violations detected, reported when the bound ends.
+} TeslaStats;
+
+#ifdef TESLA_STATS
+typedef struct TeslaThreadStats
+{
+    struct TeslaThreadStats* next;
+    size_t numAutomata;
+    TeslaStats counters[];
+} TeslaThreadStats;
+
+EXTERN_C
+
+extern __thread TeslaThreadStats* teslaThreadStats __attribute__((tls_model("initial-exec")));
+
+TeslaStats* TeslaStats_GetSlow(TeslaAutomaton* automaton);
+void TeslaStats_StartBound(TeslaAutomaton* base);
+
+EXTERN_C_END
+
+static inline TeslaStats* TeslaStats_Get(TeslaAutomaton* automaton)
+{
+    TeslaThreadStats* stats = teslaThreadStats;
+    if (__builtin_expect(stats != NULL && automaton->id < stats->numAutomata, 1))
+        return &stats->counters[automaton->id];
+
+    return TeslaStats_GetSlow(automaton);
+}
+
+#define TESLA_STAT_ADD(automaton, counter, value) (TeslaStats_Get(automaton)->counter += (value))
+#define TESLA_STAT_MAX(automaton, counter, value)            \
+    do                                                       \
+    {                                                        \
+        TeslaStats* teslaStats = TeslaStats_Get(automaton);  \
+        if (teslaStats->counter < (size_t)(value))           \
+            teslaStats->counter = (value);                   \
+    } while (0)
+#else
+#define TESLA_STAT_ADD(automaton, counter, value) ((void)0)
+#define TESLA_STAT_MAX(automaton, counter, value) ((void)0)
+#endif
+
+#define TESLA_STAT(automaton, counter) TESLA_STAT_ADD(automaton, counter, 1)
+
+EXTERN_C
+
+/*
+ * Adds up the counters of base from every thread, including threads that have
+ * exited. Returns false if the counters are compiled out or base is not one
+ * of the first TESLA_MAX_AUTOMATA automata.
+ */
+bool TeslaGetStats(TeslaAutomaton* base, TeslaStats* stats);
+
+/*
+ * Writes the counters of every automaton that has seen an event to fd, one
+ * line each. Set TESLA_STATS in the environment to have them written to
+ * stderr at exit and whenever the process receives SIGUSR2.
+ */
+void TeslaDumpStats(int fd);
+
+EXTERN_C_END
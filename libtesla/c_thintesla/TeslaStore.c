@@ -1,4 +1,58 @@
 #include "TeslaStore.h"
+#include "TeslaTag.h"
+
+#ifndef _KERNEL
+#include <pthread.h>
+
+// One free list for each type of store and size of match data in words, TESLA_STORE_INVALID has none.
+#define TESLA_STORE_POOL_CLASSES (TESLA_STORE_SWISS * (TESLA_STORE_POOL_MAX_WORDS + 1))
+
+typedef struct TeslaStorePool
+{
+    TeslaStore* free[TESLA_STORE_POOL_CLASSES];
+    bool registered; // The pool is freed by TeslaStore_ThreadExit.
+} TeslaStorePool;
+
+static __thread TeslaStorePool storePool __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t poolKey;
+
+static void TeslaStore_ThreadExit(void* data)
+{
+    TeslaStorePool* pool = (TeslaStorePool*)data;
+
+    for (size_t i = 0; i < TESLA_STORE_POOL_CLASSES; ++i)
+    {
+        while (pool->free[i] != NULL)
+        {
+            TeslaStore* store = pool->free[i];
+            pool->free[i] = store->next;
+            TeslaStore_Destroy(store);
+            TeslaFree(store);
+        }
+    }
+
+    // A store released by a later destructor registers the pool again.
+    pool->registered = false;
+}
+
+static void TeslaStore_InitPool(void)
+{
+    pthread_key_create(&poolKey, TeslaStore_ThreadExit);
+}
+
+/* Returns TESLA_STORE_POOL_CLASSES for stores that are not kept. */
+static size_t TeslaStore_PoolClass(StoreType type, size_t dataSize)
+{
+    size_t words = dataSize / sizeof(size_t);
+
+    if (type == TESLA_STORE_INVALID || dataSize % sizeof(size_t) != 0 || words > TESLA_STORE_POOL_MAX_WORDS)
+        return TESLA_STORE_POOL_CLASSES;
+
+    return (type - 1) * (TESLA_STORE_POOL_MAX_WORDS + 1) + words;
+}
+#endif
 
 bool TeslaStore_Create(StoreType type, size_t initialCapacity, size_t dataSize, TeslaStore* store)
 {
@@ -9,17 +63,17 @@ bool TeslaStore_Create(StoreType type, size_t initialCapacity, size_t dataSize,
     {
         return TeslaHT_Create(initialCapacity, dataSize, &store->store.hashtable);
     }
+    else if (type == TESLA_STORE_SWISS)
+    {
+        return TeslaSwiss_Create(initialCapacity, dataSize, &store->store.swiss);
+    }
     else if (type == TESLA_STORE_SINGLE)
     {
-        assert(initialCapacity == 1);
-
-        uint8_t* data = TeslaMalloc(dataSize + sizeof(TeslaTemporalTag));
-        if (data == NULL)
-            return false;
-
-        memset(data, 0, dataSize + sizeof(TeslaTemporalTag));
+        if (dataSize > sizeof(store->store.single.data))
+            return TeslaStore_Create(TESLA_DEFAULT_STORE, initialCapacity, dataSize, store);
 
-        store->store.data = data;
+        memset(&store->store.single, 0, sizeof(TeslaSingleStore));
+        return true;
     }
 
     assert(false && "StoreType value not defined");
@@ -32,9 +86,9 @@ void TeslaStore_Destroy(TeslaStore* store)
     {
         TeslaHT_Destroy(&store->store.hashtable);
     }
-    else if (store->type == TESLA_STORE_SINGLE)
+    else if (store->type == TESLA_STORE_SWISS)
     {
-        TeslaFree(store->store.data);
+        TeslaSwiss_Destroy(&store->store.swiss);
     }
 
     store->type = TESLA_STORE_INVALID;
@@ -46,10 +100,85 @@ void TeslaStore_Clear(TeslaStore* store)
     {
         TeslaHT_Clear(&store->store.hashtable);
     }
+    else if (store->type == TESLA_STORE_SWISS)
+    {
+        TeslaSwiss_Clear(&store->store.swiss);
+    }
     else if (store->type == TESLA_STORE_SINGLE)
     {
-        memset(store->store.data, 0, store->dataSize);
+        store->store.single.tag = 0;
+    }
+}
+
+TeslaStore* TeslaStore_Acquire(StoreType type, size_t initialCapacity, size_t dataSize)
+{
+#ifndef _KERNEL
+    size_t poolClass = TeslaStore_PoolClass(type, dataSize);
+    if (poolClass < TESLA_STORE_POOL_CLASSES && storePool.free[poolClass] != NULL)
+    {
+        TeslaStore* store = storePool.free[poolClass];
+        storePool.free[poolClass] = store->next;
+        store->next = NULL;
+        return store;
+    }
+#endif
+
+    TeslaStore* store = TeslaMalloc(sizeof(TeslaStore));
+    if (store == NULL)
+        return NULL;
+
+    if (!TeslaStore_Create(type, initialCapacity, dataSize, store))
+    {
+        TeslaFree(store);
+        return NULL;
+    }
+
+    store->next = NULL;
+    return store;
+}
+
+void TeslaStore_Release(TeslaStore* store)
+{
+#ifndef _KERNEL
+    // Keyed by the type the store ended up with, a single store for large data is a TESLA_DEFAULT_STORE.
+    size_t poolClass = TeslaStore_PoolClass(store->type, store->dataSize);
+    if (poolClass < TESLA_STORE_POOL_CLASSES)
+    {
+        if (!storePool.registered)
+        {
+            pthread_once(&poolOnce, TeslaStore_InitPool);
+            storePool.registered = pthread_setspecific(poolKey, &storePool) == 0;
+        }
+
+        TeslaStore_Clear(store);
+        store->next = storePool.free[poolClass];
+        storePool.free[poolClass] = store;
+        return;
     }
+#endif
+
+    TeslaStore_Destroy(store);
+    TeslaFree(store);
+}
+
+/*
+ * The instrumenter only picks TESLA_STORE_SINGLE for events that the static
+ * optimizer found to happen at most once per bound of their automaton, but a
+ * second value can still come, e.g. from a call the call graph did not see.
+ * The store then becomes a TESLA_DEFAULT_STORE in place, with both values.
+ */
+static bool TeslaStore_InsertSecond(TeslaStore* store, TeslaTemporalTag tag, void* data)
+{
+    TeslaSingleStore first = store->store.single;
+
+    if (!TeslaStore_Create(TESLA_DEFAULT_STORE, 16, store->dataSize, store))
+    {
+        store->type = TESLA_STORE_SINGLE;
+        store->store.single = first;
+        return false;
+    }
+
+    return TeslaStore_Insert(store, first.tag, first.data) && TeslaStore_Insert(store, tag, data);
 }
 
 bool TeslaStore_Insert(TeslaStore* store, TeslaTemporalTag tag, void* data)
@@ -58,24 +187,23 @@ bool TeslaStore_Insert(TeslaStore* store, TeslaTemporalTag tag, void* data)
     {
         return TeslaHT_Insert(&store->store.hashtable, tag, data);
     }
+    else if (store->type == TESLA_STORE_SWISS)
+    {
+        return TeslaSwiss_Insert(&store->store.swiss, tag, data);
+    }
     else if (store->type == TESLA_STORE_SINGLE)
     {
-        TeslaTemporalTag* storeTag = (TeslaTemporalTag*)(store->store.data + store->dataSize);
-        if (*storeTag == 0)
+        TeslaSingleStore* single = &store->store.single;
+        if (single->tag == 0)
         {
-            memcpy(store->store.data, data, store->dataSize);
-            *storeTag |= tag;
+            memcpy(single->data, data, store->dataSize);
         }
-        else
+        else if (memcmp(data, single->data, store->dataSize) != 0)
         {
-            size_t cmp = memcmp(data, store->store.data, store->dataSize);
-            if (cmp != 0)
-            {
-                assert(false && "Multiple values inserted");
-            }
-            *storeTag |= tag;
+            return TeslaStore_InsertSecond(store, tag, data);
         }
 
+        single->tag = TeslaTag_Merge(single->tag, tag);
         return true;
     }
 
@@ -87,16 +215,39 @@ bool TeslaStore_Insert(TeslaStore* store, TeslaTemporalTag tag, void* data)
 
 TeslaTemporalTag TeslaStore_Get(TeslaStore* store, void* data)
 {
+    // Stores are created on the first insert, an event without one has not happened.
+    if (store == NULL)
+        return 0;
+
     if (store->type == TESLA_STORE_HT)
     {
         return TeslaHT_LookupTag(&store->store.hashtable, data);
     }
+    else if (store->type == TESLA_STORE_SWISS)
+    {
+        return TeslaSwiss_LookupTag(&store->store.swiss, data);
+    }
     else if (store->type == TESLA_STORE_SINGLE)
     {
-        TeslaTemporalTag* storeTag = (TeslaTemporalTag*)(store->store.data + store->dataSize);
-        return *storeTag;
+        TeslaSingleStore* single = &store->store.single;
+        if (single->tag != 0 && memcmp(data, single->data, store->dataSize) == 0)
+            return single->tag;
+
+        return 0;
     }
 
     assert(false);
     return 0;
+}
+
+size_t TeslaStore_GetCapacity(TeslaStore* store)
+{
+    if (store->type == TESLA_STORE_HT)
+        return store->store.hashtable.capacity;
+    else if (store->type == TESLA_STORE_SWISS)
+        return store->store.swiss.capacity;
+    else if (store->type == TESLA_STORE_SINGLE)
+        return 1;
+
+    return 0;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "TeslaHashTable.h"
+#include "TeslaSwissTable.h"
 #include "TeslaTypes.h"
 #include "TeslaMalloc.h"
 
@@ -8,17 +9,40 @@ typedef enum
 {
     TESLA_STORE_INVALID,
     TESLA_STORE_HT,
-    TESLA_STORE_SINGLE
+    TESLA_STORE_SINGLE,
+    TESLA_STORE_SWISS
 } StoreType;
 
+// Store used for the events of non-deterministic automata.
+#define TESLA_DEFAULT_STORE TESLA_STORE_SWISS
+
+// Match data of at most this many words fits in a TESLA_STORE_SINGLE store, bigger data gets TESLA_DEFAULT_STORE.
+#define TESLA_STORE_SINGLE_MAX_WORDS 8
+
+// Released stores with at most this many words of match data are kept for reuse, bigger ones are freed.
+#define TESLA_STORE_POOL_MAX_WORDS 8
+
+/*
+ * For events that happen at most once per temporal bound: the one value and
+ * its tag are kept inside the TeslaStore, so they are neither hashed nor
+ * allocated.
+ */
+typedef struct TeslaSingleStore
+{
+    TeslaTemporalTag tag; // 0 until a value is inserted.
+    size_t data[TESLA_STORE_SINGLE_MAX_WORDS];
+} TeslaSingleStore;
+
 typedef struct TeslaStore
 {
     StoreType type;
     size_t dataSize;
+    struct TeslaStore* next; // While the store waits in the pool of a thread, see TeslaStore_Release.
 
     union store {
-        struct TeslaHashTable hashtable;
-        uint8_t* data;
+        TeslaHT hashtable;
+        TeslaSwissTable swiss;
+        TeslaSingleStore single;
     } store;
 } TeslaStore;
 
@@ -26,5 +50,15 @@ bool TeslaStore_Create(StoreType type, size_t initialCapacity, size_t dataSize,
 void TeslaStore_Destroy(TeslaStore* store);
 void TeslaStore_Clear(TeslaStore* store);
 
+/*
+ * The store of a parametric event is only taken once the event has something
+ * to insert. TeslaStore_Acquire gives an empty store from the pool of the
+ * calling thread, or creates one, and TeslaStore_Release clears a store and
+ * puts it back. Stores left in the pool are freed when their thread exits.
+ */
+TeslaStore* TeslaStore_Acquire(StoreType type, size_t initialCapacity, size_t dataSize);
+void TeslaStore_Release(TeslaStore* store);
+
 bool TeslaStore_Insert(TeslaStore* store, TeslaTemporalTag tag, void* data);
 TeslaTemporalTag TeslaStore_Get(TeslaStore* store, void* data);
+size_t TeslaStore_GetCapacity(TeslaStore* store);
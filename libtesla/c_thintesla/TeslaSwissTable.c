@@ -0,0 +1,228 @@
+#include "TeslaSwissTable.h"
+#include "TeslaMalloc.h"
+#include "TeslaTag.h"
+#include "TeslaUtils.h"
+
+#ifndef _KERNEL
+#include <string.h>
+#endif
+
+#if defined(__SSE2__) && !defined(_KERNEL)
+#include <emmintrin.h>
+#define TESLA_SWISS_SIMD
+#endif
+
+_Static_assert(TESLA_SWISS_GROUP_SIZE == 16, "Control groups must fit in a SSE2 register");
+
+#define H2_MASK 0x7F
+
+/* Returns a bitmask of the control bytes in the group that are equal to value. */
+static inline uint32_t TeslaSwiss_MatchGroup(const int8_t* group, int8_t value)
+{
+#ifdef TESLA_SWISS_SIMD
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < TESLA_SWISS_GROUP_SIZE; ++i)
+    {
+        if (group[i] == value)
+            mask |= (uint32_t)1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint64_t TeslaSwiss_Hash(TeslaSwissTable* table, void* data)
+{
+    return TeslaHash_Run(table->hashKernel, data, table->dataSize);
+}
+
+static inline uint8_t* TeslaSwiss_GetKey(TeslaSwissTable* table, size_t slot)
+{
+    return table->keys + table->dataSize * slot;
+}
+
+static size_t TeslaSwiss_GetTableSize(size_t capacity, size_t dataSize)
+{
+    return capacity * (sizeof(int8_t) + sizeof(TeslaTemporalTag) + dataSize) +
+           capacity / TESLA_SWISS_GROUP_SIZE * sizeof(uint32_t);
+}
+
+static inline bool TeslaSwiss_IsGroupCurrent(TeslaSwissTable* table, size_t group)
+{
+    return table->groupGenerations[group] == table->generation;
+}
+
+static TeslaTemporalTag* TeslaSwiss_Find(TeslaSwissTable* table, void* data, uint64_t hash)
+{
+    int8_t h2 = (int8_t)(hash & H2_MASK);
+
+    size_t groupMask = table->capacity / TESLA_SWISS_GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t step = 1;; ++step)
+    {
+        // A group left over from before the last clear is empty, which ends the probe sequence.
+        if (!TeslaSwiss_IsGroupCurrent(table, group))
+            return NULL;
+
+        const int8_t* control = table->control + group * TESLA_SWISS_GROUP_SIZE;
+
+        uint32_t match = TeslaSwiss_MatchGroup(control, h2);
+        while (match != 0)
+        {
+            size_t slot = group * TESLA_SWISS_GROUP_SIZE + __builtin_ctz(match);
+            if (memcmp(data, TeslaSwiss_GetKey(table, slot), table->dataSize) == 0)
+                return &table->tags[slot];
+
+            match &= match - 1;
+        }
+
+        // Nothing is ever removed, so an empty slot ends the probe sequence.
+        if (TeslaSwiss_MatchGroup(control, TESLA_SWISS_EMPTY) != 0)
+            return NULL;
+
+        group = (group + step) & groupMask;
+    }
+}
+
+/* Finds an empty slot for data, which must not be in the table already. */
+static size_t TeslaSwiss_FindEmptySlot(TeslaSwissTable* table, uint64_t hash)
+{
+    size_t groupMask = table->capacity / TESLA_SWISS_GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & groupMask;
+
+    for (size_t step = 1;; ++step)
+    {
+        if (!TeslaSwiss_IsGroupCurrent(table, group))
+        {
+            memset(table->control + group * TESLA_SWISS_GROUP_SIZE, TESLA_SWISS_EMPTY, TESLA_SWISS_GROUP_SIZE);
+            table->groupGenerations[group] = table->generation;
+        }
+
+        uint32_t empty = TeslaSwiss_MatchGroup(table->control + group * TESLA_SWISS_GROUP_SIZE, TESLA_SWISS_EMPTY);
+        if (empty != 0)
+            return group * TESLA_SWISS_GROUP_SIZE + __builtin_ctz(empty);
+
+        group = (group + step) & groupMask;
+    }
+}
+
+bool TeslaSwiss_Create(size_t initialCapacity, size_t dataSize, TeslaSwissTable* table)
+{
+    memset(table, 0, sizeof(TeslaSwissTable));
+
+    table->dataSize = dataSize;
+    table->hashKernel = TeslaHash_SelectKernel(dataSize / sizeof(size_t));
+    table->generation = 1;
+
+    size_t capacity = TESLA_SWISS_GROUP_SIZE;
+    while (capacity < initialCapacity)
+        capacity *= 2;
+
+    return TeslaSwiss_Resize(table, capacity);
+}
+
+void TeslaSwiss_Destroy(TeslaSwissTable* table)
+{
+    TeslaFree(table->control);
+    table->control = NULL;
+}
+
+void TeslaSwiss_Clear(TeslaSwissTable* table)
+{
+    table->size = 0;
+    table->generation++;
+
+    // Groups from the previous use of this generation could look current again.
+    if (table->generation == 0)
+    {
+        memset(table->groupGenerations, 0, table->capacity / TESLA_SWISS_GROUP_SIZE * sizeof(uint32_t));
+        table->generation = 1;
+    }
+}
+
+bool TeslaSwiss_Resize(TeslaSwissTable* table, size_t newCapacity)
+{
+    DEBUG_ASSERT(newCapacity > table->capacity);
+    DEBUG_ASSERT(IsPowerOfTwo(newCapacity) && newCapacity % TESLA_SWISS_GROUP_SIZE == 0);
+
+    uint8_t* block = TeslaMalloc(TeslaSwiss_GetTableSize(newCapacity, table->dataSize));
+    if (block == NULL)
+        return false;
+
+    TeslaSwissTable old = *table;
+
+    table->capacity = newCapacity;
+    table->control = (int8_t*)block;
+    table->tags = (TeslaTemporalTag*)(block + newCapacity);
+    table->keys = block + newCapacity * (sizeof(int8_t) + sizeof(TeslaTemporalTag));
+    table->groupGenerations = (uint32_t*)(table->keys + newCapacity * table->dataSize);
+
+    // Groups become current as they are first written to.
+    memset(table->groupGenerations, 0, newCapacity / TESLA_SWISS_GROUP_SIZE * sizeof(uint32_t));
+
+    for (size_t i = 0; i < old.capacity && old.size > 0; ++i)
+    {
+        if (!TeslaSwiss_IsGroupCurrent(&old, i / TESLA_SWISS_GROUP_SIZE) || old.control[i] == TESLA_SWISS_EMPTY)
+            continue;
+
+        uint8_t* key = TeslaSwiss_GetKey(&old, i);
+        uint64_t hash = TeslaSwiss_Hash(table, key);
+        size_t slot = TeslaSwiss_FindEmptySlot(table, hash);
+
+        table->control[slot] = (int8_t)(hash & H2_MASK);
+        table->tags[slot] = old.tags[i];
+        memcpy(TeslaSwiss_GetKey(table, slot), key, table->dataSize);
+    }
+
+    TeslaFree(old.control);
+
+    return true;
+}
+
+bool TeslaSwiss_Insert(TeslaSwissTable* table, TeslaTemporalTag tag, void* data)
+{
+    uint64_t hash = TeslaSwiss_Hash(table, data);
+
+    TeslaTemporalTag* existing = TeslaSwiss_Find(table, data, hash);
+    if (existing != NULL)
+    {
+        *existing = TeslaTag_Merge(*existing, tag);
+        return true;
+    }
+
+    // Keep the load factor under 7/8, so that every probe sequence ends on an empty slot.
+    if ((table->size + 1) * 8 > table->capacity * 7)
+    {
+        if (!TeslaSwiss_Resize(table, table->capacity * 2))
+            return false;
+    }
+
+    size_t slot = TeslaSwiss_FindEmptySlot(table, hash);
+
+    table->control[slot] = (int8_t)(hash & H2_MASK);
+    table->tags[slot] = tag;
+    memcpy(TeslaSwiss_GetKey(table, slot), data, table->dataSize);
+    table->size++;
+
+    return true;
+}
+
+TeslaTemporalTag TeslaSwiss_LookupTag(TeslaSwissTable* table, void* data)
+{
+    TeslaTemporalTag* tag = TeslaSwiss_LookupTagPtr(table, data);
+    if (tag != NULL)
+        return *tag;
+
+    return 0;
+}
+
+TeslaTemporalTag* TeslaSwiss_LookupTagPtr(TeslaSwissTable* table, void* data)
+{
+    if (table->size == 0)
+        return NULL;
+
+    return TeslaSwiss_Find(table, data, TeslaSwiss_Hash(table, data));
+}
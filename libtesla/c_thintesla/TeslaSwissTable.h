@@ -0,0 +1,48 @@
+#pragma once
+
+#include "TeslaHash.h"
+#include "TeslaTypes.h"
+#include "ThinTesla.h"
+
+/*
+ * Open addressing table in the style of Swiss tables: one control byte per slot,
+ * probed a group at a time, with tags and keys kept in separate arrays so that
+ * a probe only touches the key of a slot whose control byte already matched.
+ *
+ * Entries are never removed individually, so there are no tombstones. Every
+ * group records the generation it was last written in; clearing the table
+ * bumps the generation of the table, which turns every group back to empty.
+ */
+
+#define TESLA_SWISS_GROUP_SIZE 16
+#define TESLA_SWISS_EMPTY ((int8_t)-128)
+
+typedef struct TeslaSwissTable
+{
+    size_t dataSize;
+    uint8_t hashKernel;
+
+    size_t capacity; // Power of two, multiple of TESLA_SWISS_GROUP_SIZE.
+    size_t size;
+
+    int8_t* control;
+    TeslaTemporalTag* tags;
+    uint8_t* keys;
+
+    uint32_t* groupGenerations;
+    uint32_t generation;
+} TeslaSwissTable;
+
+EXTERN_C
+
+bool TeslaSwiss_Create(size_t initialCapacity, size_t dataSize, TeslaSwissTable* table);
+void TeslaSwiss_Destroy(TeslaSwissTable* table);
+void TeslaSwiss_Clear(TeslaSwissTable* table);
+
+bool TeslaSwiss_Insert(TeslaSwissTable* table, TeslaTemporalTag tag, void* data);
+TeslaTemporalTag TeslaSwiss_LookupTag(TeslaSwissTable* table, void* data);
+TeslaTemporalTag* TeslaSwiss_LookupTagPtr(TeslaSwissTable* table, void* data);
+
+bool TeslaSwiss_Resize(TeslaSwissTable* table, size_t newCapacity);
+
+EXTERN_C_END
@@ -0,0 +1,42 @@
+#include "TeslaTag.h"
+
+TeslaTemporalTag TeslaTag_MakeWide(int64_t latest, int64_t previous)
+{
+    if (latest == TESLA_NO_EPOCH)
+        return 0;
+
+    assert(latest <= TESLA_TAG_MAX_EPOCH && previous < latest);
+    return TESLA_TAG_WIDE | ((TeslaTemporalTag)(latest + 1) << TESLA_TAG_EPOCH_BITS) | (TeslaTemporalTag)(previous + 1);
+}
+
+TeslaTemporalTag TeslaTag_NextWide(TeslaTemporalTag current)
+{
+    int64_t latest = TeslaTag_Latest(current);
+    if (latest >= TESLA_TAG_MAX_EPOCH)
+        return current;
+
+    return TeslaTag_MakeWide(latest + 1, TESLA_NO_EPOCH);
+}
+
+/* Keeps the two latest epochs of either tag. */
+TeslaTemporalTag TeslaTag_MergeWide(TeslaTemporalTag tag, TeslaTemporalTag other)
+{
+    int64_t epochs[4] = {TeslaTag_Latest(tag), TeslaTag_Previous(tag), TeslaTag_Latest(other), TeslaTag_Previous(other)};
+    int64_t latest = TESLA_NO_EPOCH;
+    int64_t previous = TESLA_NO_EPOCH;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (epochs[i] > latest)
+        {
+            previous = latest;
+            latest = epochs[i];
+        }
+        else if (epochs[i] < latest && epochs[i] > previous)
+        {
+            previous = epochs[i];
+        }
+    }
+
+    return TeslaTag_MakeWide(latest, previous);
+}
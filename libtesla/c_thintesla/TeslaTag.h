@@ -0,0 +1,83 @@
+#pragma once
+
+#include "TeslaTypes.h"
+#include "ThinTesla.h"
+
+/*
+ * A temporal tag holds the epochs of a bound in which an event happened, with
+ * a new epoch each time the automaton backtracks. For the first
+ * TESLA_TAG_NARROW_EPOCHS epochs a tag is a mask with one bit per epoch: the
+ * current tag of the automaton has one bit set and tags are merged with an or.
+ *
+ * Verification only looks at the last two epochs in which an event happened,
+ * so once the automaton runs out of bits it moves to wide tags, which keep
+ * TESLA_TAG_WIDE, then those two epochs plus one (0 for none) in
+ * TESLA_TAG_EPOCH_BITS each. Narrow tags already in the stores stay as they
+ * are, both forms are read through TeslaTag_Latest and TeslaTag_Previous.
+ */
+
+// The hash table keeps 63 bits of a tag, so the marker is the highest bit all stores keep.
+#define TESLA_TAG_WIDE ((TeslaTemporalTag)1 << 62)
+#define TESLA_TAG_NARROW_EPOCHS 62
+
+#define TESLA_TAG_EPOCH_BITS 31
+#define TESLA_TAG_EPOCH_MASK (((TeslaTemporalTag)1 << TESLA_TAG_EPOCH_BITS) - 1)
+#define TESLA_TAG_MAX_EPOCH ((int64_t)TESLA_TAG_EPOCH_MASK - 1)
+
+// The epoch of an event that did not happen, before every other epoch.
+#define TESLA_NO_EPOCH ((int64_t)-1)
+
+EXTERN_C
+
+TeslaTemporalTag TeslaTag_MakeWide(int64_t latest, int64_t previous);
+TeslaTemporalTag TeslaTag_NextWide(TeslaTemporalTag current);
+TeslaTemporalTag TeslaTag_MergeWide(TeslaTemporalTag tag, TeslaTemporalTag other);
+
+EXTERN_C_END
+
+static inline bool TeslaTag_IsWide(TeslaTemporalTag tag)
+{
+    return (tag & TESLA_TAG_WIDE) != 0;
+}
+
+static inline int64_t TeslaTag_Latest(TeslaTemporalTag tag)
+{
+    if (tag == 0)
+        return TESLA_NO_EPOCH;
+
+    if (!TeslaTag_IsWide(tag))
+        return 63 - __builtin_clzll(tag);
+
+    return (int64_t)((tag >> TESLA_TAG_EPOCH_BITS) & TESLA_TAG_EPOCH_MASK) - 1;
+}
+
+/* The epoch before the latest one in which the event happened. */
+static inline int64_t TeslaTag_Previous(TeslaTemporalTag tag)
+{
+    if (!TeslaTag_IsWide(tag))
+    {
+        if (tag == 0)
+            return TESLA_NO_EPOCH;
+
+        return TeslaTag_Latest(tag & ~((TeslaTemporalTag)1 << TeslaTag_Latest(tag)));
+    }
+
+    return (int64_t)(tag & TESLA_TAG_EPOCH_MASK) - 1;
+}
+
+/* The tag of the epoch after the current one. Stays on the last epoch once there are no more. */
+static inline TeslaTemporalTag TeslaTag_Next(TeslaTemporalTag current)
+{
+    if (__builtin_expect(current < ((TeslaTemporalTag)1 << (TESLA_TAG_NARROW_EPOCHS - 1)), 1))
+        return current << 1;
+
+    return TeslaTag_NextWide(current);
+}
+
+static inline TeslaTemporalTag TeslaTag_Merge(TeslaTemporalTag tag, TeslaTemporalTag other)
+{
+    if (__builtin_expect(!TeslaTag_IsWide(tag | other), 1))
+        return tag | other;
+
+    return TeslaTag_MergeWide(tag, other);
+}
@@ -0,0 +1,508 @@
+#define _POSIX_C_SOURCE 200809L // ftruncate, mmap and clock_gettime under -std=c99.
+
+#include "TeslaTrace.h"
+#include "TeslaMalloc.h"
+
+#ifdef TESLA_TRACE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Every thread appends its records to its own ring, which only that thread
+ * writes and only the flusher thread reads, so that recording is a few
+ * stores and a release of the head. The flusher copies whatever the rings
+ * hold into a window of the trace file mapped into memory, and maps the next
+ * window when one is full, so the file is written sequentially in large
+ * blocks, and mostly by the kernel.
+ */
+
+// The part of the trace file mapped at a time.
+#define TESLA_TRACE_WINDOW_SIZE (16 * 1024 * 1024)
+
+// How long the flusher sleeps when it found nothing to write.
+#define TESLA_TRACE_FLUSH_INTERVAL_NS 1000000
+
+typedef struct TeslaTraceRing
+{
+    struct TeslaTraceRing* next;
+    uint32_t thread;
+    bool closed; // The thread has exited, the flusher frees the ring once it is empty.
+
+    // Only written by the thread.
+    char padHead[64];
+    size_t head;
+    size_t cachedTail;
+    size_t dropped;
+    bool recording; // Between checking that the trace is on and publishing the record, see TeslaStopTrace.
+
+    // Only written by the flusher.
+    char padTail[64];
+    size_t tail;
+    size_t droppedSeen;
+
+    char padRecords[64];
+    TeslaTraceRecord records[TESLA_TRACE_RING_SIZE];
+} TeslaTraceRing;
+
+int teslaTraceState = TESLA_TRACE_UNRESOLVED;
+
+// TESLA_TRACE_RECORD_ONLY..., set before the trace is on.
+static unsigned traceFlags;
+
+static __thread TeslaTraceRing* traceRing __attribute__((tls_model("initial-exec")));
+
+// Rings of the running threads, and of exited threads that still hold records. Linked and drained under the lock.
+static TeslaTraceRing* traceRingList = NULL;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static bool traceFlushing = false;
+static uint32_t numTraceThreads = 0;
+
+// Serializes starting and stopping traces.
+static pthread_mutex_t traceControlLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The trace file, only touched by the flusher while it runs.
+static int traceFile = -1;
+static char* traceWindow;
+static size_t traceWindowOffset;
+static size_t traceWindowUsed;
+static uint64_t numTraceRecords;
+static uint64_t numTraceDropped;
+static TeslaTraceHeader traceHeader;
+
+static pthread_t traceFlusher;
+static int traceFlusherStop;
+
+// Automata seen by a hook while tracing: 0 unseen, 1 being named, 2 named.
+static int traceNamed[TESLA_MAX_AUTOMATA];
+static TeslaTraceAutomaton traceAutomata[TESLA_MAX_AUTOMATA];
+
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t traceKey;
+
+static uint64_t TeslaTrace_Now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static uint64_t TeslaTrace_NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* Called with the lock held. Grows the file by a window and maps it. */
+static bool TeslaTrace_NextWindow(void)
+{
+    munmap(traceWindow, TESLA_TRACE_WINDOW_SIZE);
+    traceWindowOffset += TESLA_TRACE_WINDOW_SIZE;
+    traceWindowUsed = 0;
+
+    traceWindow = NULL;
+    if (ftruncate(traceFile, traceWindowOffset + TESLA_TRACE_WINDOW_SIZE) != 0)
+        return false;
+
+    void* window = mmap(NULL, TESLA_TRACE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, traceFile, traceWindowOffset);
+    if (window == MAP_FAILED)
+        return false;
+
+    traceWindow = (char*)window;
+    return true;
+}
+
+/* Called with the lock held. Records that cannot be written, because the file cannot grow, are counted as dropped. */
+static void TeslaTrace_Write(const TeslaTraceRecord* records, size_t count)
+{
+    size_t written = 0;
+    while (written < count && traceWindow != NULL)
+    {
+        if (traceWindowUsed == TESLA_TRACE_WINDOW_SIZE && !TeslaTrace_NextWindow())
+            break;
+
+        size_t room = (TESLA_TRACE_WINDOW_SIZE - traceWindowUsed) / sizeof(TeslaTraceRecord);
+        size_t batch = count - written < room ? count - written : room;
+
+        memcpy(traceWindow + traceWindowUsed, records + written, batch * sizeof(TeslaTraceRecord));
+        traceWindowUsed += batch * sizeof(TeslaTraceRecord);
+        written += batch;
+    }
+
+    numTraceRecords += written;
+    numTraceDropped += count - written;
+}
+
+/* Called with the lock held. Moves everything the rings hold to the file, and frees the rings of exited threads. */
+static size_t TeslaTrace_Drain(void)
+{
+    size_t drained = 0;
+
+    for (TeslaTraceRing** it = &traceRingList; *it != NULL;)
+    {
+        TeslaTraceRing* ring = *it;
+        bool closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        // The ring wraps, so copy it in at most two pieces.
+        while (ring->tail != head)
+        {
+            size_t start = ring->tail % TESLA_TRACE_RING_SIZE;
+            size_t count = head - ring->tail;
+            if (count > TESLA_TRACE_RING_SIZE - start)
+                count = TESLA_TRACE_RING_SIZE - start;
+
+            TeslaTrace_Write(&ring->records[start], count);
+            drained += count;
+            __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+        }
+
+        size_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        numTraceDropped += dropped - ring->droppedSeen;
+        ring->droppedSeen = dropped;
+
+        if (closed)
+        {
+            *it = ring->next;
+            TeslaFree(ring);
+            continue;
+        }
+
+        it = &ring->next;
+    }
+
+    return drained;
+}
+
+/* Called with the lock held, once the trace is off. Waits for the threads that saw it on to publish their record. */
+static void TeslaTrace_WaitForRecords(void)
+{
+    for (TeslaTraceRing* ring = traceRingList; ring != NULL; ring = ring->next)
+    {
+        while (__atomic_load_n(&ring->recording, __ATOMIC_SEQ_CST))
+            sched_yield();
+    }
+}
+
+static void* TeslaTrace_Flush(void* unused)
+{
+    (void)unused;
+    struct timespec interval = {0, TESLA_TRACE_FLUSH_INTERVAL_NS};
+
+    while (!__atomic_load_n(&traceFlusherStop, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&traceLock);
+        size_t drained = TeslaTrace_Drain();
+        pthread_mutex_unlock(&traceLock);
+
+        if (drained == 0)
+            nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+static void TeslaTrace_ThreadExit(void* data)
+{
+    TeslaTraceRing* ring = (TeslaTraceRing*)data;
+    traceRing = NULL;
+
+    pthread_mutex_lock(&traceLock);
+    if (traceFlushing)
+    {
+        __atomic_store_n(&ring->closed, true, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        for (TeslaTraceRing** it = &traceRingList; *it != NULL; it = &(*it)->next)
+        {
+            if (*it == ring)
+            {
+                *it = ring->next;
+                break;
+            }
+        }
+        TeslaFree(ring);
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+/* Called with the control lock held. */
+static bool TeslaTrace_Open(const char* path, unsigned flags)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    void* window = MAP_FAILED;
+    if (ftruncate(fd, TESLA_TRACE_WINDOW_SIZE) == 0)
+        window = mmap(NULL, TESLA_TRACE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (window == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    memset(&traceHeader, 0, sizeof(traceHeader));
+    memcpy(traceHeader.magic, TESLA_TRACE_MAGIC, sizeof(traceHeader.magic));
+    traceHeader.version = TESLA_TRACE_VERSION;
+    traceHeader.headerSize = sizeof(TeslaTraceHeader);
+    traceHeader.recordSize = sizeof(TeslaTraceRecord);
+    traceHeader.automatonSize = sizeof(TeslaTraceAutomaton);
+    traceHeader.tscStart = TeslaTrace_Now();
+    traceHeader.nsStart = TeslaTrace_NowNs();
+
+    // Written now so that the trace of a process that dies can still be recognized.
+    memcpy(window, &traceHeader, sizeof(traceHeader));
+
+    traceFile = fd;
+    traceWindow = (char*)window;
+    traceWindowOffset = 0;
+    traceWindowUsed = sizeof(TeslaTraceHeader);
+    numTraceRecords = 0;
+    numTraceDropped = 0;
+    traceFlags = flags;
+
+    // Leftovers from the end of an earlier trace are not part of this one.
+    pthread_mutex_lock(&traceLock);
+    for (TeslaTraceRing* ring = traceRingList; ring != NULL; ring = ring->next)
+    {
+        ring->tail = ring->head;
+        ring->droppedSeen = ring->dropped;
+    }
+    traceFlushing = true;
+    pthread_mutex_unlock(&traceLock);
+
+    __atomic_store_n(&traceFlusherStop, 0, __ATOMIC_RELAXED);
+    if (pthread_create(&traceFlusher, NULL, TeslaTrace_Flush, NULL) != 0)
+    {
+        pthread_mutex_lock(&traceLock);
+        traceFlushing = false;
+        pthread_mutex_unlock(&traceLock);
+
+        munmap(traceWindow, TESLA_TRACE_WINDOW_SIZE);
+        close(fd);
+        traceFile = -1;
+        return false;
+    }
+
+    __atomic_store_n(&teslaTraceState, TESLA_TRACE_ON, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void TeslaTrace_Resolve(void)
+{
+    pthread_key_create(&traceKey, TeslaTrace_ThreadExit);
+
+    pthread_mutex_lock(&traceControlLock);
+    const char* path = getenv("TESLA_TRACE");
+    unsigned flags = (getenv("TESLA_TRACE_ONLY") != NULL ? TESLA_TRACE_RECORD_ONLY : 0) |
+                     (getenv("TESLA_TRACE_DROP") != NULL ? TESLA_TRACE_DROP_WHEN_FULL : 0);
+    if (path != NULL && TeslaTrace_Open(path, flags))
+        atexit(TeslaStopTrace);
+    else
+        __atomic_store_n(&teslaTraceState, TESLA_TRACE_OFF, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&traceControlLock);
+}
+
+static TeslaTraceRing* TeslaTrace_NewRing(void)
+{
+    TeslaTraceRing* ring = (TeslaTraceRing*)TeslaMallocZero(sizeof(TeslaTraceRing));
+    if (ring == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&traceLock);
+    ring->thread = numTraceThreads++;
+    ring->next = traceRingList;
+    traceRingList = ring;
+    pthread_mutex_unlock(&traceLock);
+
+    traceRing = ring;
+    pthread_setspecific(traceKey, ring);
+    return ring;
+}
+
+/* The name is copied, since the table is written at exit, after the automaton may be gone. */
+static void TeslaTrace_Name(TeslaAutomaton* base)
+{
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&traceNamed[base->id], &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    TeslaTraceAutomaton* entry = &traceAutomata[base->id];
+    entry->id = base->id;
+    entry->numEvents = base->numEvents;
+    strncpy(entry->name, base->name, sizeof(entry->name) - 1);
+    entry->name[sizeof(entry->name) - 1] = '\0';
+
+    __atomic_store_n(&traceNamed[base->id], 2, __ATOMIC_RELEASE);
+}
+
+/* Waits for the flusher to make room in the ring. False if the record is lost instead. */
+static bool TeslaTrace_WaitForRoom(TeslaTraceRing* ring, size_t head)
+{
+    for (;;)
+    {
+        ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - ring->cachedTail < TESLA_TRACE_RING_SIZE)
+            return true;
+
+        // The flusher is gone once the trace stops.
+        if ((traceFlags & TESLA_TRACE_DROP_WHEN_FULL) || __atomic_load_n(&teslaTraceState, __ATOMIC_ACQUIRE) != TESLA_TRACE_ON)
+        {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        sched_yield();
+    }
+}
+
+bool TeslaTrace_Record(TeslaAutomaton* automaton, size_t eventId, size_t kind, const void* data, size_t numWords)
+{
+    if (__builtin_expect(teslaTraceState == TESLA_TRACE_UNRESOLVED, 0))
+        pthread_once(&traceOnce, TeslaTrace_Resolve);
+
+    if (__atomic_load_n(&teslaTraceState, __ATOMIC_ACQUIRE) != TESLA_TRACE_ON)
+        return false;
+
+    bool recordOnly = (traceFlags & TESLA_TRACE_RECORD_ONLY) != 0;
+
+    TeslaTraceRing* ring = traceRing;
+    if (__builtin_expect(ring == NULL, 0) && (ring = TeslaTrace_NewRing()) == NULL)
+        return recordOnly;
+
+    // Checked again once the stop can see this thread recording, so the record is either drained or never written.
+    __atomic_store_n(&ring->recording, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&teslaTraceState, __ATOMIC_SEQ_CST) != TESLA_TRACE_ON)
+    {
+        __atomic_store_n(&ring->recording, false, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    size_t head = ring->head;
+    if (__builtin_expect(head - ring->cachedTail == TESLA_TRACE_RING_SIZE, 0) && !TeslaTrace_WaitForRoom(ring, head))
+    {
+        __atomic_store_n(&ring->recording, false, __ATOMIC_RELEASE);
+        return recordOnly;
+    }
+
+    if (automaton->id < TESLA_MAX_AUTOMATA && __atomic_load_n(&traceNamed[automaton->id], __ATOMIC_RELAXED) != 2)
+        TeslaTrace_Name(automaton);
+
+    if (numWords > TESLA_TRACE_MAX_WORDS)
+    {
+        numWords = TESLA_TRACE_MAX_WORDS;
+        kind |= TESLA_TRACE_TRUNCATED;
+    }
+
+    TeslaTraceRecord* record = &ring->records[head % TESLA_TRACE_RING_SIZE];
+    record->tsc = TeslaTrace_Now();
+    record->automatonId = automaton->id;
+    record->eventId = eventId;
+    record->kind = kind;
+    record->numWords = numWords;
+    record->thread = ring->thread;
+
+    const uint64_t* words = (const uint64_t*)data;
+    for (size_t i = 0; i < TESLA_TRACE_MAX_WORDS; ++i)
+        record->data[i] = i < numWords ? words[i] : 0;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->recording, false, __ATOMIC_RELEASE);
+    return recordOnly;
+}
+#endif
+
+bool TeslaStartTrace(const char* path)
+{
+    return TeslaStartTraceWithFlags(path, 0);
+}
+
+bool TeslaStartTraceWithFlags(const char* path, unsigned flags)
+{
+#ifdef TESLA_TRACE
+    pthread_once(&traceOnce, TeslaTrace_Resolve);
+
+    pthread_mutex_lock(&traceControlLock);
+    bool started = teslaTraceState != TESLA_TRACE_ON && TeslaTrace_Open(path, flags);
+    pthread_mutex_unlock(&traceControlLock);
+
+    return started;
+#else
+    (void)path;
+    (void)flags;
+    return false;
+#endif
+}
+
+void TeslaStopTrace(void)
+{
+#ifdef TESLA_TRACE
+    pthread_mutex_lock(&traceControlLock);
+    if (teslaTraceState != TESLA_TRACE_ON)
+    {
+        pthread_mutex_unlock(&traceControlLock);
+        return;
+    }
+
+    __atomic_store_n(&teslaTraceState, TESLA_TRACE_OFF, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&traceFlusherStop, 1, __ATOMIC_RELEASE);
+    pthread_join(traceFlusher, NULL);
+
+    pthread_mutex_lock(&traceLock);
+    TeslaTrace_WaitForRecords();
+    TeslaTrace_Drain();
+    traceFlushing = false;
+    pthread_mutex_unlock(&traceLock);
+
+    if (traceWindow != NULL)
+        munmap(traceWindow, TESLA_TRACE_WINDOW_SIZE);
+    traceWindow = NULL;
+
+    // Cut the file after the last record, and append the automaton table.
+    traceHeader.automataOffset = sizeof(TeslaTraceHeader) + numTraceRecords * sizeof(TeslaTraceRecord);
+    ftruncate(traceFile, traceHeader.automataOffset);
+
+    for (size_t id = 0; id < TESLA_MAX_AUTOMATA; ++id)
+    {
+        if (__atomic_load_n(&traceNamed[id], __ATOMIC_ACQUIRE) != 2)
+            continue;
+
+        off_t offset = traceHeader.automataOffset + traceHeader.numAutomata * sizeof(TeslaTraceAutomaton);
+        if (pwrite(traceFile, &traceAutomata[id], sizeof(TeslaTraceAutomaton), offset) == sizeof(TeslaTraceAutomaton))
+            traceHeader.numAutomata++;
+    }
+
+    traceHeader.numThreads = numTraceThreads;
+    traceHeader.numRecords = numTraceRecords;
+    traceHeader.numDropped = numTraceDropped;
+    traceHeader.tscEnd = TeslaTrace_Now();
+    traceHeader.nsEnd = TeslaTrace_NowNs();
+    pwrite(traceFile, &traceHeader, sizeof(traceHeader), 0);
+
+    // A trace with holes cannot be replayed faithfully, say so rather than leave it to the reader of the header.
+    if (numTraceDropped > 0)
+    {
+        fprintf(stderr, "[TESLA] The trace lost %llu of %llu records\n", (unsigned long long)numTraceDropped,
+                (unsigned long long)(numTraceRecords + numTraceDropped));
+    }
+
+    close(traceFile);
+    traceFile = -1;
+
+    pthread_mutex_unlock(&traceControlLock);
+#endif
+}
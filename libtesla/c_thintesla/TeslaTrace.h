@@ -0,0 +1,158 @@
+#pragma once
+
+#include "TeslaState.h"
+#include "ThinTesla.h"
+
+// Event traces. Build with TESLA_NO_TRACE (cmake -DTHIN_TESLA_TRACE=OFF) to compile them away.
+#if !defined(_KERNEL) && !defined(TESLA_NO_TRACE)
+#define TESLA_TRACE
+#endif
+
+/*
+ * Trace file format, version 1
+ * ============================
+ *
+ * Written by TeslaStartTrace/TeslaStopTrace, or for the whole run when
+ * TESLA_TRACE=<path> is set in the environment, with TESLA_TRACE_ONLY and
+ * TESLA_TRACE_DROP set for the flags of the same name. Every field is in the
+ * byte order of the machine that recorded the trace.
+ *
+ *   offset 0                      TeslaTraceHeader (headerSize bytes)
+ *   offset headerSize             numRecords TeslaTraceRecord (recordSize bytes each)
+ *   offset automataOffset         numAutomata TeslaTraceAutomaton (automatonSize bytes each)
+ *
+ * The header is written when the trace is stopped. A trace whose process
+ * died before that still has magic and version, but numRecords == 0: read
+ * records until one has kind TESLA_TRACE_NONE.
+ *
+ * Records of one thread are in the order its hooks ran. Records of different
+ * threads are interleaved in the order the flusher drained them, so sort by
+ * tsc to merge them. A thread whose ring is full waits for the flusher, so
+ * the trace holds every hook, unless it was started with
+ * TESLA_TRACE_DROP_WHEN_FULL: the record is lost then, and the losses are
+ * added up in numDropped.
+ *
+ * Readers must check version, and use headerSize, recordSize and
+ * automatonSize rather than the sizes of these structures, so that later
+ * versions can append fields.
+ */
+#define TESLA_TRACE_MAGIC "TESLATRC"
+#define TESLA_TRACE_VERSION 1
+
+typedef struct TeslaTraceHeader
+{
+    char magic[8];           // TESLA_TRACE_MAGIC, without the terminating zero.
+    uint32_t version;        // TESLA_TRACE_VERSION.
+    uint32_t headerSize;     // Offset of the first record.
+    uint32_t recordSize;     // Size of a record.
+    uint32_t numThreads;     // Threads that recorded events, numbered from 0.
+    uint64_t numRecords;     // Records that follow the header.
+    uint64_t numDropped;     // Records lost because a ring was full.
+    uint64_t tscStart;       // Time stamp counter when the trace started...
+    uint64_t tscEnd;         // ...and stopped.
+    uint64_t nsStart;        // CLOCK_MONOTONIC when the trace started...
+    uint64_t nsEnd;          // ...and stopped, to turn time stamps into time.
+    uint64_t automataOffset; // Offset of the automaton table.
+    uint32_t numAutomata;    // Entries in the automaton table.
+    uint32_t automatonSize;  // Size of an entry.
+    uint64_t reserved[5];
+} TeslaTraceHeader;
+
+/* What called the hook, and so how to replay the record. */
+enum
+{
+    TESLA_TRACE_NONE = 0,   // Not a record, past the end of a trace that was not stopped.
+    TESLA_TRACE_EVENT,      // UpdateAutomatonDeterministic, or a specialized transition function.
+    TESLA_TRACE_EVENT_DATA, // UpdateAutomaton, data holds the match data.
+    TESLA_TRACE_MATCH_DATA, // UpdateEventWithData or StageEventWithData, data holds the match data.
+    TESLA_TRACE_END,        // EndAutomaton.
+    TESLA_TRACE_END_LINKED, // EndLinkedAutomata, one record per automaton, data holds its index and their number.
+};
+
+// Set in kind if the event has more match data than a record holds. Only the first words were kept.
+#define TESLA_TRACE_TRUNCATED 0x80
+#define TESLA_TRACE_KIND_MASK 0x7f
+
+#define TESLA_TRACE_MAX_WORDS 5
+
+typedef struct TeslaTraceRecord
+{
+    uint64_t tsc;         // Time stamp counter when the hook ran.
+    uint32_t automatonId; // id of the base automaton, its index in the automaton table of the module.
+    uint16_t eventId;     // id of the event in the automaton.
+    uint8_t kind;         // TESLA_TRACE_EVENT..., maybe with TESLA_TRACE_TRUNCATED.
+    uint8_t numWords;     // Words of data used.
+    uint32_t thread;      // Thread that ran the hook.
+    uint32_t reserved;
+    uint64_t data[TESLA_TRACE_MAX_WORDS];
+} TeslaTraceRecord;
+
+/* One per automaton that has records, to tell automata of different modules apart. */
+typedef struct TeslaTraceAutomaton
+{
+    uint32_t id;
+    uint32_t numEvents;
+    char name[56]; // Truncated to fit, always zero-terminated.
+} TeslaTraceAutomaton;
+
+_Static_assert(sizeof(TeslaTraceHeader) == 128, "Trace header size changed, bump TESLA_TRACE_VERSION");
+_Static_assert(sizeof(TeslaTraceRecord) == 64, "Trace record size changed, bump TESLA_TRACE_VERSION");
+_Static_assert(sizeof(TeslaTraceAutomaton) == 64, "Trace automaton size changed, bump TESLA_TRACE_VERSION");
+
+/* How a trace is recorded, for TeslaStartTraceWithFlags. */
+enum
+{
+    TESLA_TRACE_RECORD_ONLY = 1 << 0,    // Hooks return once recorded, checking is left to tesla-replay.
+    TESLA_TRACE_DROP_WHEN_FULL = 1 << 1, // A thread whose ring is full loses the record rather than waiting.
+};
+
+#ifdef TESLA_TRACE
+// Records per thread waiting for the flusher. A thread that gets this far ahead waits, or drops records.
+#define TESLA_TRACE_RING_SIZE 8192
+
+enum
+{
+    TESLA_TRACE_UNRESOLVED = 0, // The environment has not been read yet.
+    TESLA_TRACE_OFF,
+    TESLA_TRACE_ON,
+};
+
+EXTERN_C
+
+extern int teslaTraceState;
+
+/* Returns true if the hook must not check the event, see TESLA_TRACE_RECORD_ONLY. */
+bool TeslaTrace_Record(TeslaAutomaton* automaton, size_t eventId, size_t kind, const void* data, size_t numWords);
+
+EXTERN_C_END
+
+/*
+ * Records an event of automaton, the base automaton the hook was called with,
+ * if tracing. True if the hook must return without checking the event.
+ */
+#define TESLA_TRACE_HOOK(automaton, eventId, kind, data, numWords) \
+    (__builtin_expect(teslaTraceState != TESLA_TRACE_OFF, 0) && TeslaTrace_Record((automaton), (eventId), (kind), (data), (numWords)))
+#else
+#define TESLA_TRACE_HOOK(automaton, eventId, kind, data, numWords) false
+#endif
+
+EXTERN_C
+
+/*
+ * Starts recording every hook into a new trace file at path, replacing an
+ * existing one. Returns false if traces are compiled out, a trace is already
+ * being recorded, or the file cannot be created.
+ */
+bool TeslaStartTrace(const char* path);
+
+/* Same, with TESLA_TRACE_RECORD_ONLY and TESLA_TRACE_DROP_WHEN_FULL. */
+bool TeslaStartTraceWithFlags(const char* path, unsigned flags);
+
+/*
+ * Writes out what the threads have recorded, completes the header and closes
+ * the file. Hooks that are running while the trace stops may lose their
+ * records. Lost records are reported on stderr.
+ */
+void TeslaStopTrace(void);
+
+EXTERN_C_END
@@ -14,4 +14,12 @@ typedef struct KernelThreadAutomata
     unsigned long initTag;
 } KernelThreadAutomata;
 
+// Userspace counterpart of KernelThreadAutomata: a per-thread table indexed by automaton id.
+typedef struct UserThreadAutomata
+{
+    struct TeslaAutomaton** automata;
+    unsigned long numAutomata;
+    TeslaThreadKey threadKey;
+} UserThreadAutomata;
+
 #define INVALID_THREAD_KEY ((TeslaThreadKey)-1)
@@ -0,0 +1,121 @@
+extern "C" {
+#include "TeslaSlab.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <thread>
+
+/*
+ * The fields of an automaton that are written on every update start on their
+ * own cache line, apart from the description shared by every clone and from
+ * the chain that other threads walk and append to. Checks the layout, then
+ * measures how many events threads get through when each one updates its own
+ * automaton in an array, which is how the instrumenter lays out global
+ * automata and the kernel its per-thread automata.
+ */
+
+const size_t NUM_BENCH_EVENTS = 1 << 20;
+const size_t MAX_BENCH_THREADS = 16;
+
+#define LINE_OF(FIELD) (offsetof(TeslaAutomaton, FIELD) / TESLA_CACHE_LINE_SIZE)
+#define LAST_LINE_OF(FIELD) ((offsetof(TeslaAutomaton, FIELD) + sizeof(((TeslaAutomaton*)NULL)->FIELD) - 1) / TESLA_CACHE_LINE_SIZE)
+
+std::vector<TestEvent> MakeDeterministic()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+void TestLayout()
+{
+    assert(alignof(TeslaAutomaton) == TESLA_CACHE_LINE_SIZE);
+    assert(sizeof(TeslaAutomaton) % TESLA_CACHE_LINE_SIZE == 0);
+    assert(offsetof(TeslaAutomaton, state) % TESLA_CACHE_LINE_SIZE == 0);
+
+    // What an update reads and writes fits in the first line of the state.
+    size_t state = LINE_OF(state);
+    assert(LAST_LINE_OF(state.currentTemporalTag) == state && LAST_LINE_OF(state.currentEvent) == state);
+    assert(LAST_LINE_OF(state.lastEvent) == state && LAST_LINE_OF(state.hasFailed) == state);
+    assert(LINE_OF(lock) > state);
+
+    // Nothing that is only read, or written by other threads, shares a line with the state.
+    assert(LAST_LINE_OF(events) < state && LAST_LINE_OF(flags) < state && LAST_LINE_OF(numEvents) < state);
+    assert(LAST_LINE_OF(name) < state && LAST_LINE_OF(eventStates) < state && LAST_LINE_OF(history) < state);
+    assert(LAST_LINE_OF(numTotalAutomata) < state && LAST_LINE_OF(id) < state && LAST_LINE_OF(sampleRate) < state);
+    assert(LAST_LINE_OF(threadKey) < state && LAST_LINE_OF(next) < state);
+}
+
+/* Copies of the same automaton, one after the other. */
+TeslaAutomaton* MakeArray(TestAutomaton& base, size_t count)
+{
+    void* array = NULL;
+    if (posix_memalign(&array, TESLA_CACHE_LINE_SIZE, sizeof(TeslaAutomaton) * count) != 0)
+        return NULL;
+
+    TeslaAutomaton* automata = (TeslaAutomaton*)array;
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(&automata[i], base.Get(), sizeof(TeslaAutomaton));
+        automata[i].id = i;
+    }
+
+    return automata;
+}
+
+/* Events 1 and 2 forever, the automaton never completes. */
+void Hammer(TeslaAutomaton* automaton, TestAutomaton& base)
+{
+    for (size_t i = 0; i < NUM_BENCH_EVENTS; ++i)
+        UpdateAutomatonDeterministic(automaton, base.Event(1 + i % 2));
+}
+
+double Measure(TestAutomaton& base, size_t numThreads)
+{
+    TeslaAutomaton* automata = MakeArray(base, numThreads);
+    assert(automata != NULL);
+
+    std::vector<std::thread> threads;
+    BenchTimer timer;
+    for (size_t t = 0; t < numThreads; ++t)
+        threads.emplace_back([&, t] { Hammer(&automata[t], base); });
+
+    for (auto& thread : threads)
+        thread.join();
+    double ns = timer.ElapsedNs() / (NUM_BENCH_EVENTS * numThreads);
+
+    for (size_t t = 0; t < numThreads; ++t)
+    {
+        assert(automata[t].state.isActive && !automata[t].state.hasFailed);
+        TA_Reset(&automata[t]);
+    }
+
+    free(automata);
+    return ns;
+}
+
+/* Plain automata run by the shift-and engine, and concurrent ones that move with a compare-and-swap. */
+void Benchmark()
+{
+    TestAutomaton plain("plain", MakeDeterministic(), false);
+
+    TestAutomaton concurrent("concurrent", MakeDeterministic(), false);
+    concurrent.Get()->flags.isConcurrent = true;
+
+    std::cout << "# threads\tplain ns/event\tcas ns/event\t(" << std::thread::hardware_concurrency() << " cpus, "
+              << sizeof(TeslaAutomaton) << " bytes per automaton)\n";
+
+    for (size_t numThreads = 1; numThreads <= MAX_BENCH_THREADS; numThreads *= 2)
+        std::cout << "  " << numThreads << "\t\t" << Measure(plain, numThreads) << "\t\t" << Measure(concurrent, numThreads) << "\n";
+}
+
+int main()
+{
+    TestLayout();
+    Benchmark();
+
+    TestPassed("Automaton layout");
+    return 0;
+}
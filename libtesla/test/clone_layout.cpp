@@ -0,0 +1,259 @@
+extern "C" {
+#include "TeslaHistory.h"
+#include "TeslaMalloc.h"
+#include "TeslaSlab.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/*
+ * Clones are allocated as one cache-line-aligned block from a per-thread slab.
+ * Checks the layout, then compares memory and update latency with clones built
+ * the way CloneAutomaton used to, with a separate allocation for every part.
+ */
+
+const size_t NUM_AUTOMATA = 512;
+const size_t NUM_ROUNDS = 32;
+
+/* TestAutomaton holds a cache-line-aligned TeslaAutomaton, which new only honours from C++17. */
+struct FreeAligned
+{
+    void operator()(TestAutomaton* automaton) const
+    {
+        automaton->~TestAutomaton();
+        free(automaton);
+    }
+};
+
+typedef std::vector<std::unique_ptr<TestAutomaton, FreeAligned>> AutomatonSet;
+
+/* The first thread to use an automaton gets the base itself, keep it busy so that threads get clones. */
+TeslaAutomaton* Occupy(TestAutomaton& automaton)
+{
+    automaton.Get()->threadKey = (TeslaThreadKey)&automaton;
+    return automaton.Get();
+}
+
+bool IsInside(void* ptr, void* block, size_t size)
+{
+    return (uint8_t*)ptr >= (uint8_t*)block && (uint8_t*)ptr < (uint8_t*)block + size;
+}
+
+void TestLayout()
+{
+    TestAutomaton automaton("layout", {Deterministic(), Parametric(1), Parametric(3), AssertionSite(), Deterministic()}, true);
+
+    Occupy(automaton);
+
+    size_t value = 7;
+    UpdateAutomaton(automaton.Get(), automaton.Event(1), &value);
+
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+    assert(clone != automaton.Get());
+    assert((uintptr_t)clone % TESLA_CACHE_LINE_SIZE == 0);
+
+    // Event states start on the line after the automaton, and the rest of the clone follows.
+    assert((uint8_t*)clone->eventStates == (uint8_t*)clone + TeslaSlab_Align(sizeof(TeslaAutomaton)));
+    assert(clone->eventStates[2].matchData == clone->eventStates[1].matchData + sizeof(size_t));
+
+    size_t size = (uint8_t*)clone->history->ring - (uint8_t*)clone + TeslaHistory_GetBlockSize(clone->numEvents);
+    assert(IsInside(clone->eventStates[2].matchData, clone, size));
+    assert(IsInside(clone->history, clone, size));
+    assert(clone->history->valid && !clone->history->ownsBlock);
+    assert(clone->history->numObservations == 1);
+
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void TestDeterministicClones()
+{
+    TestAutomaton first("first", {Deterministic(), Deterministic(), AssertionSite(), Deterministic()}, true, 0, 2);
+    TestAutomaton second("second", {Deterministic(), Deterministic(), AssertionSite(), Deterministic()}, true, 1, 2);
+    Occupy(first);
+    Occupy(second);
+
+    // A new thread starts with an empty slab, so its clones are next to each other.
+    std::thread([&]() {
+        UpdateAutomatonDeterministic(first.Get(), first.Event(1));
+        UpdateAutomatonDeterministic(second.Get(), second.Event(1));
+
+        TeslaAutomaton* a = GetThreadAutomaton(first.Get());
+        TeslaAutomaton* b = GetThreadAutomaton(second.Get());
+        assert(a->eventStates == NULL && a->history == NULL);
+        assert((uint8_t*)b - (uint8_t*)a == (ptrdiff_t)TeslaSlab_Align(sizeof(TeslaAutomaton)));
+
+        EndAutomaton(first.Get(), first.End());
+        EndAutomaton(second.Get(), second.End());
+    }).join();
+}
+
+void TestSlab()
+{
+    TeslaSlab slab = {NULL, NULL};
+
+    uint8_t* a = (uint8_t*)TeslaSlab_AllocateFrom(&slab, 1);
+    uint8_t* b = (uint8_t*)TeslaSlab_AllocateFrom(&slab, 100);
+    uint8_t* c = (uint8_t*)TeslaSlab_AllocateFrom(&slab, TESLA_SLAB_SIZE);
+
+    assert((uintptr_t)a % TESLA_CACHE_LINE_SIZE == 0 && b == a + TESLA_CACHE_LINE_SIZE);
+    assert((uintptr_t)c % TESLA_CACHE_LINE_SIZE == 0 && !IsInside(c, a, TESLA_SLAB_SIZE));
+    assert(slab.current == b + 2 * TESLA_CACHE_LINE_SIZE);
+
+    for (size_t i = 0; i < TESLA_SLAB_SIZE; ++i)
+        assert(c[i] == 0);
+}
+
+/* Builds a clone like the old CloneAutomaton did, with another allocation after each of its parts but the last. */
+TeslaAutomaton* CreateScatteredClone(TeslaAutomaton* base, std::vector<std::unique_ptr<char[]>>& spacers)
+{
+    auto spacer = [&]() { spacers.emplace_back(new char[48]); };
+
+    TeslaAutomaton* automaton = (TeslaAutomaton*)TeslaMallocZero(sizeof(TeslaAutomaton));
+    spacer();
+
+    automaton->numEvents = base->numEvents;
+    automaton->flags = base->flags;
+    automaton->events = base->events;
+    automaton->name = base->name;
+    automaton->threadKey = GetThreadKey();
+
+    automaton->eventStates = (TeslaEventState*)TeslaMallocZero(sizeof(TeslaEventState) * base->numEvents);
+    spacer();
+
+    for (size_t i = 0; i < base->numEvents; ++i)
+    {
+        if (!base->events[i]->flags.isDeterministic)
+        {
+            automaton->eventStates[i].matchData = (uint8_t*)TeslaMalloc(base->events[i]->matchDataSize * sizeof(size_t));
+            spacer();
+        }
+    }
+
+    // The runtime is built with packed structs, so sizeof can differ from ours: round it up.
+    automaton->history = (TeslaHistory*)TeslaMalloc(TeslaSlab_Align(sizeof(TeslaHistory)));
+    spacer();
+    TeslaHistory_Create(automaton->history, base->numEvents);
+    automaton->history->valid = true;
+
+    base->next = automaton;
+    return automaton;
+}
+
+/* Heap taken by a separate allocation, including the allocator's own header. */
+size_t AllocatedSize(void* ptr)
+{
+#ifdef __GLIBC__
+    return malloc_usable_size(ptr) + sizeof(size_t);
+#else
+    (void)ptr;
+    return 0;
+#endif
+}
+
+size_t ScatteredCloneSize(TeslaAutomaton* automaton)
+{
+    size_t size = AllocatedSize(automaton) + AllocatedSize(automaton->eventStates) +
+                  AllocatedSize(automaton->history) + AllocatedSize(automaton->history->ring);
+
+    for (size_t i = 0; i < automaton->numEvents; ++i)
+    {
+        if (!automaton->events[i]->flags.isDeterministic)
+            size += AllocatedSize(automaton->eventStates[i].matchData);
+    }
+
+    return size;
+}
+
+AutomatonSet MakeAutomata(const char* name, size_t firstId)
+{
+    AutomatonSet automata;
+    for (size_t i = 0; i < NUM_AUTOMATA; ++i)
+    {
+        void* memory = nullptr;
+        int error = posix_memalign(&memory, alignof(TestAutomaton), sizeof(TestAutomaton));
+        assert(error == 0 && memory != nullptr);
+
+        automata.emplace_back(new (memory) TestAutomaton(name, {Deterministic(), Parametric(1), Parametric(2), AssertionSite(), Deterministic()},
+                                                         true, firstId + i, 2 * NUM_AUTOMATA));
+        Occupy(*automata.back());
+    }
+
+    return automata;
+}
+
+/* Median time of one parametric event, spread round-robin over all the clones. */
+double MeasureUpdates(AutomatonSet& automata)
+{
+    std::vector<double> elapsed;
+    size_t values[2] = {7, 8};
+
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        BenchTimer timer;
+        for (auto& automaton : automata)
+        {
+            UpdateAutomaton(automaton->Get(), automaton->Event(1), values);
+            UpdateAutomaton(automaton->Get(), automaton->Event(2), values);
+        }
+        elapsed.push_back(timer.ElapsedNs() / (2 * automata.size()));
+
+        for (auto& automaton : automata)
+            EndAutomaton(automaton->Get(), automaton->End());
+    }
+
+    std::sort(elapsed.begin(), elapsed.end());
+    return elapsed[NUM_ROUNDS / 2];
+}
+
+void Benchmark()
+{
+    std::cout << "# layout\tbytes/clone\tallocations\tns/event (median)\n";
+
+    AutomatonSet contiguous = MakeAutomata("contiguous", 0);
+    AutomatonSet scattered = MakeAutomata("scattered", NUM_AUTOMATA);
+
+    size_t values[2] = {7, 8};
+    for (auto& automaton : contiguous)
+    {
+        UpdateAutomaton(automaton->Get(), automaton->Event(1), values);
+        EndAutomaton(automaton->Get(), automaton->End());
+    }
+
+    // Clones made in a row by the same thread sit next to each other in the slab.
+    size_t contiguousBytes = (uint8_t*)contiguous[1]->Get()->next - (uint8_t*)contiguous[0]->Get()->next;
+
+    std::vector<std::unique_ptr<char[]>> spacers;
+    size_t scatteredBytes = 0;
+    for (auto& automaton : scattered)
+        scatteredBytes += ScatteredCloneSize(CreateScatteredClone(automaton->Get(), spacers));
+    scatteredBytes /= NUM_AUTOMATA;
+
+    double contiguousNs = MeasureUpdates(contiguous);
+    double scatteredNs = MeasureUpdates(scattered);
+
+    std::cout << "  contiguous\t" << contiguousBytes << "\t\t1\t\t" << contiguousNs << "\n";
+    std::cout << "  scattered\t" << scatteredBytes << "\t\t" << spacers.size() / NUM_AUTOMATA + 1 << "\t\t" << scatteredNs << "\n";
+}
+
+int main()
+{
+    TestSlab();
+    TestLayout();
+    TestDeterministicClones();
+
+    // The main thread's table of clones was sized for the automata above.
+    std::thread(Benchmark).join();
+
+    TestPassed("Clone layout");
+    return 0;
+}
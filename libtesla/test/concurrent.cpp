@@ -0,0 +1,242 @@
+#include "thintesla_helpers.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <thread>
+
+/*
+ * Concurrent global automata: the compare-and-swap path must move a
+ * deterministic automaton exactly like the generic engine, match data staged
+ * at an assertion site must only reach the automaton with the assertion, an
+ * assertion racing with the end of the bound must not leak into the next one,
+ * and many threads must be able to hammer the same automaton.
+ */
+
+const size_t NUM_RANDOM_EVENTS = 200000;
+const size_t NUM_STRESS_EVENTS = 1 << 16;
+const size_t NUM_BENCH_EVENTS = 1 << 17;
+const size_t MAX_BENCH_THREADS = 64;
+
+std::vector<TestEvent> MakeDeterministic()
+{
+    return {Deterministic(), Deterministic(), OR(Deterministic()), OR(Deterministic()), Deterministic(), AssertionSite(), Deterministic(), Deterministic()};
+}
+
+void ExpectSameState(TeslaAutomaton* concurrent, TeslaAutomaton* generic)
+{
+    assert(concurrent->state.isInit == generic->state.isInit);
+    assert(concurrent->state.isActive == generic->state.isActive);
+    assert(concurrent->state.hasFailed == generic->state.hasFailed);
+    assert(concurrent->state.reachedAssertion == generic->state.reachedAssertion);
+    assert(concurrent->state.failReason == generic->state.failReason);
+
+    if (concurrent->state.isInit)
+        assert(concurrent->state.currentEvent->id == generic->state.currentEvent->id);
+}
+
+void EndBound(TestAutomaton& automaton)
+{
+    TeslaAutomaton* state = automaton.Get();
+
+    // A failed or unfinished automaton would panic at the end of the bound.
+    if (state->state.hasFailed || (state->state.isActive && state->state.reachedAssertion))
+        TA_Reset(state);
+    else
+        EndAutomaton(state, automaton.End());
+}
+
+void TestEquivalence()
+{
+    TestAutomaton concurrent("concurrent", MakeDeterministic(), false);
+    TestAutomaton generic("generic", MakeDeterministic(), false);
+    concurrent.Get()->flags.isConcurrent = true;
+    generic.Get()->flags.isShiftAnd = false;
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> pick(1, MakeDeterministic().size() - 1);
+
+    for (size_t i = 0; i < NUM_RANDOM_EVENTS; ++i)
+    {
+        size_t id = pick(random);
+        if (id == MakeDeterministic().size() - 1)
+        {
+            EndBound(concurrent);
+            EndBound(generic);
+        }
+        else
+        {
+            UpdateAutomatonDeterministic(concurrent.Get(), concurrent.Event(id));
+            UpdateAutomatonDeterministic(generic.Get(), generic.Event(id));
+        }
+
+        ExpectSameState(concurrent.Get(), generic.Get());
+    }
+}
+
+std::vector<TestEvent> MakeParametric()
+{
+    return {Deterministic(), Parametric(1), AssertionSite(), Deterministic()};
+}
+
+const size_t A = 1;
+const size_t ASSERTION = 2;
+
+bool Assert(TestAutomaton& automaton, size_t observed, size_t asserted)
+{
+    UpdateAutomaton(automaton.Get(), automaton.Event(A), &observed);
+
+    // Nothing reaches the automaton before the assertion itself.
+    StageEventWithData(automaton.Get(), A, &asserted);
+    assert(*(size_t*)automaton.Get()->eventStates[A].matchData == 0);
+
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(ASSERTION));
+    assert(*(size_t*)automaton.Get()->eventStates[A].matchData == asserted);
+
+    bool failed = automaton.Get()->state.hasFailed;
+    automaton.SetMatch(A, {0});
+    EndBound(automaton);
+    return !failed;
+}
+
+void TestStaging()
+{
+    TestAutomaton automaton("staging", MakeParametric(), false);
+    automaton.Get()->flags.isConcurrent = true;
+
+    assert(Assert(automaton, 7, 7));
+    assert(!Assert(automaton, 7, 8));
+
+    // Data staged by another thread stays in that thread.
+    std::thread([&] {
+        size_t other = 9;
+        StageEventWithData(automaton.Get(), A, &other);
+    }).join();
+    assert(Assert(automaton, 7, 7));
+}
+
+void ReachAssertion(TestAutomaton& automaton)
+{
+    for (size_t id : {1, 2, 3, 4})
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(id));
+}
+
+void TestAssertionAfterReset()
+{
+    TestAutomaton automaton("reset", MakeDeterministic(), false);
+    automaton.Get()->flags.isConcurrent = true;
+    TeslaAutomaton* state = automaton.Get();
+
+    // The assertion waits while the bound ends, and then finds nothing to assert.
+    ReachAssertion(automaton);
+    TeslaAutomaton_Lock(state);
+    std::atomic<bool> asserted(false);
+    std::thread assertion([&] {
+        UpdateAutomatonDeterministic(state, automaton.Event(5));
+        asserted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(!asserted);
+    TA_Reset(state);
+    TeslaAutomaton_Unlock(state);
+    assertion.join();
+    assert(!state->state.reachedAssertion && !state->state.hasFailed);
+
+    // The next bound reaches its assertion once.
+    TA_Reset(state);
+    ReachAssertion(automaton);
+    UpdateAutomatonDeterministic(state, automaton.Event(5));
+    assert(state->state.reachedAssertion && !state->state.hasFailed);
+    EndBound(automaton);
+}
+
+/* Events 1 and 2 forever: 2 follows 1, and 1 starts over from 2, so the automaton never completes. */
+void Hammer(TestAutomaton* automaton, size_t numEvents)
+{
+    for (size_t i = 0; i < numEvents; ++i)
+        UpdateAutomatonDeterministic(automaton->Get(), automaton->Event(1 + i % 2));
+}
+
+void RunThreads(size_t numThreads, std::function<void()> body)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < numThreads; ++i)
+        threads.emplace_back(body);
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void TestStress()
+{
+    TestAutomaton deterministic("stress", MakeDeterministic(), false);
+    deterministic.Get()->flags.isConcurrent = true;
+
+    RunThreads(8, [&] { Hammer(&deterministic, NUM_STRESS_EVENTS); });
+
+    TeslaAutomaton* state = deterministic.Get();
+    assert(state->state.isActive && !state->state.hasFailed);
+    assert(state->state.currentEvent == deterministic.Event(1) || state->state.currentEvent == deterministic.Event(2));
+    EndBound(deterministic);
+
+    // Parametric events go through the history, under the lock.
+    TestAutomaton parametric("stress-parametric", MakeParametric(), false);
+    parametric.Get()->flags.isConcurrent = true;
+
+    RunThreads(8, [&] {
+        for (size_t i = 0; i < NUM_STRESS_EVENTS; ++i)
+            UpdateAutomaton(parametric.Get(), parametric.Event(A), &i);
+    });
+
+    assert(parametric.Get()->state.isActive && !parametric.Get()->state.hasFailed);
+    assert(Assert(parametric, 7, 7));
+}
+
+double Measure(TestAutomaton& automaton, size_t numThreads)
+{
+    BenchTimer timer;
+    RunThreads(numThreads, [&] { Hammer(&automaton, NUM_BENCH_EVENTS); });
+    double ns = timer.ElapsedNs() / (NUM_BENCH_EVENTS * numThreads);
+
+    EndBound(automaton);
+    return ns;
+}
+
+/*
+ * Throughput of one global automaton: with compare-and-swap, under the lock
+ * (what non-deterministic automata take), and without any synchronization,
+ * which is the old behaviour and loses transitions.
+ */
+void Benchmark()
+{
+    TestAutomaton cas("cas", MakeDeterministic(), false);
+    cas.Get()->flags.isConcurrent = true;
+
+    TestAutomaton locked("locked", MakeDeterministic(), false);
+    locked.Get()->flags.isConcurrent = true;
+    locked.Get()->flags.isDeterministic = false;
+
+    TestAutomaton racy("racy", MakeDeterministic(), false);
+
+    std::cout << "# threads\tcas ns/event\tlock ns/event\tracy ns/event\n";
+
+    for (size_t numThreads = 1; numThreads <= MAX_BENCH_THREADS; numThreads *= 2)
+    {
+        std::cout << "  " << numThreads << "\t\t" << Measure(cas, numThreads) << "\t\t" << Measure(locked, numThreads) << "\t\t"
+                  << Measure(racy, numThreads) << "\n";
+    }
+}
+
+int main()
+{
+    TestEquivalence();
+    TestStaging();
+    TestAssertionAfterReset();
+    TestStress();
+    Benchmark();
+
+    TestPassed("Concurrent global automata");
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "thintesla_helpers.h"
+#include "TeslaFailure.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Failure policies: under count and log, a failing bound is counted and the
+ * program goes on. Under log, the reporter thread writes one line for a burst
+ * of identical failures. The benchmark gives what a failure costs the failing
+ * thread.
+ */
+
+const size_t NUM_AUTOMATA = 4;
+const size_t NUM_FAILURES = 1000;
+const size_t NUM_THREADS = 4;
+const size_t NUM_BENCH_FAILURES = 1 << 16;
+
+std::vector<TestEvent> MakeDescription()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+/* Skips the second event, so the assertion fails. */
+void FailBound(TestAutomaton& automaton)
+{
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void PassBound(TestAutomaton& automaton)
+{
+    for (size_t event = 1; event < 4; ++event)
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(event));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void TestCount()
+{
+    TestAutomaton automaton("count", MakeDescription(), true, 0, NUM_AUTOMATA);
+    TeslaSetFailPolicy(TESLA_FAIL_COUNT);
+
+    for (size_t i = 0; i < NUM_FAILURES; ++i)
+    {
+        FailBound(automaton);
+        PassBound(automaton); // Checking goes on after a failure.
+    }
+
+    assert(TeslaGetFailureCount(automaton.Get()) == NUM_FAILURES);
+}
+
+void TestLog()
+{
+    TestAutomaton automaton("log", MakeDescription(), true, 1, NUM_AUTOMATA);
+    TeslaSetFailPolicy(TESLA_FAIL_LOG);
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    fflush(stderr);
+    int savedStderr = dup(STDERR_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&] {
+            for (size_t k = 0; k < NUM_FAILURES; ++k)
+                FailBound(automaton);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    TeslaFlushFailures();
+
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+    close(fds[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, length);
+    close(fds[0]);
+
+    assert(TeslaGetFailureCount(automaton.Get()) == NUM_THREADS * NUM_FAILURES);
+
+    // The repeats within the report interval are held back, and summed up at exit.
+    assert(output.find("[TESLA] ") == 0);
+    assert(output.find("assertion failed - automaton log: ") != std::string::npos);
+    assert(std::count(output.begin(), output.end(), '\n') == 1);
+}
+
+double Measure(TeslaFailPolicy policy, size_t id)
+{
+    TestAutomaton automaton("bench", MakeDescription(), true, id, NUM_AUTOMATA);
+    TeslaSetFailPolicy(policy);
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_FAILURES; ++i)
+        FailBound(automaton);
+    double ns = timer.ElapsedNs() / NUM_BENCH_FAILURES;
+
+    TeslaFlushFailures();
+    return ns;
+}
+
+int main()
+{
+    TestCount();
+    TestLog();
+
+    std::cout << "# policy\tns/failing bound\n";
+    std::cout << "  count\t\t" << Measure(TESLA_FAIL_COUNT, 2) << "\n";
+    std::cout << "  log\t\t" << Measure(TESLA_FAIL_LOG, 3) << "\n";
+
+    TestPassed("Failure policies");
+    return 0;
+}
@@ -0,0 +1,124 @@
+extern "C" {
+#include "TeslaHash.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <set>
+
+/*
+ * Collision rate and throughput of the match data hash kernels, with keys made
+ * of real heap pointers like the ones instrumented code passes as match data.
+ */
+
+const size_t NUM_KEYS = 1 << 16;
+const size_t NUM_BUCKETS = 1 << 16;
+const size_t NUM_ROUNDS = 64;
+
+struct NamedHash
+{
+    const char* name;
+    TeslaHashFunction function;
+};
+
+HashSize Murmur64(void* data, size_t len)
+{
+    uint64_t out[2] = {0};
+    MurmurHash3_x64_128(data, len, 19, out);
+    return out[0];
+}
+
+/* Keys of numWords pointers each, taken from separate small allocations. */
+std::vector<size_t> MakePointerKeys(std::vector<std::unique_ptr<char[]>>& objects, size_t numWords)
+{
+    std::vector<size_t> keys(NUM_KEYS * numWords);
+    for (auto& word : keys)
+    {
+        objects.emplace_back(new char[48]);
+        word = (size_t)objects.back().get();
+    }
+
+    return keys;
+}
+
+void TestKernelSelection()
+{
+    assert(TeslaHash_SelectKernel(1) == TESLA_HASH_1_WORD);
+    assert(TeslaHash_SelectKernel(4) == TESLA_HASH_4_WORDS);
+    assert(TeslaHash_SelectKernel(5) == TESLA_HASH_N_WORDS);
+    assert(TeslaHash_SelectKernel(0) == TESLA_HASH_N_WORDS);
+
+    // Hash64 must agree with the kernel stored in the event.
+    size_t words[6] = {0x1000, 0x2000, 0x3000, 0x4000, 0x5000, 0x6000};
+    for (size_t numWords = 1; numWords <= 6; ++numWords)
+    {
+        size_t len = numWords * sizeof(size_t);
+        assert(Hash64(words, len) == TeslaHash_Run(TeslaHash_SelectKernel(numWords), words, len));
+    }
+
+    // Every word takes part in the hash, and so does its position.
+    size_t swapped[2] = {0x2000, 0x1000};
+    assert(Hash64(words, 2 * sizeof(size_t)) != Hash64(swapped, 2 * sizeof(size_t)));
+
+    size_t changed[6] = {0x1000, 0x2000, 0x3000, 0x4000, 0x5000, 0x6008};
+    assert(Hash64(words, sizeof(words)) != Hash64(changed, sizeof(changed)));
+}
+
+void Benchmark(const NamedHash& hash, const std::vector<size_t>& keys, size_t numWords)
+{
+    size_t len = numWords * sizeof(size_t);
+
+    // Buckets are picked from the low bits, like TeslaSwissTable does.
+    std::vector<uint32_t> buckets(NUM_BUCKETS);
+    std::set<HashSize> distinct;
+    for (size_t i = 0; i < NUM_KEYS; ++i)
+    {
+        HashSize h = hash.function((void*)&keys[i * numWords], len);
+        buckets[h % NUM_BUCKETS]++;
+        distinct.insert(h);
+    }
+
+    // Expected number of keys sharing a bucket with an earlier key, for a uniform hash.
+    double expected = NUM_KEYS - NUM_BUCKETS * (1 - std::pow(1 - 1.0 / NUM_BUCKETS, NUM_KEYS));
+    size_t collisions = 0;
+    for (auto count : buckets)
+        collisions += count > 1 ? count - 1 : 0;
+
+    HashSize sink = 0;
+    BenchTimer timer;
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+        for (size_t i = 0; i < NUM_KEYS; ++i)
+            sink += hash.function((void*)&keys[i * numWords], len);
+    double ns = timer.ElapsedNs() / (NUM_ROUNDS * NUM_KEYS);
+
+    std::cout << "  " << hash.name << "\t" << numWords << "\t" << NUM_KEYS - distinct.size() << "\t\t"
+              << (double)collisions / expected << "\t\t" << ns << (sink == 1 ? " " : "") << "\n";
+}
+
+int main()
+{
+    TestKernelSelection();
+
+    std::cout << "# hash\twords\tfull collisions\tbucket collisions/uniform\tns/hash\n";
+    for (size_t numWords : {1, 2, 3, 4, 6})
+    {
+        std::vector<std::unique_ptr<char[]>> objects;
+        std::vector<size_t> keys = MakePointerKeys(objects, numWords);
+
+        std::vector<NamedHash> hashes = {
+            {"fake", FakeHash64},
+            {"xor", BadHash64},
+            {"murmur", Murmur64},
+            {"kernel", TeslaHashKernels[TeslaHash_SelectKernel(numWords)]},
+        };
+
+        for (auto& hash : hashes)
+            Benchmark(hash, keys, numWords);
+    }
+
+    TestPassed("Hash");
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "thintesla_helpers.h"
+
+#include <algorithm>
+#include <cassert>
+
+/*
+ * Linear history: the ring keeps a bounded number of observations and the
+ * per-event summaries answer verification without walking it.
+ */
+
+const size_t A = 1;
+const size_t B = 2;
+const size_t ASSERTION = 3;
+
+TestAutomaton MakeAutomaton()
+{
+    return TestAutomaton("history", {Deterministic(), Parametric(1), Parametric(1), AssertionSite(), Deterministic()}, true);
+}
+
+void Observe(TestAutomaton& automaton, size_t event, size_t value)
+{
+    UpdateAutomaton(automaton.Get(), automaton.Event(event), &value);
+}
+
+/* Reaches the assertion with value as the match data of both events, and returns the clone that was checked. */
+TeslaAutomaton* Assert(TestAutomaton& automaton, size_t value)
+{
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+
+    UpdateEventWithData(automaton.Get(), A, &value);
+    UpdateEventWithData(automaton.Get(), B, &value);
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(ASSERTION));
+
+    return clone;
+}
+
+bool UsesSummaries(TeslaAutomaton* clone)
+{
+    ObservationWindow window;
+    return GetSummaryWindow(clone, &window);
+}
+
+void EndBound(TestAutomaton& automaton, TeslaAutomaton* clone)
+{
+    // A failed automaton would panic at the end of the bound.
+    if (clone->state.hasFailed)
+        TA_Reset(clone);
+    else
+        EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void TestPasses()
+{
+    TestAutomaton automaton = MakeAutomaton();
+
+    Observe(automaton, A, 7);
+    Observe(automaton, B, 7);
+    TeslaAutomaton* clone = Assert(automaton, 7);
+
+    assert(UsesSummaries(clone));
+    assert(!clone->state.hasFailed && clone->state.isCorrect);
+    EndBound(automaton, clone);
+}
+
+void TestIgnoresOtherValues()
+{
+    TestAutomaton automaton = MakeAutomaton();
+
+    for (size_t i = 0; i < 100; ++i)
+        Observe(automaton, A, 1000 + i);
+    Observe(automaton, A, 7);
+    Observe(automaton, B, 8);
+    Observe(automaton, B, 7);
+    TeslaAutomaton* clone = Assert(automaton, 7);
+
+    assert(UsesSummaries(clone));
+    assert(!clone->state.hasFailed && clone->state.isCorrect);
+    EndBound(automaton, clone);
+}
+
+void TestMissingEvent()
+{
+    TestAutomaton automaton = MakeAutomaton();
+
+    Observe(automaton, A, 7);
+    Observe(automaton, B, 8);
+    TeslaAutomaton* clone = Assert(automaton, 7);
+
+    assert(clone->state.hasFailed);
+    EndBound(automaton, clone);
+}
+
+void TestRepeatedValue()
+{
+    TestAutomaton automaton = MakeAutomaton();
+
+    Observe(automaton, A, 7);
+    Observe(automaton, A, 7);
+    Observe(automaton, B, 7);
+    TeslaAutomaton* clone = Assert(automaton, 7);
+
+    // A was seen twice with the asserted value, so the ring has to be walked.
+    assert(!UsesSummaries(clone));
+    assert(!clone->state.hasFailed && clone->state.isCorrect);
+    EndBound(automaton, clone);
+}
+
+void TestOverflow()
+{
+    TestAutomaton automaton = MakeAutomaton();
+
+    // The observation of A we need is evicted from both its summary and the ring.
+    Observe(automaton, A, 7);
+    for (size_t i = 0; i < TESLA_HISTORY_CAPACITY * 4; ++i)
+        Observe(automaton, A, 1000 + i);
+    Observe(automaton, B, 7);
+    TeslaAutomaton* clone = Assert(automaton, 7);
+
+    assert(clone->history->numObservations > TESLA_HISTORY_CAPACITY);
+    assert(!UsesSummaries(clone));
+
+    // We can't tell whether A happened: don't fail, but don't claim the result is correct either.
+    assert(!clone->state.hasFailed && !clone->state.isCorrect);
+    EndBound(automaton, clone);
+
+    // The next bound starts from an empty history.
+    Observe(automaton, A, 7);
+    Observe(automaton, B, 7);
+    clone = Assert(automaton, 7);
+    assert(!clone->state.hasFailed && clone->state.isCorrect);
+    EndBound(automaton, clone);
+}
+
+void BenchmarkBoundLength()
+{
+    std::cout << "# observations\tns/verification (median)\n";
+
+    TestAutomaton automaton = MakeAutomaton();
+
+    for (size_t length = 16; length <= (1 << 16); length *= 16)
+    {
+        const size_t rounds = 64;
+        std::vector<double> elapsed;
+
+        for (size_t round = 0; round < rounds; ++round)
+        {
+            for (size_t i = 0; i < length; ++i)
+                Observe(automaton, A, 1000 + i);
+            Observe(automaton, A, 7);
+            Observe(automaton, B, 7);
+
+            BenchTimer timer;
+            TeslaAutomaton* clone = Assert(automaton, 7);
+            elapsed.push_back(timer.ElapsedNs());
+
+            assert(!clone->state.hasFailed && clone->state.isCorrect);
+            EndBound(automaton, clone);
+        }
+
+        std::sort(elapsed.begin(), elapsed.end());
+        std::cout << "  " << length + 2 << "\t\t" << elapsed[rounds / 2] << "\n";
+    }
+}
+
+int main()
+{
+    TestPasses();
+    TestIgnoresOtherValues();
+    TestMissingEvent();
+    TestRepeatedValue();
+    TestOverflow();
+    BenchmarkBoundLength();
+
+    TestPassed("History");
+    return 0;
+}
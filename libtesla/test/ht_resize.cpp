@@ -0,0 +1,151 @@
+extern "C" {
+#include "TeslaStore.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <algorithm>
+#include <cassert>
+
+/*
+ * Incremental resizing of TESLA_STORE_HT: entries stay reachable while they
+ * move from the old table to the new one, and the benchmark compares the tail
+ * latency of inserts with and without it.
+ */
+
+const size_t NUM_KEYS = 100000;
+const size_t NUM_BENCH_KEYS = 1000000;
+
+/* Keys look like the addresses of distinct objects. */
+size_t MakeKey(size_t i)
+{
+    return 0x7f0000000000 + i * 64;
+}
+
+void TestMigration(bool incremental)
+{
+    TeslaHT table;
+    bool ok = TeslaHT_Create(16, sizeof(size_t), &table);
+    assert(ok);
+    table.incrementalResize = incremental;
+
+    bool merged = false;
+    for (size_t i = 0; i < NUM_KEYS; ++i)
+    {
+        size_t key = MakeKey(i);
+        ok = TeslaHT_Insert(&table, 1ULL << (i % 60), &key);
+        assert(ok);
+        assert(incremental || table.oldTable == NULL);
+
+        // Right after a resize the first keys are still in the old table, updates must reach them there.
+        if (!merged && table.oldTable != NULL && table.oldCapacity >= 1024)
+        {
+            assert(table.migrated == 0);
+            for (size_t k = 0; k < 4; ++k)
+            {
+                size_t oldKey = MakeKey(k);
+                TeslaHT_Insert(&table, 1ULL << 61, &oldKey);
+            }
+
+            assert(table.size == i + 1);
+            merged = true;
+        }
+
+        // Lookups see every key, wherever it is at the moment.
+        if (i % 997 == 0)
+        {
+            for (size_t k = 0; k <= i; k += 101)
+            {
+                size_t lookupKey = MakeKey(k);
+                assert(TeslaHT_LookupTag(&table, &lookupKey) & (1ULL << (k % 60)));
+            }
+        }
+    }
+
+    assert(merged == incremental);
+    assert(table.size == NUM_KEYS);
+
+    for (size_t i = 0; i < NUM_KEYS; ++i)
+    {
+        size_t key = MakeKey(i);
+        uint64_t expected = (1ULL << (i % 60)) | (incremental && i < 4 ? 1ULL << 61 : 0);
+        assert(TeslaHT_LookupTag(&table, &key) == expected);
+    }
+
+    size_t missing = 3;
+    assert(TeslaHT_LookupTag(&table, &missing) == 0);
+
+    TeslaHT_Destroy(&table);
+}
+
+void TestClearDuringMigration()
+{
+    TeslaHT table;
+    TeslaHT_Create(16, sizeof(size_t), &table);
+    table.incrementalResize = true;
+
+    size_t i = 0;
+    do
+    {
+        size_t key = MakeKey(i++);
+        TeslaHT_Insert(&table, 1, &key);
+    } while (table.oldTable == NULL || table.oldCapacity < 1024);
+
+    TeslaHT_Clear(&table);
+    assert(table.oldTable == NULL && table.size == 0);
+
+    for (size_t k = 0; k < i; ++k)
+    {
+        size_t key = MakeKey(k);
+        assert(TeslaHT_LookupTag(&table, &key) == 0);
+    }
+
+    size_t key = MakeKey(1);
+    TeslaHT_Insert(&table, 2, &key);
+    assert(TeslaHT_LookupTag(&table, &key) == 2);
+
+    TeslaHT_Destroy(&table);
+}
+
+void Benchmark(const char* name, bool incremental)
+{
+    TeslaStore store;
+    TeslaStore_Create(TESLA_STORE_HT, 16, sizeof(size_t), &store);
+    store.store.hashtable.incrementalResize = incremental;
+
+    std::vector<double> elapsed;
+    elapsed.reserve(NUM_BENCH_KEYS);
+
+    BenchTimer total;
+    for (size_t i = 0; i < NUM_BENCH_KEYS; ++i)
+    {
+        size_t key = MakeKey(i);
+
+        BenchTimer timer;
+        TeslaStore_Insert(&store, 1, &key);
+        elapsed.push_back(timer.ElapsedNs());
+    }
+    double totalMs = total.ElapsedNs() / 1e6;
+
+    TeslaStore_Destroy(&store);
+
+    std::sort(elapsed.begin(), elapsed.end());
+    auto percentile = [&](double p) { return elapsed[(size_t)(p * (elapsed.size() - 1))]; };
+
+    std::cout << "  " << name << "\t" << percentile(0.5) << "\t" << percentile(0.99) << "\t" << percentile(0.999) << "\t"
+              << percentile(0.9999) << "\t" << elapsed.back() << "\t" << totalMs << "\n";
+}
+
+int main()
+{
+    TestMigration(true);
+    TestMigration(false);
+    TestClearDuringMigration();
+
+    std::cout << "# resize\tp50 ns\tp99\tp99.9\tp99.99\tmax\ttotal ms (1M distinct keys)\n";
+    Benchmark("sync\t", false);
+    Benchmark("incremental", true);
+
+    TestPassed("Incremental resize");
+    return 0;
+}
@@ -0,0 +1,204 @@
+extern "C" {
+#include "TeslaStore.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <thread>
+
+/*
+ * Stores of parametric events are taken on their first insert and go back to
+ * the pool of the thread when the automaton is next initialized. The benchmark
+ * gives the cost of entering a bound, and of the inserts that follow, when
+ * few or all of the parametric events happen in it.
+ */
+
+const size_t NUM_PARAMETRIC = 8;
+const size_t NUM_BENCH_BOUNDS = 1 << 18;
+
+std::vector<TestEvent> MakeDescription()
+{
+    std::vector<TestEvent> description = {Deterministic()};
+    for (size_t i = 0; i < NUM_PARAMETRIC; ++i)
+        description.push_back(Parametric(2));
+    description.push_back(AssertionSite());
+    description.push_back(Deterministic());
+    return description;
+}
+
+void TestLazy()
+{
+    TestAutomaton automaton("lazy", {Deterministic(), Parametric(2), Parametric(1), SingleStore(Parametric(2)), AssertionSite(),
+                                     Deterministic()},
+                            false);
+    TeslaAutomaton* base = automaton.Get();
+
+    TA_Init(base);
+    assert(base->state.isCorrect);
+    for (size_t i = 0; i < base->numEvents; ++i)
+        assert(base->eventStates[i].store == NULL);
+
+    // An event that has not happened has no store, and looking it up does not create one.
+    size_t key[2] = {0x1000, 0x2000};
+    assert(TeslaStore_Get(base->eventStates[1].store, key) == 0);
+    assert(base->eventStates[1].store == NULL);
+
+    TeslaStore* store = TA_GetStore(base, automaton.Event(1));
+    assert(store != NULL && store == base->eventStates[1].store);
+    assert(store->type == TESLA_DEFAULT_STORE && store->dataSize == 2 * sizeof(size_t));
+    assert(TA_GetStore(base, automaton.Event(1)) == store);
+
+    TeslaStore_Insert(store, 2, key);
+    assert(TeslaStore_Get(store, key) == 2);
+
+    TeslaStore* single = TA_GetStore(base, automaton.Event(3));
+    assert(single->type == TESLA_STORE_SINGLE);
+    assert(base->eventStates[2].store == NULL);
+
+    // The next bound reuses the stores of the same kind, emptied.
+    TA_Init(base);
+    assert(base->eventStates[1].store == NULL && base->eventStates[3].store == NULL);
+
+    TeslaStore* narrow = TA_GetStore(base, automaton.Event(2));
+    assert(narrow != store && narrow != single); // Other data size.
+    assert(TA_GetStore(base, automaton.Event(1)) == store);
+    assert(TeslaStore_Get(store, key) == 0);
+    assert(TA_GetStore(base, automaton.Event(3)) == single);
+
+    TA_ClearEventStates(base);
+}
+
+void TestLargeData()
+{
+    // Too big for the pool, released stores are freed.
+    const size_t words = TESLA_STORE_POOL_MAX_WORDS + 1;
+    std::vector<size_t> key(words, 3);
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        TeslaStore* store = TeslaStore_Acquire(TESLA_STORE_SINGLE, 1, words * sizeof(size_t));
+        assert(store != NULL && store->type == TESLA_DEFAULT_STORE);
+        assert(TeslaStore_Get(store, key.data()) == 0);
+
+        TeslaStore_Insert(store, 1, key.data());
+        TeslaStore_Release(store);
+    }
+}
+
+/* A thread fills its pool and exits, the pool is freed then. */
+void TestThreadExit()
+{
+    std::thread thread([] {
+        std::vector<TeslaStore*> stores;
+        for (size_t i = 0; i < 64; ++i)
+            stores.push_back(TeslaStore_Acquire(TESLA_STORE_HT, 16, sizeof(size_t)));
+
+        for (auto store : stores)
+            TeslaStore_Release(store);
+
+        // Released last, taken first.
+        assert(TeslaStore_Acquire(TESLA_STORE_HT, 16, sizeof(size_t)) == stores.back());
+        TeslaStore_Release(stores.back());
+    });
+
+    thread.join();
+}
+
+/*
+ * Enters a bound, and inserts into the first `fired` parametric events. Eager
+ * takes the store of every parametric event at the entry, which is what
+ * TA_Init used to do.
+ */
+double MeasureBound(bool eager, size_t fired)
+{
+    TestAutomaton automaton("bench", MakeDescription(), false);
+    TeslaAutomaton* base = automaton.Get();
+
+    size_t key[2] = {0x7f0000001000, 0x7f0000002000};
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+    {
+        TA_Init(base);
+
+        if (eager)
+        {
+            for (size_t event = 1; event <= NUM_PARAMETRIC; ++event)
+                TA_GetStore(base, automaton.Event(event));
+        }
+
+        key[1] += 64;
+        for (size_t event = 1; event <= fired; ++event)
+            TeslaStore_Insert(TA_GetStore(base, automaton.Event(event)), 1, key);
+
+        TA_Reset(base);
+    }
+    double ns = timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+
+    TA_ClearEventStates(base);
+    return ns;
+}
+
+/*
+ * The first entry of a new automaton, such as the clone of a new thread: the
+ * stores used to be created then, without a pool to take them from.
+ */
+double MeasureFirstEntry(bool eager)
+{
+    TestAutomaton automaton("first", MakeDescription(), false);
+    TeslaAutomaton* base = automaton.Get();
+
+    double elapsed = 0;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS / 16; ++i)
+    {
+        BenchTimer timer;
+        TA_Init(base);
+
+        if (eager)
+        {
+            for (size_t event = 1; event <= NUM_PARAMETRIC; ++event)
+            {
+                TeslaStore* store = (TeslaStore*)TeslaMalloc(sizeof(TeslaStore));
+                TeslaStore_Create(TESLA_DEFAULT_STORE, 16, 2 * sizeof(size_t), store);
+                base->eventStates[event].store = store;
+            }
+        }
+        elapsed += timer.ElapsedNs();
+
+        for (size_t event = 1; event <= NUM_PARAMETRIC; ++event)
+        {
+            TeslaStore* store = base->eventStates[event].store;
+            if (store != NULL)
+            {
+                TeslaStore_Destroy(store);
+                TeslaFree(store);
+                base->eventStates[event].store = NULL;
+            }
+        }
+
+        TA_Reset(base);
+    }
+
+    return elapsed / (NUM_BENCH_BOUNDS / 16);
+}
+
+int main()
+{
+    TestLazy();
+    TestLargeData();
+    TestThreadExit();
+
+    std::cout << "# entry\t\tns/bound, " << NUM_PARAMETRIC << " parametric events of which 0, 1 or all happen\n";
+    std::cout << "  lazy\t\t" << MeasureBound(false, 0) << "\t" << MeasureBound(false, 1) << "\t"
+              << MeasureBound(false, NUM_PARAMETRIC) << "\n";
+    std::cout << "  eager\t\t" << MeasureBound(true, 0) << "\t" << MeasureBound(true, 1) << "\t"
+              << MeasureBound(true, NUM_PARAMETRIC) << "\n";
+
+    std::cout << "# first entry\tns\n";
+    std::cout << "  lazy\t\t" << MeasureFirstEntry(false) << "\n";
+    std::cout << "  eager\t\t" << MeasureFirstEntry(true) << "\n";
+
+    TestPassed("Lazy stores");
+    return 0;
+}
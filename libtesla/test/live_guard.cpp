@@ -0,0 +1,200 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <random>
+#include <thread>
+
+/*
+ * Instrumented code only calls into the runtime for an event that cannot start
+ * a thread-local automaton if the live byte of the automaton is set in the
+ * thread. Checks that skipping those calls never changes what the automaton
+ * does, that every thread has its own bytes, and times the guard against the
+ * plain call with the automaton live and not.
+ */
+
+const size_t NUM_SEQUENCES = 20000;
+const size_t NUM_BENCH_CYCLES = 1 << 22;
+
+const size_t NUM_AUTOMATA = 16;
+
+bool IsLive(TestAutomaton& automaton)
+{
+    return teslaLiveAutomata[automaton.Get()->id];
+}
+
+/* What ThinTeslaInstrumenter::CreateGuardedUpdate emits. */
+inline void GuardedUpdate(TestAutomaton& automaton, size_t id)
+{
+    TeslaEvent* event = automaton.Event(id);
+
+    if (event->flags.isInitial || event->flags.isAssertion || __builtin_expect(IsLive(automaton), 0))
+        UpdateAutomatonDeterministic(automaton.Get(), event);
+}
+
+void CheckSameState(TestAutomaton& plain, TestAutomaton& guarded)
+{
+    TeslaAutomaton* a = GetThreadAutomaton(plain.Get());
+    TeslaAutomaton* b = GetThreadAutomaton(guarded.Get());
+
+    assert((a != NULL) == (b != NULL));
+    if (a == NULL)
+        return;
+
+    assert(a->state.isInit == b->state.isInit);
+    if (!a->state.isInit)
+        return;
+
+    assert(a->state.currentEvent->id == b->state.currentEvent->id);
+    assert(a->state.isActive == b->state.isActive);
+    assert(a->state.hasFailed == b->state.hasFailed);
+    assert(a->state.reachedAssertion == b->state.reachedAssertion);
+
+    // Live for at least as long as the automaton is active.
+    assert(!b->state.isActive || IsLive(guarded));
+}
+
+void TestLifetime()
+{
+    std::vector<TestEvent> description = {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+    TestAutomaton automaton("lifetime", description, true, 0, NUM_AUTOMATA);
+
+    // Only an initial event can start the automaton.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    assert(!IsLive(automaton));
+
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    assert(IsLive(automaton));
+
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    assert(IsLive(automaton));
+
+    // The assertion site is the last event before the end: the automaton has completed.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+    assert(!IsLive(automaton));
+    EndAutomaton(automaton.Get(), automaton.End());
+
+    // The end of the bound clears it too.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    assert(IsLive(automaton));
+    EndAutomaton(automaton.Get(), automaton.End());
+    assert(!IsLive(automaton));
+}
+
+void TestThreads()
+{
+    std::vector<TestEvent> description = {Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+    TestAutomaton automaton("threads", description, true, 1, NUM_AUTOMATA);
+
+    // Keep the base for this thread, so that the other one gets a clone.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    assert(IsLive(automaton));
+
+    std::thread other([&]() {
+        assert(!IsLive(automaton));
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+        assert(GetThreadAutomaton(automaton.Get()) != automaton.Get());
+        assert(IsLive(automaton));
+
+        EndAutomaton(automaton.Get(), automaton.End());
+        assert(!IsLive(automaton));
+    });
+    other.join();
+
+    assert(IsLive(automaton));
+    EndAutomaton(automaton.Get(), automaton.End());
+    assert(!IsLive(automaton));
+}
+
+void ResetBoth(TestAutomaton& plain, TestAutomaton& guarded)
+{
+    // Ending the bound would panic on a failed automaton, and failures are compared too.
+    for (TestAutomaton* automaton : {&plain, &guarded})
+    {
+        TeslaAutomaton* clone = GetThreadAutomaton(automaton->Get());
+        if (clone != NULL && clone->state.isInit)
+            TA_Reset(clone);
+    }
+}
+
+void TestEquivalence()
+{
+    std::vector<std::vector<TestEvent>> descriptions = {
+        {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), OR(Deterministic()), OR(Deterministic()), AssertionSite(), Deterministic(), Deterministic()},
+        {Deterministic(), Optional(Deterministic()), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), Deterministic(), AssertionSite(), OR(Deterministic()), OR(Deterministic()), Deterministic(), Deterministic()},
+    };
+
+    std::mt19937 rng(13);
+
+    for (size_t d = 0; d < descriptions.size(); ++d)
+    {
+        auto& description = descriptions[d];
+        TestAutomaton plain("plain", description, true, 2 + 2 * d, NUM_AUTOMATA);
+        TestAutomaton guarded("guarded", description, true, 3 + 2 * d, NUM_AUTOMATA);
+
+        size_t numEvents = description.size();
+
+        for (size_t sequence = 0; sequence < NUM_SEQUENCES; ++sequence)
+        {
+            // Random events, so that most sequences start outside of the automaton and many complete early.
+            size_t length = 1 + rng() % (2 * numEvents);
+
+            for (size_t i = 0; i < length; ++i)
+            {
+                size_t id = 1 + rng() % (numEvents - 2);
+
+                UpdateAutomatonDeterministic(plain.Get(), plain.Event(id));
+                GuardedUpdate(guarded, id);
+                CheckSameState(plain, guarded);
+            }
+
+            ResetBoth(plain, guarded);
+        }
+    }
+}
+
+template <typename Update>
+double Measure(Update update)
+{
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+        update();
+
+    return timer.ElapsedNs() / NUM_BENCH_CYCLES;
+}
+
+void Benchmark()
+{
+    std::cout << "# automaton\tsite\t\tns/event\n";
+
+    std::vector<TestEvent> description = {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+    TestAutomaton automaton("bench", description, true, NUM_AUTOMATA - 1, NUM_AUTOMATA);
+
+    // An event of an automaton that is not running, which is what most sites see.
+    double plainIdle = Measure([&]() { UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2)); });
+    double guardedIdle = Measure([&]() { GuardedUpdate(automaton, 2); });
+
+    // The same event while the automaton runs, which starts it over every time.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    double plainLive = Measure([&]() { UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2)); });
+    double guardedLive = Measure([&]() { GuardedUpdate(automaton, 2); });
+    TA_Reset(GetThreadAutomaton(automaton.Get()));
+
+    std::cout << "  idle\t\tcall\t\t" << plainIdle << "\n";
+    std::cout << "  idle\t\tguarded\t\t" << guardedIdle << "\n";
+    std::cout << "  live\t\tcall\t\t" << plainLive << "\n";
+    std::cout << "  live\t\tguarded\t\t" << guardedLive << "\n";
+}
+
+int main()
+{
+    TestLifetime();
+    TestThreads();
+    TestEquivalence();
+    Benchmark();
+
+    TestPassed("Live guard");
+    return 0;
+}
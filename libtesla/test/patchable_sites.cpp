@@ -0,0 +1,142 @@
+#include "thintesla_helpers.h"
+
+#include "TeslaSites.h"
+
+#include <cassert>
+#include <cstdlib>
+
+/*
+ * Sites like the ones emitted with -thin-tesla-patchable, written as the same
+ * asm: enabling and disabling automata must patch exactly their sites, in
+ * place, and a disabled site should cost next to nothing.
+ */
+
+const size_t NUM_BENCH_CYCLES = 1 << 24;
+
+extern "C" TeslaSite __start_tesla_sites[] __attribute__((visibility("hidden")));
+extern "C" TeslaSite __stop_tesla_sites[] __attribute__((visibility("hidden")));
+
+static const char first[] = "first";
+static const char second[] = "second";
+
+#define SITE(name)                                       \
+    ({                                                   \
+        uint8_t enabled;                                 \
+        __asm__ volatile("movb $0, %0\n"                 \
+                         "1:\n"                          \
+                         "\t.pushsection tesla_sites,\"aw\"\n" \
+                         "\t.balign 8\n"                 \
+                         "\t.quad 1b - 1\n"              \
+                         "\t.quad %c1\n"                 \
+                         "\t.popsection"                 \
+                         : "=q"(enabled)                 \
+                         : "i"(name));                   \
+        enabled;                                         \
+    })
+
+__attribute__((noinline)) bool FirstSite()
+{
+    return SITE(first);
+}
+
+__attribute__((noinline)) bool OtherFirstSite()
+{
+    return SITE(first);
+}
+
+__attribute__((noinline)) bool SecondSite()
+{
+    return SITE(second);
+}
+
+size_t CountSites(const char* name)
+{
+    size_t count = 0;
+    for (TeslaSite* site = __start_tesla_sites; site < __stop_tesla_sites; ++site)
+        count += strcmp(site->automaton, name) == 0;
+
+    return count;
+}
+
+void TestPatching()
+{
+    // The benchmark has sites of its own.
+    size_t numFirst = CountSites(first);
+    assert(numFirst >= 2 && CountSites(second) == 1);
+
+    // Only the sites of automata listed in TESLA_ENABLE start enabled.
+    setenv("TESLA_ENABLE", "none,second", 1);
+    TeslaRegisterSites(__start_tesla_sites, __stop_tesla_sites);
+    assert(!FirstSite() && !OtherFirstSite() && SecondSite());
+
+    // Registering again must not reapply TESLA_ENABLE.
+    TeslaDisableAutomaton(second);
+    TeslaRegisterSites(__start_tesla_sites, __stop_tesla_sites);
+    assert(!SecondSite());
+
+    assert(TeslaEnableAutomaton("first") == numFirst);
+    assert(FirstSite() && OtherFirstSite() && !SecondSite());
+
+    assert(TeslaEnableAutomaton("unknown") == 0);
+    assert(TeslaEnableAutomaton("firs") == 0);
+
+    assert(TeslaDisableAutomaton("first") == numFirst);
+    assert(!FirstSite() && !OtherFirstSite() && !SecondSite());
+}
+
+int counter = 0;
+
+__attribute__((noinline)) void Hook()
+{
+    __asm__ volatile("" ::: "memory");
+    counter++;
+}
+
+void Benchmark()
+{
+    std::cout << "# site\t\tns/event\n";
+
+    BenchTimer none;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+        __asm__ volatile("" ::: "memory");
+    double noneNs = none.ElapsedNs() / NUM_BENCH_CYCLES;
+
+    BenchTimer disabled;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+    {
+        if (__builtin_expect(SITE(first), 0))
+            Hook();
+    }
+    double disabledNs = disabled.ElapsedNs() / NUM_BENCH_CYCLES;
+
+    TeslaEnableAutomaton(first);
+    BenchTimer enabled;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+    {
+        if (__builtin_expect(SITE(first), 0))
+            Hook();
+    }
+    double enabledNs = enabled.ElapsedNs() / NUM_BENCH_CYCLES;
+    TeslaDisableAutomaton(first);
+
+    BenchTimer call;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+        Hook();
+    double callNs = call.ElapsedNs() / NUM_BENCH_CYCLES;
+
+    assert(counter == 2 * NUM_BENCH_CYCLES);
+
+    std::cout << "  none\t\t" << noneNs << "\n";
+    std::cout << "  disabled\t" << disabledNs << "\n";
+    std::cout << "  enabled\t" << enabledNs << "\n";
+    std::cout << "  call\t\t" << callNs << "\n";
+}
+
+int main()
+{
+    TestPatching();
+    Benchmark();
+
+    TestPassed("Patchable sites");
+    return 0;
+}
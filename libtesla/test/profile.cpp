@@ -0,0 +1,129 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Cycle profiling, in builds with TESLA_PROFILE: every hook is timed under
+ * the event it was called for, profiles of exited threads are kept, and the
+ * dump names every automaton. Other builds only run the benchmark, so the
+ * cost of profiling is the difference between the two.
+ */
+
+const size_t NUM_AUTOMATA = 4;
+const size_t NUM_BOUNDS = 10000;
+const size_t NUM_THREADS = 4;
+const size_t NUM_BENCH_BOUNDS = 1 << 20;
+
+std::vector<TestEvent> MakeDescription()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+void RunBound(TestAutomaton& automaton)
+{
+    for (size_t event = 1; event < 4; ++event)
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(event));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+TeslaProfileSummary GetProfile(TestAutomaton& automaton, size_t eventId)
+{
+    TeslaProfileSummary summary;
+    bool found = TeslaGetProfile(automaton.Get(), eventId, &summary);
+    assert(found);
+    return summary;
+}
+
+void TestProfile()
+{
+    TestAutomaton automaton("profiled", MakeDescription(), true, 0, NUM_AUTOMATA);
+
+    for (size_t i = 0; i < NUM_BOUNDS; ++i)
+        RunBound(automaton);
+
+    TeslaProfileSummary summary;
+    assert(!TeslaGetProfile(automaton.Get(), 0, &summary)); // The start has no hook here.
+
+    for (size_t event = 1; event < automaton.Get()->numEvents; ++event)
+    {
+        summary = GetProfile(automaton, event);
+        assert(summary.count == NUM_BOUNDS);
+        assert(summary.mean == summary.cycles / summary.count);
+        assert(summary.p50 <= summary.p99);
+    }
+}
+
+void TestThreads()
+{
+    TestAutomaton automaton("threads", MakeDescription(), true, 1, NUM_AUTOMATA);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&] {
+            for (size_t k = 0; k < NUM_BOUNDS; ++k)
+                RunBound(automaton);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    assert(GetProfile(automaton, 1).count == NUM_THREADS * NUM_BOUNDS);
+    assert(GetProfile(automaton, 4).count == NUM_THREADS * NUM_BOUNDS);
+}
+
+void TestDump()
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    TeslaDumpProfile(fds[1]);
+    close(fds[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, length);
+    close(fds[0]);
+
+    assert(output.find("[TESLA] automaton\tevent\tcount") == 0);
+    assert(output.find("[TESLA] profiled\t1\t10000\t") != std::string::npos);
+    assert(output.find("[TESLA] threads\t4\t40000\t") != std::string::npos);
+    assert(output.find("[TESLA] total\t") != std::string::npos);
+}
+
+double Measure()
+{
+    TestAutomaton automaton("bench", MakeDescription(), true, 2, NUM_AUTOMATA);
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+        RunBound(automaton);
+
+    return timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+}
+
+int main()
+{
+    TestAutomaton probe("probe", MakeDescription(), true, 3, NUM_AUTOMATA);
+    RunBound(probe);
+
+    TeslaProfileSummary summary;
+    bool enabled = TeslaGetProfile(probe.Get(), 1, &summary);
+
+    if (enabled)
+    {
+        TestProfile();
+        TestThreads();
+        TestDump();
+    }
+
+    std::cout << "# profile\tns/bound\n";
+    std::cout << "  " << (enabled ? "on" : "off") << "\t\t" << Measure() << "\n";
+
+    TestPassed("Profile");
+    return 0;
+}
@@ -0,0 +1,147 @@
+extern "C" {
+#include "TeslaStore.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <cstdint>
+
+/*
+ * Generation-tagged clearing: stores and histories are reset by bumping a
+ * counter, and whatever was written before reads as empty. An automaton that
+ * is reset clears them when it is next initialized.
+ */
+
+void FillStore(TeslaStore* store, size_t numKeys, size_t base)
+{
+    for (size_t i = 0; i < numKeys; ++i)
+    {
+        size_t key = base + i * 64;
+        bool ok = TeslaStore_Insert(store, 1 + (i % 8), &key);
+        assert(ok);
+    }
+}
+
+void CheckStore(TeslaStore* store, size_t numKeys, size_t base, bool present)
+{
+    for (size_t i = 0; i < numKeys; ++i)
+    {
+        size_t key = base + i * 64;
+        assert(TeslaStore_Get(store, &key) == (present ? 1 + (i % 8) : 0));
+    }
+}
+
+void TestStoreClear(StoreType type)
+{
+    TeslaStore store;
+    TeslaStore_Create(type, 16, sizeof(size_t), &store);
+
+    FillStore(&store, 1000, 0x10000);
+    CheckStore(&store, 1000, 0x10000, true);
+
+    TeslaStore_Clear(&store);
+    CheckStore(&store, 1000, 0x10000, false);
+
+    // Stale entries must not stop the new ones from being found, even after a resize.
+    FillStore(&store, 3000, 0x20000);
+    CheckStore(&store, 3000, 0x20000, true);
+    CheckStore(&store, 1000, 0x10000, false);
+
+    TeslaStore_Destroy(&store);
+}
+
+void TestGenerationWrap()
+{
+    TeslaStore ht, swiss;
+    TeslaStore_Create(TESLA_STORE_HT, 16, sizeof(size_t), &ht);
+    TeslaStore_Create(TESLA_STORE_SWISS, 16, sizeof(size_t), &swiss);
+
+    FillStore(&ht, 10, 0x10000);
+    FillStore(&swiss, 10, 0x10000);
+
+    // After the counter wraps, old entries would carry a current generation again.
+    ht.store.hashtable.generation = UINT32_MAX;
+    swiss.store.swiss.generation = UINT32_MAX;
+    FillStore(&ht, 10, 0x30000);
+    FillStore(&swiss, 10, 0x30000);
+
+    TeslaStore_Clear(&ht);
+    TeslaStore_Clear(&swiss);
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        CheckStore(&ht, 10, 0x30000, false);
+        CheckStore(&swiss, 10, 0x30000, false);
+        TeslaStore_Clear(&ht);
+        TeslaStore_Clear(&swiss);
+    }
+
+    TeslaStore_Destroy(&ht);
+    TeslaStore_Destroy(&swiss);
+}
+
+void TestAutomatonReset()
+{
+    TestAutomaton automaton("reset", {Deterministic(), Parametric(1), AssertionSite(), Deterministic()}, true);
+
+    size_t value = 7;
+    UpdateAutomaton(automaton.Get(), automaton.Event(1), &value);
+
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+    assert(clone->history->numObservations == 1);
+
+    EndAutomaton(automaton.Get(), automaton.End());
+    assert(!clone->state.isInit);
+
+    // The history is only cleared once the automaton is used again.
+    UpdateAutomaton(automaton.Get(), automaton.Event(1), &value);
+    assert(GetThreadAutomaton(automaton.Get()) == clone);
+    assert(clone->history->numObservations == 1);
+
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void BenchmarkClear()
+{
+    std::cout << "# store\tentries\tns/clear\n";
+
+    for (StoreType type : {TESLA_STORE_HT, TESLA_STORE_SWISS})
+    {
+        for (size_t numKeys = 16; numKeys <= 16384; numKeys *= 4)
+        {
+            TeslaStore store;
+            TeslaStore_Create(type, 16, sizeof(size_t), &store);
+            FillStore(&store, numKeys, 0x10000);
+
+            // Each round writes a handful of entries and ends the bound, like a short request would.
+            const size_t rounds = 10000;
+            double elapsed = 0;
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                FillStore(&store, 4, 0x10000 + round * 256);
+
+                BenchTimer timer;
+                TeslaStore_Clear(&store);
+                elapsed += timer.ElapsedNs();
+            }
+
+            std::cout << "  " << (type == TESLA_STORE_HT ? "ht" : "swiss") << "\t" << numKeys << "\t"
+                      << elapsed / rounds << "\n";
+
+            TeslaStore_Destroy(&store);
+        }
+    }
+}
+
+int main()
+{
+    TestStoreClear(TESLA_STORE_HT);
+    TestStoreClear(TESLA_STORE_SWISS);
+    TestGenerationWrap();
+    TestAutomatonReset();
+    BenchmarkClear();
+
+    TestPassed("Reset");
+    return 0;
+}
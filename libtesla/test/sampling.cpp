@@ -0,0 +1,125 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+/*
+ * Sampled checking: with a sample rate of N, about one temporal bound in N is
+ * checked, and the others must not move the automaton at all.
+ */
+
+const size_t NUM_BOUNDS = 40000;
+const size_t NUM_BENCH_BOUNDS = 1 << 20;
+
+const size_t NUM_AUTOMATA = 8;
+
+std::vector<TestEvent> MakeDescription()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+/* Runs one bound that takes every event, and returns whether it was checked. */
+bool RunBound(TestAutomaton& automaton)
+{
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+    assert(clone != NULL && clone->state.isInit);
+    bool tracked = clone->state.isActive;
+
+    if (!tracked)
+    {
+        assert(!teslaLiveAutomata[automaton.Get()->id]);
+        assert(clone->state.currentEvent == automaton.Event(0));
+    }
+
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    assert(clone->state.currentEvent == automaton.Event(tracked ? 2 : 0));
+
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+    assert(clone->state.reachedAssertion == tracked && !clone->state.hasFailed);
+
+    EndAutomaton(automaton.Get(), automaton.End());
+    return tracked;
+}
+
+void TestRate(size_t id, size_t rate)
+{
+    TestAutomaton automaton("rate", MakeDescription(), true, id, NUM_AUTOMATA);
+    automaton.Get()->sampleRate = rate;
+
+    size_t numTracked = 0;
+    for (size_t i = 0; i < NUM_BOUNDS; ++i)
+        numTracked += RunBound(automaton);
+
+    size_t tracked, untracked;
+    assert(TeslaGetSampleCounts(automaton.Get(), &tracked, &untracked));
+
+    if (rate <= 1)
+    {
+        // Not sampled, nothing to count.
+        assert(numTracked == NUM_BOUNDS);
+        assert(tracked == 0 && untracked == 0);
+        return;
+    }
+
+    assert(tracked == numTracked && tracked + untracked == NUM_BOUNDS);
+
+    // Well within five standard deviations.
+    double expected = (double)NUM_BOUNDS / rate;
+    assert(std::fabs(numTracked - expected) < 5 * std::sqrt(expected));
+}
+
+void TestEnvironment()
+{
+    setenv("TESLA_SAMPLE_RATE", "other=2,named=8,3", 1);
+
+    TestAutomaton named("named", MakeDescription(), true, 4, NUM_AUTOMATA);
+    TestAutomaton unnamed("unnamed", MakeDescription(), true, 5, NUM_AUTOMATA);
+    unnamed.Get()->sampleRate = 100;
+
+    RunBound(named);
+    RunBound(unnamed);
+    assert(named.Get()->sampleRate == 8);
+    assert(unnamed.Get()->sampleRate == 3);
+
+    unsetenv("TESLA_SAMPLE_RATE");
+}
+
+double Measure(size_t id, size_t rate)
+{
+    TestAutomaton automaton("bench", MakeDescription(), true, id, NUM_AUTOMATA);
+    automaton.Get()->sampleRate = rate;
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+    {
+        for (size_t id = 1; id < 4; ++id)
+            UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(id));
+        EndAutomaton(automaton.Get(), automaton.End());
+    }
+
+    return timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+}
+
+void Benchmark()
+{
+    std::cout << "# sample rate\tns/bound\n";
+
+    size_t id = 6;
+    for (size_t rate : {1, 16})
+        std::cout << "  " << rate << "\t\t" << Measure(id++, rate) << "\n";
+}
+
+int main()
+{
+    TestRate(0, 1);
+    TestRate(1, 4);
+    TestRate(2, 100);
+    TestEnvironment();
+    Benchmark();
+
+    TestPassed("Sampling");
+    return 0;
+}
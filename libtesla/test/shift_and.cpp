@@ -0,0 +1,172 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <random>
+
+/*
+ * The shift-and engine must follow exactly the same transitions as
+ * UpdateAutomatonDeterministicGeneric. Both are driven with the same random
+ * event streams, and then timed against each other.
+ */
+
+const size_t NUM_SEQUENCES = 20000;
+const size_t NUM_BENCH_EVENTS = 1 << 22;
+
+// Every automaton gets its own id, so that the per-thread table never hands out the clone of another one.
+const size_t NUM_AUTOMATA = 32;
+
+std::vector<std::vector<TestEvent>> MakeDescriptions()
+{
+    return {
+        {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), Deterministic(), OR(Deterministic()), OR(Deterministic()), OR(Deterministic()), AssertionSite(), Deterministic()},
+        {Deterministic(), Optional(Deterministic()), Optional(Deterministic()), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), OR(Deterministic()), OR(Deterministic()), AssertionSite(), Deterministic(), Deterministic()},
+        {Deterministic(), Deterministic(), AssertionSite(), OR(Deterministic()), OR(Deterministic()), Deterministic(), Deterministic()},
+    };
+}
+
+void CheckSameState(TestAutomaton& generic, TestAutomaton& shiftAnd)
+{
+    TeslaAutomaton* a = GetThreadAutomaton(generic.Get());
+    TeslaAutomaton* b = GetThreadAutomaton(shiftAnd.Get());
+
+    assert((a != NULL) == (b != NULL));
+    if (a == NULL)
+        return;
+
+    assert(a->state.isInit == b->state.isInit);
+    if (!a->state.isInit)
+        return;
+
+    assert(a->state.currentEvent->id == b->state.currentEvent->id);
+    assert(a->state.isActive == b->state.isActive);
+    assert(a->state.hasFailed == b->state.hasFailed);
+    assert(a->state.reachedAssertion == b->state.reachedAssertion);
+}
+
+void ResetBoth(TestAutomaton& generic, TestAutomaton& shiftAnd)
+{
+    // Ending the bound would panic on a failed automaton, and we want to compare failures too.
+    for (TestAutomaton* automaton : {&generic, &shiftAnd})
+    {
+        TeslaAutomaton* clone = GetThreadAutomaton(automaton->Get());
+        if (clone != NULL && clone->state.isInit)
+            TA_Reset(clone);
+    }
+}
+
+void TestEquivalence()
+{
+    std::mt19937 rng(7);
+
+    auto descriptions = MakeDescriptions();
+    for (size_t d = 0; d < descriptions.size(); ++d)
+    {
+        auto& description = descriptions[d];
+        TestAutomaton generic("generic", description, true, 2 * d, NUM_AUTOMATA);
+        TestAutomaton shiftAnd("shift-and", description, true, 2 * d + 1, NUM_AUTOMATA);
+
+        assert(shiftAnd.Get()->flags.isShiftAnd);
+        generic.Get()->flags.isShiftAnd = false;
+
+        size_t numEvents = description.size();
+
+        for (size_t sequence = 0; sequence < NUM_SEQUENCES; ++sequence)
+        {
+            // Mostly walk forward, with random jumps to any event but the bounds.
+            size_t length = 1 + rng() % (2 * numEvents);
+            size_t id = 1;
+
+            for (size_t i = 0; i < length; ++i)
+            {
+                if (rng() % 4 == 0)
+                    id = 1 + rng() % (numEvents - 2);
+
+                UpdateAutomatonDeterministic(generic.Get(), generic.Event(id));
+                UpdateAutomatonDeterministic(shiftAnd.Get(), shiftAnd.Event(id));
+                CheckSameState(generic, shiftAnd);
+
+                id = 1 + id % (numEvents - 2);
+            }
+
+            ResetBoth(generic, shiftAnd);
+        }
+    }
+}
+
+void TestLargeAutomataUseGeneric()
+{
+    std::vector<TestEvent> description(TESLA_SHIFT_AND_MAX_EVENTS + 1, Deterministic());
+    description[description.size() - 2] = AssertionSite();
+
+    TestAutomaton automaton("large", description, true, NUM_AUTOMATA - 1, NUM_AUTOMATA);
+    assert(!automaton.Get()->flags.isShiftAnd);
+    assert(automaton.Event(1)->predecessorMask == 0);
+}
+
+/* Time of the engine alone, on a clone that is never deactivated: the stream has no assertion site. */
+double Measure(void (*update)(TeslaAutomaton*, TeslaEvent*), TestAutomaton& automaton, const std::vector<size_t>& stream)
+{
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+
+    BenchTimer timer;
+    for (auto id : stream)
+        update(clone, automaton.Event(id));
+    double ns = timer.ElapsedNs() / stream.size();
+
+    TA_Reset(clone);
+    return ns;
+}
+
+void Generic(TeslaAutomaton* automaton, TeslaEvent* event)
+{
+    UpdateAutomatonDeterministicGeneric(automaton, event, true);
+}
+
+void Benchmark()
+{
+    std::cout << "# engine\tout of order\tns/event\n";
+
+    // 16 events, with an OR block in the middle.
+    std::vector<TestEvent> description(16, Deterministic());
+    for (size_t i = 7; i < 11; ++i)
+        description[i] = OR(Deterministic());
+    description[14] = AssertionSite();
+
+    TestAutomaton generic("generic", description, true, NUM_AUTOMATA - 3, NUM_AUTOMATA);
+    TestAutomaton shiftAnd("shift-and", description, true, NUM_AUTOMATA - 2, NUM_AUTOMATA);
+    generic.Get()->flags.isShiftAnd = false;
+
+    for (size_t outOfOrder : {0, 5, 25})
+    {
+        std::mt19937 rng(42);
+        std::vector<size_t> stream;
+        size_t id = 1;
+        for (size_t i = 0; i < NUM_BENCH_EVENTS; ++i)
+        {
+            if (rng() % 100 < outOfOrder)
+                id = 1 + rng() % 13;
+
+            stream.push_back(id);
+            id = 1 + id % 13;
+        }
+
+        double genericNs = Measure(Generic, generic, stream);
+        double shiftAndNs = Measure(UpdateAutomatonShiftAnd, shiftAnd, stream);
+
+        std::cout << "  generic\t" << outOfOrder << "%\t\t" << genericNs << "\n";
+        std::cout << "  shift-and\t" << outOfOrder << "%\t\t" << shiftAndNs << "\n";
+    }
+}
+
+int main()
+{
+    TestEquivalence();
+    TestLargeAutomataUseGeneric();
+    Benchmark();
+
+    TestPassed("Shift-and");
+    return 0;
+}
@@ -0,0 +1,150 @@
+extern "C" {
+#include "TeslaStore.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+
+/*
+ * TESLA_STORE_SINGLE: the store of an event that happens at most once per
+ * bound keeps its one value inline, becomes a default store if a second value
+ * comes anyway, and TA_GetStore takes the kind of store the instrumenter
+ * picked for each event. The benchmark runs a bound's worth of
+ * store work (insert, lookup at the assertion, clear) on each kind.
+ */
+
+const size_t KEY_WORDS = 2;
+const size_t NUM_BENCH_BOUNDS = 1 << 20;
+
+void TestSemantics()
+{
+    TeslaStore store;
+    bool ok = TeslaStore_Create(TESLA_STORE_SINGLE, 1, KEY_WORDS * sizeof(size_t), &store);
+    assert(ok && store.type == TESLA_STORE_SINGLE);
+    assert(TeslaStore_GetCapacity(&store) == 1);
+
+    size_t first[KEY_WORDS] = {0x1000, 0x2000};
+    size_t second[KEY_WORDS] = {0x1000, 0x3000};
+    assert(TeslaStore_Get(&store, first) == 0);
+
+    TeslaStore_Insert(&store, 2, first);
+    assert(TeslaStore_Get(&store, first) == 2);
+    assert(TeslaStore_Get(&store, second) == 0); // Only the value that was seen has a tag.
+
+    // Seeing the same value again merges the tags.
+    TeslaStore_Insert(&store, 8, first);
+    assert(TeslaStore_Get(&store, first) == 10);
+
+    TeslaStore_Clear(&store);
+    assert(TeslaStore_Get(&store, first) == 0);
+
+    TeslaStore_Insert(&store, 1, second);
+    assert(TeslaStore_Get(&store, second) == 1);
+    assert(TeslaStore_Get(&store, first) == 0);
+
+    TeslaStore_Destroy(&store);
+    assert(store.type == TESLA_STORE_INVALID);
+}
+
+void TestLargeData()
+{
+    const size_t words = TESLA_STORE_SINGLE_MAX_WORDS + 1;
+
+    TeslaStore store;
+    bool ok = TeslaStore_Create(TESLA_STORE_SINGLE, 1, words * sizeof(size_t), &store);
+    assert(ok && store.type == TESLA_DEFAULT_STORE);
+
+    std::vector<size_t> key(words, 7);
+    TeslaStore_Insert(&store, 4, key.data());
+    assert(TeslaStore_Get(&store, key.data()) == 4);
+
+    TeslaStore_Destroy(&store);
+}
+
+void TestSecondValue()
+{
+    TeslaStore store;
+    bool ok = TeslaStore_Create(TESLA_STORE_SINGLE, 1, KEY_WORDS * sizeof(size_t), &store);
+    assert(ok);
+
+    size_t first[KEY_WORDS] = {0x1000, 0x2000};
+    size_t second[KEY_WORDS] = {0x1000, 0x3000};
+    TeslaStore_Insert(&store, 2, first);
+
+    // A second value turns the store into a default one that keeps both.
+    ok = TeslaStore_Insert(&store, 4, second);
+    assert(ok && store.type == TESLA_DEFAULT_STORE);
+    assert(TeslaStore_Get(&store, first) == 2);
+    assert(TeslaStore_Get(&store, second) == 4);
+
+    TeslaStore_Insert(&store, 8, first);
+    assert(TeslaStore_Get(&store, first) == 10);
+
+    TeslaStore_Destroy(&store);
+}
+
+void TestInit()
+{
+    TestAutomaton automaton("init", {Deterministic(), SingleStore(Parametric(2)), Parametric(2), AssertionSite(), Deterministic()},
+                            false);
+    assert(automaton.Event(1)->storeKind == TESLA_STORE_SINGLE);
+    assert(automaton.Event(2)->storeKind == TESLA_STORE_INVALID);
+
+    TeslaAutomaton* base = automaton.Get();
+    TA_Init(base);
+    assert(base->state.isCorrect);
+    assert(TA_GetStore(base, automaton.Event(1))->type == TESLA_STORE_SINGLE);
+    assert(TA_GetStore(base, automaton.Event(2))->type == TESLA_DEFAULT_STORE);
+
+    // The next bound gets an empty store of the same kind back from the pool.
+    size_t value[2] = {5, 6};
+    TeslaStore* single = base->eventStates[1].store;
+    TeslaStore_Insert(single, 1, value);
+
+    TA_Init(base);
+    assert(base->eventStates[1].store == NULL);
+    assert(TA_GetStore(base, automaton.Event(1)) == single && single->type == TESLA_STORE_SINGLE);
+    assert(TeslaStore_Get(single, value) == 0);
+
+    TA_ClearEventStates(base);
+}
+
+double Measure(StoreType type)
+{
+    TeslaStore store;
+    TeslaStore_Create(type, type == TESLA_STORE_SINGLE ? 1 : 16, KEY_WORDS * sizeof(size_t), &store);
+
+    size_t key[KEY_WORDS] = {0x7f0000001000, 0x7f0000002000};
+    TeslaTemporalTag sum = 0;
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+    {
+        key[1] += 64;
+        TeslaStore_Insert(&store, 1, key);
+        sum += TeslaStore_Get(&store, key);
+        TeslaStore_Clear(&store);
+    }
+    double ns = timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+
+    assert(sum == NUM_BENCH_BOUNDS);
+    TeslaStore_Destroy(&store);
+    return ns;
+}
+
+int main()
+{
+    TestSemantics();
+    TestLargeData();
+    TestSecondValue();
+    TestInit();
+
+    std::cout << "# store\t\tns/bound (insert, lookup, clear)\n";
+    std::cout << "  single\t" << Measure(TESLA_STORE_SINGLE) << "\n";
+    std::cout << "  swiss\t\t" << Measure(TESLA_STORE_SWISS) << "\n";
+    std::cout << "  ht\t\t" << Measure(TESLA_STORE_HT) << "\n";
+
+    TestPassed("Single-slot store");
+    return 0;
+}
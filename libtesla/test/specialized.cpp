@@ -0,0 +1,230 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <random>
+
+/*
+ * With -thin-tesla-codegen=specialized, the instrumenter emits the transitions
+ * of every deterministic automaton as a switch over the current event, and only
+ * calls the runtime through GetSpecializedAutomaton, RestartSpecializedAutomaton
+ * and FinishSpecializedTransition. This builds the same switch from the same
+ * rules as ThinTeslaInstrumenter::GetSpecializedUpdate, checks that it follows
+ * UpdateAutomatonDeterministic on random event streams, and times a hand-inlined
+ * version of it against the runtime engines.
+ */
+
+const size_t NUM_SEQUENCES = 20000;
+const size_t NUM_BENCH_CYCLES = 1 << 20;
+
+const size_t NUM_AUTOMATA = 16;
+
+enum Transition
+{
+    Advance,
+    Stay,
+    Restart
+};
+
+/* transitions[event][current], the cases of the emitted switches. */
+class SpecializedAutomaton
+{
+  public:
+    SpecializedAutomaton(TestAutomaton& automaton) : automaton(automaton)
+    {
+        size_t numEvents = automaton.Get()->numEvents;
+        transitions.assign(numEvents, std::vector<Transition>(numEvents, Restart));
+
+        for (size_t i = 0; i < numEvents; ++i)
+        {
+            TeslaEvent* event = automaton.Event(i);
+            for (size_t k = 0; k < event->numSuccessors; ++k)
+            {
+                TeslaEvent* succ = event->successors[k];
+                transitions[succ->id][i] = Advance;
+
+                if (event->flags.isOR && succ->flags.isOR)
+                    transitions[i][succ->id] = Stay;
+            }
+        }
+    }
+
+    void Update(size_t eventId)
+    {
+        TeslaEvent* event = automaton.Event(eventId);
+        TeslaAutomaton* clone = GetSpecializedAutomaton(automaton.Get(), event);
+        if (clone == NULL)
+            return;
+
+        bool found = true;
+        switch (transitions[eventId][clone->state.currentEvent->id])
+        {
+        case Advance:
+            clone->state.currentEvent = event;
+            break;
+        case Stay:
+            break;
+        case Restart:
+            RestartSpecializedAutomaton(clone);
+            found = transitions[eventId][0] == Advance;
+            if (found)
+                clone->state.currentEvent = event;
+            break;
+        }
+
+        if (event->flags.isAssertion || event->flags.isFinal)
+            FinishSpecializedTransition(clone, event, found);
+    }
+
+  private:
+    TestAutomaton& automaton;
+    std::vector<std::vector<Transition>> transitions;
+};
+
+void CheckSameState(TestAutomaton& generic, TestAutomaton& specialized)
+{
+    TeslaAutomaton* a = GetThreadAutomaton(generic.Get());
+    TeslaAutomaton* b = GetThreadAutomaton(specialized.Get());
+
+    assert((a != NULL) == (b != NULL));
+    if (a == NULL)
+        return;
+
+    assert(a->state.isInit == b->state.isInit);
+    if (!a->state.isInit)
+        return;
+
+    assert(a->state.currentEvent->id == b->state.currentEvent->id);
+    assert(a->state.isActive == b->state.isActive);
+    assert(a->state.hasFailed == b->state.hasFailed);
+    assert(a->state.reachedAssertion == b->state.reachedAssertion);
+}
+
+void ResetBoth(TestAutomaton& generic, TestAutomaton& specialized)
+{
+    // Ending the bound would panic on a failed automaton, and failures are compared too.
+    for (TestAutomaton* automaton : {&generic, &specialized})
+    {
+        TeslaAutomaton* clone = GetThreadAutomaton(automaton->Get());
+        if (clone != NULL && clone->state.isInit)
+            TA_Reset(clone);
+    }
+}
+
+void TestEquivalence()
+{
+    std::vector<std::vector<TestEvent>> descriptions = {
+        {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), Deterministic(), OR(Deterministic()), OR(Deterministic()), OR(Deterministic()), AssertionSite(), Deterministic()},
+        {Deterministic(), Optional(Deterministic()), Optional(Deterministic()), Deterministic(), AssertionSite(), Deterministic()},
+        {Deterministic(), OR(Deterministic()), OR(Deterministic()), AssertionSite(), Deterministic(), Deterministic()},
+        {Deterministic(), Deterministic(), AssertionSite(), OR(Deterministic()), OR(Deterministic()), Deterministic(), Deterministic()},
+    };
+
+    std::mt19937 rng(11);
+
+    for (size_t d = 0; d < descriptions.size(); ++d)
+    {
+        auto& description = descriptions[d];
+        TestAutomaton generic("generic", description, true, 2 * d, NUM_AUTOMATA);
+        TestAutomaton specialized("specialized", description, true, 2 * d + 1, NUM_AUTOMATA);
+        generic.Get()->flags.isShiftAnd = false;
+
+        SpecializedAutomaton update(specialized);
+        size_t numEvents = description.size();
+
+        for (size_t sequence = 0; sequence < NUM_SEQUENCES; ++sequence)
+        {
+            // Mostly walk forward, with random jumps to any event but the bounds.
+            size_t length = 1 + rng() % (2 * numEvents);
+            size_t id = 1;
+
+            for (size_t i = 0; i < length; ++i)
+            {
+                if (rng() % 4 == 0)
+                    id = 1 + rng() % (numEvents - 2);
+
+                UpdateAutomatonDeterministic(generic.Get(), generic.Event(id));
+                update.Update(id);
+                CheckSameState(generic, specialized);
+
+                id = 1 + id % (numEvents - 2);
+            }
+
+            ResetBoth(generic, specialized);
+        }
+    }
+}
+
+/*
+ * What the optimizer is left with once the emitted function is inlined at the
+ * call sites of the benchmark automaton below: only the case of that event.
+ */
+template <size_t EventId>
+inline void InlinedUpdate(TestAutomaton& automaton)
+{
+    TeslaEvent* event = automaton.Event(EventId);
+    TeslaAutomaton* clone = GetSpecializedAutomaton(automaton.Get(), event);
+    if (clone == NULL)
+        return;
+
+    if (clone->state.currentEvent->id == EventId - 1)
+    {
+        clone->state.currentEvent = event;
+    }
+    else
+    {
+        RestartSpecializedAutomaton(clone);
+        if (EventId == 1)
+            clone->state.currentEvent = event;
+    }
+}
+
+void Benchmark()
+{
+    std::cout << "# engine\tns/event\n";
+
+    // A sequence of four events, repeated: every fourth event restarts the automaton.
+    std::vector<TestEvent> description = {Deterministic(), Deterministic(), Deterministic(), Deterministic(), Deterministic(),
+                                          AssertionSite(), Deterministic(), Deterministic()};
+
+    TestAutomaton generic("generic", description, true, NUM_AUTOMATA - 3, NUM_AUTOMATA);
+    TestAutomaton shiftAnd("shift-and", description, true, NUM_AUTOMATA - 2, NUM_AUTOMATA);
+    TestAutomaton specialized("specialized", description, true, NUM_AUTOMATA - 1, NUM_AUTOMATA);
+    generic.Get()->flags.isShiftAnd = false;
+
+    for (TestAutomaton* automaton : {&generic, &shiftAnd})
+    {
+        BenchTimer timer;
+        for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+        {
+            for (size_t id = 1; id < 5; ++id)
+                UpdateAutomatonDeterministic(automaton->Get(), automaton->Event(id));
+        }
+        double ns = timer.ElapsedNs() / (4 * NUM_BENCH_CYCLES);
+
+        std::cout << "  " << automaton->Get()->name << "\t" << ns << "\n";
+        TA_Reset(GetThreadAutomaton(automaton->Get()));
+    }
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_CYCLES; ++i)
+    {
+        InlinedUpdate<1>(specialized);
+        InlinedUpdate<2>(specialized);
+        InlinedUpdate<3>(specialized);
+        InlinedUpdate<4>(specialized);
+    }
+    double ns = timer.ElapsedNs() / (4 * NUM_BENCH_CYCLES);
+
+    std::cout << "  specialized\t" << ns << "\n";
+    TA_Reset(GetThreadAutomaton(specialized.Get()));
+}
+
+int main()
+{
+    TestEquivalence();
+    Benchmark();
+
+    TestPassed("Specialized transitions");
+    return 0;
+}
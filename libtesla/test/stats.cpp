@@ -0,0 +1,190 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <csignal>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Per-automaton counters: every engine counts the same events, blocks of
+ * exited threads are kept, and the dump names every automaton, also when it
+ * is asked for with SIGUSR2. Run the
+ * benchmark in builds with and without TESLA_NO_STATS to see what counting
+ * costs.
+ */
+
+const size_t NUM_AUTOMATA = 8;
+const size_t NUM_THREADS = 4;
+const size_t NUM_THREAD_BOUNDS = 1000;
+const size_t NUM_BENCH_BOUNDS = 1 << 20;
+
+std::vector<TestEvent> MakeDescription()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+TeslaStats GetStats(TestAutomaton& automaton)
+{
+    TeslaStats stats;
+    bool found = TeslaGetStats(automaton.Get(), &stats);
+    assert(found);
+    return stats;
+}
+
+/* One bound that repeats its first event, then completes at the assertion. */
+void RunBound(TestAutomaton& automaton)
+{
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void TestCounts(size_t id, bool shiftAnd)
+{
+    TestAutomaton automaton("counts", MakeDescription(), true, id, NUM_AUTOMATA);
+    automaton.Get()->flags.isShiftAnd = shiftAnd;
+
+    RunBound(automaton);
+
+    TeslaStats stats = GetStats(automaton);
+    assert(stats.events == 4 && stats.transitions == 4 && stats.retries == 1);
+    assert(stats.lateInits == 1 && stats.failures == 0);
+    size_t resets = stats.resets;
+    assert(resets >= 1);
+
+    // Skipping the second event makes the assertion fail.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+    assert(clone->state.hasFailed);
+    TA_Reset(clone);
+
+    stats = GetStats(automaton);
+    assert(stats.events == 6 && stats.transitions == 5 && stats.retries == 2);
+    assert(stats.lateInits == 2 && stats.failures == 1 && stats.resets == resets + 1);
+}
+
+void TestThreads()
+{
+    TestAutomaton automaton("threads", MakeDescription(), true, 2, NUM_AUTOMATA);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&] {
+            for (size_t k = 0; k < NUM_THREAD_BOUNDS; ++k)
+                RunBound(automaton);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    // Every thread has exited, so these all come from the retired counters.
+    TeslaStats stats = GetStats(automaton);
+    assert(stats.events == 4 * NUM_THREADS * NUM_THREAD_BOUNDS);
+    assert(stats.lateInits == NUM_THREADS * NUM_THREAD_BOUNDS);
+}
+
+void TestHistory()
+{
+    TestAutomaton automaton("history", {Deterministic(), Parametric(1), AssertionSite(), Deterministic()}, true, 3, NUM_AUTOMATA);
+
+    for (size_t value = 0; value < 5; ++value)
+        UpdateAutomaton(automaton.Get(), automaton.Event(1), &value);
+
+    TeslaStats stats = GetStats(automaton);
+    assert(stats.events == 5 && stats.storeInserts == 5 && stats.historyHighWater == 5);
+
+    TA_Reset(GetThreadAutomaton(automaton.Get()));
+}
+
+void TestDump()
+{
+    TestAutomaton automaton("dumped", MakeDescription(), true, 4, NUM_AUTOMATA);
+    RunBound(automaton);
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    TeslaDumpStats(fds[1]);
+    close(fds[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, length);
+    close(fds[0]);
+
+    assert(output.find("[TESLA] automaton\tevents") == 0);
+    assert(output.find("[TESLA] dumped\t4\t4\t1\t1\t") != std::string::npos);
+}
+
+/* The handler only wakes the dump thread, which writes to stderr. */
+void TestSignal()
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    int savedStderr = dup(STDERR_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+
+    raise(SIGUSR2);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t length;
+    while (output.find("[TESLA] dumped\t") == std::string::npos && (length = read(fds[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, length);
+
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+    close(fds[0]);
+    close(fds[1]);
+
+    assert(output.find("[TESLA] automaton\tevents") == 0);
+}
+
+double Measure(size_t id)
+{
+    TestAutomaton automaton("bench", MakeDescription(), true, id, NUM_AUTOMATA);
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+    {
+        for (size_t event = 1; event < 4; ++event)
+            UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(event));
+        EndAutomaton(automaton.Get(), automaton.End());
+    }
+
+    return timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+}
+
+int main()
+{
+    // Before the first automaton is seen, so that SIGUSR2 dumps the counters.
+    setenv("TESLA_STATS", "1", 1);
+
+    TeslaStats unused;
+    TestAutomaton probe("probe", MakeDescription(), true, 7, NUM_AUTOMATA);
+    bool enabled = TeslaGetStats(probe.Get(), &unused);
+
+    if (enabled)
+    {
+        TestCounts(0, true);
+        TestCounts(1, false);
+        TestThreads();
+        TestHistory();
+        TestDump();
+        TestSignal();
+    }
+
+    std::cout << "# stats\t\tns/bound\n";
+    std::cout << "  " << (enabled ? "on" : "off") << "\t\t" << Measure(5) << "\n";
+
+    TestPassed("Statistics");
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+
+/*
+ * Successor lookups through the per-event bitmasks, including automata with
+ * more than 64 events, against a scan of the successors array.
+ */
+
+const size_t NUM_QUERIES = 1 << 22;
+
+/* What GetSuccessor used to do, out of line like the runtime call was. */
+__attribute__((noinline)) size_t ScanSuccessors(TeslaEvent* event, TeslaEvent* successor)
+{
+    for (size_t i = 0; i < event->numSuccessors; ++i)
+    {
+        if (event->successors[i] == successor)
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+/* A sequence of numEvents events, with an OR block of orSize events starting at orStart. */
+std::vector<TestEvent> MakeDescription(size_t numEvents, size_t orStart, size_t orSize)
+{
+    std::vector<TestEvent> description(numEvents, Deterministic());
+    for (size_t i = orStart; i < orStart + orSize; ++i)
+        description[i] = OR(Deterministic());
+
+    description[numEvents - 2] = AssertionSite();
+    return description;
+}
+
+void CheckAgainstScan(TestAutomaton& automaton, size_t numEvents)
+{
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        for (size_t k = 0; k < numEvents; ++k)
+        {
+            TeslaEvent* event = automaton.Event(i);
+            TeslaEvent* successor = automaton.Event(k);
+
+            size_t expected = ScanSuccessors(event, successor);
+            assert(GetSuccessor(event, successor) == expected);
+            assert((bool)IsSuccessor(event, successor) == (expected != SIZE_MAX));
+        }
+    }
+}
+
+void TestMasks()
+{
+    // Blocks inside the first word, across the word boundary and past it.
+    for (size_t orStart : {3, 60, 100})
+    {
+        const size_t numEvents = 140;
+        TestAutomaton automaton("successors", MakeDescription(numEvents, orStart, 8), true);
+        CheckAgainstScan(automaton, numEvents);
+    }
+}
+
+void TestLongBound()
+{
+    const size_t numEvents = 140;
+    TestAutomaton automaton("long", MakeDescription(numEvents, 60, 8), true);
+
+    // Walk the whole automaton, taking the OR block in reverse order.
+    for (size_t i = 1; i < 60; ++i)
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(i));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(65));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(62));
+    for (size_t i = 68; i < numEvents - 1; ++i)
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(i));
+
+    TeslaAutomaton* clone = GetThreadAutomaton(automaton.Get());
+    assert(clone->state.reachedAssertion && !clone->state.hasFailed);
+    assert(clone->state.currentEvent == automaton.Event(numEvents - 2));
+
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void Benchmark()
+{
+    // UpdateAutomatonDeterministicGeneric only needs to know whether an event is a successor.
+    std::cout << "# lookup\tOR block\tns/query\n";
+
+    for (size_t orSize : {2, 8, 32})
+    {
+        const size_t numEvents = orSize + 4;
+        TestAutomaton automaton("bench", MakeDescription(numEvents, 2, orSize), true);
+
+        // Every pair of events in the block, which is where the scans are longest.
+        std::vector<std::pair<TeslaEvent*, TeslaEvent*>> queries;
+        for (size_t i = 0; i < NUM_QUERIES; ++i)
+            queries.emplace_back(automaton.Event(1 + i % (orSize + 1)), automaton.Event(2 + (i / 7) % (orSize + 1)));
+
+        size_t sink = 0;
+        BenchTimer scanTimer;
+        for (auto& query : queries)
+            sink += ScanSuccessors(query.first, query.second) != SIZE_MAX;
+        double scanNs = scanTimer.ElapsedNs() / NUM_QUERIES;
+
+        BenchTimer maskTimer;
+        for (auto& query : queries)
+            sink += IsSuccessor(query.first, query.second);
+        double maskNs = maskTimer.ElapsedNs() / NUM_QUERIES;
+
+        std::cout << "  scan\t\t" << orSize << "\t\t" << scanNs << "\n";
+        std::cout << "  mask\t\t" << orSize << "\t\t" << maskNs << (sink == 1 ? " " : "") << "\n";
+    }
+}
+
+int main()
+{
+    TestMasks();
+    TestLongBound();
+    Benchmark();
+
+    TestPassed("Successors");
+    return 0;
+}
@@ -0,0 +1,134 @@
+extern "C" {
+#include "TeslaStore.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <random>
+
+/*
+ * Checks TESLA_STORE_SWISS against the semantics of TESLA_STORE_HT and compares
+ * the two through the TeslaStore API with pointer-valued match data.
+ */
+
+const size_t NUM_KEYS = 1 << 16;
+const size_t NUM_LOOKUPS = 1 << 20;
+
+/* Match data is made of pointers, so keys are aligned addresses from a single arena. */
+std::vector<size_t> MakePointerKeys(size_t numKeys, size_t keyWords)
+{
+    static std::vector<uint64_t> arena(NUM_KEYS * 4);
+
+    std::vector<size_t> keys(numKeys * keyWords);
+    for (size_t i = 0; i < keys.size(); ++i)
+        keys[i] = (size_t)&arena[(i * 7) % arena.size()];
+
+    return keys;
+}
+
+void TestSemantics(StoreType type)
+{
+    const size_t keyWords = 2;
+    std::vector<size_t> keys = MakePointerKeys(1000, keyWords);
+
+    TeslaStore store;
+    bool ok = TeslaStore_Create(type, 1, keyWords * sizeof(size_t), &store);
+    assert(ok);
+
+    for (size_t i = 0; i < 1000; ++i)
+        assert(TeslaStore_Get(&store, &keys[i * keyWords]) == 0);
+
+    // Grows through several resizes.
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        ok = TeslaStore_Insert(&store, (TeslaTemporalTag)1 << (i % 60), &keys[i * keyWords]);
+        assert(ok);
+    }
+
+    for (size_t i = 0; i < 1000; ++i)
+        assert(TeslaStore_Get(&store, &keys[i * keyWords]) == (TeslaTemporalTag)1 << (i % 60));
+
+    // Inserting an existing key merges the tags.
+    TeslaStore_Insert(&store, 1ULL << 61, &keys[0]);
+    assert(TeslaStore_Get(&store, &keys[0]) == ((1ULL << 61) | 1));
+
+    size_t missing[keyWords] = {1, 3};
+    assert(TeslaStore_Get(&store, missing) == 0);
+
+    TeslaStore_Clear(&store);
+    for (size_t i = 0; i < 1000; ++i)
+        assert(TeslaStore_Get(&store, &keys[i * keyWords]) == 0);
+
+    TeslaStore_Insert(&store, 4, &keys[keyWords]);
+    assert(TeslaStore_Get(&store, &keys[keyWords]) == 4);
+
+    TeslaStore_Destroy(&store);
+}
+
+void TestLoadFactor()
+{
+    TeslaSwissTable table;
+    bool ok = TeslaSwiss_Create(16, sizeof(size_t), &table);
+    assert(ok && table.capacity == 16);
+
+    for (size_t i = 0; i < 14; ++i)
+        TeslaSwiss_Insert(&table, 1, &i);
+    assert(table.capacity == 16 && table.size == 14);
+
+    size_t next = 14;
+    TeslaSwiss_Insert(&table, 1, &next);
+    assert(table.capacity == 32 && table.size == 15);
+
+    for (size_t i = 0; i <= next; ++i)
+        assert(TeslaSwiss_LookupTag(&table, &i) == 1);
+
+    TeslaSwiss_Destroy(&table);
+}
+
+void Benchmark(const char* name, StoreType type, size_t keyWords)
+{
+    std::vector<size_t> keys = MakePointerKeys(NUM_KEYS, keyWords);
+
+    std::mt19937 rng(42);
+    std::vector<size_t> order(NUM_LOOKUPS);
+    for (auto& index : order)
+        index = rng() % NUM_KEYS;
+
+    TeslaStore store;
+    TeslaStore_Create(type, 16, keyWords * sizeof(size_t), &store);
+
+    BenchTimer insertTimer;
+    for (size_t i = 0; i < NUM_KEYS; ++i)
+        TeslaStore_Insert(&store, 1, &keys[i * keyWords]);
+    double insertNs = insertTimer.ElapsedNs() / NUM_KEYS;
+
+    TeslaTemporalTag found = 0;
+    BenchTimer lookupTimer;
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+        found += TeslaStore_Get(&store, &keys[order[i] * keyWords]);
+    double lookupNs = lookupTimer.ElapsedNs() / NUM_LOOKUPS;
+
+    assert(found == NUM_LOOKUPS);
+
+    std::cout << "  " << name << "\t" << keyWords << "\t" << insertNs << "\t\t" << lookupNs << "\n";
+
+    TeslaStore_Destroy(&store);
+}
+
+int main()
+{
+    TestSemantics(TESLA_STORE_HT);
+    TestSemantics(TESLA_STORE_SWISS);
+    TestLoadFactor();
+
+    std::cout << "# store\twords\tns/insert\tns/lookup\n";
+    for (size_t keyWords = 1; keyWords <= 2; ++keyWords)
+    {
+        Benchmark("ht", TESLA_STORE_HT, keyWords);
+        Benchmark("swiss", TESLA_STORE_SWISS, keyWords);
+    }
+
+    TestPassed("Swiss table");
+    return 0;
+}
@@ -0,0 +1,228 @@
+extern "C" {
+#include "TeslaStore.h"
+#include "TeslaTag.h"
+}
+
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <cstring>
+#include <map>
+
+/*
+ * Temporal tags past the epochs a single mask can hold: tags go on merging in
+ * the stores, and VerifyAutomaton gives the same answer for a bound that
+ * starts after 10000 backtracks as for one that starts at the first epoch.
+ * The benchmark gives the cost of an insert with narrow and with wide tags.
+ */
+
+const int64_t WIDE_OFFSET = 10000;
+const size_t NUM_KEYS = 64;
+const size_t NUM_BENCH_INSERTS = 1 << 20;
+
+/* The current tag of an automaton that has backtracked `epoch` times. */
+TeslaTemporalTag TagOf(int64_t epoch)
+{
+    TeslaTemporalTag tag = 1;
+    for (int64_t i = 0; i < epoch; ++i)
+        tag = TeslaTag_Next(tag);
+    return tag;
+}
+
+void TestNext()
+{
+    TeslaTemporalTag tag = 1;
+    for (int64_t epoch = 0; epoch < TESLA_TAG_NARROW_EPOCHS; ++epoch)
+    {
+        assert(!TeslaTag_IsWide(tag) && tag == (TeslaTemporalTag)1 << epoch);
+        assert(TeslaTag_Latest(tag) == epoch && TeslaTag_Previous(tag) == TESLA_NO_EPOCH);
+        tag = TeslaTag_Next(tag);
+    }
+
+    assert(TeslaTag_IsWide(tag));
+    assert(TeslaTag_Latest(tag) == TESLA_TAG_NARROW_EPOCHS && TeslaTag_Previous(tag) == TESLA_NO_EPOCH);
+
+    // Narrow tags merge into wide ones, and only the two latest epochs are kept.
+    TeslaTemporalTag narrow = TagOf(3) | TagOf(10) | TagOf(40);
+    assert(TeslaTag_Latest(narrow) == 40 && TeslaTag_Previous(narrow) == 10);
+
+    TeslaTemporalTag merged = TeslaTag_Merge(narrow, tag);
+    assert(TeslaTag_Latest(merged) == TESLA_TAG_NARROW_EPOCHS && TeslaTag_Previous(merged) == 40);
+    assert(TeslaTag_Merge(merged, tag) == merged);
+
+    // The last epoch does not wrap around.
+    TeslaTemporalTag last = TeslaTag_MakeWide(TESLA_TAG_MAX_EPOCH, TESLA_NO_EPOCH);
+    assert(TeslaTag_Next(last) == last);
+
+    assert(TeslaTag_Latest(0) == TESLA_NO_EPOCH && TeslaTag_Previous(0) == TESLA_NO_EPOCH);
+}
+
+/* Inserts keys in a pattern over 10000 epochs, and checks what the store gives back against the epochs seen. */
+void TestStore(StoreType type)
+{
+    size_t numKeys = type == TESLA_STORE_SINGLE ? 1 : NUM_KEYS;
+
+    TeslaStore store;
+    TeslaStore_Create(type, 16, sizeof(size_t), &store);
+
+    std::map<size_t, std::pair<int64_t, int64_t>> expected;
+
+    TeslaTemporalTag current = 1;
+    for (int64_t epoch = 0; epoch < WIDE_OFFSET; ++epoch)
+    {
+        for (size_t k = 0; k < numKeys; ++k)
+        {
+            if ((epoch + k) % (k + 2) != 0)
+                continue;
+
+            size_t key = 0x1000 + k * 64;
+            TeslaStore_Insert(&store, current, &key);
+
+            auto& epochs = expected.emplace(key, std::make_pair(TESLA_NO_EPOCH, TESLA_NO_EPOCH)).first->second;
+            if (epochs.first != epoch)
+                epochs = std::make_pair(epoch, epochs.first);
+        }
+
+        current = TeslaTag_Next(current);
+    }
+
+    assert(!expected.empty());
+    for (auto& entry : expected)
+    {
+        size_t key = entry.first;
+        TeslaTemporalTag tag = TeslaStore_Get(&store, &key);
+        assert(TeslaTag_Latest(tag) == entry.second.first);
+        assert(TeslaTag_Previous(tag) == entry.second.second);
+    }
+
+    TeslaStore_Destroy(&store);
+}
+
+struct Occurrence
+{
+    size_t event;
+    int64_t epoch; // From the start of the bound.
+};
+
+/*
+ * Fills the stores of a fresh bound as if the events had happened in the
+ * given epochs, then runs the check made at the assertion site. Returns the
+ * reason it failed for, or an empty string.
+ */
+std::string Verify(TestAutomaton& automaton, const std::vector<Occurrence>& occurrences, int64_t offset)
+{
+    TeslaAutomaton* base = automaton.Get();
+    TA_Init(base);
+
+    for (auto& occurrence : occurrences)
+    {
+        TeslaEvent* event = automaton.Event(occurrence.event);
+        TeslaEventState* state = &base->eventStates[occurrence.event];
+        TeslaStore_Insert(TA_GetStore(base, event), TagOf(offset + occurrence.epoch), state->matchData);
+    }
+
+    VerifyAutomaton(base);
+    std::string reason = base->state.hasFailed ? base->state.failReason : "";
+
+    TA_Reset(base);
+    return reason;
+}
+
+void CheckSameAnswer(TestAutomaton& automaton, const std::vector<Occurrence>& occurrences, const std::string& expected)
+{
+    std::string narrow = Verify(automaton, occurrences, 0);
+    std::string wide = Verify(automaton, occurrences, WIDE_OFFSET);
+
+    if (narrow != expected || wide != expected)
+    {
+        std::cerr << "expected '" << expected << "', narrow tags gave '" << narrow << "', wide tags '" << wide << "'\n";
+        assert(false);
+    }
+}
+
+void TestVerify()
+{
+    // Start, A, B, assertion, C, end.
+    TestAutomaton sequence("sequence", {Deterministic(), Parametric(1), Parametric(1), AssertionSite(), Parametric(1), Deterministic()},
+                           false);
+    for (size_t i = 1; i <= 4; ++i)
+        sequence.SetMatch(i, {0x100 + i});
+
+    CheckSameAnswer(sequence, {{1, 0}, {2, 1}}, "");
+    CheckSameAnswer(sequence, {{1, 1}, {2, 0}}, "Event occurred in the past");
+    CheckSameAnswer(sequence, {{1, 0}, {2, 0}, {2, 1}}, "Multiple events of the same type occurred");
+    CheckSameAnswer(sequence, {{1, 5}, {2, 6}, {4, 6}}, "Event after assertion happened before assertion");
+    CheckSameAnswer(sequence, {{1, 0}, {1, 3}, {2, 4}, {4, 1}}, "");
+    CheckSameAnswer(sequence, {{2, 4}}, "Required event didn't occur");
+
+    // Start, X, A or B, assertion, end.
+    TestAutomaton block("block", {Deterministic(), Parametric(1), OR(Parametric(1)), OR(Parametric(1)), AssertionSite(), Deterministic()},
+                        false);
+    for (size_t i = 1; i <= 3; ++i)
+        block.SetMatch(i, {0x200 + i});
+
+    CheckSameAnswer(block, {{1, 0}, {2, 1}}, "");
+    CheckSameAnswer(block, {{1, 0}, {3, 2}, {2, 3}}, "");
+    CheckSameAnswer(block, {{1, 0}, {2, 0}, {2, 1}}, "OR event occurred multiple times");
+    CheckSameAnswer(block, {{1, 0}}, "No event in OR block has occurred");
+}
+
+/* A loop that goes back to the first event 10000 times before the assertion. */
+void TestLongBound()
+{
+    TestAutomaton automaton("long", {Deterministic(), Parametric(1), Parametric(1), AssertionSite(), Deterministic()}, false);
+    automaton.SetMatch(1, {1});
+    automaton.SetMatch(2, {2});
+
+    std::vector<Occurrence> loop;
+    for (int64_t epoch = 0; epoch < WIDE_OFFSET; ++epoch)
+    {
+        loop.push_back({1, epoch});
+        loop.push_back({2, epoch});
+    }
+    assert(Verify(automaton, loop, 0) == "");
+
+    // The second event happening twice in the last round is still caught.
+    loop.push_back({2, WIDE_OFFSET});
+    assert(Verify(automaton, loop, 0) == "Multiple events of the same type occurred");
+}
+
+double MeasureInserts(int64_t firstEpoch)
+{
+    TeslaStore store;
+    TeslaStore_Create(TESLA_STORE_SWISS, 16, sizeof(size_t), &store);
+
+    TeslaTemporalTag current = TagOf(firstEpoch);
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_INSERTS; ++i)
+    {
+        size_t key = 0x1000 + (i % NUM_KEYS) * 64;
+        TeslaStore_Insert(&store, current, &key);
+
+        // Stay within the narrow epochs for the narrow run.
+        if (i % NUM_KEYS == NUM_KEYS - 1 && (firstEpoch > 0 || TeslaTag_Latest(current) < 16))
+            current = TeslaTag_Next(current);
+    }
+    double ns = timer.ElapsedNs() / NUM_BENCH_INSERTS;
+
+    TeslaStore_Destroy(&store);
+    return ns;
+}
+
+int main()
+{
+    TestNext();
+    TestStore(TESLA_STORE_HT);
+    TestStore(TESLA_STORE_SWISS);
+    TestStore(TESLA_STORE_SINGLE);
+    TestVerify();
+    TestLongBound();
+
+    std::cout << "# tags\t\tns/insert\n";
+    std::cout << "  narrow\t" << MeasureInserts(0) << "\n";
+    std::cout << "  wide\t\t" << MeasureInserts(WIDE_OFFSET) << "\n";
+
+    TestPassed("Temporal tags");
+    return 0;
+}
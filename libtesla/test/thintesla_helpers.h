@@ -0,0 +1,231 @@
+#pragma once
+
+#include "TeslaLogic.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Builds the same TeslaAutomaton/TeslaEvent structures that ThinTeslaInstrumenter
+ * emits, so that the C runtime can be exercised without going through the
+ * instrumenter. Events are linked like ThinTeslaAssertionBuilder::LinkEvents does.
+ */
+struct TestEvent
+{
+    bool isDeterministic = true;
+    bool isOptional = false;
+    bool isOR = false;
+    bool isAssertion = false;
+    uint8_t matchDataSize = 0;
+    StoreType storeKind = TESLA_STORE_INVALID;
+};
+
+inline TestEvent Deterministic()
+{
+    return TestEvent();
+}
+
+inline TestEvent Parametric(uint8_t matchDataSize)
+{
+    TestEvent event;
+    event.isDeterministic = false;
+    event.matchDataSize = matchDataSize;
+    return event;
+}
+
+inline TestEvent Optional(TestEvent event)
+{
+    event.isOptional = true;
+    return event;
+}
+
+/* A parametric event that happens at most once per bound, see TESLA_STORE_SINGLE. */
+inline TestEvent SingleStore(TestEvent event)
+{
+    event.storeKind = TESLA_STORE_SINGLE;
+    return event;
+}
+
+inline TestEvent OR(TestEvent event)
+{
+    event.isOR = true;
+    return event;
+}
+
+inline TestEvent AssertionSite()
+{
+    TestEvent event;
+    event.isAssertion = true;
+    return event;
+}
+
+class TestAutomaton
+{
+  public:
+    /* The first and last events are always the temporal bounds. */
+    TestAutomaton(const std::string& name, const std::vector<TestEvent>& description, bool threadLocal,
+                  size_t id = 0, size_t numTotalAutomata = 1)
+        : name(name), events(description.size()), eventPtrs(description.size()),
+          successors(description.size()), successorMasks(description.size() * TESLA_SUCCESSOR_MASK_WORDS(description.size())),
+          eventStates(description.size()), matchArrays(description.size())
+    {
+        memset(&automaton, 0, sizeof(automaton));
+        memset(events.data(), 0, sizeof(TeslaEvent) * events.size());
+        memset(eventStates.data(), 0, sizeof(TeslaEventState) * eventStates.size());
+
+        bool deterministic = true;
+
+        for (size_t i = 0; i < description.size(); ++i)
+        {
+            const TestEvent& desc = description[i];
+            TeslaEvent& event = events[i];
+
+            event.id = i;
+            event.matchDataSize = desc.matchDataSize;
+            event.hashKernel = TeslaHash_SelectKernel(desc.matchDataSize);
+            event.storeKind = desc.storeKind;
+            event.flags.isDeterministic = desc.isDeterministic;
+            event.flags.isOptional = desc.isOptional;
+            event.flags.isOR = desc.isOR;
+            event.flags.isAssertion = desc.isAssertion;
+
+            if (!desc.isDeterministic)
+                deterministic = false;
+
+            matchArrays[i].resize(desc.matchDataSize);
+            eventStates[i].matchData = (uint8_t*)matchArrays[i].data();
+            eventPtrs[i] = &event;
+        }
+
+        LinkEvents(description);
+
+        bool beforeAssertion = true;
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            TeslaEvent& event = events[i];
+
+            if (event.flags.isAssertion)
+                beforeAssertion = false;
+
+            event.flags.isBeforeAssertion = beforeAssertion;
+            event.successors = (TeslaEvent**)successors[i].data();
+            event.numSuccessors = successors[i].size();
+            event.flags.isEnd = event.numSuccessors == 0;
+
+            size_t numWords = TESLA_SUCCESSOR_MASK_WORDS(events.size());
+            event.successorMask = &successorMasks[i * numWords];
+            for (auto succ : successors[i])
+            {
+                successorMasks[i * numWords + succ->id / 64] |= (uint64_t)1 << (succ->id % 64);
+
+                if (events.size() <= TESLA_SHIFT_AND_MAX_EVENTS)
+                {
+                    succ->predecessorMask |= (uint64_t)1 << i;
+                    if (event.flags.isOR && succ->flags.isOR)
+                        event.orBlockMask |= (uint64_t)1 << succ->id;
+                }
+            }
+
+            for (auto succ : successors[i])
+            {
+                if (successors[succ->id].empty())
+                    event.flags.isFinal = true;
+            }
+
+            for (auto succ : successors[0])
+            {
+                if (succ == &event)
+                    event.flags.isInitial = true;
+            }
+        }
+
+        automaton.events = eventPtrs.data();
+        automaton.flags.isDeterministic = deterministic;
+        automaton.flags.isThreadLocal = threadLocal;
+        automaton.flags.isShiftAnd = deterministic && events.size() <= TESLA_SHIFT_AND_MAX_EVENTS;
+        automaton.numEvents = events.size();
+        automaton.name = (char*)this->name.c_str();
+        automaton.eventStates = eventStates.data();
+        automaton.threadKey = INVALID_THREAD_KEY;
+        automaton.numTotalAutomata = numTotalAutomata;
+        automaton.id = id;
+    }
+
+    TeslaAutomaton* Get() { return &automaton; }
+    TeslaEvent* Event(size_t i) { return &events[i]; }
+    TeslaEvent* Start() { return &events[0]; }
+    TeslaEvent* End() { return &events[events.size() - 1]; }
+
+    /* Stores the values observed at the assertion site for a global automaton. */
+    void SetMatch(size_t i, const std::vector<size_t>& values)
+    {
+        for (size_t k = 0; k < values.size() && k < matchArrays[i].size(); ++k)
+            matchArrays[i][k] = values[k];
+    }
+
+  private:
+    void LinkEvents(const std::vector<TestEvent>& description)
+    {
+        for (size_t i = 0; i + 1 < events.size(); ++i)
+        {
+            const TestEvent& next = description[i + 1];
+
+            if (next.isOR || next.isOptional)
+            {
+                std::vector<size_t> block;
+                for (size_t k = i + 1; k < events.size() && (description[k].isOR || description[k].isOptional); ++k)
+                    block.push_back(k);
+
+                for (auto k : block)
+                    successors[i].push_back(&events[k]);
+
+                size_t firstNonOR = i + 1 + block.size();
+                if (next.isOptional)
+                    successors[i].push_back(&events[firstNonOR]);
+
+                block.push_back(firstNonOR);
+
+                for (size_t k = 0; k < block.size(); ++k)
+                    for (size_t n = k + 1; n < block.size(); ++n)
+                        successors[block[k]].push_back(&events[block[n]]);
+
+                i = i + block.size() - 1;
+            }
+            else
+            {
+                successors[i].push_back(&events[i + 1]);
+            }
+        }
+    }
+
+    std::string name;
+    TeslaAutomaton automaton;
+    std::vector<TeslaEvent> events;
+    std::vector<TeslaEvent*> eventPtrs;
+    std::vector<std::vector<TeslaEvent*>> successors;
+    std::vector<uint64_t> successorMasks;
+    std::vector<TeslaEventState> eventStates;
+    std::vector<std::vector<size_t>> matchArrays;
+};
+
+inline void TestPassed(const std::string& name)
+{
+    std::cout << "Test [" << name << "] passed\n";
+}
+
+class BenchTimer
+{
+  public:
+    BenchTimer() : start(std::chrono::steady_clock::now()) {}
+
+    double ElapsedNs()
+    {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,146 @@
+#include "thintesla_helpers.h"
+
+#include <atomic>
+#include <cassert>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+/*
+ * Per-thread automaton lookup: checks that every thread gets its own clone and
+ * measures the cost of a thread-local event as the number of live threads grows.
+ */
+
+const size_t MAX_THREADS = 1024;
+const size_t BOUNDS_PER_THREAD = 2000;
+
+struct ThreadArgs
+{
+    TestAutomaton* automaton;
+    pthread_barrier_t* ready;
+    pthread_barrier_t* done;
+    TeslaAutomaton* clone;
+    double elapsedNs;
+};
+
+void RunBound(TestAutomaton& automaton)
+{
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+void* ThreadBody(void* arg)
+{
+    ThreadArgs* args = (ThreadArgs*)arg;
+    TestAutomaton& automaton = *args->automaton;
+
+    // Make sure every thread owns a clone before we start measuring.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+    args->clone = GetThreadAutomaton(automaton.Get());
+    assert(args->clone != NULL && args->clone->state.isInit);
+    EndAutomaton(automaton.Get(), automaton.End());
+
+    pthread_barrier_wait(args->ready);
+
+    BenchTimer timer;
+    for (size_t i = 0; i < BOUNDS_PER_THREAD; ++i)
+        RunBound(automaton);
+    args->elapsedNs = timer.ElapsedNs();
+
+    pthread_barrier_wait(args->done);
+    return NULL;
+}
+
+void TestCloneIsolation()
+{
+    TestAutomaton automaton("isolation", {Deterministic(), Deterministic(), AssertionSite(), Deterministic()}, true);
+
+    const size_t numThreads = 16;
+    std::vector<TeslaAutomaton*> clones(numThreads);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> arrived{0};
+
+    for (size_t t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+            clones[t] = GetThreadAutomaton(automaton.Get());
+            assert(clones[t] != NULL && clones[t]->state.currentEvent == automaton.Event(1));
+
+            // Wait until every thread is inside its bound, so no clone can be shared.
+            arrived++;
+            while (arrived.load() < numThreads)
+                std::this_thread::yield();
+
+            assert(GetThreadAutomaton(automaton.Get()) == clones[t]);
+            UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(2));
+            EndAutomaton(automaton.Get(), automaton.End());
+
+            // A new bound reuses the clone released by this thread.
+            UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(1));
+            assert(GetThreadAutomaton(automaton.Get()) == clones[t]);
+            EndAutomaton(automaton.Get(), automaton.End());
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < numThreads; ++i)
+        for (size_t j = i + 1; j < numThreads; ++j)
+            assert(clones[i] != clones[j]);
+}
+
+void BenchmarkScaling()
+{
+    std::cout << "# threads\tns/event (per thread)\n";
+
+    for (size_t numThreads = 1; numThreads <= MAX_THREADS; numThreads *= 2)
+    {
+        TestAutomaton automaton("scaling", {Deterministic(), Deterministic(), AssertionSite(), Deterministic()}, true);
+
+        pthread_barrier_t ready, done;
+        pthread_barrier_init(&ready, NULL, numThreads + 1);
+        pthread_barrier_init(&done, NULL, numThreads + 1);
+
+        std::vector<pthread_t> threads(numThreads);
+        std::vector<ThreadArgs> args(numThreads);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 64 * 1024);
+
+        for (size_t t = 0; t < numThreads; ++t)
+        {
+            args[t] = ThreadArgs{&automaton, &ready, &done, NULL, 0};
+            int err = pthread_create(&threads[t], &attr, ThreadBody, &args[t]);
+            assert(err == 0);
+        }
+
+        pthread_barrier_wait(&ready);
+        pthread_barrier_wait(&done);
+
+        double elapsed = 0;
+        for (size_t t = 0; t < numThreads; ++t)
+        {
+            pthread_join(threads[t], NULL);
+            elapsed += args[t].elapsedNs;
+        }
+
+        std::cout << "  " << numThreads << "\t\t" << elapsed / (numThreads * BOUNDS_PER_THREAD * 3) << "\n";
+
+        pthread_attr_destroy(&attr);
+        pthread_barrier_destroy(&ready);
+        pthread_barrier_destroy(&done);
+    }
+}
+
+int main()
+{
+    TestCloneIsolation();
+    BenchmarkScaling();
+
+    TestPassed("Thread automata");
+    return 0;
+}
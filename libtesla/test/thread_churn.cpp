@@ -0,0 +1,100 @@
+#include "thintesla_helpers.h"
+
+#include <cassert>
+#include <fstream>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Threads that exit in the middle of a bound give their clones back, so a
+ * program that keeps creating threads reuses the same few clones. The soak
+ * test runs rounds of short-lived threads and reports the resident set size
+ * once it has warmed up and at the end.
+ */
+
+const size_t NUM_THREADS = 8;
+const size_t NUM_ROUNDS = 500;
+const size_t WARMUP_ROUNDS = 50;
+const size_t MAX_RSS_GROWTH_KB = 1024;
+
+size_t ResidentKb()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* The base automaton is the first clone. */
+size_t NumClones(TestAutomaton& automaton)
+{
+    size_t clones = 0;
+    for (TeslaAutomaton* clone = automaton.Get(); clone != NULL; clone = clone->next)
+        clones++;
+    return clones;
+}
+
+/* Clones that a thread still holds, or that are still in a bound. */
+size_t NumHeld(TestAutomaton& automaton)
+{
+    size_t held = 0;
+    for (TeslaAutomaton* clone = automaton.Get(); clone != NULL; clone = clone->next)
+        held += clone->threadKey != INVALID_THREAD_KEY || clone->state.isInit;
+    return held;
+}
+
+/* Starts a bound on both automata, and leaves the thread without ending them once every thread is in its bounds. */
+void AbandonBounds(TestAutomaton& parametric, TestAutomaton& deterministic, size_t value, pthread_barrier_t* inBounds)
+{
+    UpdateAutomaton(parametric.Get(), parametric.Event(1), &value);
+    UpdateAutomatonDeterministic(deterministic.Get(), deterministic.Event(1));
+
+    TeslaAutomaton* clone = GetThreadAutomaton(parametric.Get());
+    assert(clone != NULL && clone->state.isInit && clone->threadKey == GetThreadKey());
+
+    pthread_barrier_wait(inBounds);
+}
+
+void RunRound(TestAutomaton& parametric, TestAutomaton& deterministic, size_t round)
+{
+    pthread_barrier_t inBounds;
+    pthread_barrier_init(&inBounds, NULL, NUM_THREADS);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; ++t)
+        threads.emplace_back([&, t] { AbandonBounds(parametric, deterministic, round * NUM_THREADS + t, &inBounds); });
+
+    for (auto& thread : threads)
+        thread.join();
+
+    pthread_barrier_destroy(&inBounds);
+}
+
+int main()
+{
+    TestAutomaton parametric("parametric", {Deterministic(), Parametric(1), Deterministic(), AssertionSite(), Deterministic()}, true, 0,
+                             2);
+    TestAutomaton deterministic("deterministic", {Deterministic(), Deterministic(), AssertionSite(), Deterministic()}, true, 1, 2);
+
+    size_t warmRss = 0;
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        RunRound(parametric, deterministic, round);
+
+        // The bounds the threads left behind were reset, and there are never more clones than threads alive at once.
+        assert(NumHeld(parametric) == 0 && NumHeld(deterministic) == 0);
+        assert(NumClones(parametric) <= NUM_THREADS && NumClones(deterministic) <= NUM_THREADS);
+
+        if (round + 1 == WARMUP_ROUNDS)
+            warmRss = ResidentKb();
+    }
+    size_t endRss = ResidentKb();
+
+    std::cout << "# threads\tclones\tRSS kB after " << WARMUP_ROUNDS << " rounds\tafter " << NUM_ROUNDS << "\n";
+    std::cout << "  " << NUM_THREADS * NUM_ROUNDS << "\t\t" << NumClones(parametric) << "\t" << warmRss << "\t\t\t" << endRss << "\n";
+    assert(endRss < warmRss + MAX_RSS_GROWTH_KB);
+
+    TestPassed("Thread churn");
+    return 0;
+}
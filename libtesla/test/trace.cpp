@@ -0,0 +1,291 @@
+#include "thintesla_helpers.h"
+
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Event traces: every hook of every thread ends up in the file, in order per
+ * thread, with its match data, and the header and automaton table describe
+ * what was recorded. A record-only trace leaves the automata alone, and
+ * stopping a trace keeps every record of the threads still running. The
+ * benchmark compares bounds without a trace, with one, with one that drops
+ * records rather than waiting for the flusher, and with a record-only one.
+ */
+
+const size_t NUM_AUTOMATA = 4;
+const size_t NUM_THREADS = 4;
+const size_t NUM_THREAD_BOUNDS = 1000;
+const size_t NUM_BENCH_BOUNDS = 1 << 20;
+
+std::vector<TestEvent> MakeDescription()
+{
+    return {Deterministic(), Deterministic(), Deterministic(), AssertionSite(), Deterministic()};
+}
+
+void RunBound(TestAutomaton& automaton)
+{
+    for (size_t event = 1; event < 4; ++event)
+        UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(event));
+    EndAutomaton(automaton.Get(), automaton.End());
+}
+
+std::string TracePath(const char* name)
+{
+    return "/tmp/thintesla-" + std::string(name) + "-" + std::to_string(getpid()) + ".trace";
+}
+
+struct Trace
+{
+    TeslaTraceHeader header;
+    std::vector<TeslaTraceRecord> records;
+    std::vector<TeslaTraceAutomaton> automata;
+};
+
+Trace ReadTrace(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    unlink(path.c_str());
+
+    Trace trace;
+    assert(contents.size() >= sizeof(TeslaTraceHeader));
+    memcpy(&trace.header, contents.data(), sizeof(TeslaTraceHeader));
+
+    const TeslaTraceHeader& header = trace.header;
+    assert(memcmp(header.magic, TESLA_TRACE_MAGIC, sizeof(header.magic)) == 0);
+    assert(header.version == TESLA_TRACE_VERSION);
+    assert(header.headerSize == sizeof(TeslaTraceHeader) && header.recordSize == sizeof(TeslaTraceRecord));
+    assert(header.automatonSize == sizeof(TeslaTraceAutomaton));
+    assert(header.automataOffset == header.headerSize + header.numRecords * header.recordSize);
+    assert(contents.size() == header.automataOffset + header.numAutomata * header.automatonSize);
+    assert(header.tscStart <= header.tscEnd && header.nsStart <= header.nsEnd);
+
+    trace.records.resize(header.numRecords);
+    memcpy(trace.records.data(), contents.data() + header.headerSize, header.numRecords * sizeof(TeslaTraceRecord));
+
+    trace.automata.resize(header.numAutomata);
+    memcpy(trace.automata.data(), contents.data() + header.automataOffset, header.numAutomata * sizeof(TeslaTraceAutomaton));
+
+    return trace;
+}
+
+void TestThreads()
+{
+    TestAutomaton automaton("threads", MakeDescription(), true, 0, NUM_AUTOMATA);
+
+    std::string path = TracePath("threads");
+    assert(TeslaStartTrace(path.c_str()));
+    assert(!TeslaStartTrace(path.c_str())); // One trace at a time.
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&] {
+            for (size_t k = 0; k < NUM_THREAD_BOUNDS; ++k)
+                RunBound(automaton);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    TeslaStopTrace();
+
+    Trace trace = ReadTrace(path);
+    assert(trace.header.numDropped == 0);
+    assert(trace.header.numRecords == 4 * NUM_THREADS * NUM_THREAD_BOUNDS);
+
+    // Every thread recorded its bounds in order.
+    std::map<uint32_t, std::vector<const TeslaTraceRecord*>> byThread;
+    for (const TeslaTraceRecord& record : trace.records)
+        byThread[record.thread].push_back(&record);
+
+    assert(byThread.size() == NUM_THREADS);
+    for (auto& thread : byThread)
+    {
+        assert(thread.first < trace.header.numThreads);
+        assert(thread.second.size() == 4 * NUM_THREAD_BOUNDS);
+
+        for (size_t i = 0; i < thread.second.size(); ++i)
+        {
+            const TeslaTraceRecord* record = thread.second[i];
+            assert(record->automatonId == 0 && record->eventId == 1 + i % 4);
+            assert(record->kind == (i % 4 == 3 ? TESLA_TRACE_END : TESLA_TRACE_EVENT));
+            assert(record->numWords == 0);
+            assert(i == 0 || thread.second[i - 1]->tsc <= record->tsc);
+        }
+    }
+
+    assert(trace.automata.size() == 1);
+    assert(trace.automata[0].id == 0 && trace.automata[0].numEvents == 5);
+    assert(strcmp(trace.automata[0].name, "threads") == 0);
+}
+
+void TestMatchData()
+{
+    TestAutomaton automaton("match data", {Deterministic(), Parametric(2), Parametric(7), AssertionSite(), Deterministic()},
+                            true, 1, NUM_AUTOMATA);
+
+    std::string path = TracePath("data");
+    assert(TeslaStartTrace(path.c_str()));
+
+    size_t pair[2] = {42, 43};
+    size_t many[7] = {1, 2, 3, 4, 5, 6, 7};
+    UpdateAutomaton(automaton.Get(), automaton.Event(1), pair);
+    UpdateAutomaton(automaton.Get(), automaton.Event(2), many);
+    UpdateEventWithData(automaton.Get(), 1, pair);
+
+    TA_Reset(GetThreadAutomaton(automaton.Get()));
+    TeslaStopTrace();
+
+    // Hooks are not recorded between traces.
+    UpdateAutomaton(automaton.Get(), automaton.Event(1), pair);
+    TA_Reset(GetThreadAutomaton(automaton.Get()));
+
+    Trace trace = ReadTrace(path);
+    assert(trace.header.numRecords == 3);
+
+    const TeslaTraceRecord& first = trace.records[0];
+    assert(first.kind == TESLA_TRACE_EVENT_DATA && first.eventId == 1);
+    assert(first.numWords == 2 && first.data[0] == 42 && first.data[1] == 43 && first.data[2] == 0);
+
+    const TeslaTraceRecord& truncated = trace.records[1];
+    assert(truncated.kind == (TESLA_TRACE_EVENT_DATA | TESLA_TRACE_TRUNCATED));
+    assert(truncated.numWords == TESLA_TRACE_MAX_WORDS && truncated.data[TESLA_TRACE_MAX_WORDS - 1] == 5);
+
+    const TeslaTraceRecord& stored = trace.records[2];
+    assert(stored.kind == TESLA_TRACE_MATCH_DATA && stored.eventId == 1 && stored.data[1] == 43);
+}
+
+void TestLinked()
+{
+    TestAutomaton first("first", MakeDescription(), true, 2, NUM_AUTOMATA);
+    TestAutomaton second("second", MakeDescription(), true, 3, NUM_AUTOMATA);
+    TeslaAutomaton* automata[] = {first.Get(), second.Get()};
+
+    std::string path = TracePath("linked");
+    assert(TeslaStartTrace(path.c_str()));
+    EndLinkedAutomata(automata, 2);
+    TeslaStopTrace();
+
+    Trace trace = ReadTrace(path);
+    assert(trace.header.numRecords == 2);
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const TeslaTraceRecord& record = trace.records[i];
+        assert(record.kind == TESLA_TRACE_END_LINKED && record.automatonId == 2 + i && record.eventId == 4);
+        assert(record.numWords == 2 && record.data[0] == i && record.data[1] == 2);
+    }
+}
+
+/* Only recorded: the automaton does not even start, and a bound that would fail is left to the replay. */
+void TestRecordOnly()
+{
+    TestAutomaton automaton("record only", MakeDescription(), true, 1, NUM_AUTOMATA);
+
+    std::string path = TracePath("only");
+    assert(TeslaStartTraceWithFlags(path.c_str(), TESLA_TRACE_RECORD_ONLY));
+
+    // The assertion site without the events before it.
+    UpdateAutomatonDeterministic(automaton.Get(), automaton.Event(3));
+    EndAutomaton(automaton.Get(), automaton.End());
+    RunBound(automaton);
+
+    assert(!automaton.Get()->state.isInit);
+    assert(GetThreadAutomaton(automaton.Get()) == NULL || !GetThreadAutomaton(automaton.Get())->state.isInit);
+    TeslaStopTrace();
+
+    Trace trace = ReadTrace(path);
+    assert(trace.header.numRecords == 6 && trace.header.numDropped == 0);
+    assert(trace.records[0].eventId == 3 && trace.records[1].kind == TESLA_TRACE_END);
+}
+
+void TestStopWhileRecording()
+{
+    TestAutomaton automaton("stop", MakeDescription(), false, 2, NUM_AUTOMATA);
+
+    std::string path = TracePath("stop");
+    assert(TeslaStartTraceWithFlags(path.c_str(), TESLA_TRACE_RECORD_ONLY));
+
+    // A record-only hook says whether it was recorded, until the trace stops.
+    std::atomic<size_t> recorded(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.emplace_back([&] {
+            size_t count = 0;
+            while (TeslaTrace_Record(automaton.Get(), 1, TESLA_TRACE_EVENT, NULL, 0))
+                ++count;
+            recorded += count;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TeslaStopTrace();
+
+    for (auto& thread : threads)
+        thread.join();
+
+    Trace trace = ReadTrace(path);
+    assert(trace.header.numRecords + trace.header.numDropped == recorded);
+}
+
+/* Records of a thread that gets ahead of the flusher are only lost if the trace was started to drop them. */
+double Measure(bool tracing, unsigned flags = 0)
+{
+    TestAutomaton automaton("bench", MakeDescription(), true, 0, NUM_AUTOMATA);
+
+    std::string path = TracePath("bench");
+    if (tracing)
+        assert(TeslaStartTraceWithFlags(path.c_str(), flags));
+
+    BenchTimer timer;
+    for (size_t i = 0; i < NUM_BENCH_BOUNDS; ++i)
+        RunBound(automaton);
+    double ns = timer.ElapsedNs() / NUM_BENCH_BOUNDS;
+
+    if (tracing)
+    {
+        TeslaStopTrace();
+
+        Trace trace = ReadTrace(path);
+        assert(trace.header.numRecords + trace.header.numDropped == 4 * NUM_BENCH_BOUNDS);
+        assert((flags & TESLA_TRACE_DROP_WHEN_FULL) || trace.header.numDropped == 0);
+    }
+
+    return ns;
+}
+
+int main()
+{
+    std::string probe = TracePath("probe");
+    bool enabled = TeslaStartTrace(probe.c_str());
+
+    if (enabled)
+    {
+        TeslaStopTrace();
+        unlink(probe.c_str());
+
+        TestThreads();
+        TestMatchData();
+        TestLinked();
+        TestRecordOnly();
+        TestStopWhileRecording();
+    }
+
+    std::cout << "# trace\t\tns/bound\n";
+    std::cout << "  off\t\t" << Measure(false) << "\n";
+    if (enabled)
+    {
+        std::cout << "  on\t\t" << Measure(true) << "\n";
+        std::cout << "  dropping\t" << Measure(true, TESLA_TRACE_DROP_WHEN_FULL) << "\n";
+        std::cout << "  record only\t" << Measure(true, TESLA_TRACE_RECORD_ONLY) << "\n";
+    }
+
+    TestPassed("Trace");
+    return 0;
+}
@@ -19,6 +19,53 @@ std::vector<ThinTeslaEventPtr> GetOROptionalBlock(std::vector<ThinTeslaEventPtr>
     return block;
 }
 
+std::set<size_t> GetPredecessorIds(ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    std::set<size_t> ids;
+    for (auto& ev : assertion.events)
+    {
+        for (auto& succ : ev->successors)
+        {
+            if (succ->id == event.id)
+                ids.insert(ev->id);
+        }
+    }
+
+    return ids;
+}
+
+std::set<size_t> GetLaterORBlockIds(ThinTeslaEvent& event)
+{
+    std::set<size_t> ids;
+    if (!event.isOR)
+        return ids;
+
+    for (auto& succ : event.successors)
+    {
+        if (succ->isOR)
+            ids.insert(succ->id);
+    }
+
+    return ids;
+}
+
+std::vector<ThinTeslaAssertion> ThinTeslaAssertionBuilder::BuildAll(const tesla::Manifest& manifest)
+{
+    std::vector<ThinTeslaAssertion> all;
+
+    for (auto& automaton : manifest.RootAutomata())
+    {
+        ThinTeslaAssertionBuilder builder{manifest, automaton};
+        for (auto& assertion : builder.GetAssertions())
+        {
+            all.push_back(*assertion);
+            all.back().globalId = all.size() - 1;
+        }
+    }
+
+    return all;
+}
+
 void ThinTeslaAssertionBuilder::BuildAssertion()
 {
     isThreadLocal = desc->context() == tesla::AutomatonDescription_Context_ThreadLocal;
@@ -108,6 +108,9 @@ class ThinTeslaEvent
 
     size_t id = 0;
     std::vector<std::shared_ptr<ThinTeslaEvent>> successors;
+
+    // Store for the match data of the event at runtime. TESLA_STORE_INVALID lets the runtime pick TESLA_DEFAULT_STORE.
+    StoreType storeKind = TESLA_STORE_INVALID;
 };
 
 using ThinTeslaEventPtr = std::shared_ptr<ThinTeslaEvent>;
@@ -215,6 +218,13 @@ struct ThinTeslaAssertion
         return linkMaster;
     }
 
+    // Name of the automaton global, and of the automaton at runtime.
+    std::string GetName() const
+    {
+        return assertionFilename + "_" + std::to_string(assertionLine) + "_" + std::to_string(assertionCounter) + "_" +
+               std::to_string(id);
+    }
+
     std::vector<ThinTeslaEventPtr> events;
     size_t id = 0;
     size_t globalId = 0;
@@ -232,6 +242,12 @@ struct ThinTeslaAssertion
 
 using AssertionPtr = std::shared_ptr<ThinTeslaAssertion>;
 
+/* Ids of the events that have this one as a successor. */
+std::set<size_t> GetPredecessorIds(ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
+
+/* Ids of the later events of the OR block of this one, from which it causes no transition. */
+std::set<size_t> GetLaterORBlockIds(ThinTeslaEvent& event);
+
 class ThinTeslaAssertionBuilder
 {
   public:
@@ -260,6 +276,13 @@ class ThinTeslaAssertionBuilder
         return assertions;
     }
 
+    /*
+     * The assertions of every automaton in the manifest. globalId is the
+     * index in the result, which is the id of the automaton at runtime, so
+     * the same manifest always gives the same ids.
+     */
+    static std::vector<ThinTeslaAssertion> BuildAll(const tesla::Manifest& manifest);
+
     bool HasMultipleAssertions()
     {
         return assertions.size() > 1;
@@ -1,16 +1,81 @@
 #include "ThinTeslaInstrumenter.h"
+#include "Debug.h"
 #include "Names.h"
 
 #include "../../libtesla/c_thintesla/TeslaLogic.h"
 
+#include <algorithm>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
 using namespace llvm;
 
+static cl::opt<bool>
+    UseShiftAnd("thin-tesla-shift-and",
+                cl::desc("Run small deterministic automata with the shift-and engine"), cl::init(true));
+
+enum class CodegenMode
+{
+    Generic,
+    Specialized
+};
+
+static cl::opt<CodegenMode>
+    Codegen("thin-tesla-codegen",
+            cl::desc("How transitions of deterministic automata are compiled"),
+            cl::values(clEnumValN(CodegenMode::Generic, "generic", "Call the runtime interpreter"),
+                       clEnumValN(CodegenMode::Specialized, "specialized", "Emit a transition function for every automaton")),
+            cl::init(CodegenMode::Generic));
+
+static cl::opt<std::string>
+    RuntimeBitcode("thin-tesla-runtime-bitcode",
+                   cl::desc("Runtime fast path (cthintesla-fastpath.bc) to inline into instrumented code"), cl::init(""));
+
+static cl::opt<bool>
+    UseLiveGuard("thin-tesla-live-guard",
+                 cl::desc("Only call the runtime for events of thread-local automata that are live in the thread"), cl::init(true));
+
+static cl::opt<bool>
+    Patchable("thin-tesla-patchable",
+              cl::desc("Emit every hook behind a site that is disabled until TeslaEnableAutomaton patches it"), cl::init(false));
+
+static cl::opt<bool>
+    ConcurrentGlobal("thin-tesla-concurrent-global",
+                     cl::desc("Let several threads update global automata at once (lock-free for deterministic automata)"), cl::init(true));
+
+static cl::opt<unsigned>
+    SampleRate("thin-tesla-sample-rate",
+               cl::desc("Check one temporal bound in N of every automaton (TESLA_SAMPLE_RATE overrides it)"), cl::init(1));
+
+static cl::list<std::string>
+    SampleRates("thin-tesla-sample",
+                cl::desc("Sample rate of a single automaton, as <automaton>=<N>"), cl::CommaSeparated);
+
+static cl::list<std::string>
+    SingleStores("thin-tesla-single-store",
+                 cl::desc("Events that happen at most once per temporal bound of their automaton, as <automaton>=<event id> "
+                          "reported by the static optimizer; they keep their match data in a single slot"),
+                 cl::CommaSeparated);
+
 const bool THREAD_LOCAL = false;
 
 const GlobalValue::LinkageTypes DEFAULT_LINKAGE = GlobalValue::LinkOnceODRLinkage;
 
 char ThinTeslaInstrumenter::ID = 0;
 
+/* Weights of a branch into the runtime: most events happen outside of the bounds of the automata that watch them. */
+static MDNode* GetColdWeights(LLVMContext& C)
+{
+    return MDBuilder(C).createBranchWeights(1, 1000);
+}
+
 void OutFunction(llvm::Function* f)
 {
     llvm::errs() << "Function " << f->getName() << "\n"
@@ -67,6 +132,15 @@ bool ThinTeslaInstrumenter::runOnModule(llvm::Module& M)
 
     multipleInstrumentedFunctions = GetFunctionsInstrumentedMoreThanOnce();
 
+    if (Patchable)
+    {
+        if (assertionsShareTemporalBounds && temporalBound == "amd64_syscall")
+            tesla::panic("-thin-tesla-patchable is not supported in the kernel", false);
+
+        if (Triple(M.getTargetTriple()).getArch() != Triple::x86_64)
+            tesla::panic("-thin-tesla-patchable is only supported on x86-64", false);
+    }
+
     for (auto& assertion : assertions)
     {
         bool needsInstrumentation = (GetFilenameFromPath(M.getName()) == GetFilenameFromPath(assertion.assertionFilename));
@@ -100,9 +174,52 @@ bool ThinTeslaInstrumenter::runOnModule(llvm::Module& M)
 
     multipleInstrumentedFunctions.clear();
 
+    if (instrumented && !RuntimeBitcode.empty())
+        LinkRuntimeFastPath(M);
+
     return instrumented;
 }
 
+/*
+ * Links the fast path of the runtime into the module, so that hooks become inline code instead of
+ * calls into libcthintesla. Only the functions reached from the hooks are pulled in. They are made
+ * internal, not to clash with the library, which still provides the slow paths they call.
+ */
+void ThinTeslaInstrumenter::LinkRuntimeFastPath(llvm::Module& M)
+{
+    SMDiagnostic error;
+    std::unique_ptr<Module> runtime = parseIRFile(RuntimeBitcode, error, M.getContext());
+    if (!runtime)
+    {
+        error.print("tesla", llvm::errs());
+        tesla::panic("unable to load runtime bitcode " + RuntimeBitcode, false);
+    }
+
+    std::set<std::string> fastPath;
+    for (auto& F : *runtime)
+    {
+        if (!F.isDeclaration())
+            fastPath.insert(F.getName());
+    }
+
+    runtime->setDataLayout(M.getDataLayout());
+    runtime->setTargetTriple(M.getTargetTriple());
+
+    if (Linker::linkModules(M, std::move(runtime), Linker::Flags::LinkOnlyNeeded))
+        tesla::panic("unable to link runtime bitcode " + RuntimeBitcode, false);
+
+    for (auto& name : fastPath)
+    {
+        Function* F = M.getFunction(name);
+        if (F == nullptr || F->isDeclaration())
+            continue;
+
+        F->setLinkage(GlobalValue::InternalLinkage);
+        F->addFnAttr(Attribute::AlwaysInline);
+        F->removeFnAttr(Attribute::NoInline);
+    }
+}
+
 void ThinTeslaInstrumenter::Instrument(llvm::Module& M, ThinTeslaAssertion& assertion)
 {
     for (auto event : assertion.events)
@@ -188,6 +305,22 @@ Function* ThinTeslaInstrumenter::BuildInstrumentationCheck(llvm::Module& M, Thin
         constIndex++;
     }
 
+    // Then skip the call if the automaton is not running in this thread, before any matching is done.
+    if (NeedsLiveGuard(assertion, event))
+    {
+        BasicBlock* live = BasicBlock::Create(C, "live", function, ifTrue);
+        builder.SetInsertPoint(live);
+        builder.CreateCondBr(CreateLiveCheck(M, builder, assertion), ifTrue, exit, GetColdWeights(C));
+        ifTrue = live;
+    }
+
+    if (Patchable)
+    {
+        BasicBlock* site = BasicBlock::Create(C, "site", function, ifTrue);
+        builder.SetInsertPoint(site);
+        builder.CreateCondBr(CreateSiteCheck(M, builder, assertion), ifTrue, exit, GetColdWeights(C));
+    }
+
     // Now collect all runtime values if needed.
     builder.SetInsertPoint(instrument);
 
@@ -216,8 +349,7 @@ Function* ThinTeslaInstrumenter::BuildInstrumentationCheck(llvm::Module& M, Thin
     }
     else // No runtime values, all checks have been done statically.
     {
-        Function* updateAutomaton = TeslaTypes::GetUpdateAutomatonDeterministic(M);
-        builder.CreateCall(updateAutomaton, {GetAutomatonGlobal(M, assertion), GetEventGlobal(M, assertion, event)});
+        CreateDeterministicUpdate(M, builder, assertion, event);
     }
 
     builder.CreateBr(exit);
@@ -421,7 +553,8 @@ void ThinTeslaInstrumenter::UpdateEventsWithParametersGlobal(llvm::Module& M, Th
     }
 }
 
-void ThinTeslaInstrumenter::UpdateEventsWithParametersThread(llvm::Module& M, ThinTeslaAssertion& assertion, llvm::Instruction* insertPoint)
+void ThinTeslaInstrumenter::UpdateEventsWithParametersThread(llvm::Module& M, ThinTeslaAssertion& assertion, llvm::Instruction* insertPoint,
+                                                             llvm::Function* updateFunction)
 {
     Function* function = insertPoint->getParent()->getParent();
 
@@ -429,7 +562,6 @@ void ThinTeslaInstrumenter::UpdateEventsWithParametersThread(llvm::Module& M, Th
 
     LLVMContext& C = M.getContext();
 
-    Function* updateFunction = TeslaTypes::GetUpdateEventWithData(M);
     auto automatonGlobal = GetAutomatonGlobal(M, assertion);
 
     for (auto event : assertion.events)
@@ -475,8 +607,6 @@ void ThinTeslaInstrumenter::InstrumentEvent(llvm::Module& M, ThinTeslaAssertion&
 {
     Function* function = M.getFunction(event.functionName);
 
-    Function* updateAutomaton = TeslaTypes::GetUpdateAutomatonDeterministic(M);
-
     if (function != nullptr && !function->isDeclaration())
     {
         assert(event.isDeterministic);
@@ -487,20 +617,33 @@ void ThinTeslaInstrumenter::InstrumentEvent(llvm::Module& M, ThinTeslaAssertion&
             llvm::errs() << *function << "\n";
         assert(callInst != nullptr);
 
+        // Parameters are read from the function, so the site cannot go in a function of its own.
+        Instruction* insertPoint = callInst;
+        if (Patchable)
+        {
+            IRBuilder<> siteBuilder(callInst);
+            insertPoint = SplitBlockAndInsertIfThen(CreateSiteCheck(M, siteBuilder, assertion), callInst, false,
+                                                    GetColdWeights(M.getContext()));
+        }
+
         if (!assertion.isDeterministic)
         {
-            if (!assertion.isThreadLocal)
+            if (IsConcurrent(assertion)) // Other threads may be asserting too, so the data is staged in this thread.
             {
-                UpdateEventsWithParametersGlobal(M, assertion, callInst);
+                UpdateEventsWithParametersThread(M, assertion, insertPoint, TeslaTypes::GetStageEventWithData(M));
+            }
+            else if (!assertion.isThreadLocal)
+            {
+                UpdateEventsWithParametersGlobal(M, assertion, insertPoint);
             }
             else
             {
-                UpdateEventsWithParametersThread(M, assertion, callInst);
+                UpdateEventsWithParametersThread(M, assertion, insertPoint, TeslaTypes::GetUpdateEventWithData(M));
             }
         }
 
-        IRBuilder<> builder(callInst);
-        builder.CreateCall(updateAutomaton, {GetAutomatonGlobal(M, assertion), GetEventGlobal(M, assertion, event)});
+        IRBuilder<> builder(insertPoint);
+        CreateDeterministicUpdate(M, builder, assertion, event);
 
         if (!assertion.IsLinked() || (assertion.IsLinked() && assertion.IsLinkMaster()))
             callInst->eraseFromParent();
@@ -521,12 +664,9 @@ Instruction* ThinTeslaInstrumenter::GetFirstInstruction(llvm::Function* function
 
 void ThinTeslaInstrumenter::InstrumentInstruction(llvm::Module& M, llvm::Instruction* instr, ThinTeslaAssertion& assertion, ThinTeslaFunction& event)
 {
-    Function* updateAutomaton = TeslaTypes::GetUpdateAutomatonDeterministic(M);
     Function* startAutomaton = TeslaTypes::GetStartAutomaton(M);
     Function* incrementInitTag = TeslaTypes::GetIncrementInitTag(M);
 
-    GlobalVariable* global = GetEventGlobal(M, assertion, event);
-
     IRBuilder<> builder(M.getContext());
 
     if (event.IsEnd())
@@ -558,10 +698,322 @@ void ThinTeslaInstrumenter::InstrumentInstruction(llvm::Module& M, llvm::Instruc
     }
     else
     {
-        builder.CreateCall(updateAutomaton, {GetAutomatonGlobal(M, assertion), global});
+        CreateSite(M, builder, assertion, GetEventID(assertion, event) + "_site",
+                   [&](IRBuilder<>& siteBuilder) { CreateGuardedUpdate(M, siteBuilder, assertion, event); });
     }
 }
 
+/*
+ * Only events that can start an automaton have to reach the runtime while it is not live
+ * in the thread: every other event returns from GetThreadAutomaton or LateInitAutomaton
+ * without doing anything. Global automata have no per-thread state to check, and the
+ * kernel has no live bytes.
+ */
+bool ThinTeslaInstrumenter::NeedsLiveGuard(ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    if (!UseLiveGuard || !assertion.isThreadLocal)
+        return false;
+
+    if (assertionsShareTemporalBounds && temporalBound == "amd64_syscall")
+        return false;
+
+    return !event.IsInitial() && !event.IsAssertion() && assertion.globalId < TESLA_MAX_AUTOMATA;
+}
+
+/*
+ * Global automata of the kernel are only updated by one thread at a time. Only the
+ * assertion sites of parametric automata stage their data, so only those are limited
+ * by the staging buffer of the runtime.
+ */
+bool ThinTeslaInstrumenter::IsConcurrent(ThinTeslaAssertion& assertion)
+{
+    if (!ConcurrentGlobal || assertion.isThreadLocal)
+        return false;
+
+    if (assertionsShareTemporalBounds && temporalBound == "amd64_syscall")
+        return false;
+
+    return assertion.isDeterministic || assertion.events.size() <= TESLA_MAX_STAGED_EVENTS;
+}
+
+Value* ThinTeslaInstrumenter::CreateLiveCheck(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion)
+{
+    GlobalVariable* liveAutomata = TeslaTypes::GetLiveAutomata(M);
+    Value* live = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(liveAutomata->getValueType(), liveAutomata, 0, assertion.globalId), "live");
+    return builder.CreateIsNotNull(live);
+}
+
+/*
+ * The guard of an event that is not parametric goes in a function of its own, so that the
+ * instrumented block is not split: parameters are read from allocas that must stay in the
+ * entry block. It is always inlined, and only the load and the branch stay in line.
+ */
+void ThinTeslaInstrumenter::CreateGuardedUpdate(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    if (!NeedsLiveGuard(assertion, event))
+    {
+        CreateDeterministicUpdate(M, builder, assertion, event);
+        return;
+    }
+
+    std::string name = GetEventID(assertion, event) + "_guarded";
+    Function* function = M.getFunction(name);
+    if (function == nullptr)
+    {
+        LLVMContext& C = M.getContext();
+
+        function = Function::Create(FunctionType::get(Type::getVoidTy(C), false), DEFAULT_LINKAGE, name, &M);
+        function->addFnAttr(Attribute::AlwaysInline);
+
+        BasicBlock* entry = BasicBlock::Create(C, "entry", function);
+        BasicBlock* update = BasicBlock::Create(C, "update", function);
+        BasicBlock* exit = BasicBlock::Create(C, "exit", function);
+
+        IRBuilder<> guardBuilder{entry};
+        guardBuilder.CreateCondBr(CreateLiveCheck(M, guardBuilder, assertion), update, exit, GetColdWeights(C));
+
+        guardBuilder.SetInsertPoint(update);
+        CreateDeterministicUpdate(M, guardBuilder, assertion, event);
+        guardBuilder.CreateBr(exit);
+
+        guardBuilder.SetInsertPoint(exit);
+        guardBuilder.CreateRetVoid();
+    }
+
+    builder.CreateCall(function, {});
+}
+
+/*
+ * A patchable site is a movb of an immediate into a register, which TeslaEnableAutomaton
+ * and TeslaDisableAutomaton rewrite to 1 or 0 in place. The asm records the address of the
+ * immediate and the name of the automaton in the tesla_sites section, which the runtime
+ * reads through TeslaRegisterSites. LLVM has no asm goto to jump over the hook directly,
+ * so the register is tested by a branch that is never taken while the site is disabled.
+ */
+Value* ThinTeslaInstrumenter::CreateSiteCheck(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion)
+{
+    LLVMContext& C = M.getContext();
+
+    std::string autID = GetAutomatonID(assertion);
+
+    // A private copy of the name, so that the asm can refer to it without a GOT entry.
+    std::string nameID = autID + "_site_name";
+    GlobalVariable* name = M.getGlobalVariable(nameID, true);
+    if (name == nullptr)
+    {
+        Constant* nameConst = ConstantDataArray::getString(C, autID);
+        name = new GlobalVariable(M, nameConst->getType(), true, GlobalValue::PrivateLinkage, nameConst, nameID);
+    }
+
+    RegisterSites(M);
+
+    Type* Int8PtrTy = Type::getInt8PtrTy(C);
+    InlineAsm* site = InlineAsm::get(FunctionType::get(Type::getInt8Ty(C), {Int8PtrTy}, false),
+                                     "movb $$0, $0\n"
+                                     "1:\n"
+                                     "\t.pushsection tesla_sites,\"aw\"\n"
+                                     "\t.balign 8\n"
+                                     "\t.quad 1b - 1\n"
+                                     "\t.quad ${1:c}\n"
+                                     "\t.popsection",
+                                     "=q,i,~{dirflag},~{fpsr},~{flags}", true);
+
+    Value* enabled = builder.CreateCall(site, {ConstantExpr::getBitCast(name, Int8PtrTy)}, "site");
+    return builder.CreateIsNotNull(enabled);
+}
+
+/*
+ * Emits a constructor that hands the tesla_sites section of the final executable or library
+ * to the runtime. The linker defines the bounds of the section. Every instrumented object
+ * file has its own copy of the constructor, and the runtime ignores all but the first call.
+ */
+void ThinTeslaInstrumenter::RegisterSites(llvm::Module& M)
+{
+    const std::string name = "tesla_register_sites";
+    if (M.getFunction(name) != nullptr)
+        return;
+
+    LLVMContext& C = M.getContext();
+
+    auto getBound = [&](const std::string& boundName) {
+        GlobalVariable* bound = new GlobalVariable(M, Type::getInt8Ty(C), false, GlobalValue::ExternalLinkage, nullptr, boundName);
+        bound->setVisibility(GlobalValue::HiddenVisibility);
+        return bound;
+    };
+
+    Function* function = Function::Create(FunctionType::get(Type::getVoidTy(C), false), GlobalValue::InternalLinkage, name, &M);
+    IRBuilder<> builder{BasicBlock::Create(C, "entry", function)};
+    builder.CreateCall(TeslaTypes::GetRegisterSites(M), {getBound("__start_tesla_sites"), getBound("__stop_tesla_sites")});
+    builder.CreateRetVoid();
+
+    appendToGlobalCtors(M, function, 0);
+
+    // The section must exist for the linker to define its bounds, even if the optimizer removes every site.
+    M.appendModuleInlineAsm("\t.pushsection tesla_sites,\"aw\"\n\t.popsection");
+}
+
+/*
+ * Runs the code emitted by createBody only if the site is enabled, from an always inlined function
+ * that keeps the instrumented block in one piece. Without -thin-tesla-patchable it is emitted directly.
+ */
+void ThinTeslaInstrumenter::CreateSite(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, const std::string& name,
+                                       std::function<void(IRBuilder<>&)> createBody)
+{
+    if (!Patchable)
+    {
+        createBody(builder);
+        return;
+    }
+
+    Function* function = M.getFunction(name);
+    if (function == nullptr)
+    {
+        LLVMContext& C = M.getContext();
+
+        function = Function::Create(FunctionType::get(Type::getVoidTy(C), false), DEFAULT_LINKAGE, name, &M);
+        function->addFnAttr(Attribute::AlwaysInline);
+
+        BasicBlock* entry = BasicBlock::Create(C, "entry", function);
+        BasicBlock* hook = BasicBlock::Create(C, "hook", function);
+        BasicBlock* exit = BasicBlock::Create(C, "exit", function);
+
+        IRBuilder<> siteBuilder{entry};
+        siteBuilder.CreateCondBr(CreateSiteCheck(M, siteBuilder, assertion), hook, exit, GetColdWeights(C));
+
+        siteBuilder.SetInsertPoint(hook);
+        createBody(siteBuilder);
+        siteBuilder.CreateBr(exit);
+
+        siteBuilder.SetInsertPoint(exit);
+        siteBuilder.CreateRetVoid();
+    }
+
+    builder.CreateCall(function, {});
+}
+
+void ThinTeslaInstrumenter::CreateDeterministicUpdate(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    if (Codegen == CodegenMode::Specialized && assertion.isDeterministic && !IsConcurrent(assertion))
+    {
+        builder.CreateCall(GetSpecializedUpdate(M, assertion), {TeslaTypes::GetSizeT(M.getContext(), event.id)});
+    }
+    else
+    {
+        Function* updateAutomaton = TeslaTypes::GetUpdateAutomatonDeterministic(M);
+        builder.CreateCall(updateAutomaton, {GetAutomatonGlobal(M, assertion), GetEventGlobal(M, assertion, event)});
+    }
+}
+
+/*
+ * Builds void <automaton>_update(size_t eventId), the transitions of a deterministic automaton
+ * hard-coded as a switch over the current event. It follows UpdateAutomatonDeterministicGeneric:
+ * an event is taken from its predecessors, ignored from the later events of its OR block, and
+ * otherwise the automaton starts over from the first event. Every call site passes a constant
+ * id, so once the function is inlined only the switch of that event is left.
+ */
+Function* ThinTeslaInstrumenter::GetSpecializedUpdate(llvm::Module& M, ThinTeslaAssertion& assertion)
+{
+    std::string name = GetAutomatonID(assertion) + "_update";
+    Function* old = M.getFunction(name);
+    if (old != nullptr)
+        return old;
+
+    LLVMContext& C = M.getContext();
+
+    Function* function = Function::Create(FunctionType::get(Type::getVoidTy(C), {TeslaTypes::GetSizeTType(C)}, false),
+                                          DEFAULT_LINKAGE, name, &M);
+    function->addFnAttr(Attribute::AlwaysInline);
+    Argument* eventId = &*function->arg_begin();
+
+    BasicBlock* entry = BasicBlock::Create(C, "entry", function);
+    BasicBlock* dispatch = BasicBlock::Create(C, "dispatch", function);
+    BasicBlock* exit = BasicBlock::Create(C, "exit", function);
+
+    IRBuilder<> builder{exit};
+    builder.CreateRetVoid();
+
+    // The array of events is constant, so this load folds away with a constant id.
+    builder.SetInsertPoint(entry);
+    GlobalVariable* events = GetEventsArray(M, assertion);
+    Value* event = builder.CreateLoad(builder.CreateInBoundsGEP(events->getValueType(), events, {TeslaTypes::GetInt(C, 32, 0), eventId}));
+    Value* automaton = builder.CreateCall(TeslaTypes::GetSpecializedAutomaton(M), {GetAutomatonGlobal(M, assertion), event});
+    builder.CreateCondBr(builder.CreateIsNotNull(automaton), dispatch, exit);
+
+    builder.SetInsertPoint(dispatch);
+    Value* currentPtr = builder.CreateInBoundsGEP(TeslaTypes::AutomatonTy, automaton,
+                                                  {TeslaTypes::GetInt(C, 32, 0), TeslaTypes::GetInt(C, 32, AUTOMATON_STATE_FIELD), TeslaTypes::GetInt(C, 32, 1)});
+    Value* current = builder.CreateLoad(currentPtr, "current");
+    Value* currentId = builder.CreateLoad(builder.CreateStructGEP(TeslaTypes::EventTy, current, 3), "current_id");
+    SwitchInst* eventSwitch = builder.CreateSwitch(eventId, exit);
+
+    for (auto& ev : assertion.events)
+    {
+        // The first event is handled by late initialization, and the end by EndAutomaton.
+        if (ev->id == 0 || ev->IsEnd())
+            continue;
+
+        std::string prefix = "e" + std::to_string(ev->id) + "_";
+        GlobalVariable* evGlobal = GetEventGlobal(M, assertion, *ev);
+        auto predecessors = GetPredecessorIds(assertion, *ev);
+        auto orBlock = GetLaterORBlockIds(*ev);
+        bool takenFromFirst = predecessors.count(0) > 0;
+
+        BasicBlock* transition = BasicBlock::Create(C, prefix + "transition", function);
+        BasicBlock* restart = BasicBlock::Create(C, prefix + "restart", function);
+        BasicBlock* done = BasicBlock::Create(C, prefix + "done", function);
+        eventSwitch->addCase(TeslaTypes::GetSizeT(C, ev->id), transition);
+
+        builder.SetInsertPoint(done);
+        PHINode* found = builder.CreatePHI(TeslaTypes::GetBoolType(C), 3, "found");
+
+        builder.SetInsertPoint(transition);
+        SwitchInst* currentSwitch = builder.CreateSwitch(currentId, restart);
+
+        if (!predecessors.empty())
+        {
+            BasicBlock* advance = BasicBlock::Create(C, prefix + "advance", function, restart);
+            for (auto id : predecessors)
+                currentSwitch->addCase(TeslaTypes::GetSizeT(C, id), advance);
+
+            builder.SetInsertPoint(advance);
+            builder.CreateStore(evGlobal, currentPtr);
+            builder.CreateBr(done);
+            found->addIncoming(TeslaTypes::GetBoolValue(C, 1), advance);
+        }
+
+        if (!orBlock.empty())
+        {
+            BasicBlock* stay = BasicBlock::Create(C, prefix + "stay", function, restart);
+            for (auto id : orBlock)
+                currentSwitch->addCase(TeslaTypes::GetSizeT(C, id), stay);
+
+            builder.SetInsertPoint(stay);
+            builder.CreateBr(done);
+            found->addIncoming(TeslaTypes::GetBoolValue(C, 1), stay);
+        }
+
+        // From the first event, this one is either taken or the automaton stays there.
+        builder.SetInsertPoint(restart);
+        builder.CreateCall(TeslaTypes::GetRestartSpecializedAutomaton(M), {automaton});
+        if (takenFromFirst)
+            builder.CreateStore(evGlobal, currentPtr);
+        builder.CreateBr(done);
+        found->addIncoming(TeslaTypes::GetBoolValue(C, takenFromFirst), restart);
+
+        bool needsFinish = ev->IsAssertion();
+#ifdef GUIDELINE_MODE
+        needsFinish = needsFinish || ev->IsFinal();
+#endif
+
+        builder.SetInsertPoint(done);
+        if (needsFinish)
+            builder.CreateCall(TeslaTypes::GetFinishSpecializedTransition(M), {automaton, evGlobal, found});
+        builder.CreateBr(exit);
+    }
+
+    return function;
+}
+
 std::vector<llvm::CallInst*> ThinTeslaInstrumenter::GetAllCallsToFunction(llvm::Module& M, const std::string& functionName)
 {
     std::vector<llvm::CallInst*> calls;
@@ -650,6 +1102,19 @@ void ThinTeslaInstrumenter::InstrumentEveryExit(llvm::Module& M, Function* funct
 }
 
 void ThinTeslaInstrumenter::InstrumentEndAutomaton(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaFunction& event)
+{
+    if (Patchable)
+    {
+        CreateSite(M, builder, assertion, GetEventID(assertion, event) + "_site",
+                   [&](IRBuilder<>& siteBuilder) { InstrumentEndAutomatonUnpatched(M, siteBuilder, assertion, event); });
+    }
+    else
+    {
+        InstrumentEndAutomatonUnpatched(M, builder, assertion, event);
+    }
+}
+
+void ThinTeslaInstrumenter::InstrumentEndAutomatonUnpatched(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaFunction& event)
 {
     Function* endAutomaton = TeslaTypes::GetEndAutomaton(M);
     Function* endAllAutomataKernel = TeslaTypes::GetEndAllAutomataKernel(M);
@@ -714,8 +1179,13 @@ GlobalVariable* ThinTeslaInstrumenter::GetEventGlobal(llvm::Module& M, ThinTesla
 
     if (event.successors.size() > 0)
     {
+        // The runtime finds the index of a successor from the mask, which relies on this order.
+        auto sortedSuccessors = event.successors;
+        std::sort(sortedSuccessors.begin(), sortedSuccessors.end(),
+                  [](const std::shared_ptr<ThinTeslaEvent>& a, const std::shared_ptr<ThinTeslaEvent>& b) { return a->id < b->id; });
+
         std::vector<Constant*> successors;
-        for (auto succ : event.successors)
+        for (auto succ : sortedSuccessors)
         {
             successors.push_back(GetEventGlobal(M, assertion, *succ));
         }
@@ -737,9 +1207,25 @@ GlobalVariable* ThinTeslaInstrumenter::GetEventGlobal(llvm::Module& M, ThinTesla
     flags.isInitial = event.IsInitial();
     Constant* cFlags = ConstantStruct::get(TeslaTypes::EventFlagsTy, TeslaTypes::GetInt(C, 8, *(uint8_t*)(&flags)));
 
+    // Masks for the shift-and engine, see UpdateAutomatonShiftAnd.
+    uint64_t predecessorMask = 0;
+    uint64_t orBlockMask = 0;
+    if (assertion.events.size() <= TESLA_SHIFT_AND_MAX_EVENTS)
+    {
+        for (auto id : GetPredecessorIds(assertion, event))
+            predecessorMask |= (uint64_t)1 << id;
+
+        for (auto id : GetLaterORBlockIds(event))
+            orBlockMask |= (uint64_t)1 << id;
+    }
+
     Constant* init = ConstantStruct::get(TeslaTypes::EventTy, eventsArrayPtr, cFlags,
                                          TeslaTypes::GetSizeT(C, event.successors.size()), TeslaTypes::GetSizeT(C, event.id),
-                                         TeslaTypes::GetInt(C, 8, event.GetMatchDataSize()));
+                                         TeslaTypes::GetInt(C, 8, event.GetMatchDataSize()),
+                                         TeslaTypes::GetInt(C, 8, TeslaHash_SelectKernel(event.GetMatchDataSize())),
+                                         TeslaTypes::GetInt(C, 8, GetStoreKind(assertion, event)),
+                                         GetEventSuccessorMask(M, assertion, event),
+                                         TeslaTypes::GetInt(C, 64, predecessorMask), TeslaTypes::GetInt(C, 64, orBlockMask));
 
     GlobalVariable* var = CreateGlobalVariable(M, TeslaTypes::EventTy, init, eventID, THREAD_LOCAL);
 
@@ -748,6 +1234,41 @@ GlobalVariable* ThinTeslaInstrumenter::GetEventGlobal(llvm::Module& M, ThinTesla
     return var;
 }
 
+Constant* ThinTeslaInstrumenter::GetEventSuccessorMask(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    LLVMContext& C = M.getContext();
+    Type* Int64Ty = Type::getInt64Ty(C);
+
+    size_t numWords = TESLA_SUCCESSOR_MASK_WORDS(assertion.events.size());
+
+    // The masks of every event of the automaton go in one read-only table, indexed by event id.
+    std::string id = GetAutomatonID(assertion) + "_succ_masks";
+    GlobalVariable* table = M.getGlobalVariable(id);
+    if (table == nullptr)
+    {
+        std::vector<uint64_t> words(assertion.events.size() * numWords, 0);
+        for (auto& ev : assertion.events)
+        {
+            for (auto& succ : ev->successors)
+            {
+                assert(succ->id > ev->id && succ->id < assertion.events.size());
+                words[ev->id * numWords + succ->id / 64] |= (uint64_t)1 << (succ->id % 64);
+            }
+        }
+
+        std::vector<Constant*> masks;
+        for (auto word : words)
+            masks.push_back(ConstantInt::get(Int64Ty, word));
+
+        ArrayType* tableTy = ArrayType::get(Int64Ty, masks.size());
+        table = CreateGlobalVariable(M, tableTy, ConstantArray::get(tableTy, masks), id, THREAD_LOCAL);
+    }
+
+    return ConstantExpr::getInBoundsGetElementPtr(table->getValueType(), table,
+                                                  ArrayRef<Constant*>{TeslaTypes::GetInt(C, 32, 0),
+                                                                      TeslaTypes::GetInt(C, 32, event.id * numWords)});
+}
+
 Constant* ThinTeslaInstrumenter::GetEventMatchArray(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
 {
     if (event.GetMatchDataSize() == 0)
@@ -803,6 +1324,13 @@ GlobalVariable* ThinTeslaInstrumenter::GetAutomatonGlobal(llvm::Module& M, ThinT
     if (old != nullptr)
         return old;
 
+    if (assertion.globalId >= TESLA_MAX_AUTOMATA)
+    {
+        llvm::errs() << "Warning: automaton " << autID << " has id " << assertion.globalId << ", but only the first "
+                     << TESLA_MAX_AUTOMATA << " automata get a live guard, sampling, statistics, profiles,"
+                     << " failure counts and a name in traces\n";
+    }
+
     auto& C = M.getContext();
     PointerType* Int8PtrTy = PointerType::getUnqual(IntegerType::getInt8Ty(C));
     PointerType* VoidPtrPtrTy = PointerType::getUnqual(Int8PtrTy);
@@ -814,6 +1342,14 @@ GlobalVariable* ThinTeslaInstrumenter::GetAutomatonGlobal(llvm::Module& M, ThinT
     flags.isDeterministic = assertion.isDeterministic;
     flags.isThreadLocal = assertion.isThreadLocal;
     flags.isLinked = assertion.IsLinked();
+    flags.isShiftAnd = UseShiftAnd && assertion.isDeterministic && assertion.events.size() <= TESLA_SHIFT_AND_MAX_EVENTS;
+    flags.isConcurrent = IsConcurrent(assertion);
+    bool kernel = assertionsShareTemporalBounds && temporalBound == "amd64_syscall";
+    if (!flags.isConcurrent && ConcurrentGlobal && !assertion.isThreadLocal && !kernel)
+    {
+        llvm::errs() << "Warning: automaton " << autID << " has more than " << TESLA_MAX_STAGED_EVENTS
+                     << " parametric events and is not synchronized between threads\n";
+    }
     Constant* cFlags = ConstantStruct::get(TeslaTypes::AutomatonFlagsTy, TeslaTypes::GetInt(C, 8, *(uint8_t*)(&flags)));
 
     Constant* state = ConstantStruct::get(TeslaTypes::AutomatonStateTy,
@@ -828,21 +1364,78 @@ GlobalVariable* ThinTeslaInstrumenter::GetAutomatonGlobal(llvm::Module& M, ThinT
                                           ConstantPointerNull::get(Int8PtrTy),
                                           TeslaTypes::GetSizeT(C, 0));
 
-    Constant* init = ConstantStruct::get(TeslaTypes::AutomatonTy, eventsArrayPtr, cFlags,
+    StructType* automatonTy = TeslaTypes::AutomatonTy;
+    Constant* init = ConstantStruct::get(automatonTy, eventsArrayPtr, cFlags,
                                          TeslaTypes::GetSizeT(C, assertion.events.size()),
                                          ConstantExpr::getBitCast(GetStringGlobal(M, autID, autID + "_name"), Int8PtrTy),
-                                         state, ConstantExpr::getBitCast(GetEventsStateArray(M, assertion), TeslaTypes::EventStateTy->getPointerTo()),
+                                         ConstantExpr::getBitCast(GetEventsStateArray(M, assertion), TeslaTypes::EventStateTy->getPointerTo()),
                                          ConstantPointerNull::get(Int8PtrTy),
+                                         TeslaTypes::GetSizeT(C, assertions.size()), TeslaTypes::GetSizeT(C, assertion.globalId),
                                          TeslaTypes::GetSizeT(C, INVALID_THREAD_KEY), ConstantPointerNull::get(Int8PtrTy),
-                                         TeslaTypes::GetSizeT(C, assertions.size()), TeslaTypes::GetSizeT(C, assertion.globalId));
+                                         TeslaTypes::GetSizeT(C, GetSampleRate(assertion)),
+                                         ConstantAggregateZero::get(automatonTy->getElementType(AUTOMATON_STATE_FIELD - 1)),
+                                         state, TeslaTypes::GetSizeT(C, 0),
+                                         ConstantAggregateZero::get(automatonTy->getElementType(AUTOMATON_STATE_FIELD + 2)));
+
+    GlobalVariable* var = CreateGlobalVariable(M, automatonTy, init, autID, THREAD_LOCAL);
 
-    GlobalVariable* var = CreateGlobalVariable(M, TeslaTypes::AutomatonTy, init, autID, THREAD_LOCAL);
+    // Global automata are laid out next to each other, the state of one must not share a line with its neighbours.
+    var->setAlignment(alignof(TeslaAutomaton));
 
     var->setConstant(false);
 
     return var;
 }
 
+/*
+ * Events that happen at most once per bound need no more than a single slot for their match data. That holds for
+ * one automaton: the same function can be called several times within the bound of another one.
+ */
+StoreType ThinTeslaInstrumenter::GetStoreKind(ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
+{
+    if (event.storeKind != TESLA_STORE_INVALID || event.isDeterministic)
+        return event.storeKind;
+
+    std::string autID = GetAutomatonID(assertion);
+    for (auto& entry : SingleStores)
+    {
+        StringRef name, id;
+        std::tie(name, id) = StringRef(entry).split('=');
+
+        size_t value;
+        if (id.getAsInteger(10, value))
+            tesla::panic("invalid single-slot event '" + entry + "', expected <automaton>=<event id>", false);
+
+        if (name == autID && value == event.id)
+            return TESLA_STORE_SINGLE;
+    }
+
+    return TESLA_STORE_INVALID;
+}
+
+/* Linked automata are checked together, so they are never sampled. */
+size_t ThinTeslaInstrumenter::GetSampleRate(ThinTeslaAssertion& assertion)
+{
+    if (assertion.IsLinked())
+        return 1;
+
+    std::string autID = GetAutomatonID(assertion);
+    for (auto& entry : SampleRates)
+    {
+        StringRef name, rate;
+        std::tie(name, rate) = StringRef(entry).split('=');
+
+        size_t value;
+        if (rate.getAsInteger(10, value))
+            tesla::panic("invalid sample rate '" + entry + "', expected <automaton>=<N>", false);
+
+        if (name == autID)
+            return value;
+    }
+
+    return SampleRate;
+}
+
 GlobalVariable* ThinTeslaInstrumenter::GetLinkedAutomataArray(llvm::Module& M, ThinTeslaAssertion& linkMaster)
 {
     std::string autID = GetAutomatonID(linkMaster) + "_links";
@@ -902,8 +1495,7 @@ GlobalVariable* ThinTeslaInstrumenter::CreateGlobalVariable(llvm::Module& M, llv
 
 std::string ThinTeslaInstrumenter::GetAutomatonID(ThinTeslaAssertion& assertion)
 {
-    return assertion.assertionFilename + "_" + std::to_string(assertion.assertionLine) + "_" +
-           std::to_string(assertion.assertionCounter) + "_" + std::to_string(assertion.id);
+    return assertion.GetName();
 }
 
 std::string ThinTeslaInstrumenter::GetEventID(ThinTeslaAssertion& assertion, ThinTeslaEvent& event)
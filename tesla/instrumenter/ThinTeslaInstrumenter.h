@@ -7,6 +7,7 @@
 #include "Manifest.h"
 #include "ThinTeslaAssertion.h"
 #include "ThinTeslaTypes.h"
+#include <functional>
 #include <map>
 
 class ThinTeslaInstrumenter : public ThinTeslaEventVisitor, public llvm::ModulePass
@@ -14,15 +15,7 @@ class ThinTeslaInstrumenter : public ThinTeslaEventVisitor, public llvm::ModuleP
   public:
     ThinTeslaInstrumenter(tesla::Manifest& manifest) : llvm::ModulePass(ID), manifest(manifest)
     {
-        for (auto& automaton : manifest.RootAutomata())
-        {
-            ThinTeslaAssertionBuilder builder{manifest, automaton};
-            for (auto& assertion : builder.GetAssertions())
-            {
-                assertions.push_back(*assertion);
-                assertions[assertions.size() - 1].globalId = assertions.size() - 1;
-            }
-        }
+        assertions = ThinTeslaAssertionBuilder::BuildAll(manifest);
 
         temporalBound = "";
         for (auto& assertion : assertions)
@@ -44,6 +37,7 @@ class ThinTeslaInstrumenter : public ThinTeslaEventVisitor, public llvm::ModuleP
 
   private:
     void Instrument(llvm::Module& M, ThinTeslaAssertion& assertion);
+    void LinkRuntimeFastPath(llvm::Module& M);
 
     void InstrumentEvent(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
     void InstrumentEvent(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaFunction& event);
@@ -51,10 +45,21 @@ class ThinTeslaInstrumenter : public ThinTeslaEventVisitor, public llvm::ModuleP
     void InstrumentEvent(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaAssertionSite& event);
     void InstrumentEveryExit(llvm::Module& M, llvm::Function* function, ThinTeslaAssertion& assertion, ThinTeslaFunction& event);
     void InstrumentEndAutomaton(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaFunction& event);
+    void InstrumentEndAutomatonUnpatched(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaFunction& event);
     void InstrumentInstruction(llvm::Module& M, llvm::Instruction* instr, ThinTeslaAssertion& assertion, ThinTeslaFunction& event);
     void UpdateEventsWithParametersGlobal(llvm::Module& M, ThinTeslaAssertion& assertion, llvm::Instruction* insertPoint);
-    void UpdateEventsWithParametersThread(llvm::Module& M, ThinTeslaAssertion& assertion, llvm::Instruction* insertPoint);
+    void UpdateEventsWithParametersThread(llvm::Module& M, ThinTeslaAssertion& assertion, llvm::Instruction* insertPoint, llvm::Function* updateFunction);
     Function* BuildInstrumentationCheck(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaParametricFunction& event);
+    llvm::Value* CreateSiteCheck(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion);
+    void RegisterSites(llvm::Module& M);
+    void CreateSite(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, const std::string& name,
+                    std::function<void(llvm::IRBuilder<>&)> createBody);
+    bool NeedsLiveGuard(ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
+    bool IsConcurrent(ThinTeslaAssertion& assertion);
+    llvm::Value* CreateLiveCheck(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion);
+    void CreateGuardedUpdate(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
+    void CreateDeterministicUpdate(llvm::Module& M, llvm::IRBuilder<>& builder, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
+    Function* GetSpecializedUpdate(llvm::Module& M, ThinTeslaAssertion& assertion);
 
     llvm::CallInst* GetTeslaAssertionInstr(llvm::Function* function, ThinTeslaAssertionSite& event);
     llvm::Instruction* GetFirstInstruction(llvm::Function* function);
@@ -64,9 +69,12 @@ class ThinTeslaInstrumenter : public ThinTeslaEventVisitor, public llvm::ModuleP
 
     GlobalVariable* GetEventGlobal(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
     Constant* GetEventMatchArray(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
+    Constant* GetEventSuccessorMask(llvm::Module& M, ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
     GlobalVariable* GetEventsArray(llvm::Module& M, ThinTeslaAssertion& assertion);
     GlobalVariable* GetEventsStateArray(llvm::Module& M, ThinTeslaAssertion& assertion);
     GlobalVariable* GetAutomatonGlobal(llvm::Module& M, ThinTeslaAssertion& assertion);
+    size_t GetSampleRate(ThinTeslaAssertion& assertion);
+    StoreType GetStoreKind(ThinTeslaAssertion& assertion, ThinTeslaEvent& event);
     GlobalVariable* GetLinkedAutomataArray(llvm::Module& M, ThinTeslaAssertion& linkMaster);
     GlobalVariable* GetStringGlobal(llvm::Module& M, const std::string& str, const std::string& globalID);
     GlobalVariable* CreateGlobalVariable(llvm::Module& M, llvm::Type* type, llvm::Constant* initializer, const std::string& name, bool threadLocal = false);
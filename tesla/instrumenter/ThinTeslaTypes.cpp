@@ -56,7 +56,9 @@ void TeslaTypes::PopulateEventTy(Module& M)
 
     EventFlagsTy = GetStructType("TeslaEventFlags", {Int8Ty}, M, TESLA_STRUCTS_PACKED);
     EventStateTy = GetStructType("TeslaEventState", {VoidPtrTy, Int8PtrTy}, M, TESLA_STRUCTS_PACKED);
-    EventTy = GetStructType("TeslaEvent", {VoidPtrPtrTy, EventFlagsTy, SizeTTy, SizeTTy, Int8Ty}, M, TESLA_STRUCTS_PACKED);
+    IntegerType* Int64Ty = IntegerType::getInt64Ty(C);
+    PointerType* Int64PtrTy = PointerType::getUnqual(Int64Ty);
+    EventTy = GetStructType("TeslaEvent", {VoidPtrPtrTy, EventFlagsTy, SizeTTy, SizeTTy, Int8Ty, Int8Ty, Int8Ty, Int64PtrTy, Int64Ty, Int64Ty}, M, TESLA_STRUCTS_PACKED);
 }
 
 void TeslaTypes::PopulateAutomatonTy(Module& M)
@@ -79,15 +81,21 @@ void TeslaTypes::PopulateAutomatonTy(Module& M)
 
     AutomatonFlagsTy = GetStructType("TeslaAutomatonFlags", {Int8Ty}, M, TESLA_STRUCTS_PACKED);
     AutomatonStateTy = GetStructType("TeslaAutomatonState", {SizeTTy, EventPtrTy, EventPtrTy, Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int32Ty, Int8PtrTy, SizeTTy}, M, TESLA_STRUCTS_PACKED);
+
+    // The state starts on a cache line, the padding makes the offsets those of TeslaAutomaton.
+    ArrayType* DescriptionPaddingTy = ArrayType::get(Int8Ty, offsetof(TeslaAutomaton, state) - offsetof(TeslaAutomaton, sampleRate) - sizeof(size_t));
+    ArrayType* TailPaddingTy = ArrayType::get(Int8Ty, sizeof(TeslaAutomaton) - offsetof(TeslaAutomaton, lock) - sizeof(size_t));
     AutomatonTy = GetStructType("TeslaAutomaton",
-                                {VoidPtrPtrTy, AutomatonFlagsTy, SizeTTy, VoidPtrTy, AutomatonStateTy, EventStateTy->getPointerTo(), VoidPtrTy, SizeTTy, VoidPtrTy,
-                                 SizeTTy, SizeTTy},
+                                {VoidPtrPtrTy, AutomatonFlagsTy, SizeTTy, VoidPtrTy, EventStateTy->getPointerTo(), VoidPtrTy, SizeTTy, SizeTTy,
+                                 SizeTTy, VoidPtrTy, SizeTTy, DescriptionPaddingTy,
+                                 AutomatonStateTy, SizeTTy, TailPaddingTy},
                                 M, TESLA_STRUCTS_PACKED);
 
     DataLayout dataLayout{&M};
     const StructLayout* layout = dataLayout.getStructLayout(AutomatonTy);
-    assert(layout->getElementOffset(7) == offsetof(TeslaAutomaton, threadKey));
-    assert(layout->getElementOffset(8) == offsetof(TeslaAutomaton, next));
+    assert(layout->getElementOffset(8) == offsetof(TeslaAutomaton, threadKey));
+    assert(layout->getElementOffset(9) == offsetof(TeslaAutomaton, next));
+    assert(layout->getElementOffset(AUTOMATON_STATE_FIELD) == offsetof(TeslaAutomaton, state));
     assert(dataLayout.getTypeStoreSize(AutomatonTy) == sizeof(TeslaAutomaton));
 }
 
@@ -148,4 +156,57 @@ Function* TeslaTypes::GetUpdateEventWithData(Module& M)
                                                                                       GetSizeTType(C),
                                                                                       Type::getInt8PtrTy(C)},
                                                                                      false));
+}
+
+Function* TeslaTypes::GetStageEventWithData(Module& M)
+{
+    auto& C = M.getContext();
+    return (Function*)M.getOrInsertFunction("StageEventWithData", FunctionType::get(Type::getVoidTy(C),
+                                                                                    {AutomatonTy->getPointerTo(),
+                                                                                     GetSizeTType(C),
+                                                                                     Type::getInt8PtrTy(C)},
+                                                                                    false));
+}
+
+Function* TeslaTypes::GetSpecializedAutomaton(Module& M)
+{
+    return (Function*)M.getOrInsertFunction("GetSpecializedAutomaton", FunctionType::get(AutomatonTy->getPointerTo(),
+                                                                                         {AutomatonTy->getPointerTo(), EventTy->getPointerTo()},
+                                                                                         false));
+}
+
+Function* TeslaTypes::GetRestartSpecializedAutomaton(Module& M)
+{
+    auto& C = M.getContext();
+    return (Function*)M.getOrInsertFunction("RestartSpecializedAutomaton", FunctionType::get(Type::getVoidTy(C),
+                                                                                             {AutomatonTy->getPointerTo()}, false));
+}
+
+Function* TeslaTypes::GetFinishSpecializedTransition(Module& M)
+{
+    auto& C = M.getContext();
+    return (Function*)M.getOrInsertFunction("FinishSpecializedTransition", FunctionType::get(Type::getVoidTy(C),
+                                                                                             {AutomatonTy->getPointerTo(), EventTy->getPointerTo(),
+                                                                                              GetBoolType(C)},
+                                                                                             false));
+}
+
+GlobalVariable* TeslaTypes::GetLiveAutomata(Module& M)
+{
+    GlobalVariable* old = M.getGlobalVariable("teslaLiveAutomata");
+    if (old != nullptr)
+        return old;
+
+    auto& C = M.getContext();
+    return new GlobalVariable(M, ArrayType::get(IntegerType::getInt8Ty(C), TESLA_MAX_AUTOMATA), false,
+                              GlobalValue::ExternalLinkage, nullptr, "teslaLiveAutomata",
+                              nullptr, GlobalValue::ThreadLocalMode::InitialExecTLSModel);
+}
+
+Function* TeslaTypes::GetRegisterSites(Module& M)
+{
+    auto& C = M.getContext();
+    return (Function*)M.getOrInsertFunction("TeslaRegisterSites", FunctionType::get(Type::getVoidTy(C),
+                                                                                    {Type::getInt8PtrTy(C), Type::getInt8PtrTy(C)},
+                                                                                    false));
 }
\ No newline at end of file
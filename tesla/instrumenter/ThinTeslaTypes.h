@@ -11,6 +11,9 @@
 
 using namespace llvm;
 
+// Index of the state in TeslaTypes::AutomatonTy, after the description and its padding.
+#define AUTOMATON_STATE_FIELD 12
+
 class TeslaTypes
 {
   public:
@@ -76,6 +79,12 @@ class TeslaTypes
     static Function* GetEndAllAutomataKernel(Module& M);
     static Function* GetIncrementInitTag(Module& M);
     static Function* GetUpdateEventWithData(Module& M);
+    static Function* GetStageEventWithData(Module& M);
+    static Function* GetSpecializedAutomaton(Module& M);
+    static Function* GetRestartSpecializedAutomaton(Module& M);
+    static Function* GetFinishSpecializedTransition(Module& M);
+    static GlobalVariable* GetLiveAutomata(Module& M);
+    static Function* GetRegisterSites(Module& M);
 
     static StructType* GetStructType(StringRef name, ArrayRef<Type*> fields, Module& M, bool packed = true);
 
@@ -311,6 +311,7 @@ struct InstrumentPass : public ModulePass
         }
 
         std::vector<ThinTeslaAssertion> assertions;
+        std::set<std::string> singleStores;
 
         for (auto& automaton : manifest->RootAutomata())
         {
@@ -347,6 +348,14 @@ struct InstrumentPass : public ModulePass
                 Analyse(M, assertion.events[0]->GetInstrumentationTarget(), first, second, second->IsFinal());
                 llvm::errs() << "**************************************************\n\n";
             }
+
+            FindSingleStores(M, assertion, singleStores);
+        }
+
+        if (!singleStores.empty())
+        {
+            llvm::errs() << "[OPTIMIZATION] Match data fits in a single slot, instrument with -thin-tesla-single-store="
+                         << StringFromSet(singleStores, ",") << "\n";
         }
 
         legacy::PassManager Passes;
@@ -367,6 +376,33 @@ struct InstrumentPass : public ModulePass
         return runOnTesla(M);
     }
 
+    /*
+     * A parametric event that happens at most once per bound never needs to keep more than one value. This only
+     * holds within the bound of this assertion, so the result names the automaton and the event, not the function.
+     */
+    void FindSingleStores(Module& M, ThinTeslaAssertion& assertion, std::set<std::string>& singleStores)
+    {
+        const std::string& bound = assertion.events[0]->GetInstrumentationTarget();
+        if (M.getFunction(bound) == nullptr)
+            return;
+
+        CallGraph graph{M};
+
+        for (auto& event : assertion.events)
+        {
+            std::string function = event->GetInstrumentationTarget();
+            if (event->isDeterministic || M.getFunction(function) == nullptr)
+                continue;
+
+            if (AtMostCalledOnce(M, graph, bound, function))
+            {
+                llvm::errs() << "[RESULT] Event " << event->id << " (" << function << ") needs a single-slot store\n";
+                event->storeKind = TESLA_STORE_SINGLE;
+                singleStores.insert(assertion.GetName() + "=" + std::to_string(event->id));
+            }
+        }
+    }
+
     bool Analyse(Module& M, const std::string& bound, ThinTeslaEventPtr& first, ThinTeslaEventPtr& second, bool secondIsFinal)
     {
         CallGraph graph{M};
@@ -0,0 +1,117 @@
+//! @file thin-codegen.c  Tests that specialized and generic ThinTESLA code agree.
+/*
+ * The same assertion is instrumented with -thin-tesla-codegen=specialized,
+ * which emits the transitions of a deterministic automaton as a switch, and
+ * with -thin-tesla-codegen=generic, which calls the runtime interpreter. Both
+ * binaries run the same event streams and must fail the same bounds.
+ *
+ * Commands for llvm-lit:
+ * RUN: tesla analyse %s -o %t.tesla -- %cflags
+ * RUN: %clang -S -emit-llvm %cflags %s -o %t.ll
+ * RUN: tesla instrument -S -thin-tesla -thin-tesla-codegen=generic -tesla-manifest %t.tesla %t.ll -o %t.generic.ll
+ * RUN: tesla instrument -S -thin-tesla -thin-tesla-codegen=specialized -tesla-manifest %t.tesla %t.ll -o %t.specialized.ll
+ * RUN: %filecheck -check-prefix=GENERIC -input-file %t.generic.ll %s
+ * RUN: %filecheck -check-prefix=SPECIALIZED -input-file %t.specialized.ll %s
+ * RUN: %clang %t.generic.ll %thinldflags -o %t.generic
+ * RUN: %clang %t.specialized.ll %thinldflags -o %t.specialized
+ * RUN: %t.generic > %t.generic.out
+ * RUN: %t.specialized > %t.specialized.out
+ * RUN: %filecheck -input-file %t.generic.out %s
+ * RUN: diff %t.generic.out %t.specialized.out
+ */
+
+#include <stdio.h>
+
+#include <tesla-macros.h>
+
+/*
+ * GENERIC-NOT: define {{.*}}_update(i64
+ * GENERIC: call void @UpdateAutomatonDeterministic
+ *
+ * SPECIALIZED: define {{.*}}_update(i64
+ * SPECIALIZED: switch i64
+ * SPECIALIZED-NOT: call void @UpdateAutomatonDeterministic
+ */
+
+struct TeslaAutomaton;
+void	TeslaSetFailHandler(void (*)(struct TeslaAutomaton *, const char *));
+
+void	open_obj(void) {}
+void	lock_obj(void) {}
+void	check_obj(void) {}
+void	audit_obj(void) {}
+void	close_obj(void) {}
+
+void
+site(void)
+{
+	TESLA_WITHIN(bound,
+		TSEQUENCE(
+			call(open_obj()),
+			optional(call(lock_obj())),
+			call(check_obj()) || call(audit_obj()),
+			TESLA_ASSERTION_SITE,
+			call(close_obj())
+		)
+	);
+}
+
+/* One temporal bound: o(pen), l(ock), c(heck), a(udit), s(ite), x (close). */
+void
+bound(const char *stream)
+{
+	for (const char *e = stream; *e != '\0'; e++) {
+		switch (*e) {
+		case 'o': open_obj(); break;
+		case 'l': lock_obj(); break;
+		case 'c': check_obj(); break;
+		case 'a': audit_obj(); break;
+		case 's': site(); break;
+		case 'x': close_obj(); break;
+		}
+	}
+}
+
+static void
+fail(struct TeslaAutomaton *automaton, const char *reason)
+{
+	printf("  failed: %s\n", reason != NULL ? reason : "");
+}
+
+/*
+ * Both binaries print the same lines, and the generic one passes and fails
+ * where the assertion says it should:
+ *
+ * CHECK: bound 0: ocsx
+ * CHECK-NOT: failed
+ * CHECK: bound 1: olasx
+ * CHECK-NOT: failed
+ * CHECK: bound 2: ocasx
+ * CHECK-NOT: failed
+ * CHECK: bound 3: osx
+ * CHECK: bound 4: ocs
+ * CHECK-NEXT: failed: {{.*}}final
+ * CHECK: bound 13: ocssx
+ * CHECK-NEXT: failed: Assertion site reached multiple times
+ * CHECK: done
+ */
+int
+main(int argc, char *argv[])
+{
+	static const char *streams[] = {
+		"ocsx", "olasx", "ocasx", "osx", "ocs", "cosx", "s", "x", "",
+		"olcsx", "llocsx", "ococsx", "ocsxx", "ocssx", "oclsx", "xocsx",
+		"ocxsx", "oaacsx", "ooocsx", "olalcsx",
+	};
+
+	TeslaSetFailHandler(fail);
+
+	for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+		printf("bound %zu: %s\n", i, streams[i]);
+		bound(streams[i]);
+	}
+
+	printf("done\n");
+
+	return 0;
+}
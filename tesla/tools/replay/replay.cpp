@@ -0,0 +1,503 @@
+/** @file  replay.cpp    Check recorded event traces against their automata, offline. */
+
+#include "Manifest.h"
+#include "ThinTeslaAssertion.h"
+
+#include "TeslaAssert.h"
+#include "TeslaLogic.h"
+#include "TeslaTrace.h"
+
+#include "tesla.pb.h"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Replays a trace recorded with TESLA_TRACE through the runtime, with the
+ * automata rebuilt from the manifest the program was instrumented with, so
+ * that checking can happen somewhere else than where the program ran.
+ *
+ * The records of thread-local automata are replayed thread by thread, in the
+ * order the thread recorded them. Threads are independent, so they are
+ * checked in parallel by a pool of workers. The records of global automata
+ * are merged by time stamp and replayed in order by a single worker.
+ */
+
+using namespace llvm;
+using namespace tesla;
+
+static cl::opt<std::string> ManifestPath(cl::Positional, cl::desc("<manifest>"), cl::Required);
+static cl::opt<std::string> TracePath(cl::Positional, cl::desc("<trace>"), cl::Required);
+
+static cl::opt<unsigned> Jobs("j", cl::desc("Worker threads (default: one per core)"), cl::init(0));
+
+static cl::opt<bool> UseShiftAnd("thin-tesla-shift-and", cl::desc("Run small deterministic automata with the shift-and engine"),
+                                 cl::init(true));
+
+static cl::opt<unsigned> MaxReports("max-reports", cl::desc("Failures to describe per automaton"), cl::init(10));
+
+/*
+ * The globals ThinTeslaInstrumenter emits for one assertion, see
+ * GetAutomatonGlobal and GetEventGlobal, built in memory.
+ */
+class ReplayAutomaton
+{
+  public:
+    ReplayAutomaton(ThinTeslaAssertion& assertion, size_t numTotalAutomata)
+        : name(assertion.GetName()), events(assertion.events.size()), eventPtrs(assertion.events.size()),
+          successors(assertion.events.size()), eventStates(assertion.events.size()), matchArrays(assertion.events.size())
+    {
+        size_t numEvents = assertion.events.size();
+        size_t numWords = TESLA_SUCCESSOR_MASK_WORDS(numEvents);
+        successorMasks.resize(numEvents * numWords);
+
+        memset(&automaton, 0, sizeof(automaton));
+        memset(events.data(), 0, sizeof(TeslaEvent) * numEvents);
+        memset(eventStates.data(), 0, sizeof(TeslaEventState) * numEvents);
+
+        for (auto& ev : assertion.events)
+        {
+            TeslaEvent& event = events[ev->id];
+
+            // The runtime finds the index of a successor from the mask, which relies on this order.
+            auto sortedSuccessors = ev->successors;
+            std::sort(sortedSuccessors.begin(), sortedSuccessors.end(),
+                      [](const ThinTeslaEventPtr& a, const ThinTeslaEventPtr& b) { return a->id < b->id; });
+
+            for (auto& succ : sortedSuccessors)
+            {
+                successors[ev->id].push_back(&events[succ->id]);
+                successorMasks[ev->id * numWords + succ->id / 64] |= (uint64_t)1 << (succ->id % 64);
+            }
+
+            event.successors = successors[ev->id].data();
+            event.numSuccessors = successors[ev->id].size();
+            event.id = ev->id;
+            event.matchDataSize = ev->GetMatchDataSize();
+            event.hashKernel = TeslaHash_SelectKernel(ev->GetMatchDataSize());
+            event.storeKind = ev->storeKind;
+            event.successorMask = &successorMasks[ev->id * numWords];
+
+            event.flags.isOR = ev->isOR;
+            event.flags.isOptional = ev->isOptional;
+            event.flags.isDeterministic = ev->isDeterministic;
+            event.flags.isAssertion = ev->IsAssertion();
+            event.flags.isBeforeAssertion = ev->isBeforeAssertion;
+            event.flags.isEnd = ev->IsEnd();
+            event.flags.isFinal = ev->IsFinal();
+            event.flags.isInitial = ev->IsInitial();
+
+            if (numEvents <= TESLA_SHIFT_AND_MAX_EVENTS)
+            {
+                for (auto id : GetPredecessorIds(assertion, *ev))
+                    event.predecessorMask |= (uint64_t)1 << id;
+
+                for (auto id : GetLaterORBlockIds(*ev))
+                    event.orBlockMask |= (uint64_t)1 << id;
+            }
+
+            matchArrays[ev->id].resize(ev->GetMatchDataSize());
+            eventStates[ev->id].matchData = (uint8_t*)matchArrays[ev->id].data();
+            eventPtrs[ev->id] = &event;
+        }
+
+        automaton.events = eventPtrs.data();
+        automaton.flags.isDeterministic = assertion.isDeterministic;
+        automaton.flags.isThreadLocal = assertion.isThreadLocal;
+        automaton.flags.isLinked = assertion.IsLinked();
+        automaton.flags.isShiftAnd = UseShiftAnd && assertion.isDeterministic && numEvents <= TESLA_SHIFT_AND_MAX_EVENTS;
+        automaton.numEvents = numEvents;
+        automaton.name = (char*)name.c_str();
+        automaton.eventStates = eventStates.data();
+        automaton.threadKey = INVALID_THREAD_KEY;
+        automaton.numTotalAutomata = numTotalAutomata;
+        automaton.id = assertion.globalId;
+
+        // Every bound is checked, and global automata are only ever updated by one worker.
+        automaton.sampleRate = 1;
+        automaton.flags.isSampleRateResolved = true;
+        automaton.flags.isConcurrent = false;
+    }
+
+    TeslaAutomaton* Get() { return &automaton; }
+    TeslaEvent* Event(size_t id) { return &events[id]; }
+    const std::string& Name() const { return name; }
+
+  private:
+    std::string name;
+    TeslaAutomaton automaton;
+    std::vector<TeslaEvent> events;
+    std::vector<TeslaEvent*> eventPtrs;
+    std::vector<std::vector<TeslaEvent*>> successors;
+    std::vector<uint64_t> successorMasks;
+    std::vector<TeslaEventState> eventStates;
+    std::vector<std::vector<size_t>> matchArrays;
+};
+
+/*
+ * Runs tasks on a fixed number of threads. Every worker has its own deque,
+ * and takes tasks from its back. A worker whose deque is empty steals from
+ * the front of the others, so long streams do not leave the other workers
+ * idle. Tasks do not create tasks, so a worker that finds nothing to steal
+ * is done.
+ */
+class WorkStealingPool
+{
+  public:
+    WorkStealingPool(size_t numWorkers) : queues(numWorkers) {}
+
+    void Push(size_t worker, std::function<void()> task)
+    {
+        queues[worker % queues.size()].tasks.push_back(std::move(task));
+    }
+
+    void Run()
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < queues.size(); ++i)
+            threads.emplace_back([this, i] { Work(i); });
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    size_t Steals() const { return steals; }
+
+  private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool Pop(size_t worker, std::function<void()>& task)
+    {
+        Queue& queue = queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            return false;
+
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool Steal(size_t worker, std::function<void()>& task)
+    {
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue& victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty())
+                continue;
+
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            steals++;
+            return true;
+        }
+
+        return false;
+    }
+
+    void Work(size_t worker)
+    {
+        std::function<void()> task;
+        while (Pop(worker, task) || Steal(worker, task))
+            task();
+    }
+
+    std::vector<Queue> queues;
+    std::atomic<size_t> steals{0};
+};
+
+/* The records of one thread, or of every global automaton. */
+struct Stream
+{
+    std::string description;
+    std::vector<const TeslaTraceRecord*> records;
+
+    size_t truncated = 0; // Records skipped because their match data did not fit.
+    std::map<size_t, size_t> failures; // By automaton id.
+    std::vector<std::string> reports;
+};
+
+static thread_local Stream* currentStream;
+static thread_local const TeslaTraceRecord* currentRecord;
+
+static void CountFailure(TeslaAutomaton* automaton, const char* message)
+{
+    Stream& stream = *currentStream;
+    if (stream.failures[automaton->id]++ < MaxReports)
+    {
+        stream.reports.push_back(std::string(automaton->name) + ": " + (message != nullptr ? message : "failed") + " (" +
+                                 stream.description + ", tsc " + std::to_string(currentRecord->tsc) + ")");
+    }
+}
+
+static void ReplayStream(Stream& stream, std::vector<std::unique_ptr<ReplayAutomaton>>& automata)
+{
+    currentStream = &stream;
+    std::vector<TeslaAutomaton*> linked;
+    std::vector<size_t> data;
+
+    for (const TeslaTraceRecord* record : stream.records)
+    {
+        currentRecord = record;
+        ReplayAutomaton& automaton = *automata[record->automatonId];
+        TeslaEvent* event = automaton.Event(record->eventId);
+
+        if (record->kind & TESLA_TRACE_TRUNCATED)
+        {
+            stream.truncated++;
+            continue;
+        }
+
+        data.assign(event->matchDataSize, 0);
+        for (size_t i = 0; i < record->numWords && i < data.size(); ++i)
+            data[i] = record->data[i];
+
+        switch (record->kind & TESLA_TRACE_KIND_MASK)
+        {
+        case TESLA_TRACE_EVENT:
+            UpdateAutomatonDeterministic(automaton.Get(), event);
+            break;
+
+        case TESLA_TRACE_EVENT_DATA:
+            UpdateAutomaton(automaton.Get(), event, data.data());
+            break;
+
+        case TESLA_TRACE_MATCH_DATA:
+            UpdateEventWithData(automaton.Get(), event->id, data.data());
+            break;
+
+        case TESLA_TRACE_END:
+            EndAutomaton(automaton.Get(), event);
+            break;
+
+        case TESLA_TRACE_END_LINKED:
+            // The automata ended together were recorded one after the other, with their index.
+            linked.push_back(automaton.Get());
+            if (record->data[0] + 1 == record->data[1])
+            {
+                EndLinkedAutomata(linked.data(), linked.size());
+                linked.clear();
+            }
+            break;
+        }
+    }
+
+    // The next stream of this worker starts from scratch, even if the trace stopped in the middle of a bound.
+    for (auto& automaton : automata)
+    {
+        if (automaton->Get()->flags.isThreadLocal)
+            TA_Reset(GetThreadAutomaton(automaton->Get()));
+    }
+}
+
+/* Maps the trace, checks that it was recorded by a program instrumented with this manifest, and splits it into streams. */
+static bool ReadTrace(const std::string& path, std::vector<std::unique_ptr<ReplayAutomaton>>& automata,
+                      std::vector<ThinTeslaAssertion>& assertions, std::vector<Stream>& streams, const TeslaTraceHeader*& header)
+{
+    auto& err = llvm::errs();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        err << "Unable to open trace '" << path << "'\n";
+        return false;
+    }
+
+    size_t size = info.st_size;
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    header = (const TeslaTraceHeader*)mapped;
+    if (mapped == MAP_FAILED || size < sizeof(TeslaTraceHeader) || memcmp(header->magic, TESLA_TRACE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        err << "'" << path << "' is not a TESLA trace\n";
+        return false;
+    }
+
+    if (header->version > TESLA_TRACE_VERSION || header->recordSize < sizeof(TeslaTraceRecord) ||
+        header->automatonSize < sizeof(TeslaTraceAutomaton))
+    {
+        err << "Unsupported trace version " << header->version << "\n";
+        return false;
+    }
+
+    if (header->headerSize < sizeof(TeslaTraceHeader) || header->headerSize > size)
+    {
+        err << "The trace is truncated\n";
+        return false;
+    }
+
+    const char* base = (const char*)mapped;
+    const char* recordsStart = base + header->headerSize;
+    size_t numRecords = header->numRecords;
+    size_t numAutomata = header->numAutomata;
+
+    // Every size in the header is checked against the file before anything past the header is read.
+    size_t maxRecords = (size - header->headerSize) / header->recordSize;
+
+    if (numRecords == 0 && header->automataOffset == 0)
+    {
+        // The process died before the trace was stopped: the records run up to the first empty one.
+        err << "warning: the trace was not stopped, reading up to the last record written\n";
+        numAutomata = 0;
+        while (numRecords < maxRecords && ((const TeslaTraceRecord*)(recordsStart + numRecords * header->recordSize))->kind != TESLA_TRACE_NONE)
+            numRecords++;
+    }
+    else if (numRecords > maxRecords || header->automataOffset < header->headerSize + numRecords * header->recordSize ||
+             header->automataOffset > size || numAutomata > (size - header->automataOffset) / header->automatonSize)
+    {
+        err << "The trace is truncated\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < numAutomata; ++i)
+    {
+        auto* entry = (const TeslaTraceAutomaton*)(base + header->automataOffset + i * header->automatonSize);
+        if (entry->id >= assertions.size() || entry->numEvents != assertions[entry->id].events.size() ||
+            assertions[entry->id].GetName().compare(0, strlen(entry->name), entry->name) != 0)
+        {
+            err << "Automaton " << entry->id << " (" << entry->name << ") of the trace is not in the manifest, "
+                << "was it recorded with another one?\n";
+            return false;
+        }
+    }
+
+    if (header->numDropped > 0)
+        err << "warning: " << header->numDropped << " records were dropped while recording, expect spurious failures\n";
+
+    std::map<uint32_t, size_t> threadStreams;
+    Stream global;
+    global.description = "global automata";
+
+    for (size_t i = 0; i < numRecords; ++i)
+    {
+        auto* record = (const TeslaTraceRecord*)(recordsStart + i * header->recordSize);
+        if (record->automatonId >= automata.size() || record->eventId >= automata[record->automatonId]->Get()->numEvents)
+        {
+            err << "Record " << i << " is for an unknown automaton or event\n";
+            return false;
+        }
+
+        if (!automata[record->automatonId]->Get()->flags.isThreadLocal)
+        {
+            global.records.push_back(record);
+            continue;
+        }
+
+        auto stream = threadStreams.find(record->thread);
+        if (stream == threadStreams.end())
+        {
+            stream = threadStreams.emplace(record->thread, streams.size()).first;
+            streams.emplace_back();
+            streams.back().description = "thread " + std::to_string(record->thread);
+        }
+
+        streams[stream->second].records.push_back(record);
+    }
+
+    // Threads recorded in their own order, but the flusher interleaved them.
+    std::stable_sort(global.records.begin(), global.records.end(),
+                     [](const TeslaTraceRecord* a, const TeslaTraceRecord* b) { return a->tsc < b->tsc; });
+
+    if (!global.records.empty())
+        streams.push_back(std::move(global));
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    cl::ParseCommandLineOptions(argc, argv, "Check a TESLA trace against the automata of a manifest\n");
+    auto& out = llvm::outs();
+    auto& err = llvm::errs();
+
+    // Replaying must not record a trace of its own, nor skip checking.
+    unsetenv("TESLA_TRACE");
+    unsetenv("TESLA_TRACE_ONLY");
+
+    std::unique_ptr<Manifest> manifest(Manifest::load(err, Automaton::Deterministic, ManifestPath));
+    if (!manifest)
+    {
+        err << "Unable to read manifest '" << ManifestPath << "'\n";
+        return 1;
+    }
+
+    std::vector<ThinTeslaAssertion> assertions = ThinTeslaAssertionBuilder::BuildAll(*manifest);
+
+    std::vector<std::unique_ptr<ReplayAutomaton>> automata;
+    for (auto& assertion : assertions)
+        automata.emplace_back(new ReplayAutomaton(assertion, assertions.size()));
+
+    std::vector<Stream> streams;
+    const TeslaTraceHeader* header;
+    if (!ReadTrace(TracePath, automata, assertions, streams, header))
+        return 1;
+
+    size_t numWorkers = Jobs > 0 ? Jobs : std::max(1u, std::thread::hardware_concurrency());
+    numWorkers = std::min(numWorkers, std::max<size_t>(streams.size(), 1));
+
+    // Longest streams first, spread over the workers, so that the tail is made of short ones.
+    std::vector<Stream*> order;
+    for (auto& stream : streams)
+        order.push_back(&stream);
+    std::sort(order.begin(), order.end(), [](Stream* a, Stream* b) { return a->records.size() > b->records.size(); });
+
+    WorkStealingPool pool(numWorkers);
+    for (size_t i = order.size(); i-- > 0;)
+        pool.Push(i, [&automata, stream = order[i]] { ReplayStream(*stream, automata); });
+
+    TeslaSetFailHandler(CountFailure);
+    pool.Run();
+    TeslaSetFailHandler(nullptr);
+
+    std::map<size_t, size_t> failures;
+    size_t numRecords = 0, truncated = 0, numFailures = 0;
+    for (auto& stream : streams)
+    {
+        numRecords += stream.records.size();
+        truncated += stream.truncated;
+        for (auto& failure : stream.failures)
+        {
+            failures[failure.first] += failure.second;
+            numFailures += failure.second;
+        }
+
+        for (auto& report : stream.reports)
+            out << report << "\n";
+    }
+
+    for (auto& failure : failures)
+        out << automata[failure.first]->Name() << ": " << failure.second << " failures\n";
+
+    if (truncated > 0)
+        err << "warning: " << truncated << " records had more match data than a trace holds and were skipped\n";
+
+    out << "Replayed " << numRecords << " records of " << streams.size() << " streams with " << numWorkers << " workers ("
+        << pool.Steals() << " steals), " << numFailures << " failures\n";
+
+    google::protobuf::ShutdownProtobufLibrary();
+    return numFailures > 0 ? 1 : 0;
+}